@@ -24,20 +24,77 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
 #include <vector>
 #include "./devourer.hpp"
+#include "./trace.hpp"
 #include "./optparse.h"
 
+static const char *trace_path = NULL;
+
+static void dump_trace(int sig) {
+  int fd = ::open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    devourer::trace::dump(fd);
+    ::close(fd);
+  }
+}
+
+static void print_trace(const std::string &path) {
+  std::vector<devourer::trace::Event> events;
+  devourer::trace::read(path, &events);
+  for (size_t i = 0; i < events.size(); i++) {
+    const devourer::trace::Event &e = events[i];
+    printf("%llu %u %s %016llX %llu\n",
+           static_cast<unsigned long long>(e.cycles), e.thread,
+           devourer::trace::point_name(e.point),
+           static_cast<unsigned long long>(e.arg[0]),
+           static_cast<unsigned long long>(e.arg[1]));
+  }
+}
+
 int devourer_main(int argc, char *argv[]) {
   optparse::OptionParser psr = optparse::OptionParser();
   psr.add_option("-r").dest("read_file")
-    .help("Pcap format file path");
+    .help("Pcap format file path, comma separated paths or glob pattern "
+          "(e.g. '/data/*.pcap'), packets are merged in time order");
   psr.add_option("-i").dest("interface")
     .help("Interface to monitor on the fly");
+  psr.add_option("-a").dest("afpacket")
+    .help("Interface to monitor by AF_PACKET ring, workers share it by "
+          "fanout (Linux only)");
+  psr.add_option("-R").dest("ring_size")
+    .help("AF_PACKET ring size in MB per worker (default 64)");
+  psr.add_option("-B").dest("block_size")
+    .help("AF_PACKET ring block size in KB (default 1024)");
   psr.add_option("-f").dest("fluentd")
-    .help("Fluentd destination, e.g. 127.0.0.1:24224");
+    .help("Fluentd destination, e.g. 127.0.0.1:24224. Records are kept up "
+          "to 16MB while fluentd is down, and dropped over it");
   psr.add_option("-o").dest("output")
     .help("Log file path, stdout if '-'");
+  psr.add_option("-C").dest("column_file")
+    .help("Column file path to write flow.log, dns.tx and dns.log");
+  psr.add_option("-x").dest("ipfix")
+    .help("IPFIX collector to export flows by UDP, e.g. 127.0.0.1:4739");
+  psr.add_option("-w").dest("workers")
+    .help("Number of worker threads, packets are sharded by 5-tuple");
+  psr.add_option("-A").dest("active_timeout")
+    .help("Seconds to report long-lived flows periodically, 0 disables "
+          "(default 1800)");
+  psr.add_option("-q").dest("query_timeout")
+    .help("Milliseconds to wait for a DNS response, 1 to 3599999 "
+          "(default 120000)");
+  psr.add_option("-I").dest("flow_timeout")
+    .help("Milliseconds to close an idle flow, 1 to 3599999 "
+          "(default 600000)");
+  psr.add_option("-T").dest("trace")
+    .help("Record trace events, and write them to the file by SIGUSR2 and "
+          "at exit (built with WITH_TRACE)");
+  psr.add_option("-P").dest("print_trace")
+    .help("Print events of a trace file and exit");
   psr.add_option("-v").dest("version").action("store_true")
     .help("Show version");
   
@@ -49,6 +106,16 @@ int devourer_main(int argc, char *argv[]) {
     std::cout << "Version: " << devourer::VERSION << std::endl;
     return true;
   }
+
+  if (opt.is_set("print_trace")) {
+    try {
+      print_trace(opt["print_trace"]);
+    } catch (const devourer::Exception &e) {
+      std::cerr << "Devourer Error: " << e.what() << std::endl;
+      return false;
+    }
+    return true;
+  }
   
   
   Devourer *devourer = NULL;
@@ -56,6 +123,8 @@ int devourer_main(int argc, char *argv[]) {
     devourer = new Devourer(opt["read_file"], devourer::PCAP_FILE);
   } else if (opt.is_set("interface")) {
     devourer = new Devourer(opt["interface"], devourer::INTERFACE);
+  } else if (opt.is_set("afpacket")) {
+    devourer = new Devourer(opt["afpacket"], devourer::AFPACKET);
   }
   
   if (!devourer) {
@@ -68,11 +137,99 @@ int devourer_main(int argc, char *argv[]) {
       devourer->setdst_filestream(opt["output"]);
     }
     
+    if (opt.is_set("column_file")) {
+      devourer->setdst_columnfile(opt["column_file"]);
+    }
+
+    if (opt.is_set("ipfix")) {
+      devourer->setdst_ipfix(opt["ipfix"]);
+    }
+
     if (opt.is_set("fluentd")) {
       devourer->setdst_fluentd(opt["fluentd"]);
     }
 
+    if (opt.is_set("workers")) {
+      char *e;
+      size_t n = strtoul(opt["workers"].c_str(), &e, 0);
+      if (*e != '\0') {
+        throw devourer::Exception("Invalid number of workers: " +
+                                  opt["workers"]);
+      }
+      devourer->set_workers(n);
+    }
+
+    if (opt.is_set("active_timeout")) {
+      char *e;
+      time_t timeout = strtoul(opt["active_timeout"].c_str(), &e, 0);
+      if (*e != '\0') {
+        throw devourer::Exception("Invalid active timeout: " +
+                                  opt["active_timeout"]);
+      }
+      devourer->set_active_timeout(timeout);
+    }
+
+    if (opt.is_set("query_timeout")) {
+      char *e;
+      uint64_t timeout = strtoull(opt["query_timeout"].c_str(), &e, 0);
+      if (*e != '\0') {
+        throw devourer::Exception("Invalid query timeout: " +
+                                  opt["query_timeout"]);
+      }
+      devourer->set_query_timeout(timeout);
+    }
+
+    if (opt.is_set("flow_timeout")) {
+      char *e;
+      uint64_t timeout = strtoull(opt["flow_timeout"].c_str(), &e, 0);
+      if (*e != '\0') {
+        throw devourer::Exception("Invalid flow timeout: " +
+                                  opt["flow_timeout"]);
+      }
+      devourer->set_flow_timeout(timeout);
+    }
+
+    if (opt.is_set("ring_size") || opt.is_set("block_size")) {
+      size_t ring_mb = 64, block_kb = 1024;
+      char *e = NULL;
+      if (opt.is_set("ring_size")) {
+        ring_mb = strtoul(opt["ring_size"].c_str(), &e, 0);
+        if (*e != '\0') {
+          throw devourer::Exception("Invalid ring size: " + opt["ring_size"]);
+        }
+      }
+      if (opt.is_set("block_size")) {
+        block_kb = strtoul(opt["block_size"].c_str(), &e, 0);
+        if (*e != '\0') {
+          throw devourer::Exception("Invalid block size: " +
+                                    opt["block_size"]);
+        }
+      }
+      devourer->set_ring_size(ring_mb * 1024 * 1024, block_kb * 1024);
+    }
+
+    if (opt.is_set("trace")) {
+      if (!devourer::trace::COMPILED) {
+        throw devourer::Exception("Trace points are not compiled, "
+                                  "build with WITH_TRACE");
+      }
+      trace_path = opt["trace"].c_str();
+      signal(SIGUSR2, dump_trace);
+      devourer::trace::enable(true);
+    }
+
     devourer->start();
+    if (trace_path) {
+      dump_trace(0);
+    }
+    if (devourer->dropped_packets() > 0) {
+      std::cerr << "Dropped packets: " << devourer->dropped_packets() <<
+        std::endl;
+    }
+    if (devourer->shed_messages() > 0) {
+      std::cerr << "Shed messages: " << devourer->shed_messages() <<
+        std::endl;
+    }
   } catch (const devourer::Exception &e) {
     std::cerr << "Devourer Error: " << e.what() << std::endl;
     return false;
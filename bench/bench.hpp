@@ -0,0 +1,85 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENCH_BENCH_H__
+#define BENCH_BENCH_H__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace bench {
+  // Benchmark case registered by BENCHMARK() macro, run by devourer-bench.
+  class Case {
+  public:
+    typedef void (*Func)();
+
+  private:
+    std::string name_;
+    Func func_;
+    static std::vector<Case*> *cases();
+
+  public:
+    Case(const std::string &name, Func func);
+    const std::string& name() const { return this->name_; }
+    // Run all cases whose name contains filter, return number of run cases.
+    static size_t run_all(const std::string &filter);
+  };
+
+  struct Result {
+    std::string name;
+    std::string metric;
+    double value;
+    std::string unit;
+  };
+
+  // Monotonic clock in seconds.
+  double now();
+  // Print a result line as "case  metric  value unit", or keep it for JSON
+  // output by set_json().
+  void report(const std::string &metric, double value,
+              const std::string &unit);
+  void set_json(bool json);
+  // Print kept results as a JSON object.
+  void print_json();
+  // Number of operator new calls since the process started.
+  size_t alloc_count();
+  // Current and peak resident set size in KB. reset_peak_rss() makes the
+  // peak the current size on Linux 4.0 or later, and returns false if it
+  // is not supported.
+  size_t rss_kb();
+  size_t peak_rss_kb();
+  bool reset_peak_rss();
+  // Count of devourer::cycles() per nanosecond, measured at the first call.
+  double cycles_per_ns();
+}
+
+#define BENCHMARK(NAME)                                         \
+  static void bench_##NAME();                                   \
+  static bench::Case bench_case_##NAME(#NAME, bench_##NAME);    \
+  static void bench_##NAME()
+
+#endif  // BENCH_BENCH_H__
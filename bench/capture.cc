@@ -0,0 +1,110 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+
+#include "./bench.hpp"
+#include "capture.hpp"
+
+namespace {
+  // Write a pcap file of about size bytes with Ethernet frames of mixed
+  // length. The file is removed by destructor.
+  class PcapFile {
+  private:
+    std::string path_;
+    size_t size_;
+
+  public:
+    explicit PcapFile(size_t size) : size_(0) {
+      const char *dir = getenv("TMPDIR");
+      this->path_ = std::string(dir ? dir : "/tmp") +
+        "/devourer-bench-XXXXXX";
+      std::vector<char> path(this->path_.begin(), this->path_.end());
+      path.push_back('\0');
+      int fd = mkstemp(&path[0]);
+      this->path_ = &path[0];
+      FILE *fp = fdopen(fd, "wb");
+
+      const uint32_t hdr[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1};
+      fwrite(hdr, sizeof(hdr), 1, fp);
+      this->size_ += sizeof(hdr);
+
+      static const size_t lens[] = {64, 1514, 590, 1514, 128, 1514};
+      uint8_t data[1514];
+      memset(data, 0x5A, sizeof(data));
+      for (uint32_t i = 0; this->size_ < size; i++) {
+        const uint32_t len = lens[i % (sizeof(lens) / sizeof(lens[0]))];
+        const uint32_t rec[4] = {1400000000 + i / 100000, i % 1000000,
+                                 len, len};
+        fwrite(rec, sizeof(rec), 1, fp);
+        fwrite(data, len, 1, fp);
+        this->size_ += sizeof(rec) + len;
+      }
+      fclose(fp);
+    }
+    ~PcapFile() { unlink(this->path_.c_str()); }
+    const std::string& path() const { return this->path_; }
+    size_t size() const { return this->size_; }
+  };
+
+  // Touch head and tail of each packet like a decoder does.
+  void read_all(devourer::Capture *cap, size_t file_size) {
+    devourer::Packet pkt;
+    size_t count = 0, sum = 0;
+    double begin = bench::now();
+    while (devourer::Capture::END != cap->next(&pkt)) {
+      sum += pkt.data[0] + pkt.data[pkt.len - 1];
+      count++;
+    }
+    double elapsed = bench::now() - begin;
+
+    bench::report("GB/s", file_size / elapsed / 1e9, "GB/s");
+    bench::report("Mpps", count / elapsed / 1e6, "Mpps");
+    if (sum == 0) {
+      std::cerr << "no packet" << std::endl;
+    }
+  }
+
+  const size_t FILE_SIZE = 1024UL * 1024 * 1024;
+}
+
+// Both cases read a file just written, then it is likely in page cache.
+BENCHMARK(pcap_read_libpcap) {
+  PcapFile file(FILE_SIZE);
+  devourer::PcapCapture cap(file.path(), devourer::PCAP_FILE);
+  read_all(&cap, file.size());
+}
+
+BENCHMARK(pcap_read_mmap) {
+  PcapFile file(FILE_SIZE);
+  devourer::MmapPcapCapture cap(file.path());
+  read_all(&cap, file.size());
+}
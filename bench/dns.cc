@@ -0,0 +1,122 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <sstream>
+#include <iostream>
+
+#include "./bench.hpp"
+#include "modules/dns.hpp"
+
+static std::string num_name(const std::string &prefix, size_t n,
+                            const std::string &suffix) {
+  std::stringstream ss;
+  ss << prefix << n << suffix;
+  return ss.str();
+}
+
+// Lookup cost of resolv_addr() should stay flat as the CNAME cache grows.
+BENCHMARK(dns_cname_lookup) {
+  static const size_t cache_size[] = {1000, 10000, 100000, 300000};
+  static const size_t lookup_count = 1000000;
+
+  for (size_t c = 0; c < sizeof(cache_size) / sizeof(cache_size[0]); c++) {
+    const size_t n = cache_size[c];
+    devourer::ModDns dns;
+
+    // www-N.example.com. -> EDGE-N.cdn.example.net -> 10.x.x.x
+    // A record name differs in case and trailing dot from CNAME data.
+    for (size_t i = 0; i < n; i++) {
+      uint32_t addr = htonl(0x0A000000 + i);
+      dns.add_cname_record(num_name("www-", i, ".example.com."),
+                           num_name("edge-", i, ".cdn.example.net."), 0);
+      dns.add_a_record(num_name("EDGE-", i, ".cdn.example.net"),
+                       &addr, sizeof(addr), 0);
+    }
+
+    size_t miss = 0;
+    uint32_t seed = 1;
+    double begin = bench::now();
+    for (size_t i = 0; i < lookup_count; i++) {
+      seed = seed * 1103515245 + 12345;
+      uint32_t addr = htonl(0x0A000000 + (seed >> 8) % n);
+      const std::string &name = dns.resolv_addr(&addr, sizeof(addr));
+      if (name.empty() || name[0] != 'w') {
+        miss++;
+      }
+    }
+    double elapsed = bench::now() - begin;
+
+    bench::report(num_name("ns/lookup (", n, " cnames)"),
+                  elapsed * 1e9 / lookup_count, "ns");
+    if (miss > 0) {
+      std::cerr << "unresolved lookups: " << miss << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// Records expire after CACHE_TTL and their nodes are reused from the pool,
+// then adding a record should not call allocator in steady state. Names are
+// short enough for std::string to keep them inline.
+BENCHMARK(dns_record_alloc) {
+  static const size_t rate = 200;        // New records per second
+  static const time_t duration = 1800;   // 3 x CACHE_TTL
+  static const time_t measure_from = 1200;
+
+  std::vector<std::string> names;
+  for (size_t i = 0; i < rate; i++) {
+    names.push_back(num_name("h", i, ".ex.net"));
+  }
+
+  devourer::ModDns dns;
+  size_t alloc_begin = 0, added = 0;
+  double begin = 0;
+  for (time_t t = 1; t <= duration; t++) {
+    if (t == measure_from) {
+      alloc_begin = bench::alloc_count();
+      begin = bench::now();
+    }
+    dns.update_time(t * 1000);
+    for (size_t i = 0; i < rate; i++) {
+      uint32_t addr = htonl(0x0A000000 + t * rate + i);
+      dns.add_a_record(names[i], &addr, sizeof(addr), t);
+      dns.add_cname_record(names[i], names[(i + 1) % rate], t);
+      if (t >= measure_from) {
+        added++;
+      }
+    }
+  }
+  double elapsed = bench::now() - begin;
+  size_t allocs = bench::alloc_count() - alloc_begin;
+
+  bench::report("live A records", dns.a_record_count(), "nodes");
+  bench::report("ns/record", elapsed * 1e9 / added, "ns");
+  bench::report("allocs/record (steady state)",
+                static_cast<double>(allocs) / added, "allocs");
+}
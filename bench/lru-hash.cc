@@ -0,0 +1,217 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#include "./bench.hpp"
+#include "lru-hash.hpp"
+#include "lru-table.hpp"
+
+namespace {
+  uint64_t bench_hash(uint64_t n) { return n * 0x9E3779B97F4A7C15ULL; }
+
+  // Node for compatible LRUHash, virtual hash() and match().
+  class BenchNode : public devourer::LRUHash::Node {
+  private:
+    uint64_t key_[2];
+    uint64_t hv_;
+  public:
+    explicit BenchNode(uint64_t n) : hv_(bench_hash(n)) {
+      this->key_[0] = n;
+      this->key_[1] = ~n;
+    }
+    uint64_t hash() { return this->hv_; }
+    bool match(const void *key, size_t len) {
+      return (len == sizeof(this->key_) &&
+              0 == memcmp(key, this->key_, sizeof(this->key_)));
+    }
+  };
+
+  // Node and key for LRUTable, resolved at compile time.
+  class BenchKey {
+  private:
+    uint64_t key_[2];
+  public:
+    explicit BenchKey(uint64_t n) {
+      this->key_[0] = n;
+      this->key_[1] = ~n;
+    }
+    uint64_t hash() const { return bench_hash(this->key_[0]); }
+    const uint64_t *key() const { return this->key_; }
+  };
+
+  class BenchTypedNode : public devourer::LRUTableNode {
+  private:
+    BenchKey key_;
+  public:
+    explicit BenchTypedNode(uint64_t n) : key_(n) {}
+    uint64_t hash() const { return this->key_.hash(); }
+    bool match(const BenchKey &key) const {
+      return 0 == memcmp(key.key(), this->key_.key(), sizeof(uint64_t) * 2);
+    }
+  };
+
+  typedef devourer::LRUTable<BenchTypedNode, BenchKey> BenchTable;
+
+  bool lookup(devourer::LRUHash *table, uint64_t n) {
+    uint64_t key[2] = {n, ~n};
+    return (NULL != table->get(bench_hash(n), key, sizeof(key)));
+  }
+  bool lookup(BenchTable *table, uint64_t n) {
+    return (NULL != table->get(BenchKey(n)));
+  }
+
+  // Put n nodes, then look up random existing keys.
+  template <typename T, typename N>
+  void bench_table(T *table, size_t n, const std::string &label) {
+    static const size_t lookup_count = 2000000;
+    std::vector<N*> nodes;
+    nodes.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      nodes.push_back(new N(i));
+      table->put(1, nodes[i]);
+    }
+
+    size_t found = 0;
+    uint64_t seed = 1;
+    double begin = bench::now();
+    for (size_t i = 0; i < lookup_count; i++) {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      if (lookup(table, (seed >> 17) % n)) {
+        found++;
+      }
+    }
+    double elapsed = bench::now() - begin;
+
+    std::stringstream ss;
+    ss << label << " ns/get (" << n << " nodes)";
+    bench::report(ss.str(), elapsed * 1e9 / lookup_count, "ns");
+
+    table->purge();
+    while (table->pop()) {}
+    for (size_t i = 0; i < n; i++) {
+      delete nodes[i];
+    }
+  }
+}
+
+// Lookup cost of LRUHash (virtual hash()/match() with raw byte key) against
+// LRUTable with concrete node and key types.
+BENCHMARK(lru_hash_get) {
+  static const size_t node_count[] = {10000, 100000, 1000000};
+  for (size_t c = 0; c < sizeof(node_count) / sizeof(node_count[0]); c++) {
+    const size_t n = node_count[c];
+    {
+      devourer::LRUHash table(4);
+      bench_table<devourer::LRUHash, BenchNode>(&table, n, "LRUHash");
+    }
+    {
+      BenchTable table(4);
+      bench_table<BenchTable, BenchTypedNode>(&table, n, "LRUTable");
+    }
+  }
+}
+
+namespace {
+  // Put n nodes into a table created with default size and report the worst
+  // put() latency, which includes resizing.
+  template <typename T, typename N>
+  void bench_put_latency(T *table, size_t n, const std::string &label) {
+    std::vector<N*> nodes;
+    nodes.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      nodes.push_back(new N(i));
+    }
+
+    double max_put = 0;
+    double begin = bench::now();
+    for (size_t i = 0; i < n; i++) {
+      double ts = bench::now();
+      table->put(1, nodes[i]);
+      max_put = std::max(max_put, bench::now() - ts);
+    }
+    double elapsed = bench::now() - begin;
+
+    bench::report(label + " ns/put", elapsed * 1e9 / n, "ns");
+    bench::report(label + " max put latency", max_put * 1e6, "us");
+
+    table->purge();
+    while (table->pop()) {}
+    for (size_t i = 0; i < n; i++) {
+      delete nodes[i];
+    }
+  }
+}
+
+BENCHMARK(lru_hash_put_latency) {
+  static const size_t n = 2000000;
+  {
+    devourer::LRUHash table(4);
+    bench_put_latency<devourer::LRUHash, BenchNode>(&table, n, "LRUHash");
+  }
+  {
+    BenchTable table(4);
+    bench_put_latency<BenchTable, BenchTypedNode>(&table, n, "LRUTable");
+  }
+}
+
+// Cost of prog() after a long gap of capture time, e.g. a pcap file that
+// has no packet for hours. Expiry does not walk every skipped tick.
+BENCHMARK(lru_hash_prog_gap) {
+  static const size_t n = 100000;
+  static const size_t gap = 3600 * 1000;  // 1 hour in millisecond ticks
+  BenchTable table(gap * 2);
+  std::vector<BenchTypedNode*> nodes;
+  for (size_t i = 0; i < n; i++) {
+    nodes.push_back(new BenchTypedNode(i));
+    table.put(i % gap, nodes[i]);
+  }
+
+  double begin = bench::now();
+  table.prog(gap);
+  double elapsed = bench::now() - begin;
+  size_t expired = 0;
+  while (table.pop()) {
+    expired++;
+  }
+  bench::report("prog() over 1 hour of ms ticks", elapsed * 1e6, "us");
+  bench::report("expired nodes", expired, "nodes");
+
+  begin = bench::now();
+  for (size_t i = 0; i < 1000; i++) {
+    table.prog(gap);
+  }
+  elapsed = bench::now() - begin;
+  bench::report("prog() over 1 hour, empty table", elapsed * 1e9 / 1000, "ns");
+
+  for (size_t i = 0; i < n; i++) {
+    delete nodes[i];
+  }
+}
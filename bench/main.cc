@@ -0,0 +1,228 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <new>
+
+#include "./bench.hpp"
+#include "devourer.hpp"
+#include "stats.hpp"
+
+namespace bench {
+  static const Case *curr_case_ = NULL;
+  static size_t alloc_count_ = 0;
+  static bool json_ = false;
+  static std::vector<Result> results_;
+
+  std::vector<Case*> *Case::cases() {
+    // Constructed on first use, registration runs in static initialization.
+    static std::vector<Case*> cases;
+    return &cases;
+  }
+
+  Case::Case(const std::string &name, Func func) : name_(name), func_(func) {
+    Case::cases()->push_back(this);
+  }
+
+  size_t Case::run_all(const std::string &filter) {
+    size_t count = 0;
+    std::vector<Case*> *cases = Case::cases();
+    for (size_t i = 0; i < cases->size(); i++) {
+      Case *c = (*cases)[i];
+      if (!filter.empty() && c->name_.find(filter) == std::string::npos) {
+        continue;
+      }
+      curr_case_ = c;
+      c->func_();
+      curr_case_ = NULL;
+      count++;
+    }
+    return count;
+  }
+
+  double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) +
+      static_cast<double>(ts.tv_nsec) / 1e9;
+  }
+
+  void report(const std::string &metric, double value,
+              const std::string &unit) {
+    const std::string &name = curr_case_ ? curr_case_->name() : "-";
+    if (json_) {
+      const Result r = {name, metric, value, unit};
+      results_.push_back(r);
+      return;
+    }
+    printf("%-24s %-32s %14.3f %s\n", name.c_str(), metric.c_str(), value,
+           unit.c_str());
+    fflush(stdout);
+  }
+
+  void set_json(bool json) {
+    json_ = json;
+  }
+
+  static std::string json_str(const std::string &str) {
+    std::string out = "\"";
+    for (size_t i = 0; i < str.size(); i++) {
+      const char c = str[i];
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      } else {
+        out += c;
+      }
+    }
+    return out + "\"";
+  }
+
+  void print_json() {
+    struct utsname uts;
+    const std::string host = (uname(&uts) == 0) ?
+      std::string(uts.nodename) + " " + uts.machine : "";
+    printf("{\n  \"version\": %s,\n  \"host\": %s,\n"
+           "  \"time\": %ld,\n  \"results\": [",
+           json_str(devourer::VERSION).c_str(), json_str(host).c_str(),
+           static_cast<long>(::time(NULL)));
+    for (size_t i = 0; i < results_.size(); i++) {
+      const Result &r = results_[i];
+      char value[32];
+      if (std::isfinite(r.value)) {
+        snprintf(value, sizeof(value), "%.6g", r.value);
+      } else {
+        snprintf(value, sizeof(value), "null");
+      }
+      printf("%s\n    {\"case\": %s, \"metric\": %s, \"value\": %s, "
+             "\"unit\": %s}", (i > 0) ? "," : "", json_str(r.name).c_str(),
+             json_str(r.metric).c_str(), value, json_str(r.unit).c_str());
+    }
+    printf("\n  ]\n}\n");
+    fflush(stdout);
+  }
+
+  size_t alloc_count() {
+    return alloc_count_;
+  }
+
+  // Value of a "Name:  N kB" line in /proc/self/status.
+  static size_t proc_status_kb(const char *name) {
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    const size_t len = strlen(name);
+    while (std::getline(ifs, line)) {
+      if (line.compare(0, len, name) == 0 && line.size() > len &&
+          line[len] == ':') {
+        return strtoul(line.c_str() + len + 1, NULL, 10);
+      }
+    }
+    return 0;
+  }
+
+  size_t rss_kb() {
+    return proc_status_kb("VmRSS");
+  }
+
+  size_t peak_rss_kb() {
+    const size_t kb = proc_status_kb("VmHWM");
+    if (kb > 0) {
+      return kb;
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;  // KB on Linux, bytes on macOS
+  }
+
+  bool reset_peak_rss() {
+    std::ofstream ofs("/proc/self/clear_refs");
+    ofs << "5";
+    ofs.flush();
+    return ofs.good();
+  }
+
+  double cycles_per_ns() {
+    static double rate = 0;
+    if (rate == 0) {
+      const double begin = now();
+      const uint64_t c_begin = devourer::cycles();
+      usleep(100000);
+      const uint64_t c_end = devourer::cycles();
+      rate = static_cast<double>(c_end - c_begin) / ((now() - begin) * 1e9);
+    }
+    return rate;
+  }
+}
+
+// Count allocations to check hot paths do not call allocator.
+void *operator new(size_t size) {
+  bench::alloc_count_++;
+  void *ptr = malloc(size > 0 ? size : 1);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+
+// devourer-bench [--json] [filter]
+int main(int argc, char *argv[]) {
+  std::string filter;
+  bool json = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  bench::set_json(json);
+  if (bench::Case::run_all(filter) == 0) {
+    std::cerr << "No benchmark matched: " << filter << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (json) {
+    bench::print_json();
+  }
+  exit(EXIT_SUCCESS);
+}
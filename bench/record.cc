@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+
+#include "./bench.hpp"
+#include "record.hpp"
+
+// Encoding a record of flow.log into a reused buffer should not call
+// allocator, and costs only copying keys and values.
+BENCHMARK(record_flow_log) {
+  static const size_t count = 1000000;
+  static const std::vector<std::string> keys = {
+    "c_addr", "c_name", "c_pkt", "c_port", "c_size", "hash", "init_ts",
+    "last_ts", "proto", "s_addr", "s_name", "s_pkt", "s_port", "s_size",
+  };
+  const devourer::RecordSchema schema("flow.log", keys);
+  const std::string proto("tcp");
+  std::vector<uint8_t> buf;
+  buf.reserve(256 * 1024);
+  devourer::RecordWriter w;
+
+  size_t bytes = 0;
+  const size_t alloc_begin = bench::alloc_count();
+  const double begin = bench::now();
+  for (size_t i = 0; i < count; i++) {
+    if (buf.size() > 128 * 1024) {
+      bytes += buf.size();
+      buf.clear();
+    }
+    w.begin(&buf, schema, 1420070400 + i / 1000);
+    w.put_str(0, "192.168.0.10");
+    w.put_uint(2, i & 0xff);
+    w.put_uint(3, 49152 + (i & 0x3fff));
+    w.put_uint(4, i * 1500);
+    w.put_str(5, "0123456789ABCDEF");
+    w.put_uint(6, 1420070400);
+    w.put_uint(7, 1420070460);
+    w.put_str(8, proto);
+    w.put_str(9, "10.0.0.1");
+    w.put_uint(11, i & 0xfff);
+    w.put_uint(12, 443);
+    w.put_uint(13, i * 40);
+    w.end();
+  }
+  const double elapsed = bench::now() - begin;
+  bytes += buf.size();
+
+  bench::report("ns/record", elapsed * 1e9 / count, "ns");
+  bench::report("bytes/record", static_cast<double>(bytes) / count, "B");
+  bench::report("allocs/record",
+                static_cast<double>(bench::alloc_count() - alloc_begin) /
+                count, "allocs");
+}
@@ -0,0 +1,161 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string>
+#include <vector>
+
+#include "./bench.hpp"
+#include "devourer.hpp"
+#include "module.hpp"
+#include "shard.hpp"
+#include "traffic-gen.hpp"
+
+// Packet mixes are built in memory by TrafficGen before measuring, and
+// given to Devourer::input() without output destination, so records are
+// built but not written anywhere.
+namespace {
+  static const size_t PACKETS = 1000000;
+  static const size_t SNAP_LEN = 128;  // Captured bytes of a packet
+
+  void run_mix(const devourer::TrafficGen::Config &config) {
+    devourer::TrafficGen gen(config);
+    std::vector<uint8_t> data;
+    std::vector<devourer::Packet> pkts;
+    gen.generate(PACKETS, &data, &pkts);
+
+    Devourer devourer("", devourer::PCAP_FILE);
+    const size_t rss_begin = bench::rss_kb();
+    const bool peak_reset = bench::reset_peak_rss();
+    const size_t alloc_begin = bench::alloc_count();
+
+    const double begin = bench::now();
+    for (size_t i = 0; i < pkts.size(); i++) {
+      devourer.input(pkts[i].data, pkts[i].len, pkts[i].tv, pkts[i].cap_len);
+    }
+    const double elapsed = bench::now() - begin;
+    const size_t allocs = bench::alloc_count() - alloc_begin;
+    const size_t n = pkts.size();
+
+    const double span = (pkts[n - 1].tv.tv_sec - pkts[0].tv.tv_sec) +
+      (pkts[n - 1].tv.tv_usec - pkts[0].tv.tv_usec) / 1e6;
+
+    bench::report("packets/s", n / elapsed, "pps");
+    bench::report("speed to traffic", span / elapsed, "x");
+    bench::report("ns/packet", elapsed * 1e9 / n, "ns");
+    const double cpn = bench::cycles_per_ns();
+    const devourer::Shard *shard = devourer.shards()[0];
+    for (size_t i = 0; i < shard->modules().size(); i++) {
+      const devourer::Module *mod = shard->modules()[i];
+      const std::string name = mod->name();
+      bench::report("ns/packet " + name,
+                    mod->stats().cycles.get() / cpn / n, "ns");
+      bench::report("events/packet " + name,
+                    static_cast<double>(mod->stats().events.get()) / n,
+                    "events");
+    }
+    bench::report("allocs/packet", static_cast<double>(allocs) / n,
+                  "allocs");
+    const size_t peak = bench::peak_rss_kb();
+    bench::report(peak_reset ? "peak RSS" : "peak RSS (process)",
+                  peak / 1024.0, "MB");
+    bench::report("RSS growth", (peak > rss_begin ? peak - rss_begin : 0) /
+                  1024.0, "MB");
+  }
+}
+
+// Clients resolve names and connect to the address, DNS is 2/3 of
+// packets. Names are reused, and answers update the cache.
+BENCHMARK(traffic_dns_heavy) {
+  devourer::TrafficGen::Config c;
+  c.clients = 60000;
+  c.names = 50000;
+  c.servers = 50000;
+  c.dns_ratio = 1.0;
+  c.udp_ratio = 1.0;
+  c.flow_packets = 1;
+  c.payload = 100;
+  c.interval_nsec = 20000;
+  c.snap_len = SNAP_LEN;
+  run_mix(c);
+}
+
+// A busy resolver at 200k queries/s: clients send only DNS, 2% of queries
+// are not answered and time out, and others are answered in a few ms.
+BENCHMARK(traffic_dns_200k_qps) {
+  devourer::TrafficGen::Config c;
+  c.clients = 50000;
+  c.names = 100000;
+  c.servers = 100000;
+  c.concurrent = 2000;
+  c.dns_ratio = 1.0;
+  c.dns_loss = 0.02;
+  c.udp_ratio = 1.0;
+  c.flow_packets = 0;
+  c.interval_nsec = 2500;  // Query and response, 400k packets/s
+  c.snap_len = SNAP_LEN;
+  run_mix(c);
+}
+
+// Many short TCP flows (handshake, 1 data packet and FIN), every flow is
+// new.
+BENCHMARK(traffic_short_flows) {
+  devourer::TrafficGen::Config c;
+  c.clients = 60000;
+  c.servers = 256;
+  c.names = 256;
+  c.dns_ratio = 0.0;
+  c.flow_packets = 1;
+  c.payload = 200;
+  c.snap_len = SNAP_LEN;
+  run_mix(c);
+}
+
+// A few long flows of full size packets.
+BENCHMARK(traffic_elephant_flows) {
+  devourer::TrafficGen::Config c;
+  c.clients = 16;
+  c.servers = 1;
+  c.names = 1;
+  c.concurrent = 16;
+  c.dns_ratio = 0.0;
+  c.flow_packets = PACKETS;
+  c.payload = 1460;
+  c.interval_nsec = 1000;
+  c.snap_len = SNAP_LEN;
+  run_mix(c);
+}
+
+// One host sends SYN to random ports of many hosts, none answers.
+BENCHMARK(traffic_syn_scan) {
+  devourer::TrafficGen::Config c;
+  c.clients = 1;
+  c.servers = 65536;
+  c.concurrent = 1;
+  c.syn_only_ratio = 1.0;
+  c.interval_nsec = 2000;
+  c.snap_len = SNAP_LEN;
+  run_mix(c);
+}
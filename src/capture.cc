@@ -0,0 +1,689 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pcap.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glob.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif
+#include <algorithm>
+
+#include "./capture.hpp"
+
+namespace devourer {
+  PcapCapture::PcapCapture(const std::string &target, Source src)
+    throw(Exception) : pcap_(NULL) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+
+    switch (src) {
+    case PCAP_FILE:
+      this->pcap_ = pcap_open_offline(target.c_str(), errbuf);
+      break;
+    case INTERFACE:
+      // 100ms timeout to flush pending batches in quiet traffic.
+      this->pcap_ = pcap_open_live(target.c_str(), 0xffff, 1, 100, errbuf);
+      break;
+    default:
+      throw Exception("Unsupported source for pcap: " + target);
+    }
+
+    if (this->pcap_ == NULL) {
+      throw Exception(errbuf);
+    }
+    if (pcap_datalink(this->pcap_) != DLT_EN10MB) {
+      pcap_close(this->pcap_);
+      throw Exception("Only Ethernet is supported: " + target);
+    }
+  }
+
+  PcapCapture::~PcapCapture() {
+    pcap_close(this->pcap_);
+  }
+
+  Capture::Status PcapCapture::next(Packet *pkt) throw(Exception) {
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+
+    switch (pcap_next_ex(this->pcap_, &hdr, &data)) {
+    case 1:
+      pkt->data = data;
+      pkt->len = hdr->caplen;
+      pkt->cap_len = hdr->len;
+      pkt->tv = hdr->ts;
+      return READ;
+    case 0:
+      return TIMEOUT;
+    case -2:
+      return END;
+    default:
+      throw Exception(pcap_geterr(this->pcap_));
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class AfPacketCapture
+  //
+  const size_t AfPacketCapture::DEFAULT_RING_SIZE;
+  const size_t AfPacketCapture::DEFAULT_BLOCK_SIZE;
+  const size_t AfPacketCapture::FRAME_SIZE;
+
+  static inline size_t page_size() {
+    static const size_t size = ::sysconf(_SC_PAGESIZE);
+    return size;
+  }
+
+  // Sizes are checked before any socket is opened, then invalid options
+  // are reported without CAP_NET_RAW.
+  void AfPacketCapture::check_size(size_t ring_size, size_t block_size)
+    throw(Exception) {
+    if (block_size == 0 || block_size % page_size() != 0 ||
+        block_size % FRAME_SIZE != 0) {
+      throw Exception("Block size must be a multiple of page size");
+    }
+    if (ring_size < block_size || ring_size % block_size != 0) {
+      throw Exception("Ring size must be a multiple of block size");
+    }
+  }
+
+#ifdef __linux__
+  AfPacketCapture::AfPacketCapture(const std::string &dev,
+                                   uint16_t fanout_group, size_t ring_size,
+                                   size_t block_size) throw(Exception) :
+    fd_(-1), map_(NULL), ring_size_(ring_size), block_size_(block_size),
+    block_nr_(0), block_idx_(0), pkt_left_(0), next_pkt_(NULL),
+    in_block_(false)
+  {
+    AfPacketCapture::check_size(ring_size, block_size);
+    this->block_nr_ = ring_size / block_size;
+
+    const unsigned int ifindex = ::if_nametoindex(dev.c_str());
+    if (ifindex == 0) {
+      throw Exception(dev + ": " + strerror(errno));
+    }
+
+    this->fd_ = ::socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (this->fd_ < 0) {
+      throw Exception(std::string("AF_PACKET socket: ") + strerror(errno));
+    }
+
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = this->block_nr_;
+    req.tp_frame_size = FRAME_SIZE;
+    req.tp_frame_nr = (block_size / FRAME_SIZE) * this->block_nr_;
+    req.tp_retire_blk_tov = 100;  // ms to retire a block not filled
+    if (::setsockopt(this->fd_, SOL_PACKET, PACKET_VERSION, &version,
+                     sizeof(version)) < 0 ||
+        ::setsockopt(this->fd_, SOL_PACKET, PACKET_RX_RING, &req,
+                     sizeof(req)) < 0) {
+      const std::string err = strerror(errno);
+      this->close_socket();
+      throw Exception("TPACKET_V3 ring: " + err);
+    }
+
+    void *ptr = ::mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       this->fd_, 0);
+    if (ptr == MAP_FAILED) {
+      const std::string err = strerror(errno);
+      this->close_socket();
+      throw Exception("TPACKET_V3 mmap: " + err);
+    }
+    this->map_ = static_cast<uint8_t*>(ptr);
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    int fanout = fanout_group | (PACKET_FANOUT_HASH << 16);
+    if (::bind(this->fd_, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr)) < 0 ||
+        ::setsockopt(this->fd_, SOL_PACKET, PACKET_FANOUT, &fanout,
+                     sizeof(fanout)) < 0) {
+      const std::string err = strerror(errno);
+      this->close_socket();
+      throw Exception(dev + ": " + err);
+    }
+  }
+
+  AfPacketCapture::~AfPacketCapture() {
+    this->close_socket();
+  }
+
+  void AfPacketCapture::close_socket() {
+    if (this->map_) {
+      ::munmap(this->map_, this->ring_size_);
+      this->map_ = NULL;
+    }
+    if (this->fd_ >= 0) {
+      ::close(this->fd_);
+      this->fd_ = -1;
+    }
+  }
+
+  void AfPacketCapture::release_block() {
+    struct tpacket_block_desc *bd = reinterpret_cast<struct tpacket_block_desc*>
+      (this->map_ + this->block_idx_ * this->block_size_);
+    __sync_synchronize();
+    bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    this->block_idx_ = (this->block_idx_ + 1) % this->block_nr_;
+    this->in_block_ = false;
+  }
+
+  Capture::Status AfPacketCapture::next(Packet *pkt) throw(Exception) {
+    if (this->in_block_ && this->pkt_left_ == 0) {
+      this->release_block();
+    }
+
+    if (!this->in_block_) {
+      struct tpacket_block_desc *bd =
+        reinterpret_cast<struct tpacket_block_desc*>
+        (this->map_ + this->block_idx_ * this->block_size_);
+      if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+        struct pollfd pfd;
+        pfd.fd = this->fd_;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        if (::poll(&pfd, 1, 100) < 0 && errno != EINTR) {
+          throw Exception(std::string("poll: ") + strerror(errno));
+        }
+        if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+          return TIMEOUT;
+        }
+      }
+      __sync_synchronize();
+      this->in_block_ = true;
+      this->pkt_left_ = bd->hdr.bh1.num_pkts;
+      this->next_pkt_ = reinterpret_cast<const uint8_t*>(bd) +
+        bd->hdr.bh1.offset_to_first_pkt;
+      if (this->pkt_left_ == 0) {
+        return TIMEOUT;
+      }
+    }
+
+    const struct tpacket3_hdr *hdr =
+      reinterpret_cast<const struct tpacket3_hdr*>(this->next_pkt_);
+    pkt->data = this->next_pkt_ + hdr->tp_mac;
+    pkt->len = hdr->tp_snaplen;
+    pkt->cap_len = hdr->tp_len;
+    pkt->tv.tv_sec = hdr->tp_sec;
+    pkt->tv.tv_usec = hdr->tp_nsec / 1000;
+    this->next_pkt_ += hdr->tp_next_offset;
+    this->pkt_left_--;
+    return READ;
+  }
+
+  bool AfPacketCapture::stats(uint64_t *packets, uint64_t *drops) {
+    // Kernel resets counters on each read.
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+    if (::getsockopt(this->fd_, SOL_PACKET, PACKET_STATISTICS, &st,
+                     &len) < 0) {
+      return false;
+    }
+    *packets = st.tp_packets;
+    *drops = st.tp_drops;
+    return true;
+  }
+
+#else  // __linux__
+  AfPacketCapture::AfPacketCapture(const std::string &dev,
+                                   uint16_t fanout_group, size_t ring_size,
+                                   size_t block_size) throw(Exception) :
+    fd_(-1), map_(NULL) {
+    AfPacketCapture::check_size(ring_size, block_size);
+    throw Exception("AF_PACKET is supported only on Linux");
+  }
+  AfPacketCapture::~AfPacketCapture() {}
+  void AfPacketCapture::close_socket() {}
+  void AfPacketCapture::release_block() {}
+  Capture::Status AfPacketCapture::next(Packet *pkt) throw(Exception) {
+    return END;
+  }
+  bool AfPacketCapture::stats(uint64_t *packets, uint64_t *drops) {
+    return false;
+  }
+#endif  // __linux__
+
+  // ------------------------------------------------------------
+  // class MmapPcapCapture
+  //
+  const size_t MmapPcapCapture::READAHEAD;
+
+  static const uint32_t PCAP_MAGIC      = 0xa1b2c3d4;
+  static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+  static const uint32_t PCAPNG_SHB      = 0x0A0D0D0A;
+  static const uint32_t PCAPNG_IDB      = 0x00000001;
+  static const uint32_t PCAPNG_PB       = 0x00000002;
+  static const uint32_t PCAPNG_SPB      = 0x00000003;
+  static const uint32_t PCAPNG_EPB      = 0x00000006;
+  static const uint32_t PCAPNG_BOM      = 0x1A2B3C4D;
+  static const uint32_t LINKTYPE_ETHERNET = 1;
+
+  static inline uint32_t native32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  MmapPcapCapture::MmapPcapCapture(const std::string &path)
+    throw(Exception) : path_(path), base_(NULL), size_(0), pos_(0),
+                       advised_(0), pcapng_(false), swapped_(false),
+                       nsec_(false) {
+    // Pages are read ahead by next(), only the header is read here.
+    this->map();
+    const uint32_t magic = native32(this->base_);
+    if (magic == PCAPNG_SHB) {
+      this->pcapng_ = true;
+      return;
+    }
+
+    if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC) {
+      this->swapped_ = false;
+    } else if (__builtin_bswap32(magic) == PCAP_MAGIC ||
+               __builtin_bswap32(magic) == PCAP_MAGIC_NSEC) {
+      this->swapped_ = true;
+    } else {
+      this->unmap();
+      throw Exception(path + ": Not pcap format");
+    }
+    this->nsec_ = (this->read32(this->base_) == PCAP_MAGIC_NSEC);
+
+    if (this->read32(this->base_ + 20) != LINKTYPE_ETHERNET) {
+      this->unmap();
+      throw Exception("Only Ethernet is supported: " + path);
+    }
+    this->pos_ = 24;
+  }
+
+  MmapPcapCapture::~MmapPcapCapture() {
+    this->unmap();
+  }
+
+  void MmapPcapCapture::map() throw(Exception) {
+    const std::string &path = this->path_;
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw Exception(path + ": " + strerror(errno));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || st.st_size < 24 ||
+        static_cast<size_t>(st.st_size) < this->pos_) {
+      ::close(fd);
+      throw Exception(path + ": Not pcap format");
+    }
+    this->size_ = st.st_size;
+
+    // Mapping is kept after close, then many files can be opened at once.
+    void *ptr = ::mmap(NULL, this->size_, PROT_READ, MAP_SHARED, fd, 0);
+    const int err = errno;
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+      throw Exception(path + ": " + strerror(err));
+    }
+    this->base_ = static_cast<const uint8_t*>(ptr);
+    ::madvise(ptr, this->size_, MADV_SEQUENTIAL);
+    this->advised_ = this->pos_ & ~(page_size() - 1);
+  }
+
+  void MmapPcapCapture::unmap() {
+    if (this->base_) {
+      ::munmap(const_cast<uint8_t*>(this->base_), this->size_);
+      this->base_ = NULL;
+    }
+  }
+
+  uint16_t MmapPcapCapture::read16(const uint8_t *p) const {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return this->swapped_ ? __builtin_bswap16(v) : v;
+  }
+
+  uint32_t MmapPcapCapture::read32(const uint8_t *p) const {
+    const uint32_t v = native32(p);
+    return this->swapped_ ? __builtin_bswap32(v) : v;
+  }
+
+  // Ask kernel to read the next window while packets of the current window
+  // are decoded. The first window of a file is a page for the first packet,
+  // MergeCapture reads only it from every file at start.
+  void MmapPcapCapture::readahead() {
+    if (this->pos_ + READAHEAD / 2 >= this->advised_ &&
+        this->advised_ < this->size_) {
+      size_t len = (this->advised_ == 0) ? page_size() : READAHEAD;
+      if (this->advised_ + len > this->size_) {
+        len = this->size_ - this->advised_;
+      }
+      ::madvise(const_cast<uint8_t*>(this->base_) + this->advised_, len,
+                MADV_WILLNEED);
+      this->advised_ += len;
+    }
+  }
+
+  Capture::Status MmapPcapCapture::next(Packet *pkt) throw(Exception) {
+    if (this->base_ == NULL) {
+      this->map();
+    }
+    this->readahead();
+    return this->pcapng_ ? this->next_pcapng(pkt) : this->next_pcap(pkt);
+  }
+
+  Capture::Status MmapPcapCapture::next_pcap(Packet *pkt) throw(Exception) {
+    // Truncated record at the end, e.g. a file being written, is ignored.
+    if (this->pos_ + 16 > this->size_) {
+      return END;
+    }
+    const uint8_t *hdr = this->base_ + this->pos_;
+    const uint32_t caplen = this->read32(hdr + 8);
+    if (this->pos_ + 16 + caplen > this->size_) {
+      return END;
+    }
+
+    pkt->data = hdr + 16;
+    pkt->len = caplen;
+    pkt->cap_len = this->read32(hdr + 12);
+    pkt->tv.tv_sec = this->read32(hdr);
+    pkt->tv.tv_usec = this->nsec_ ?
+      this->read32(hdr + 4) / 1000 : this->read32(hdr + 4);
+    this->pos_ += 16 + caplen;
+    return READ;
+  }
+
+  void MmapPcapCapture::read_shb(const uint8_t *block) throw(Exception) {
+    const uint32_t bom = native32(block + 8);
+    if (bom == PCAPNG_BOM) {
+      this->swapped_ = false;
+    } else if (__builtin_bswap32(bom) == PCAPNG_BOM) {
+      this->swapped_ = true;
+    } else {
+      throw Exception("Invalid pcap-ng section header");
+    }
+    // Interface IDs are local to a section.
+    this->if_.clear();
+  }
+
+  void MmapPcapCapture::read_idb(const uint8_t *block, size_t len) {
+    Interface iface;
+    iface.linktype = this->read16(block + 8);
+    iface.ts_unit = 1000000;
+
+    // Options follow LinkType, Reserved and SnapLen.
+    size_t off = 16;
+    while (off + 4 <= len - 4) {
+      const uint16_t code = this->read16(block + off);
+      const uint16_t opt_len = this->read16(block + off + 2);
+      if (code == 0 || off + 4 + opt_len > len - 4) {
+        break;
+      }
+      if (code == 9 && opt_len >= 1) {
+        // if_tsresol: power of 10, or power of 2 if MSB is set.
+        const uint8_t res = block[off + 4];
+        uint64_t unit = 1;
+        for (uint8_t i = 0; i < (res & 0x7F) && unit < (1ULL << 60); i++) {
+          unit *= (res & 0x80) ? 2 : 10;
+        }
+        iface.ts_unit = unit;
+      }
+      off += 4 + ((opt_len + 3) & ~3);
+    }
+
+    this->if_.push_back(iface);
+  }
+
+  Capture::Status MmapPcapCapture::next_pcapng(Packet *pkt)
+    throw(Exception) {
+    for (;;) {
+      if (this->pos_ + 12 > this->size_) {
+        return END;
+      }
+      const uint8_t *block = this->base_ + this->pos_;
+      const uint32_t type = native32(block);
+      if (type == PCAPNG_SHB) {
+        this->read_shb(block);
+      }
+
+      const uint32_t len = this->read32(block + 4);
+      if (len < 12 || len % 4 != 0) {
+        throw Exception("Invalid pcap-ng block length");
+      }
+      if (this->pos_ + len > this->size_) {
+        return END;
+      }
+      this->pos_ += len;
+
+      // Fixed fields and the trailing length must be in the block before
+      // they are read, the block may be the last one of the mapping.
+      uint32_t if_id = 0;
+      uint64_t ts = 0;
+      switch (this->read32(block)) {
+      case PCAPNG_IDB:
+        if (len < 20) {
+          throw Exception("Invalid pcap-ng block length");
+        }
+        this->read_idb(block, len);
+        continue;
+
+      case PCAPNG_EPB:
+        if (len < 32) {
+          throw Exception("Invalid pcap-ng block length");
+        }
+        if_id = this->read32(block + 8);
+        pkt->len = this->read32(block + 20);
+        pkt->cap_len = this->read32(block + 24);
+        pkt->data = block + 28;
+        break;
+
+      case PCAPNG_PB:
+        if (len < 32) {
+          throw Exception("Invalid pcap-ng block length");
+        }
+        if_id = this->read16(block + 8);
+        pkt->len = this->read32(block + 20);
+        pkt->cap_len = this->read32(block + 24);
+        pkt->data = block + 28;
+        break;
+
+      case PCAPNG_SPB:
+        // Simple Packet Block has no timestamp.
+        if (len < 16) {
+          throw Exception("Invalid pcap-ng block length");
+        }
+        pkt->cap_len = this->read32(block + 8);
+        pkt->len = std::min<size_t>(pkt->cap_len, len - 16);
+        pkt->data = block + 12;
+        pkt->tv.tv_sec = 0;
+        pkt->tv.tv_usec = 0;
+        break;
+
+      default:
+        continue;  // Statistics, name resolution and so on.
+      }
+
+      if (if_id >= this->if_.size()) {
+        throw Exception("Invalid pcap-ng interface ID");
+      }
+      if (this->if_[if_id].linktype != LINKTYPE_ETHERNET) {
+        throw Exception("Only Ethernet is supported");
+      }
+      if (pkt->data + pkt->len > block + len - 4) {
+        throw Exception("Invalid pcap-ng packet length");
+      }
+
+      if (this->read32(block) != PCAPNG_SPB) {
+        ts = (static_cast<uint64_t>(this->read32(block + 12)) << 32) |
+          this->read32(block + 16);
+        const uint64_t unit = this->if_[if_id].ts_unit;
+        const uint64_t frac = ts % unit;
+        pkt->tv.tv_sec = ts / unit;
+        pkt->tv.tv_usec = (unit == 1000000) ? frac :
+          static_cast<uint64_t>(static_cast<double>(frac) * 1e6 / unit);
+      }
+      return READ;
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class MergeCapture
+  //
+  bool MergeCapture::later(const Source &a, const Source &b) {
+    if (a.pkt.tv.tv_sec != b.pkt.tv.tv_sec) {
+      return a.pkt.tv.tv_sec > b.pkt.tv.tv_sec;
+    }
+    if (a.pkt.tv.tv_usec != b.pkt.tv.tv_usec) {
+      return a.pkt.tv.tv_usec > b.pkt.tv.tv_usec;
+    }
+    return a.idx > b.idx;  // Keep order of files for same timestamp
+  }
+
+  MergeCapture::MergeCapture(const std::vector<std::string> &paths,
+                             size_t max_mapped) throw(Exception) :
+    max_mapped_(std::max(max_mapped, static_cast<size_t>(1))), mapped_(0),
+    seq_(0) {
+    try {
+      for (size_t i = 0; i < paths.size(); i++) {
+        MmapPcapCapture *cap = new MmapPcapCapture(paths[i]);
+        this->caps_.push_back(cap);
+        this->used_.push_back(++this->seq_);
+        this->mapped_++;
+
+        Source src;
+        src.cap = cap;
+        src.idx = i;
+        if (cap->next(&src.pkt) == READ) {
+          src.data_off = cap->offset_of(src.pkt.data);
+          this->heap_.push_back(src);
+        }
+        this->limit_mapped(i);
+      }
+    } catch (const Exception &e) {
+      for (size_t i = 0; i < this->caps_.size(); i++) {
+        delete this->caps_[i];
+      }
+      throw;
+    }
+    std::make_heap(this->heap_.begin(), this->heap_.end(), MergeCapture::later);
+  }
+
+  MergeCapture::~MergeCapture() {
+    for (size_t i = 0; i < this->caps_.size(); i++) {
+      delete this->caps_[i];
+    }
+  }
+
+  // Unmap the least recently read files except keep. Packet of the previous
+  // next() may be unmapped, then zero_copy() is false when files are more
+  // than max_mapped_ and callers copy each packet before the next call.
+  void MergeCapture::limit_mapped(size_t keep) {
+    while (this->mapped_ > this->max_mapped_) {
+      size_t lru = keep;
+      for (size_t i = 0; i < this->caps_.size(); i++) {
+        if (i != keep && this->caps_[i]->mapped() &&
+            (lru == keep || this->used_[i] < this->used_[lru])) {
+          lru = i;
+        }
+      }
+      if (lru == keep) {
+        break;
+      }
+      this->caps_[lru]->release();
+      this->mapped_--;
+    }
+  }
+
+  Capture::Status MergeCapture::next(Packet *pkt) throw(Exception) {
+    if (this->heap_.empty()) {
+      return END;
+    }
+
+    std::pop_heap(this->heap_.begin(), this->heap_.end(), MergeCapture::later);
+    Source &src = this->heap_.back();
+    if (!src.cap->mapped()) {
+      src.pkt.data = src.cap->data_at(src.data_off);
+      this->mapped_++;
+      this->limit_mapped(src.idx);
+    }
+    this->used_[src.idx] = ++this->seq_;
+
+    *pkt = src.pkt;
+    if (src.cap->next(&src.pkt) == READ) {
+      src.data_off = src.cap->offset_of(src.pkt.data);
+      std::push_heap(this->heap_.begin(), this->heap_.end(),
+                     MergeCapture::later);
+    } else {
+      this->heap_.pop_back();
+    }
+    return READ;
+  }
+
+  std::vector<std::string> expand_files(const std::string &target)
+    throw(Exception) {
+    std::vector<std::string> files;
+    size_t pos = 0;
+    while (pos <= target.length()) {
+      size_t end = target.find(',', pos);
+      if (end == std::string::npos) {
+        end = target.length();
+      }
+      const std::string pattern = target.substr(pos, end - pos);
+      pos = end + 1;
+      if (pattern.empty()) {
+        continue;
+      }
+
+      glob_t g;
+      int rc = ::glob(pattern.c_str(), 0, NULL, &g);
+      if (rc == GLOB_NOMATCH) {
+        throw Exception(pattern + ": No such file");
+      } else if (rc != 0) {
+        throw Exception(pattern + ": Failed to expand");
+      }
+      // glob(3) sorts names, then rotated files are in order of time.
+      for (size_t i = 0; i < g.gl_pathc; i++) {
+        files.push_back(g.gl_pathv[i]);
+      }
+      globfree(&g);
+    }
+
+    if (files.empty()) {
+      throw Exception("No pcap file is specified");
+    }
+    return files;
+  }
+}
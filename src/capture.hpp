@@ -0,0 +1,198 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_CAPTURE_H__
+#define SRC_CAPTURE_H__
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "./devourer.hpp"
+
+namespace devourer {
+  // Capture reads packets in the calling thread, and Devourer::start()
+  // dispatches them to workers before decoding.
+  class Capture {
+  public:
+    enum Status {
+      READ = 0,     // A packet is available
+      TIMEOUT = 1,  // No packet arrived in read timeout
+      END = 2,      // End of file or capture is stopped
+    };
+    virtual ~Capture() {}
+    // data of the packet is valid until next call of next(), or until the
+    // capture is destroyed if zero_copy() is true.
+    virtual Status next(Packet *pkt) throw(Exception) = 0;
+    virtual bool zero_copy() const { return false; }
+    // Packets received and dropped by kernel since the last call. Return
+    // false if the capture does not have statistics.
+    virtual bool stats(uint64_t *packets, uint64_t *drops) {
+      return false;
+    }
+  };
+
+  class PcapCapture : public Capture {
+  private:
+    struct pcap *pcap_;
+
+  public:
+    PcapCapture(const std::string &target, Source src) throw(Exception);
+    ~PcapCapture();
+    Status next(Packet *pkt) throw(Exception);
+  };
+
+  // AfPacketCapture receives packets by AF_PACKET socket with TPACKET_V3
+  // ring on Linux. Sockets that have same fanout group share packets of the
+  // interface by flow hash of kernel, both directions of a flow go to the
+  // same socket. Packet data is in the ring, and valid until next call of
+  // next() because the block is returned to kernel after all its packets.
+  class AfPacketCapture : public Capture {
+  private:
+    int fd_;
+    uint8_t *map_;
+    size_t ring_size_;
+    size_t block_size_;
+    size_t block_nr_;
+    size_t block_idx_;
+    uint32_t pkt_left_;
+    const uint8_t *next_pkt_;
+    bool in_block_;
+    static const size_t FRAME_SIZE = 2048;
+    void close_socket();
+    void release_block();
+
+  public:
+    static const size_t DEFAULT_RING_SIZE = 64 * 1024 * 1024;
+    static const size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    static void check_size(size_t ring_size, size_t block_size)
+      throw(Exception);
+
+    // fanout_group is shared by sockets reading the same interface.
+    AfPacketCapture(const std::string &dev, uint16_t fanout_group,
+                    size_t ring_size = DEFAULT_RING_SIZE,
+                    size_t block_size = DEFAULT_BLOCK_SIZE) throw(Exception);
+    ~AfPacketCapture();
+    Status next(Packet *pkt) throw(Exception);
+    bool stats(uint64_t *packets, uint64_t *drops);
+  };
+
+  // MmapPcapCapture reads a pcap or pcap-ng file mapped by mmap(2), and
+  // packet data points into the mapping without copy.
+  class MmapPcapCapture : public Capture {
+  private:
+    static const size_t READAHEAD = 64 * 1024 * 1024;
+
+    struct Interface {
+      uint32_t linktype;
+      uint64_t ts_unit;  // Timestamp units per second
+    };
+
+    std::string path_;
+    const uint8_t *base_;
+    size_t size_;
+    size_t pos_;
+    size_t advised_;
+    bool pcapng_;
+    bool swapped_;
+    bool nsec_;
+    std::vector<Interface> if_;
+
+    uint16_t read16(const uint8_t *p) const;
+    uint32_t read32(const uint8_t *p) const;
+    void map() throw(Exception);
+    void unmap();
+    void readahead();
+    Status next_pcap(Packet *pkt) throw(Exception);
+    Status next_pcapng(Packet *pkt) throw(Exception);
+    void read_shb(const uint8_t *block) throw(Exception);
+    void read_idb(const uint8_t *block, size_t len);
+
+  public:
+    explicit MmapPcapCapture(const std::string &path) throw(Exception);
+    ~MmapPcapCapture();
+    Status next(Packet *pkt) throw(Exception);
+    bool zero_copy() const { return true; }
+    size_t size() const { return this->size_; }
+
+    // Unmap the file and keep the position, next() and data_at() map it
+    // again. Data of packets read before is invalid after release().
+    void release() { this->unmap(); }
+    bool mapped() const { return this->base_ != NULL; }
+    size_t offset_of(const uint8_t *p) const { return p - this->base_; }
+    const uint8_t *data_at(size_t offset) throw(Exception) {
+      if (this->base_ == NULL) {
+        this->map();
+      }
+      return this->base_ + offset;
+    }
+  };
+
+  // MergeCapture reads multiple files, e.g. rotated captures, and returns
+  // packets of all files in timestamp order, so that timeouts of modules
+  // work across files. Every file is opened once for its first packet, and
+  // at most max_mapped files stay mapped. The least recently read file is
+  // unmapped, and mapped again when its packet comes. Packets are zero copy
+  // only if all files stay mapped, otherwise packet data is valid until the
+  // next call of next().
+  class MergeCapture : public Capture {
+  private:
+    struct Source {
+      MmapPcapCapture *cap;
+      size_t idx;
+      Packet pkt;
+      size_t data_off;  // Offset of pkt.data in the file
+    };
+    std::vector<MmapPcapCapture*> caps_;
+    std::vector<uint64_t> used_;  // Sequence of the last read of files
+    std::vector<Source> heap_;
+    size_t max_mapped_;
+    size_t mapped_;
+    uint64_t seq_;
+    static bool later(const Source &a, const Source &b);
+    void limit_mapped(size_t keep);
+
+  public:
+    static const size_t MAX_MAPPED = 64;
+
+    explicit MergeCapture(const std::vector<std::string> &paths,
+                          size_t max_mapped = MAX_MAPPED) throw(Exception);
+    ~MergeCapture();
+    Status next(Packet *pkt) throw(Exception);
+    bool zero_copy() const {
+      return this->caps_.size() <= this->max_mapped_;
+    }
+  };
+
+  // Split target by comma and expand glob pattern of each part, e.g.
+  // "/data/*.pcap" or "a.pcap,b.pcap".
+  std::vector<std::string> expand_files(const std::string &target)
+    throw(Exception);
+}
+
+#endif  // SRC_CAPTURE_H__
@@ -0,0 +1,591 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+
+#include "./column.hpp"
+#include "./record.hpp"
+
+namespace devourer {
+  static void put_le(std::vector<uint8_t> *buf, uint64_t v, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      buf->push_back(static_cast<uint8_t>(v >> (i * 8)));
+    }
+  }
+
+  static uint64_t get_le(const uint8_t *p, size_t len) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+      v |= static_cast<uint64_t>(p[i]) << (i * 8);
+    }
+    return v;
+  }
+
+  static void put_name(std::vector<uint8_t> *buf, const std::string &name) {
+    buf->push_back(static_cast<uint8_t>(name.size()));
+    buf->insert(buf->end(), name.begin(), name.end());
+  }
+
+  static size_t fixed_width(column::Type type) {
+    switch (type) {
+    case column::UINT16: return 2;
+    case column::UINT64: return 8;
+    case column::DOUBLE: return 8;
+    case column::ADDR:   return 16;
+    default:             return 0;
+    }
+  }
+
+  typedef std::vector<std::pair<std::string, column::Type> > ColumnList;
+
+  static const ColumnList flow_log_columns = {
+    {"c_addr", column::ADDR},   {"c_name", column::DICT},
+    {"c_pkt", column::UINT64},  {"c_port", column::UINT16},
+    {"c_size", column::UINT64}, {"hash", column::UINT64},
+    {"init_ts", column::UINT64}, {"last_ts", column::UINT64},
+    {"proto", column::DICT},    {"s_addr", column::ADDR},
+    {"s_name", column::DICT},   {"s_pkt", column::UINT64},
+    {"s_port", column::UINT16}, {"s_size", column::UINT64},
+  };
+
+  static const ColumnList dns_tx_columns = {
+    {"client", column::ADDR}, {"latency", column::DOUBLE},
+    {"q_name", column::DICT}, {"server", column::ADDR},
+    {"status", column::DICT},
+  };
+
+  static const ColumnList dns_log_columns = {
+    {"client", column::ADDR}, {"data", column::DICT},
+    {"name", column::DICT},   {"server", column::ADDR},
+    {"type", column::DICT},
+  };
+
+  // ------------------------------------------------------------
+  // class ColumnOutput::Column
+  //
+  ColumnOutput::Column::Column(const std::string &key, column::Type type) :
+    key_(key), type_(type), rows_(0) {
+    this->clear();
+  }
+
+  void ColumnOutput::Column::put_fixed(uint64_t v, size_t len) {
+    put_le(&this->data_, v, len);
+    this->rows_++;
+  }
+
+  bool ColumnOutput::Column::append(msgpack::Reader *rd) {
+    const char *s;
+    size_t len;
+    uint64_t u;
+    double d;
+
+    switch (this->type_) {
+    case column::UINT16:
+    case column::UINT64:
+      if (rd->read_uint(&u)) {
+        this->put_fixed(u, fixed_width(this->type_));
+        return true;
+      }
+      if (!rd->read_str(&s, &len)) {
+        return false;
+      }
+      // Hash of flow is hex text.
+      this->str_.assign(s, len);
+      this->put_fixed(strtoull(this->str_.c_str(), NULL, 16),
+                      fixed_width(this->type_));
+      return true;
+
+    case column::DOUBLE:
+      if (rd->read_uint(&u)) {
+        d = static_cast<double>(u);
+      } else if (!rd->read_double(&d)) {
+        return false;
+      }
+      memcpy(&u, &d, sizeof(u));
+      this->put_fixed(u, 8);
+      return true;
+
+    case column::ADDR: {
+      if (!rd->read_str(&s, &len)) {
+        return false;
+      }
+      this->str_.assign(s, len);
+      uint8_t addr[16];
+      memset(addr, 0, sizeof(addr));
+      if (inet_pton(AF_INET, this->str_.c_str(), addr + 12) == 1) {
+        addr[10] = addr[11] = 0xff;
+      } else if (inet_pton(AF_INET6, this->str_.c_str(), addr) != 1) {
+        memset(addr, 0, sizeof(addr));
+      }
+      this->data_.insert(this->data_.end(), addr, addr + sizeof(addr));
+      this->rows_++;
+      return true;
+    }
+
+    case column::DICT: {
+      if (!rd->read_str(&s, &len)) {
+        return false;
+      }
+      this->str_.assign(s, len < 0xffff ? len : 0xffff);
+      auto it = this->dict_.find(this->str_);
+      if (it == this->dict_.end()) {
+        it = this->dict_.insert(std::make_pair(
+            this->str_, static_cast<uint32_t>(this->entries_.size()))).first;
+        this->entries_.push_back(&it->first);
+      }
+      this->put_fixed(it->second, 4);
+      return true;
+    }
+    }
+    return false;
+  }
+
+  void ColumnOutput::Column::append_uint(uint64_t v) {
+    this->put_fixed(v, fixed_width(this->type_));
+  }
+
+  void ColumnOutput::Column::append_null() {
+    if (this->type_ == column::DICT) {
+      this->put_fixed(0, 4);  // Empty string
+    } else {
+      const size_t len = fixed_width(this->type_);
+      this->data_.insert(this->data_.end(), len, 0);
+      this->rows_++;
+    }
+  }
+
+  void ColumnOutput::Column::encode(std::vector<uint8_t> *buf) const {
+    if (this->type_ == column::DICT) {
+      put_le(buf, this->entries_.size(), 4);
+      for (size_t i = 0; i < this->entries_.size(); i++) {
+        const std::string &s = *this->entries_[i];
+        put_le(buf, s.size(), 2);
+        buf->insert(buf->end(), s.begin(), s.end());
+      }
+    }
+    buf->insert(buf->end(), this->data_.begin(), this->data_.end());
+  }
+
+  void ColumnOutput::Column::clear() {
+    this->rows_ = 0;
+    this->data_.clear();
+    this->dict_.clear();
+    this->entries_.clear();
+    if (this->type_ == column::DICT) {
+      auto it = this->dict_.insert(std::make_pair(std::string(), 0)).first;
+      this->entries_.push_back(&it->first);
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class ColumnOutput::Table
+  //
+  ColumnOutput::Table::Table(const std::string &name, const ColumnList &cols)
+    : tag_(std::string(RecordSchema::TAG_PREFIX) + name), name_(name),
+      rows_(0), first_at_(0) {
+    this->columns_.push_back(new Column("ts", column::UINT64));
+    for (size_t i = 0; i < cols.size(); i++) {
+      this->columns_.push_back(new Column(cols[i].first, cols[i].second));
+    }
+  }
+
+  ColumnOutput::Table::~Table() {
+    for (size_t i = 0; i < this->columns_.size(); i++) {
+      delete this->columns_[i];
+    }
+  }
+
+  bool ColumnOutput::Table::append(msgpack::Reader *rd, uint64_t ts,
+                                   time_t now) {
+    size_t n;
+    if (!rd->read_map(&n)) {
+      return false;
+    }
+    if (this->rows_ == 0) {
+      this->first_at_ = now;
+    }
+    this->columns_[0]->append_uint(ts);
+
+    // Keys of records and columns are both sorted.
+    size_t col = 1;
+    bool ok = true;
+    for (size_t i = 0; ok && i < n; i++) {
+      const char *key;
+      size_t key_len;
+      if (!rd->read_str(&key, &key_len)) {
+        ok = false;
+        break;
+      }
+      while (col < this->columns_.size() &&
+             this->columns_[col]->key().compare(0, std::string::npos,
+                                                key, key_len) < 0) {
+        this->columns_[col++]->append_null();
+      }
+      if (col < this->columns_.size() &&
+          this->columns_[col]->key().compare(0, std::string::npos,
+                                             key, key_len) == 0) {
+        ok = this->columns_[col++]->append(rd);
+      } else {
+        ok = rd->skip();
+      }
+    }
+
+    this->rows_++;
+    for (size_t i = 0; i < this->columns_.size(); i++) {
+      if (this->columns_[i]->rows() < this->rows_) {
+        this->columns_[i]->append_null();
+      }
+    }
+    return ok;
+  }
+
+  void ColumnOutput::Table::encode(std::vector<uint8_t> *buf) {
+    std::vector<uint8_t> raw;
+    std::vector<std::vector<uint8_t> > data(this->columns_.size());
+    std::vector<uint8_t> dir;
+
+    for (size_t i = 0; i < this->columns_.size(); i++) {
+      const Column *c = this->columns_[i];
+      raw.clear();
+      c->encode(&raw);
+
+      uLongf len = compressBound(raw.size());
+      data[i].resize(len);
+      uint8_t codec = column::DEFLATE;
+      if (compress2(&data[i][0], &len, &raw[0], raw.size(), Z_BEST_SPEED) !=
+          Z_OK || len >= raw.size()) {
+        codec = column::RAW;
+        data[i] = raw;
+      } else {
+        data[i].resize(len);
+      }
+
+      put_name(&dir, c->key());
+      dir.push_back(static_cast<uint8_t>(c->type()));
+      dir.push_back(codec);
+      put_le(&dir, raw.size(), 4);
+      put_le(&dir, data[i].size(), 4);
+    }
+
+    std::vector<uint8_t> body;
+    body.push_back(column::VERSION);
+    put_name(&body, this->name_);
+    put_le(&body, this->rows_, 4);
+    put_le(&body, this->columns_.size(), 2);
+    body.insert(body.end(), dir.begin(), dir.end());
+    for (size_t i = 0; i < data.size(); i++) {
+      body.insert(body.end(), data[i].begin(), data[i].end());
+    }
+
+    buf->insert(buf->end(), column::MAGIC, column::MAGIC + 4);
+    put_le(buf, body.size(), 4);
+    buf->insert(buf->end(), body.begin(), body.end());
+
+    this->rows_ = 0;
+    for (size_t i = 0; i < this->columns_.size(); i++) {
+      this->columns_[i]->clear();
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class ColumnOutput
+  //
+  const size_t ColumnOutput::BLOCK_ROWS;
+  const time_t ColumnOutput::FLUSH_SEC;
+
+  ColumnOutput::ColumnOutput(const std::string &path, size_t block_rows)
+    throw(Exception) : fd_(-1), block_rows_(block_rows) {
+    if (block_rows == 0) {
+      throw Exception("Rows of column block must be 1 or more");
+    }
+    this->fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (this->fd_ < 0) {
+      throw Exception(path + ": " + strerror(errno));
+    }
+    this->tables_.push_back(new Table("flow.log", flow_log_columns));
+    this->tables_.push_back(new Table("dns.tx", dns_tx_columns));
+    this->tables_.push_back(new Table("dns.log", dns_log_columns));
+  }
+
+  ColumnOutput::~ColumnOutput() {
+    this->flush();
+    for (size_t i = 0; i < this->tables_.size(); i++) {
+      delete this->tables_[i];
+    }
+    ::close(this->fd_);
+  }
+
+  void ColumnOutput::flush(Table *table) {
+    this->buf_.clear();
+    table->encode(&this->buf_);
+    write_all(this->fd_, &this->buf_[0], this->buf_.size(), false);
+  }
+
+  void ColumnOutput::flush() {
+    for (size_t i = 0; i < this->tables_.size(); i++) {
+      if (this->tables_[i]->rows() > 0) {
+        this->flush(this->tables_[i]);
+      }
+    }
+  }
+
+  void ColumnOutput::write(const uint8_t *data, size_t len, size_t) {
+    const time_t now = ::time(NULL);
+    msgpack::Reader rd(data, len);
+    while (!rd.empty()) {
+      size_t n;
+      const char *tag;
+      size_t tag_len;
+      uint64_t ts;
+      if (!rd.read_array(&n) || n != 3 || !rd.read_str(&tag, &tag_len) ||
+          !rd.read_uint(&ts)) {
+        return;
+      }
+
+      Table *table = NULL;
+      for (size_t i = 0; i < this->tables_.size(); i++) {
+        const std::string &t = this->tables_[i]->tag();
+        if (t.size() == tag_len && memcmp(t.data(), tag, tag_len) == 0) {
+          table = this->tables_[i];
+          break;
+        }
+      }
+      if (table == NULL) {
+        if (!rd.skip()) {
+          return;
+        }
+        continue;
+      }
+
+      if (!table->append(&rd, ts, now)) {
+        return;
+      }
+      if (table->rows() >= this->block_rows_) {
+        this->flush(table);
+      }
+    }
+
+    for (size_t i = 0; i < this->tables_.size(); i++) {
+      Table *table = this->tables_[i];
+      if (table->rows() > 0 && table->first_at() + FLUSH_SEC <= now) {
+        this->flush(table);
+      }
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class ColumnReader
+  //
+  static bool read_at(int fd, off_t offset, void *buf, size_t len) {
+    uint8_t *p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+      const ssize_t rc = ::pread(fd, p, len, offset);
+      if (rc < 0 && errno == EINTR) {
+        continue;
+      }
+      if (rc <= 0) {
+        return false;
+      }
+      p += rc;
+      len -= rc;
+      offset += rc;
+    }
+    return true;
+  }
+
+  ColumnReader::ColumnReader(const std::string &path) throw(Exception) :
+    fd_(-1), next_(0), rows_(0) {
+    this->fd_ = ::open(path.c_str(), O_RDONLY);
+    if (this->fd_ < 0) {
+      throw Exception(path + ": " + strerror(errno));
+    }
+  }
+
+  ColumnReader::~ColumnReader() {
+    ::close(this->fd_);
+  }
+
+  bool ColumnReader::next() throw(Exception) {
+    uint8_t head[8];
+    if (!read_at(this->fd_, this->next_, head, sizeof(head))) {
+      return false;
+    }
+    if (memcmp(head, column::MAGIC, 4) != 0) {
+      throw Exception("Invalid column block");
+    }
+    const off_t start = this->next_ + sizeof(head);
+    const size_t body_len = get_le(head + 4, 4);
+
+    // Header and directory are loaded on demand, and data of columns is
+    // read by read().
+    std::vector<uint8_t> body;
+    size_t pos = 0;
+    auto need = [&](size_t len) {
+      if (pos + len > body_len) {
+        throw Exception("Broken column block");
+      }
+      const size_t loaded = body.size();
+      if (pos + len > loaded) {
+        body.resize(std::min(body_len, std::max(pos + len, loaded + 256)));
+        if (!read_at(this->fd_, start + loaded, &body[loaded],
+                     body.size() - loaded)) {
+          throw Exception("Truncated column block");
+        }
+      }
+    };
+    auto get_name = [&]() {
+      need(1);
+      const size_t len = body[pos++];
+      need(len);
+      std::string name(reinterpret_cast<char*>(&body[pos]), len);
+      pos += len;
+      return name;
+    };
+
+    need(1);
+    if (body[pos++] != column::VERSION) {
+      throw Exception("Unsupported column block version");
+    }
+    this->table_ = get_name();
+    need(6);
+    this->rows_ = get_le(&body[pos], 4);
+    const size_t ncol = get_le(&body[pos + 4], 2);
+    pos += 6;
+
+    this->columns_.clear();
+    for (size_t i = 0; i < ncol; i++) {
+      ColumnInfo info;
+      info.name = get_name();
+      need(10);
+      info.type = static_cast<column::Type>(body[pos]);
+      info.codec = static_cast<column::Codec>(body[pos + 1]);
+      info.raw_len = get_le(&body[pos + 2], 4);
+      info.len = get_le(&body[pos + 6], 4);
+      pos += 10;
+      this->columns_.push_back(info);
+    }
+    for (size_t i = 0; i < ncol; i++) {
+      this->columns_[i].offset = start + pos;
+      pos += this->columns_[i].len;
+    }
+    if (pos > body_len) {
+      throw Exception("Broken column block");
+    }
+
+    this->next_ = start + body_len;
+    return true;
+  }
+
+  bool ColumnReader::read(const std::string &name, std::vector<uint8_t> *raw)
+    throw(Exception) {
+    const ColumnInfo *info = NULL;
+    for (size_t i = 0; i < this->columns_.size(); i++) {
+      if (this->columns_[i].name == name) {
+        info = &this->columns_[i];
+        break;
+      }
+    }
+    if (info == NULL) {
+      return false;
+    }
+
+    std::vector<uint8_t> data(info->len);
+    if (info->len > 0 &&
+        !read_at(this->fd_, info->offset, &data[0], info->len)) {
+      throw Exception("Truncated column data");
+    }
+    if (info->codec == column::RAW) {
+      raw->swap(data);
+      return true;
+    }
+
+    raw->resize(info->raw_len);
+    uLongf len = info->raw_len;
+    if (info->codec != column::DEFLATE ||
+        uncompress(&(*raw)[0], &len, &data[0], data.size()) != Z_OK ||
+        len != info->raw_len) {
+      throw Exception("Broken column data: " + name);
+    }
+    return true;
+  }
+
+  uint64_t ColumnReader::get_uint(const std::vector<uint8_t> &raw,
+                                  column::Type type, size_t idx) {
+    const size_t len = fixed_width(type);
+    return get_le(&raw[idx * len], len);
+  }
+
+  double ColumnReader::get_double(const std::vector<uint8_t> &raw,
+                                  size_t idx) {
+    const uint64_t bits = get_le(&raw[idx * 8], 8);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+  }
+
+  bool ColumnReader::get_dict(const std::vector<uint8_t> &raw, size_t rows,
+                              std::vector<std::string> *values) {
+    if (raw.size() < 4) {
+      return false;
+    }
+    const size_t n = get_le(&raw[0], 4);
+    size_t pos = 4;
+    std::vector<std::string> entries;
+    for (size_t i = 0; i < n; i++) {
+      if (pos + 2 > raw.size()) {
+        return false;
+      }
+      const size_t len = get_le(&raw[pos], 2);
+      pos += 2;
+      if (pos + len > raw.size()) {
+        return false;
+      }
+      entries.push_back(std::string(
+          reinterpret_cast<const char*>(&raw[pos]), len));
+      pos += len;
+    }
+    if (pos + rows * 4 != raw.size()) {
+      return false;
+    }
+
+    values->clear();
+    for (size_t i = 0; i < rows; i++) {
+      const size_t idx = get_le(&raw[pos + i * 4], 4);
+      if (idx >= n) {
+        return false;
+      }
+      values->push_back(entries[idx]);
+    }
+    return true;
+  }
+}
@@ -0,0 +1,182 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_COLUMN_H__
+#define SRC_COLUMN_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./devourer.hpp"
+#include "./output.hpp"
+
+namespace devourer {
+  namespace msgpack {
+    class Reader;
+  }
+
+  // Column file is a sequence of blocks, so it can be appended. A block
+  // has rows of one tag. All integers are little endian.
+  //
+  //   "DVCB", u32 bytes after this field, u8 version, u8 len + table name,
+  //   u32 rows, u16 columns,
+  //   columns x (u8 len + name, u8 type, u8 codec, u32 raw_len, u32 len),
+  //   columns x data of len bytes
+  //
+  // Data of a column is deflated if it gets smaller. Missing values are 0,
+  // :: or an empty string.
+  namespace column {
+    enum Type {
+      UINT16 = 1,
+      UINT64 = 2,
+      DOUBLE = 3,
+      ADDR   = 4,  // 16 bytes, IPv4 is mapped to ::ffff:0:0/96
+      DICT   = 5,  // u32 n, n x (u16 len + str), rows x u32 index
+    };
+    enum Codec {
+      RAW     = 0,
+      DEFLATE = 1,
+    };
+    static const uint8_t VERSION = 1;
+    static const char MAGIC[] = "DVCB";
+  }
+
+  // ColumnOutput writes flow.log, dns.tx and dns.log records into column
+  // blocks, and ignores other tags. A block is written when it has
+  // block_rows or its first row is older than FLUSH_SEC at write().
+  class ColumnOutput : public Output {
+  private:
+    class Column {
+    private:
+      std::string key_;
+      column::Type type_;
+      size_t rows_;
+      std::vector<uint8_t> data_;
+      std::unordered_map<std::string, uint32_t> dict_;
+      std::vector<const std::string*> entries_;
+      std::string str_;
+
+      void put_fixed(uint64_t v, size_t len);
+
+    public:
+      Column(const std::string &key, column::Type type);
+      const std::string& key() const { return this->key_; }
+      column::Type type() const { return this->type_; }
+      size_t rows() const { return this->rows_; }
+      bool append(msgpack::Reader *rd);
+      void append_uint(uint64_t v);
+      void append_null();
+      void encode(std::vector<uint8_t> *buf) const;
+      void clear();
+    };
+
+    class Table {
+    private:
+      std::string tag_;
+      std::string name_;
+      std::vector<Column*> columns_;  // ts first, then keys in sorted order
+      size_t rows_;
+      time_t first_at_;
+
+    public:
+      Table(const std::string &name,
+            const std::vector<std::pair<std::string, column::Type> > &cols);
+      ~Table();
+      const std::string& tag() const { return this->tag_; }
+      size_t rows() const { return this->rows_; }
+      time_t first_at() const { return this->first_at_; }
+      bool append(msgpack::Reader *rd, uint64_t ts, time_t now);
+      void encode(std::vector<uint8_t> *buf);
+    };
+
+    int fd_;
+    size_t block_rows_;
+    std::vector<Table*> tables_;
+    std::vector<uint8_t> buf_;
+    std::vector<uint8_t> raw_;
+
+    void flush(Table *table);
+
+  public:
+    static const size_t BLOCK_ROWS = 65536;
+    static const time_t FLUSH_SEC = 60;
+    explicit ColumnOutput(const std::string &path,
+                          size_t block_rows = BLOCK_ROWS) throw(Exception);
+    ~ColumnOutput();
+    void write(const uint8_t *data, size_t len, size_t count);
+    // Write all blocks with any rows.
+    void flush();
+  };
+
+  // ColumnReader walks blocks of a column file and reads only requested
+  // columns of them.
+  class ColumnReader {
+  public:
+    struct ColumnInfo {
+      std::string name;
+      column::Type type;
+      column::Codec codec;
+      uint32_t raw_len;
+      uint32_t len;
+      off_t offset;
+    };
+
+  private:
+    int fd_;
+    off_t next_;
+    std::string table_;
+    uint32_t rows_;
+    std::vector<ColumnInfo> columns_;
+
+  public:
+    explicit ColumnReader(const std::string &path) throw(Exception);
+    ~ColumnReader();
+    // Move to the next block. Return false at the end of file.
+    bool next() throw(Exception);
+    const std::string& table() const { return this->table_; }
+    uint32_t rows() const { return this->rows_; }
+    const std::vector<ColumnInfo>& columns() const { return this->columns_; }
+    // Read raw data of the column. Return false if the block has not it.
+    bool read(const std::string &name, std::vector<uint8_t> *raw)
+      throw(Exception);
+
+    static uint64_t get_uint(const std::vector<uint8_t> &raw,
+                             column::Type type, size_t idx);
+    static double get_double(const std::vector<uint8_t> &raw, size_t idx);
+    static const uint8_t *get_addr(const std::vector<uint8_t> &raw,
+                                   size_t idx) {
+      return &raw[idx * 16];
+    }
+    // Decode DICT data into a string for each row.
+    static bool get_dict(const std::vector<uint8_t> &raw, size_t rows,
+                         std::vector<std::string> *values);
+  };
+}
+
+#endif  // SRC_COLUMN_H__
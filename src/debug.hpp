@@ -33,6 +33,10 @@
 #include <stdio.h>
 #include <libgen.h>
 
+// debug() prints only if DEVOURER_DEBUG is defined (Debug build type).
+// Otherwise arguments are type checked but never evaluated, so it can be
+// left in hot paths. Use TRACE() of trace.hpp for tracing in production.
+#ifdef DEVOURER_DEBUG
 #define debug(X, ...)                                         \
   do {                                                        \
     struct tm td;                                             \
@@ -51,6 +55,14 @@
       fprintf (out, "\n");                                    \
       fflush (out);                                           \
     }                                                         \
-  } while (0);
+  } while (0)
+#else
+#define debug(X, ...)                                         \
+  do {                                                        \
+    if (false && (X)) {                                       \
+      printf (__VA_ARGS__);                                   \
+    }                                                         \
+  } while (0)
+#endif
 
 #endif  // SRC_DEBUG_H__
@@ -25,43 +25,47 @@
  */
 
 #include <iostream>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <unistd.h>
 #include <fluent.hpp>
-#include "../external/swarm/src/swarm.hpp"
 #include "./devourer.hpp"
 #include "./debug.hpp"
 
 #include "./module.hpp"
 #include "./modules/dns.hpp"
 #include "./modules/flow.hpp"
-#include "./modules/local.hpp"
+#include "./shard.hpp"
+#include "./capture.hpp"
+#include "./output.hpp"
+#include "./column.hpp"
+#include "./ipfix.hpp"
+#include "./tuple-hash.hpp"
 
 Devourer::Devourer(const std::string &target, devourer::Source src) :
-  target_(target), src_(src), netcap_(NULL), fluent_(new fluent::Logger())
+  target_(target), src_(src), fluent_(new fluent::Logger()),
+  output_(new devourer::MultiOutput()), workers_(1),
+  ring_size_(devourer::AfPacketCapture::DEFAULT_RING_SIZE),
+  block_size_(devourer::AfPacketCapture::DEFAULT_BLOCK_SIZE),
+  active_timeout_(1800), query_timeout_(120 * 1000),
+  flow_timeout_(600 * 1000)
 {
-  this->netdec_ = new swarm::NetDec();
-  
-  devourer::ModDns *mod_dns = new devourer::ModDns();
-  devourer::ModFlow *mod_flow = new devourer::ModFlow(mod_dns);
-  devourer::ModLocal *mod_local = new devourer::ModLocal();
-  this->install_module(mod_dns);
-  this->install_module(mod_flow);
-  this->install_module(mod_local);
-
-  this->fluent_->set_tag_prefix("devourer");
+  this->reset_shards(1, false);
 }
 
 Devourer::~Devourer(){
-  delete this->netcap_;
-  for(size_t i = 0; i < this->modules_.size(); i++) {
-    delete this->modules_[i];
+  for(size_t i = 0; i < this->shards_.size(); i++) {
+    delete this->shards_[i];
   }
+  delete this->output_;
 }
 
 void Devourer::setdst_fluentd(const std::string &dst) {
   size_t pos;
   if(std::string::npos == (pos = dst.find(":", 0))) {
     // Specify only host, use default port
-    this->fluent_->new_forward(dst);
+    this->output_->add(new devourer::ForwardOutput(dst, 24224));
   } else {
     std::string host = dst.substr(0, pos);
     std::string str_port = dst.substr(pos + 1);
@@ -72,81 +76,289 @@ void Devourer::setdst_fluentd(const std::string &dst) {
       throw devourer::Exception("Invalid port number: " + str_port);
     }
     
-    this->fluent_->new_forward(host, port);
+    this->output_->add(new devourer::ForwardOutput(host, port));
   }
 }
 
-void Devourer::setdst_filestream(const std::string &fpath) {
+void Devourer::setdst_filestream(const std::string &fpath)
+  throw(devourer::Exception) {
   if (fpath == "-") {
-    this->fluent_->new_dumpfile(1); // stdout
+    this->output_->add(new devourer::FileOutput(1)); // stdout
   } else {
-    this->fluent_->new_dumpfile(fpath);
+    this->output_->add(new devourer::FileOutput(fpath));
   }
 }
 
+void Devourer::setdst_columnfile(const std::string &fpath)
+  throw(devourer::Exception) {
+  this->output_->add(new devourer::ColumnOutput(fpath));
+}
+
+void Devourer::setdst_ipfix(const std::string &dst)
+  throw(devourer::Exception) {
+  std::string host = dst;
+  int port = devourer::IpfixOutput::DEFAULT_PORT;
+  size_t pos = dst.rfind(":");
+  // IPv6 address without port is given as it is.
+  if (pos != std::string::npos && dst.find(":") == pos) {
+    host = dst.substr(0, pos);
+    std::string str_port = dst.substr(pos + 1);
+    char *e;
+    port = strtoul(str_port.c_str(), &e, 0);
+    if (*e != '\0') {
+      throw devourer::Exception("Invalid port number: " + str_port);
+    }
+  }
+  this->output_->add(new devourer::IpfixOutput(host, port));
+}
+
+// Records are converted to fluent::Message only for the message queue.
 fluent::MsgQueue* Devourer::setdst_msgqueue() {
+  this->output_->add(new devourer::LoggerOutput(this->fluent_));
   return this->fluent_->new_msgqueue();
 }
 
 
-void Devourer::install_module(devourer::Module *module)
+void Devourer::set_workers(size_t n) throw(devourer::Exception) {
+  if (n == 0) {
+    throw devourer::Exception("Number of workers must be 1 or more");
+  }
+  this->workers_ = n;
+}
+
+void Devourer::set_ring_size(size_t ring_size, size_t block_size)
+  throw(devourer::Exception) {
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  if (block_size == 0 || block_size % page_size != 0) {
+    throw devourer::Exception("Block size must be a multiple of page size");
+  }
+  if (ring_size < block_size || ring_size % block_size != 0) {
+    throw devourer::Exception("Ring size must be a multiple of block size");
+  }
+  this->ring_size_ = ring_size;
+  this->block_size_ = block_size;
+}
+
+void Devourer::set_active_timeout(time_t timeout) {
+  this->active_timeout_ = timeout;
+  for (size_t i = 0; i < this->shards_.size(); i++) {
+    this->shards_[i]->mod_flow()->set_active_timeout(timeout);
+  }
+}
+
+void Devourer::set_query_timeout(uint64_t timeout)
   throw(devourer::Exception) {
-  assert(this->netdec_);
-  
-  const std::vector<std::string> &ev_set = module->recv_event();
-  for(size_t i = 0; i < ev_set.size(); i++) {
-    swarm::ev_id eid = this->netdec_->lookup_event_id(ev_set[i]);
-    swarm::hdlr_id hid = this->netdec_->set_handler(eid, module);
-    if (hid == swarm::HDLR_NULL) {
-      throw devourer::Exception(this->netdec_->errmsg());
+  devourer::check_timeout("Query", timeout, devourer::ModDns::MAX_TIMEOUT);
+  this->query_timeout_ = timeout;
+  for (size_t i = 0; i < this->shards_.size(); i++) {
+    this->shards_[i]->mod_dns()->set_query_timeout(timeout);
+  }
+}
+
+void Devourer::set_flow_timeout(uint64_t timeout)
+  throw(devourer::Exception) {
+  devourer::check_timeout("Flow", timeout, devourer::ModFlow::MAX_TIMEOUT);
+  this->flow_timeout_ = timeout;
+  for (size_t i = 0; i < this->shards_.size(); i++) {
+    this->shards_[i]->mod_flow()->set_flow_timeout(timeout);
+  }
+}
+
+// Shards for input() write records to the output directly. Shards of worker
+// threads queue records, and the output thread writes them.
+void Devourer::reset_shards(size_t n, bool queued) {
+  for(size_t i = 0; i < this->shards_.size(); i++) {
+    delete this->shards_[i];
+  }
+  this->shards_.clear();
+  for (size_t i = 0; i < n; i++) {
+    devourer::Shard *shard =
+      new devourer::Shard(queued ? NULL : this->output_, i);
+    shard->mod_flow()->set_active_timeout(this->active_timeout_);
+    shard->mod_flow()->set_flow_timeout(this->flow_timeout_);
+    shard->mod_dns()->set_query_timeout(this->query_timeout_);
+    this->shards_.push_back(shard);
+  }
+}
+
+bool Devourer::input (const uint8_t *data, const size_t len,
+                      const struct timeval &tv, const size_t cap_len) {
+  return this->shards_[0]->input(data, len, tv, cap_len);
+}
+
+size_t Devourer::input_batch(const devourer::Packet *pkts, size_t count) {
+  return this->shards_[0]->input_batch(pkts, count);
+}
+
+
+// Move batches of records from shards to the output until done is set and
+// all queues are drained.
+static void merge_output(devourer::Output *dst,
+                         const std::vector<devourer::Shard*> &shards,
+                         const std::atomic<bool> *done) {
+  for (;;) {
+    const bool finished = done->load();
+    size_t count = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+      count += shards[i]->emitter()->drain(dst);
+    }
+    if (count == 0) {
+      if (finished) {
+        break;
+      }
+      usleep(1000);
     }
-    module->bind_event_id(ev_set[i], eid);
+  }
+}
+
+// Each worker reads own AF_PACKET socket in a fanout group, so that the
+// kernel distributes packets by flow and no thread dispatches them.
+void Devourer::start_afpacket() throw(devourer::Exception) {
+  const size_t n = this->workers_;
+  const uint16_t group = getpid() & 0xffff;
+  std::vector<devourer::Capture*> caps;
+
+  try {
+    for (size_t i = 0; i < n; i++) {
+      caps.push_back(new devourer::AfPacketCapture(this->target_, group,
+                                                   this->ring_size_,
+                                                   this->block_size_));
+    }
+  } catch (...) {
+    for (size_t i = 0; i < caps.size(); i++) {
+      delete caps[i];
+    }
+    throw;
+  }
+
+  this->reset_shards(n, true);
+  for (size_t i = 0; i < n; i++) {
+    this->shards_[i]->start(caps[i], &this->shards_);
   }
 
-  this->modules_.push_back(module);
+  std::atomic<bool> done(false);
+  std::thread merger(merge_output, this->output_, std::cref(this->shards_),
+                     &done);
+
+  for (size_t i = 0; i < n; i++) {
+    this->shards_[i]->join();
+  }
+  done.store(true);
+  if (merger.joinable()) {
+    merger.join();
+  }
+  for (size_t i = 0; i < n; i++) {
+    delete caps[i];
+  }
 }
 
 void Devourer::start() throw(devourer::Exception) {
-  // Create a new Swarm instance.
-  switch(this->src_) {
-  case devourer::PCAP_FILE:
-    this->netcap_ = new swarm::CapPcapFile(this->target_);
-    break;
-  case devourer::INTERFACE:
-    this->netcap_ = new swarm::CapPcapDev(this->target_);
-    break;
-  }
-
-  if (!this->netcap_) {
-    throw devourer::Exception("Fatal error");
-  }
-  if (!this->netcap_->ready()) {
-    throw devourer::Exception(this->netcap_->errmsg());
-  }
-
-  this->netcap_->bind_netdec(this->netdec_);
-
-  // Setup modules
-  for(size_t i = 0; i < this->modules_.size(); i++) {
-    devourer::Module *module = this->modules_[i];
-    int interval = module->task_interval();
-    if (interval > 0) {
-      swarm::task_id tid =
-        this->netcap_->set_periodic_task(module,
-                                         static_cast<float>(interval));
-      if (tid == swarm::TASK_NULL) {
-        throw devourer::Exception(this->netcap_->errmsg());
+  if (this->src_ == devourer::AFPACKET) {
+    this->start_afpacket();
+    return;
+  }
+
+  std::unique_ptr<devourer::Capture> cap;
+  if (this->src_ == devourer::PCAP_FILE) {
+    const std::vector<std::string> files =
+      devourer::expand_files(this->target_);
+    if (files.size() == 1) {
+      cap.reset(new devourer::MmapPcapCapture(files[0]));
+    } else {
+      cap.reset(new devourer::MergeCapture(files));
+    }
+  } else {
+    cap.reset(new devourer::PcapCapture(this->target_, this->src_));
+  }
+  // Packets are not copied if the capture keeps all files mapped until
+  // workers finish, MergeCapture of many files unmaps some of them.
+  const bool zero_copy = cap->zero_copy();
+  const size_t n = this->workers_;
+  // Packets of file wait for workers, but capture on interface never waits
+  // and packets are dropped if the worker is behind.
+  const bool block = (this->src_ == devourer::PCAP_FILE);
+
+  // Workers queue messages, and the output thread emits them, so that
+  // decoding does not wait for the output.
+  this->reset_shards(n, true);
+  for (size_t i = 0; i < n; i++) {
+    this->shards_[i]->start();
+  }
+
+  std::atomic<bool> done(false);
+  std::thread merger(merge_output, this->output_, std::cref(this->shards_),
+                     &done);
+
+  // DNS answers are sent to all shards to resolve names of flows in each
+  // shard, but only the owner emits messages of them.
+  std::string errmsg;
+  try {
+    devourer::Packet pkt;
+    devourer::Capture::Status st;
+    while (devourer::Capture::END != (st = cap->next(&pkt))) {
+      if (st == devourer::Capture::TIMEOUT) {
+        continue;
+      }
+
+      bool dns_answer = false;
+      const size_t owner = (n == 1) ? 0 :
+        devourer::tuple_hash(pkt.data, pkt.len, &dns_answer) % n;
+      for (size_t i = 0; i < n; i++) {
+        if (i != owner && !dns_answer) {
+          continue;
+        }
+        if (zero_copy) {
+          this->shards_[i]->push_ref(pkt.data, pkt.len, pkt.tv, pkt.cap_len,
+                                     i != owner, block);
+        } else {
+          this->shards_[i]->push(pkt.data, pkt.len, pkt.tv, pkt.cap_len,
+                                 i != owner, block);
+        }
       }
     }
-    module->set_fluent(this->fluent_);
-  }    
-  
-  this->netcap_->start();
-  return;
+  } catch (const devourer::Exception &e) {
+    errmsg = e.what();
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    this->shards_[i]->close();
+  }
+  for (size_t i = 0; i < n; i++) {
+    this->shards_[i]->join();
+  }
+  done.store(true);
+  if (merger.joinable()) {
+    merger.join();
+  }
+
+  if (!errmsg.empty()) {
+    throw devourer::Exception(errmsg);
+  }
 }
 
+uint64_t Devourer::dropped_packets() const {
+  uint64_t count = 0;
+  for (size_t i = 0; i < this->shards_.size(); i++) {
+    count += this->shards_[i]->ring().dropped();
+    count += this->shards_[i]->kernel_drops();
+  }
+  return count;
+}
 
-bool Devourer::input (const uint8_t *data, const size_t len,
-                      const struct timeval &tv, const size_t cap_len) {
-  return this->netdec_->input(data, len, tv, cap_len);
+uint64_t Devourer::shed_messages() const {
+  uint64_t count = 0;
+  for (size_t i = 0; i < this->shards_.size(); i++) {
+    const devourer::Emitter *emitter = this->shards_[i]->emitter();
+    count += emitter->shed(devourer::Emitter::LOW) +
+      emitter->shed(devourer::Emitter::NORMAL) + emitter->dropped();
+  }
+  return count;
+}
+
+uint64_t Devourer::stalled_packets() const {
+  uint64_t count = 0;
+  for (size_t i = 0; i < this->shards_.size(); i++) {
+    count += this->shards_[i]->ring().stalled();
+  }
+  return count;
 }
@@ -31,6 +31,8 @@
 #include <vector>
 #include <deque>
 #include <string>
+#include <stdint.h>
+#include <sys/time.h>
 
 namespace devourer {
   static const std::string VERSION("0.1.0");
@@ -45,15 +47,22 @@ namespace devourer {
   };
 
   class Module;
+  class Shard;
+  class MultiOutput;
   enum Source {
     PCAP_FILE = 1,
     INTERFACE = 2,
+    AFPACKET = 3,   // Linux AF_PACKET (TPACKET_V3) with fanout to workers
   };
-}
 
-namespace swarm {
-  class NetCap;
-  class NetDec;
+  // Packet descriptor. len is captured length and cap_len is original
+  // length on the wire, same as arguments of Devourer::input().
+  struct Packet {
+    const uint8_t *data;
+    size_t len;
+    size_t cap_len;
+    struct timeval tv;
+  };
 }
 
 namespace fluent {
@@ -65,29 +74,70 @@ class Devourer {
 private:
   std::string target_;
   devourer::Source src_;
-  swarm::NetDec *netdec_;
-  swarm::NetCap *netcap_;
   fluent::Logger *fluent_;
-  std::vector<devourer::Module*> modules_;
+  devourer::MultiOutput *output_;
+  size_t workers_;
+  size_t ring_size_;
+  size_t block_size_;
+  time_t active_timeout_;
+  uint64_t query_timeout_;
+  uint64_t flow_timeout_;
+  std::vector<devourer::Shard*> shards_;
 
-  void install_module(devourer::Module *module) throw(devourer::Exception);
+  void start_afpacket() throw(devourer::Exception);
+  void reset_shards(size_t n, bool queued);
 
 public:
   Devourer(const std::string &target, devourer::Source src);
   ~Devourer();
+  // Records are kept up to ForwardOutput::BACKLOG_SIZE while fluentd is
+  // down, and dropped over it.
   void setdst_fluentd(const std::string &dst);
-  void setdst_filestream(const std::string &fpath);
+  void setdst_filestream(const std::string &fpath) throw(devourer::Exception);
+  // flow.log, dns.tx and dns.log in compressed column blocks.
+  void setdst_columnfile(const std::string &fpath) throw(devourer::Exception);
+  // flow.log as IPFIX to a collector, e.g. 127.0.0.1:4739.
+  void setdst_ipfix(const std::string &dst) throw(devourer::Exception);
   fluent::MsgQueue* setdst_msgqueue();
 
   void set_filter(const std::string &filter) throw(devourer::Exception);
   void enable_verbose();
+  // Distribute packets to n worker threads by hash of 5-tuple. Each worker
+  // has own flow and DNS tables, and their messages are merged to output.
+  void set_workers(size_t n) throw(devourer::Exception);
+  // Size of packet ring and its block in bytes for AFPACKET source.
+  void set_ring_size(size_t ring_size, size_t block_size)
+    throw(devourer::Exception);
+
+  // Report flows living longer than timeout seconds periodically as
+  // flow.active. 0 disables it.
+  void set_active_timeout(time_t timeout);
+  // Timeout of DNS queries without response, and of idle flows in msec.
+  // They must be 1 msec to 1 hour, Exception is thrown for others.
+  void set_query_timeout(uint64_t timeout) throw(devourer::Exception);
+  void set_flow_timeout(uint64_t timeout) throw(devourer::Exception);
 
   // to capture
   void start() throw(devourer::Exception);
+  // Packets dropped because a worker was behind (interface only) or by
+  // kernel (AFPACKET), and packets that waited for a worker (file only).
+  uint64_t dropped_packets() const;
+  uint64_t stalled_packets() const;
+  // Messages given up because the output was behind or stalled.
+  uint64_t shed_messages() const;
+  // Shards of workers, or the one used by input(). Counters of modules can
+  // be read by any thread.
+  const std::vector<devourer::Shard*>& shards() const {
+    return this->shards_;
+  }
 
   // only decoding
   bool input (const uint8_t *data, const size_t len,
               const struct timeval &tv, const size_t cap_len = 0);
+  // Decode packets in order, return number of decoded packets. Time of
+  // modules advances once for the batch, and flow table entries of next
+  // packets are prefetched.
+  size_t input_batch(const devourer::Packet *pkts, size_t count);
 };
 
 
@@ -0,0 +1,236 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+
+#include "./emitter.hpp"
+#include "./output.hpp"
+#include "./trace.hpp"
+
+namespace devourer {
+  const size_t Emitter::PRIORITY_NUM;
+  const size_t Emitter::DEFAULT_BATCH_SIZE;
+  const size_t Emitter::DEFAULT_QUEUE_SIZE;
+  const uint64_t Emitter::FLUSH_MSEC;
+  const uint64_t Emitter::MAX_WAIT_MSEC;
+  const size_t Emitter::MAX_TAGS;
+
+  Emitter::Emitter(Output *output) :
+    output_(output), queued_(false), batch_size_(1), max_wait_(0),
+    batch_(NULL), batch_start_(0), now_(0), out_(1), free_(1),
+    emitted_(0), batches_(0), dropped_(0), tag_num_(0)
+  {
+    for (size_t i = 0; i < PRIORITY_NUM; i++) {
+      this->shed_[i] = 0;
+    }
+  }
+
+  Emitter::Emitter(size_t batch_size, size_t queue_size, uint64_t max_wait) :
+    output_(NULL), queued_(true), batch_size_(batch_size),
+    max_wait_(max_wait), batch_(NULL), batch_start_(0), now_(0),
+    out_(queue_size), free_(queue_size + 2),
+    emitted_(0), batches_(0), dropped_(0), tag_num_(0)
+  {
+    for (size_t i = 0; i < PRIORITY_NUM; i++) {
+      this->shed_[i] = 0;
+    }
+
+    // Records of ended flows are results of a long observation, and
+    // per-packet events such as DNS answers can be given up first.
+    this->set_priority("dns.log", LOW);
+    this->set_priority("flow.new", LOW);
+    this->set_priority("flow.update", LOW);
+    this->set_priority("arp.request", LOW);
+    this->set_priority("flow.log", HIGH);
+    this->set_priority("flow.active", HIGH);
+    this->set_priority("capture.stats", HIGH);
+    this->set_priority("stats", HIGH);
+  }
+
+  Emitter::~Emitter() {
+    // Records not taken by drain() are discarded.
+    delete this->batch_;
+    Batch *batch;
+    while (this->out_.pop(&batch)) {
+      delete batch;
+    }
+    while (this->free_.pop(&batch)) {
+      delete batch;
+    }
+  }
+
+  void Emitter::set_priority(const std::string &tag, Priority prio) {
+    for (size_t i = 0; i < this->priority_.size(); i++) {
+      if (this->priority_[i].first == tag) {
+        this->priority_[i].second = prio;
+        return;
+      }
+    }
+    this->priority_.push_back(std::make_pair(tag, prio));
+  }
+
+  Emitter::Priority Emitter::priority(const std::string &tag) const {
+    for (size_t i = 0; i < this->priority_.size(); i++) {
+      if (this->priority_[i].first == tag) {
+        return this->priority_[i].second;
+      }
+    }
+    return NORMAL;
+  }
+
+  bool Emitter::shedding(Priority prio) const {
+    const size_t depth = this->out_.size(), cap = this->out_.capacity();
+    switch (prio) {
+    case LOW:    return (depth * 2 >= cap);
+    case NORMAL: return (depth * 8 >= cap * 7);
+    case HIGH:   return false;
+    }
+    return false;
+  }
+
+  void Emitter::count_tag(const RecordSchema &schema) {
+    const size_t n = this->tag_num_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < n; i++) {
+      if (this->tags_[i].schema == &schema) {
+        this->tags_[i].count.add();
+        return;
+      }
+    }
+    if (n < MAX_TAGS) {
+      this->tags_[n].schema = &schema;
+      this->tags_[n].count.add();
+      this->tag_num_.store(n + 1, std::memory_order_release);
+    }
+  }
+
+  RecordWriter *Emitter::begin(const RecordSchema &schema, time_t ts) {
+    if (!this->queued_) {
+      this->count_tag(schema);
+      this->direct_buf_.clear();
+      this->writer_.begin(&this->direct_buf_, schema, ts);
+      return &this->writer_;
+    }
+
+    // Tag is looked up only when the queue is filling up.
+    if (this->shedding(LOW)) {
+      const Priority prio = this->priority(schema.tag());
+      if (this->shedding(prio)) {
+        this->shed_[prio].store(this->shed_[prio].load() + 1,
+                                std::memory_order_relaxed);
+        TRACE(RECORD_SHED, prio, 0);
+        return NULL;
+      }
+    }
+    this->count_tag(schema);
+
+    if (this->batch_ == NULL) {
+      if (!this->free_.pop(&this->batch_)) {
+        this->batch_ = new Batch();
+      }
+      this->batch_->buf.clear();
+      this->batch_->count = 0;
+      this->batch_start_ = this->now_;
+    }
+    this->writer_.begin(&this->batch_->buf, schema, ts);
+    return &this->writer_;
+  }
+
+  void Emitter::commit() {
+    this->writer_.end();
+    if (!this->queued_) {
+      this->output_->write(this->direct_buf_.data(), this->direct_buf_.size(),
+                           1);
+      this->emitted_.store(this->emitted_.load() + 1,
+                           std::memory_order_relaxed);
+      return;
+    }
+
+    this->batch_->count++;
+    if (this->batch_->count >= this->batch_size_) {
+      this->flush();
+    }
+  }
+
+  void Emitter::tick(const struct timespec &ts) {
+    this->now_ = static_cast<uint64_t>(ts.tv_sec) * 1000 +
+      ts.tv_nsec / 1000000;
+    if (this->batch_ && this->now_ - this->batch_start_ >= FLUSH_MSEC) {
+      this->flush();
+    }
+  }
+
+  void Emitter::flush() {
+    if (this->batch_ == NULL) {
+      return;
+    }
+
+    const size_t count = this->batch_->count;
+    // Low and normal priority records are shed before the queue is full,
+    // and others wait for the output thread here. An output blocked on
+    // the network must not stop the worker, so the batch is dropped and
+    // reused after max_wait_.
+    if (!this->out_.push(this->batch_)) {
+      struct timespec start, now;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (;;) {
+        usleep(100);
+        if (this->out_.push(this->batch_)) {
+          break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const uint64_t waited = (now.tv_sec - start.tv_sec) * 1000 +
+          (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (waited >= this->max_wait_) {
+          this->dropped_.store(this->dropped_.load() + count,
+                               std::memory_order_relaxed);
+          TRACE(RECORD_DROP, count, 0);
+          this->batch_->buf.clear();
+          this->batch_->count = 0;
+          this->batch_start_ = this->now_;
+          return;
+        }
+      }
+    }
+    this->batch_ = NULL;
+    this->batches_.store(this->batches_.load() + 1,
+                         std::memory_order_relaxed);
+    this->emitted_.store(this->emitted_.load() + count,
+                         std::memory_order_relaxed);
+  }
+
+  size_t Emitter::drain(Output *dst) {
+    size_t count = 0;
+    Batch *batch;
+    while (this->out_.pop(&batch)) {
+      dst->write(batch->buf.data(), batch->buf.size(), batch->count);
+      count += batch->count;
+      if (!this->free_.push(batch)) {
+        delete batch;
+      }
+    }
+    return count;
+  }
+}
@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_EMITTER_H__
+#define SRC_EMITTER_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./spsc-ring.hpp"
+#include "./record.hpp"
+#include "./stats.hpp"
+
+namespace devourer {
+  class Output;
+
+  // Emitter is between modules and outputs. Modules write a record by
+  // begin() and commit(). In direct mode the record is written to the output
+  // immediately. In queued mode records are collected to batches, and one
+  // output thread takes them by drain(). When the queue of batches fills
+  // up, records of low priority tags are shed before they are built, and
+  // high priority ones wait for the output up to max_wait msec. A batch is
+  // dropped after that, then a stalled output does not stop capture.
+  class Emitter {
+  public:
+    enum Priority {
+      LOW = 0,
+      NORMAL = 1,
+      HIGH = 2,
+    };
+    static const size_t PRIORITY_NUM = 3;
+    static const size_t DEFAULT_BATCH_SIZE = 256;   // Records
+    static const size_t DEFAULT_QUEUE_SIZE = 64;    // Batches
+    static const uint64_t FLUSH_MSEC = 100;
+    static const uint64_t MAX_WAIT_MSEC = 1000;
+    static const size_t MAX_TAGS = 32;
+
+  private:
+    struct Batch {
+      std::vector<uint8_t> buf;
+      size_t count;
+    };
+
+    Output *output_;
+    const bool queued_;
+    const size_t batch_size_;
+    const uint64_t max_wait_;  // msec
+    Batch *batch_;
+    std::vector<uint8_t> direct_buf_;
+    RecordWriter writer_;
+    uint64_t batch_start_;  // msec
+    uint64_t now_;          // msec at the last tick()
+    SpscRing<Batch*> out_;  // To output thread
+    SpscRing<Batch*> free_;  // Used batches back to producer
+    std::vector<std::pair<std::string, Priority> > priority_;
+
+    std::atomic<uint64_t> emitted_;
+    std::atomic<uint64_t> batches_;
+    std::atomic<uint64_t> shed_[PRIORITY_NUM];
+    std::atomic<uint64_t> dropped_;
+
+    // Records begun for each schema. Slots are appended by the producer
+    // and published by tag_num_, and schemas must outlive the emitter.
+    struct TagCount {
+      const RecordSchema *schema;
+      Counter count;
+    };
+    TagCount tags_[MAX_TAGS];
+    std::atomic<size_t> tag_num_;
+    void count_tag(const RecordSchema &schema);
+
+    Priority priority(const std::string &tag) const;
+    bool shedding(Priority prio) const;
+
+  public:
+    // Direct mode.
+    explicit Emitter(Output *output);
+    // Queued mode.
+    Emitter(size_t batch_size, size_t queue_size,
+            uint64_t max_wait = MAX_WAIT_MSEC);
+    ~Emitter();
+    bool queued() const { return this->queued_; }
+    void set_priority(const std::string &tag, Priority prio);
+
+    // Producer side. begin() returns NULL if the tag is shed, otherwise
+    // fields are written by the writer and commit() must follow.
+    RecordWriter *begin(const RecordSchema &schema, time_t ts);
+    void commit();
+    void tick(const struct timespec &ts);
+    void flush();
+
+    // Consumer side, return number of written records.
+    size_t drain(Output *dst);
+
+    // Metrics can be read by any thread.
+    size_t queue_depth() const { return this->out_.size(); }
+    size_t queue_size() const { return this->out_.capacity(); }
+    uint64_t emitted() const { return this->emitted_.load(); }
+    uint64_t batches() const { return this->batches_.load(); }
+    uint64_t shed(Priority prio) const { return this->shed_[prio].load(); }
+    // Records in batches dropped after waiting max_wait for the output.
+    uint64_t dropped() const { return this->dropped_.load(); }
+    size_t tags() const {
+      return this->tag_num_.load(std::memory_order_acquire);
+    }
+    const std::string& tag(size_t idx) const {
+      return this->tags_[idx].schema->tag();
+    }
+    uint64_t tag_emitted(size_t idx) const {
+      return this->tags_[idx].count.get();
+    }
+  };
+}
+
+#endif  // SRC_EMITTER_H__
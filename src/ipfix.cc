@@ -0,0 +1,409 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <algorithm>
+
+#include "./ipfix.hpp"
+#include "./record.hpp"
+
+namespace devourer {
+  static const uint16_t TEMPLATE_SET_ID = 2;
+  static const uint16_t VARIABLE_LENGTH = 65535;
+  static const uint16_t ENTERPRISE_BIT = 0x8000;
+  static const uint32_t REVERSE_PEN = 29305;  // RFC 5103
+  static const size_t HEADER_LEN = 16;
+  static const size_t MAX_NAME = 254;  // Fits in 1 byte length
+
+  struct FieldSpec {
+    uint16_t id;
+    uint16_t len;
+    uint32_t pen;  // 0: IANA, 1: enterprise of the exporter
+  };
+
+  // Addresses are replaced for IPv6. Keep order with put_flow().
+  static const FieldSpec flow_fields[] = {
+    {8,   4, 0},                // sourceIPv4Address
+    {12,  4, 0},                // destinationIPv4Address
+    {7,   2, 0},                // sourceTransportPort
+    {11,  2, 0},                // destinationTransportPort
+    {4,   1, 0},                // protocolIdentifier
+    {150, 4, 0},                // flowStartSeconds
+    {151, 4, 0},                // flowEndSeconds
+    {2,   8, 0},                // packetDeltaCount
+    {1,   8, 0},                // octetDeltaCount
+    {2,   8, REVERSE_PEN},      // reversePacketDeltaCount
+    {1,   8, REVERSE_PEN},      // reverseOctetDeltaCount
+    {1,   8, 1},                // flowHash
+    {2,   VARIABLE_LENGTH, 1},  // sourceName
+    {3,   VARIABLE_LENGTH, 1},  // destinationName
+  };
+  static const size_t FIELD_COUNT = sizeof(flow_fields) / sizeof(FieldSpec);
+
+  static void put_be(std::vector<uint8_t> *buf, uint64_t v, size_t len) {
+    for (size_t i = len; i > 0; i--) {
+      buf->push_back(static_cast<uint8_t>(v >> ((i - 1) * 8)));
+    }
+  }
+
+  static void set_be16(std::vector<uint8_t> *buf, size_t pos, uint16_t v) {
+    (*buf)[pos] = static_cast<uint8_t>(v >> 8);
+    (*buf)[pos + 1] = static_cast<uint8_t>(v);
+  }
+
+  static uint8_t proto_number(const char *name, size_t len) {
+    static const struct {
+      const char *name;
+      uint8_t number;
+    } protos[] = {
+      {"icmp", 1}, {"tcp", 6}, {"udp", 17}, {"icmp6", 58},
+      {"ipv6-icmp", 58}, {"sctp", 132},
+    };
+    for (size_t i = 0; i < sizeof(protos) / sizeof(protos[0]); i++) {
+      if (strlen(protos[i].name) == len &&
+          strncasecmp(protos[i].name, name, len) == 0) {
+        return protos[i].number;
+      }
+    }
+    return 255;  // Reserved
+  }
+
+  static bool key_is(const char *key, size_t len, const char *name) {
+    return strlen(name) == len && memcmp(key, name, len) == 0;
+  }
+
+  // Return length of the address, or 0 if it is invalid.
+  static size_t parse_addr(const char *str, size_t len, uint8_t *addr) {
+    char buf[INET6_ADDRSTRLEN];
+    if (len >= sizeof(buf)) {
+      return 0;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    if (inet_pton(AF_INET, buf, addr) == 1) {
+      return 4;
+    } else if (inet_pton(AF_INET6, buf, addr) == 1) {
+      return 16;
+    }
+    return 0;
+  }
+
+  // ------------------------------------------------------------
+  // class IpfixOutput
+  //
+  const uint16_t IpfixOutput::VERSION;
+  const uint16_t IpfixOutput::TEMPLATE_V4;
+  const uint16_t IpfixOutput::TEMPLATE_V6;
+  const int IpfixOutput::DEFAULT_PORT;
+  const uint32_t IpfixOutput::DEFAULT_ENTERPRISE;
+  const size_t IpfixOutput::MAX_MESSAGE;
+  const time_t IpfixOutput::TEMPLATE_SEC;
+
+  IpfixOutput::IpfixOutput(const std::string &host, int port,
+                           uint32_t enterprise, uint32_t domain)
+    throw(Exception) :
+    tag_(std::string(RecordSchema::TAG_PREFIX) + "flow.log"),
+    fd_(-1), own_fd_(true), datagram_(true), enterprise_(enterprise),
+    domain_(domain), seq_(0), template_at_(0), exported_(0), dropped_(0),
+    msg_records_(0), set_pos_(0), set_id_(0) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    const int rc = ::getaddrinfo(host.c_str(), port_str, &hints, &res);
+    if (rc != 0) {
+      throw Exception(host + ": " + gai_strerror(rc));
+    }
+
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+      int sock = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (sock < 0) {
+        continue;
+      }
+      if (::connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+        this->fd_ = sock;
+        break;
+      }
+      ::close(sock);
+    }
+    ::freeaddrinfo(res);
+    if (this->fd_ < 0) {
+      throw Exception("Unable to open IPFIX socket to " + host);
+    }
+  }
+
+  IpfixOutput::IpfixOutput(int fd, uint32_t enterprise, uint32_t domain) :
+    tag_(std::string(RecordSchema::TAG_PREFIX) + "flow.log"),
+    fd_(fd), own_fd_(false), datagram_(false), enterprise_(enterprise),
+    domain_(domain), seq_(0), template_at_(0), exported_(0), dropped_(0),
+    msg_records_(0), set_pos_(0), set_id_(0) {
+  }
+
+  IpfixOutput::~IpfixOutput() {
+    if (this->own_fd_) {
+      ::close(this->fd_);
+    }
+  }
+
+  bool IpfixOutput::read_flow(msgpack::Reader *rd, Flow *flow) {
+    size_t n;
+    if (!rd->read_map(&n)) {
+      return false;
+    }
+    memset(flow, 0, sizeof(*flow));
+    flow->c_name = flow->s_name = "";
+    size_t c_len = 0, s_len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      const char *key, *s;
+      size_t key_len, len;
+      uint64_t u;
+      if (!rd->read_str(&key, &key_len)) {
+        return false;
+      }
+      if (rd->next_type() == msgpack::Reader::STR) {
+        if (!rd->read_str(&s, &len)) {
+          return false;
+        }
+        if (key_is(key, key_len, "c_addr")) {
+          c_len = parse_addr(s, len, flow->c_addr);
+        } else if (key_is(key, key_len, "s_addr")) {
+          s_len = parse_addr(s, len, flow->s_addr);
+        } else if (key_is(key, key_len, "c_name")) {
+          flow->c_name = s;
+          flow->c_name_len = std::min(len, MAX_NAME);
+        } else if (key_is(key, key_len, "s_name")) {
+          flow->s_name = s;
+          flow->s_name_len = std::min(len, MAX_NAME);
+        } else if (key_is(key, key_len, "hash")) {
+          char buf[17];
+          const size_t hlen = std::min(len, sizeof(buf) - 1);
+          memcpy(buf, s, hlen);
+          buf[hlen] = '\0';
+          flow->hash = strtoull(buf, NULL, 16);
+        } else if (key_is(key, key_len, "proto")) {
+          flow->proto = proto_number(s, len);
+        }
+      } else if (rd->read_uint(&u)) {
+        if (key_is(key, key_len, "c_pkt")) {
+          flow->c_pkt = u;
+        } else if (key_is(key, key_len, "c_size")) {
+          flow->c_size = u;
+        } else if (key_is(key, key_len, "c_port")) {
+          flow->c_port = static_cast<uint16_t>(u);
+        } else if (key_is(key, key_len, "s_pkt")) {
+          flow->s_pkt = u;
+        } else if (key_is(key, key_len, "s_size")) {
+          flow->s_size = u;
+        } else if (key_is(key, key_len, "s_port")) {
+          flow->s_port = static_cast<uint16_t>(u);
+        } else if (key_is(key, key_len, "init_ts")) {
+          flow->init_ts = static_cast<uint32_t>(u);
+        } else if (key_is(key, key_len, "last_ts")) {
+          flow->last_ts = static_cast<uint32_t>(u);
+        }
+      } else if (!rd->skip()) {
+        return false;
+      }
+    }
+
+    // Flows of both families are not mixed, or they are not exported.
+    flow->addr_len = (c_len == s_len) ? c_len : 0;
+    return true;
+  }
+
+  void IpfixOutput::begin_message(time_t now) {
+    this->msg_.clear();
+    put_be(&this->msg_, VERSION, 2);
+    put_be(&this->msg_, 0, 2);  // Length is set by send_message()
+    put_be(&this->msg_, static_cast<uint32_t>(now), 4);
+    put_be(&this->msg_, this->seq_, 4);
+    put_be(&this->msg_, this->domain_, 4);
+    this->msg_records_ = 0;
+
+    if (now >= this->template_at_) {
+      this->put_templates();
+      this->template_at_ = now + TEMPLATE_SEC;
+    }
+  }
+
+  void IpfixOutput::put_templates() {
+    this->begin_set(TEMPLATE_SET_ID);
+    const uint16_t ids[] = {TEMPLATE_V4, TEMPLATE_V6};
+    for (size_t t = 0; t < 2; t++) {
+      put_be(&this->msg_, ids[t], 2);
+      put_be(&this->msg_, FIELD_COUNT, 2);
+      for (size_t i = 0; i < FIELD_COUNT; i++) {
+        const FieldSpec &f = flow_fields[i];
+        uint16_t id = f.id, len = f.len;
+        if (ids[t] == TEMPLATE_V6 && f.pen == 0 && len == 4 &&
+            (id == 8 || id == 12)) {
+          // sourceIPv6Address and destinationIPv6Address
+          id = (id == 8) ? 27 : 28;
+          len = 16;
+        }
+        if (f.pen == 0) {
+          put_be(&this->msg_, id, 2);
+          put_be(&this->msg_, len, 2);
+        } else {
+          put_be(&this->msg_, id | ENTERPRISE_BIT, 2);
+          put_be(&this->msg_, len, 2);
+          put_be(&this->msg_, f.pen == 1 ? this->enterprise_ : f.pen, 4);
+        }
+      }
+    }
+    this->end_set();
+  }
+
+  void IpfixOutput::begin_set(uint16_t id) {
+    if (this->set_id_ == id) {
+      return;
+    }
+    this->end_set();
+    this->set_pos_ = this->msg_.size();
+    this->set_id_ = id;
+    put_be(&this->msg_, id, 2);
+    put_be(&this->msg_, 0, 2);
+  }
+
+  void IpfixOutput::end_set() {
+    if (this->set_id_ != 0) {
+      set_be16(&this->msg_, this->set_pos_ + 2,
+               static_cast<uint16_t>(this->msg_.size() - this->set_pos_));
+      this->set_id_ = 0;
+    }
+  }
+
+  void IpfixOutput::put_flow(const Flow &flow, time_t now) {
+    const uint16_t tmpl = (flow.addr_len == 4) ? TEMPLATE_V4 : TEMPLATE_V6;
+    const size_t len = flow.addr_len * 2 + 2 + 2 + 1 + 4 + 4 + 8 * 5 +
+      1 + flow.c_name_len + 1 + flow.s_name_len;
+
+    if (!this->msg_.empty()) {
+      const size_t set_len = (this->set_id_ == tmpl) ? 0 : 4;
+      if (this->msg_.size() + set_len + len > MAX_MESSAGE) {
+        this->send_message();
+      }
+    }
+    if (this->msg_.empty()) {
+      this->begin_message(now);
+    }
+
+    this->begin_set(tmpl);
+    this->msg_.insert(this->msg_.end(), flow.c_addr,
+                      flow.c_addr + flow.addr_len);
+    this->msg_.insert(this->msg_.end(), flow.s_addr,
+                      flow.s_addr + flow.addr_len);
+    put_be(&this->msg_, flow.c_port, 2);
+    put_be(&this->msg_, flow.s_port, 2);
+    this->msg_.push_back(flow.proto);
+    put_be(&this->msg_, flow.init_ts, 4);
+    put_be(&this->msg_, flow.last_ts, 4);
+    put_be(&this->msg_, flow.c_pkt, 8);
+    put_be(&this->msg_, flow.c_size, 8);
+    put_be(&this->msg_, flow.s_pkt, 8);
+    put_be(&this->msg_, flow.s_size, 8);
+    put_be(&this->msg_, flow.hash, 8);
+    this->msg_.push_back(static_cast<uint8_t>(flow.c_name_len));
+    this->msg_.insert(this->msg_.end(), flow.c_name,
+                      flow.c_name + flow.c_name_len);
+    this->msg_.push_back(static_cast<uint8_t>(flow.s_name_len));
+    this->msg_.insert(this->msg_.end(), flow.s_name,
+                      flow.s_name + flow.s_name_len);
+    this->msg_records_++;
+  }
+
+  void IpfixOutput::send_message() {
+    this->end_set();
+    set_be16(&this->msg_, 2, static_cast<uint16_t>(this->msg_.size()));
+
+    bool ok;
+    if (this->datagram_) {
+      ssize_t rc;
+      do {
+        rc = ::send(this->fd_, &this->msg_[0], this->msg_.size(), 0);
+      } while (rc < 0 && errno == EINTR);
+      ok = (rc == static_cast<ssize_t>(this->msg_.size()));
+    } else {
+      ok = write_all(this->fd_, &this->msg_[0], this->msg_.size(), false);
+    }
+
+    // Sequence number counts records sent, even if the message is lost.
+    this->seq_ += this->msg_records_;
+    if (ok) {
+      this->exported_ += this->msg_records_;
+    } else {
+      this->dropped_ += this->msg_records_;
+    }
+    this->msg_.clear();
+    this->msg_records_ = 0;
+  }
+
+  void IpfixOutput::write(const uint8_t *data, size_t len, size_t) {
+    const time_t now = ::time(NULL);
+    msgpack::Reader rd(data, len);
+    Flow flow;
+
+    while (!rd.empty()) {
+      size_t n;
+      const char *t;
+      size_t t_len;
+      uint64_t ts;
+      if (!rd.read_array(&n) || n != 3 || !rd.read_str(&t, &t_len) ||
+          !rd.read_uint(&ts)) {
+        break;
+      }
+      if (t_len != this->tag_.size() ||
+          memcmp(t, this->tag_.data(), t_len) != 0) {
+        if (!rd.skip()) {
+          break;
+        }
+        continue;
+      }
+      if (!this->read_flow(&rd, &flow)) {
+        break;
+      }
+      if (flow.addr_len > 0) {
+        this->put_flow(flow, now);
+      }
+    }
+
+    if (this->msg_records_ > 0) {
+      this->send_message();
+    }
+  }
+}
@@ -0,0 +1,114 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_IPFIX_H__
+#define SRC_IPFIX_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "./devourer.hpp"
+#include "./output.hpp"
+
+namespace devourer {
+  namespace msgpack {
+    class Reader;
+  }
+
+  // IpfixOutput exports flow.log records as IPFIX (RFC 7011) data records
+  // and ignores other tags. A flow is a biflow of RFC 5103, the client is
+  // source and counters of the server are reverse information elements.
+  // Resolved names and flow hash are enterprise specific elements.
+  //
+  // Records of a write() are packed into messages up to MAX_MESSAGE bytes,
+  // and templates are sent with the first message and every TEMPLATE_SEC.
+  class IpfixOutput : public Output {
+  private:
+    struct Flow {
+      uint8_t c_addr[16];
+      uint8_t s_addr[16];
+      size_t addr_len;
+      uint16_t c_port, s_port;
+      uint64_t c_pkt, c_size, s_pkt, s_size;
+      uint64_t hash;
+      uint32_t init_ts, last_ts;
+      uint8_t proto;
+      const char *c_name, *s_name;
+      size_t c_name_len, s_name_len;
+    };
+
+    std::string tag_;
+    int fd_;
+    bool own_fd_;
+    bool datagram_;
+    uint32_t enterprise_;
+    uint32_t domain_;
+    uint32_t seq_;
+    time_t template_at_;
+    uint64_t exported_;
+    uint64_t dropped_;
+    std::vector<uint8_t> msg_;
+    size_t msg_records_;
+    size_t set_pos_;
+    uint16_t set_id_;
+
+    bool read_flow(msgpack::Reader *rd, Flow *flow);
+    void begin_message(time_t now);
+    void put_templates();
+    void begin_set(uint16_t id);
+    void end_set();
+    void put_flow(const Flow &flow, time_t now);
+    void send_message();
+
+  public:
+    static const uint16_t VERSION = 10;
+    static const uint16_t TEMPLATE_V4 = 256;
+    static const uint16_t TEMPLATE_V6 = 257;
+    static const int DEFAULT_PORT = 4739;
+    // Enterprise number for documentation by RFC 5612, a site can give its
+    // own one.
+    static const uint32_t DEFAULT_ENTERPRISE = 32473;
+    static const size_t MAX_MESSAGE = 1400;
+    static const time_t TEMPLATE_SEC = 60;
+
+    // Send messages by UDP to collector.
+    IpfixOutput(const std::string &host, int port,
+                uint32_t enterprise = DEFAULT_ENTERPRISE, uint32_t domain = 0)
+      throw(Exception);
+    // Write messages to a file descriptor, that is the IPFIX file format of
+    // RFC 5655.
+    explicit IpfixOutput(int fd, uint32_t enterprise = DEFAULT_ENTERPRISE,
+                         uint32_t domain = 0);
+    ~IpfixOutput();
+    void write(const uint8_t *data, size_t len, size_t count);
+    uint64_t exported() const { return this->exported_; }
+    uint64_t dropped() const { return this->dropped_; }
+  };
+}
+
+#endif  // SRC_IPFIX_H__
@@ -25,145 +25,32 @@
  */
 
 #include "./lru-hash.hpp"
-#include "./debug.hpp"
 
 namespace devourer {
   LRUHash::LRUHash(size_t timeslot_size, size_t bucket_size) : 
-    timeslot_(timeslot_size), bucket_(bucket_size), curr_tick_(0) {
-    if (this->bucket_.size() == 0) {
-      this->bucket_.resize(LRUHash::DEFAULT_BUCKET_SIZE);
-    }
+    table_(timeslot_size, bucket_size) {
   }
   LRUHash::~LRUHash() {
   }
   bool LRUHash::put(size_t tick, LRUHash::Node *node) {
-    if (tick >= this->timeslot_.size()) {
-      return false;
-    }
-
-    size_t ptr = node->hash() % this->bucket_.size();
-    this->bucket_[ptr].attach(node);
-
-    size_t tp = (tick + this->curr_tick_) % this->timeslot_.size();
-    this->timeslot_[tp].push(node);
-
-    return true;
+    return this->table_.put(tick, node);
   }
   LRUHash::Node *LRUHash::get(uint64_t hv, const void *key, size_t len) {
-    size_t ptr = hv % this->bucket_.size();
-    return this->bucket_[ptr].search(hv, key, len);
+    return this->table_.get(Key(hv, key, len));
   }
-  
   void LRUHash::prog(size_t tick) {
-    for (size_t i = 0; i < tick; i++) {
-      size_t tp = (this->curr_tick_ + i) % this->timeslot_.size();
-
-      Node *node;
-      while (NULL != (node = this->timeslot_[tp].pop())) {
-        node->detach();
-        this->exp_node_.push_link(node);
-      }
-    }
-    this->curr_tick_ += tick;
-    return;
+    this->table_.prog(tick);
   }
   LRUHash::Node *LRUHash::pop() {
-    return this->exp_node_.pop_link();
+    return this->table_.pop();
   }
   void LRUHash::purge() {
-    for (size_t i = 0; i < this->timeslot_.size(); i++) {
-      for (Node *node; NULL != (node = this->timeslot_[i].pop()); ) {
-        node->detach();
-        this->exp_node_.push_link(node);
-      }
-    }
-  }
-
-  // class LRUHash::Timeslot
-  LRUHash::TimeSlot::TimeSlot() {
-  }
-  LRUHash::TimeSlot::~TimeSlot() {
-  }
-
-  void LRUHash::TimeSlot::push(LRUHash::Node *node) {
-    this->root_.push_link(node);
-  }
-
-  LRUHash::Node* LRUHash::TimeSlot::pop() {
-    return this->root_.pop_link();
-  }
-
-
-  // class LRUHash::Bucket
-  LRUHash::Bucket::Bucket() {
-  }
-  LRUHash::Bucket::~Bucket() {
-  }
-
-  void LRUHash::Bucket::attach(Node* node) {
-    this->root_.attach(node);
-  }
-
-  LRUHash::Node* LRUHash::Bucket::search(uint64_t hv, const void *key, 
-                                         size_t len) {
-    return this->root_.search(hv, key, len);
+    this->table_.purge();
   }
 
   // class LRUHash::Node
-  LRUHash::Node::Node() : next_(NULL), prev_(NULL), link_(NULL) {
+  LRUHash::Node::Node() {
   }
   LRUHash::Node::~Node() {  
   }
-
-  void LRUHash::Node::attach(Node *node) {  
-    Node *prev = this;
-    Node *next = this->next_;
-
-    node->prev_ = prev;
-    node->next_ = next;
-    prev->next_ = node;
-    if (next) {
-      next->prev_ = node;
-    }
-  }
-  void LRUHash::Node::detach() {
-    Node *next = this->next_;
-    Node *prev = this->prev_;
-    if (next) {
-      next->prev_ = prev;
-    }
-    if (prev) {
-      prev->next_ = next;
-    }
-    this->next_ = this->prev_ = NULL;
-  }
-  void LRUHash::Node::push_link(Node * node) {
-    Node * next = this->link_;
-    node->link_ = next;
-    this->link_ = node;
-  }
-  LRUHash::Node* LRUHash::Node::pop_link() {
-    Node *node = this->link_;
-    if (node) {
-      Node *next = node->link_;
-      this->link_ = next;
-    }
-    return node;
-  }  
-  LRUHash::Node* LRUHash::Node::pop_all() {
-    Node * all = this->link_;
-    this->link_ = NULL;
-    return all;  
-  }
-
-  LRUHash::Node* LRUHash::Node::search (uint64_t hv, const void *key,
-                                        size_t len) {
-    for (Node *node = this->next_; node != NULL; node = node->next_) {
-      if (node->hash() == hv && node->match(key, len)) {
-        return node;
-      }
-    }
-    return NULL;  
-  }
-
 }  // namespace swarm
@@ -27,64 +27,43 @@
 #ifndef SRC_LRU_HASH_H__
 #define SRC_LRU_HASH_H__
 
-#include <map>
-#include <vector>
-#include <deque>
-#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "./lru-table.hpp"
 
 namespace devourer {
+  // LRUHash is a compatibility wrapper of LRUTable for nodes that implement
+  // hash() and match() as virtual functions with a raw byte key. New code
+  // should use LRUTable with concrete node and key types.
   class LRUHash {
-    class Bucket;
     static const size_t DEFAULT_BUCKET_SIZE = 1031;
 
   public:
-    class Node {
+    class Key {
     private:
-      Node *next_, *prev_;  // double linked list for Bucket
-      Node *link_;          // single linked list for TimeSlot
+      uint64_t hv_;
+      const void *ptr_;
+      size_t len_;
+    public:
+      Key(uint64_t hv, const void *ptr, size_t len) :
+        hv_(hv), ptr_(ptr), len_(len) {}
+      uint64_t hash() const { return this->hv_; }
+      const void *ptr() const { return this->ptr_; }
+      size_t len() const { return this->len_; }
+    };
 
+    class Node : public LRUTableNode {
     public:
       Node();
       virtual ~Node();
       virtual uint64_t hash() = 0;
       virtual bool match(const void *key, size_t len) = 0;
-      void attach(Node *node);
-      void detach();
-      Node *pop_all();
-      void push_link(Node * prev);
-      Node *pop_link();
-      Node *search(uint64_t hv, const void *key, size_t len);
+      bool match(const Key &key) { return this->match(key.ptr(), key.len()); }
     };
 
-  private:    
-    class NodeRoot : public Node {
-    uint64_t hash() { return 0; }
-    bool match(const void *key, size_t len) { return false; }
-  };
-  class Bucket {
   private:
-    NodeRoot root_;
-  public:
-    Bucket();
-    ~Bucket();
-    void attach(Node *node);
-    Node* search(uint64_t hv, const void *key, size_t len);
-  };
-
-  class TimeSlot {
-  private:
-    NodeRoot root_;
-  public:
-    TimeSlot();
-    ~TimeSlot();
-    void push(Node *node);
-    Node* pop();
-  };
-
-  std::vector<TimeSlot> timeslot_;
-  std::vector<Bucket> bucket_;
-  size_t curr_tick_;
-  NodeRoot exp_node_;
+    LRUTable<Node, Key> table_;
 
   public:
   LRUHash(size_t timeslot_size, size_t bucket_size=DEFAULT_BUCKET_SIZE);
@@ -94,6 +73,9 @@ namespace devourer {
   void prog(size_t tick=1);  // progress tick
   Node *pop();  // Pop expired node.
   void purge(); // Expire all node, need to pop() after the function.
+  size_t size() const { return this->table_.size(); }
+  size_t capacity() const { return this->table_.capacity(); }
+  bool rehashing() const { return this->table_.rehashing(); }
   };
 }  // namespace swarm
 
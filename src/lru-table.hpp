@@ -0,0 +1,418 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_LRU_TABLE_H__
+#define SRC_LRU_TABLE_H__
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "./timing-wheel.hpp"
+
+namespace devourer {
+  // Base class of a node stored in LRUTable. It has only a timer link and
+  // no virtual function.
+  class LRUTableNode : public TimerNode {
+  };
+
+  // LRUTable is a hash table with expiry by TimingWheel. NodeT must inherit
+  // LRUTableNode and have "uint64_t hash()" and "bool match(const KeyT&)".
+  // KeyT must have "uint64_t hash()" that returns same value as hash() of
+  // the matched node. Both are resolved at compile time and get() returns
+  // NodeT directly.
+  //
+  // Index is an open addressing table. A slot has 1 byte control tag in
+  // ctrl_ and node pointer in slot_, and a lookup compares 16 tags of a group
+  // at once (SSE2 if available). Then only nodes with matched tag are
+  // dereferenced to call match().
+  //
+  // The table grows and shrinks by load factor. Slots of the previous table
+  // are moved a few groups at a time in put() and prog(), and get() looks up
+  // both tables while moving.
+  template <typename NodeT, typename KeyT>
+  class LRUTable {
+  private:
+    static const size_t GROUP_SIZE = 16;
+    static const size_t DEFAULT_CAPACITY = 1024;
+    static const size_t REHASH_STEP = 64;  // Slots moved per put()/prog()
+    // Control byte is 0x80 | 7 bit tag for a live slot. An empty slot is 0
+    // so that a large table can be allocated by calloc() without filling.
+    static const uint8_t CTRL_EMPTY   = 0x00;
+    static const uint8_t CTRL_DELETED = 0x01;
+    static const uint8_t CTRL_LIVE    = 0x80;
+
+    static uint64_t mix(uint64_t hv) {
+      // Some keys (e.g. IPv4 address) are used as hash value directly, then
+      // spread all bits before selecting group and tag.
+      hv ^= hv >> 33;
+      hv *= 0xff51afd7ed558ccdULL;
+      hv ^= hv >> 33;
+      hv *= 0xc4ceb9fe1a85ec53ULL;
+      hv ^= hv >> 33;
+      return hv;
+    }
+    static uint8_t tag(uint64_t mv) {
+      return static_cast<uint8_t>(CTRL_LIVE | (mv >> 57));
+    }
+    static uint32_t match_group(const uint8_t *ctrl, uint8_t tag) {
+#ifdef __SSE2__
+      __m128i grp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+      __m128i cmp = _mm_cmpeq_epi8(grp,
+                                   _mm_set1_epi8(static_cast<char>(tag)));
+      return static_cast<uint32_t>(_mm_movemask_epi8(cmp));
+#else
+      uint32_t bits = 0;
+      for (size_t i = 0; i < GROUP_SIZE; i++) {
+        if (ctrl[i] == tag) {
+          bits |= (1u << i);
+        }
+      }
+      return bits;
+#endif
+    }
+
+    class Table {
+    private:
+      uint8_t *ctrl_;
+      NodeT **slot_;
+      size_t capacity_;
+      size_t group_mask_;
+      size_t size_;
+      size_t used_;  // size_ + deleted slots
+      Table(const Table&);
+      Table& operator=(const Table&);
+
+      void clear_slot(size_t idx) {
+        // A group that has an empty slot has never been full, then no probe
+        // sequence passes over it and the slot can be empty again.
+        const size_t base = idx - (idx % GROUP_SIZE);
+        if (LRUTable::match_group(this->ctrl_ + base, CTRL_EMPTY)) {
+          this->ctrl_[idx] = CTRL_EMPTY;
+          this->used_--;
+        } else {
+          this->ctrl_[idx] = CTRL_DELETED;
+        }
+        this->slot_[idx] = NULL;
+        this->size_--;
+      }
+
+    public:
+      Table() : ctrl_(NULL), slot_(NULL), capacity_(0), group_mask_(0),
+                size_(0), used_(0) {}
+      ~Table() { this->release(); }
+
+      void init(size_t capacity) {
+        // Capacity is rounded up to power of 2 groups. Both arrays are zero
+        // filled (CTRL_EMPTY and NULL) by calloc(), and pages of a large
+        // table are not touched until slots are used.
+        size_t groups = 1;
+        while (groups * GROUP_SIZE < capacity) {
+          groups <<= 1;
+        }
+        this->release();
+        this->capacity_ = groups * GROUP_SIZE;
+        this->ctrl_ = static_cast<uint8_t*>(::calloc(this->capacity_, 1));
+        this->slot_ = static_cast<NodeT**>(::calloc(this->capacity_,
+                                                    sizeof(NodeT*)));
+        if (this->ctrl_ == NULL || this->slot_ == NULL) {
+          throw std::bad_alloc();
+        }
+        this->group_mask_ = groups - 1;
+      }
+      void release() {
+        ::free(this->ctrl_);
+        ::free(this->slot_);
+        this->ctrl_ = NULL;
+        this->slot_ = NULL;
+        this->capacity_ = 0;
+        this->group_mask_ = 0;
+        this->size_ = 0;
+        this->used_ = 0;
+      }
+      void swap(Table &table) {
+        std::swap(this->ctrl_, table.ctrl_);
+        std::swap(this->slot_, table.slot_);
+        std::swap(this->capacity_, table.capacity_);
+        std::swap(this->group_mask_, table.group_mask_);
+        std::swap(this->size_, table.size_);
+        std::swap(this->used_, table.used_);
+      }
+      bool full() const { return (this->used_ + 1) * 8 > this->capacity_ * 7; }
+      size_t size() const { return this->size_; }
+      size_t capacity() const { return this->capacity_; }
+
+      // Remove and return node in the slot if any.
+      NodeT *take(size_t idx) {
+        if ((this->ctrl_[idx] & CTRL_LIVE) == 0) {
+          return NULL;
+        }
+        NodeT *node = this->slot_[idx];
+        this->clear_slot(idx);
+        return node;
+      }
+
+      void insert(uint64_t mv, NodeT *node) {
+        size_t g = mv & this->group_mask_;
+        for (size_t i = 0; ; i++) {
+          const size_t base = g * GROUP_SIZE;
+          for (size_t n = 0; n < GROUP_SIZE; n++) {
+            uint8_t &ctrl = this->ctrl_[base + n];
+            if ((ctrl & CTRL_LIVE) == 0) {
+              // Empty or deleted slot.
+              if (ctrl == CTRL_EMPTY) {
+                this->used_++;
+              }
+              ctrl = LRUTable::tag(mv);
+              this->slot_[base + n] = node;
+              this->size_++;
+              return;
+            }
+          }
+          g = (g + i + 1) & this->group_mask_;
+        }
+      }
+
+      bool erase(uint64_t mv, NodeT *node) {
+        const uint8_t t = LRUTable::tag(mv);
+        size_t g = mv & this->group_mask_;
+
+        for (size_t i = 0; i <= this->group_mask_ && this->size_ > 0; i++) {
+          const size_t base = g * GROUP_SIZE;
+          const uint8_t *ctrl = this->ctrl_ + base;
+
+          for (uint32_t m = LRUTable::match_group(ctrl, t); m; m &= m - 1) {
+            const size_t idx = base + __builtin_ctz(m);
+            if (this->slot_[idx] == node) {
+              this->clear_slot(idx);
+              return true;
+            }
+          }
+
+          if (LRUTable::match_group(ctrl, CTRL_EMPTY)) {
+            break;
+          }
+          g = (g + i + 1) & this->group_mask_;
+        }
+
+        return false;
+      }
+
+      // Number of probed groups is added to probes.
+      NodeT *find(uint64_t mv, const KeyT &key, uint64_t *probes) const {
+        const uint8_t t = LRUTable::tag(mv);
+        size_t g = mv & this->group_mask_;
+
+        for (size_t i = 0; i <= this->group_mask_; i++) {
+          const size_t base = g * GROUP_SIZE;
+          const uint8_t *ctrl = this->ctrl_ + base;
+          (*probes)++;
+
+          for (uint32_t m = LRUTable::match_group(ctrl, t); m; m &= m - 1) {
+            NodeT *node = this->slot_[base + __builtin_ctz(m)];
+            if (node->match(key)) {
+              return node;
+            }
+          }
+
+          if (LRUTable::match_group(ctrl, CTRL_EMPTY)) {
+            break;
+          }
+          g = (g + i + 1) & this->group_mask_;
+        }
+
+        return NULL;
+      }
+
+      void prefetch(uint64_t mv) const {
+        if (this->ctrl_ != NULL) {
+          const size_t base = (mv & this->group_mask_) * GROUP_SIZE;
+          __builtin_prefetch(this->ctrl_ + base);
+          __builtin_prefetch(this->slot_ + base);
+          __builtin_prefetch(this->slot_ + base + GROUP_SIZE / 2);
+        }
+      }
+    };
+
+    Table curr_;
+    Table prev_;  // Not empty while rehashing
+    size_t rehash_pos_;
+    size_t min_capacity_;
+
+    TimingWheel wheel_;
+    const size_t max_tick_;
+    mutable uint64_t lookups_;
+    mutable uint64_t probes_;
+
+    // Remove a node expired by wheel_ from the index.
+    class Expire {
+    private:
+      LRUTable *table_;
+    public:
+      explicit Expire(LRUTable *table) : table_(table) {}
+      void operator()(TimerNode *node) {
+        this->table_->expire(static_cast<NodeT*>(node));
+      }
+    };
+
+    void resize(size_t capacity) {
+      assert(!this->rehashing());
+      this->curr_.swap(this->prev_);
+      this->curr_.init(capacity);
+      this->rehash_pos_ = 0;
+    }
+
+    void rehash(size_t step) {
+      if (!this->rehashing()) {
+        return;
+      }
+
+      const size_t end = std::min(this->rehash_pos_ + step,
+                                  this->prev_.capacity());
+      for (; this->rehash_pos_ < end; this->rehash_pos_++) {
+        NodeT *node = this->prev_.take(this->rehash_pos_);
+        if (node) {
+          this->curr_.insert(LRUTable::mix(node->hash()), node);
+        }
+      }
+
+      if (this->rehash_pos_ == this->prev_.capacity()) {
+        this->prev_.release();
+        this->rehash_pos_ = 0;
+      }
+    }
+
+    void expire(NodeT *node) {
+      const uint64_t mv = LRUTable::mix(node->hash());
+      if (!this->curr_.erase(mv, node)) {
+        bool found = this->prev_.erase(mv, node);
+        assert(found); // node must be in the table
+        (void)found;
+      }
+    }
+
+  public:
+    // max_tick is upper limit of tick for put(), and it does not affect
+    // memory usage.
+    LRUTable(size_t max_tick, size_t capacity=DEFAULT_CAPACITY) :
+      rehash_pos_(0), max_tick_(max_tick), lookups_(0), probes_(0) {
+      this->curr_.init(capacity);
+      this->min_capacity_ = this->curr_.capacity();
+    }
+    ~LRUTable() {
+    }
+
+    bool put(size_t tick, NodeT *node) {
+      if (tick >= this->max_tick_) {
+        return false;
+      }
+
+      this->rehash(REHASH_STEP);
+      if (this->curr_.full()) {
+        // Moving slots normally finishes before the current table gets
+        // full, but complete it anyway to start next resizing.
+        this->rehash(this->prev_.capacity());
+
+        // Grow if live nodes fill half of the table, otherwise only clean
+        // up deleted slots.
+        const size_t cap = this->curr_.capacity();
+        this->resize((this->size() + 1) * 2 > cap ? cap * 2 : cap);
+      }
+      this->curr_.insert(LRUTable::mix(node->hash()), node);
+      this->wheel_.push(node, tick);
+
+      return true;
+    }
+
+    NodeT *get(const KeyT &key) const {
+      const uint64_t mv = LRUTable::mix(key.hash());
+      this->lookups_++;
+      NodeT *node = this->curr_.find(mv, key, &this->probes_);
+      if (node == NULL && this->rehashing()) {
+        node = this->prev_.find(mv, key, &this->probes_);
+      }
+      return node;
+    }
+
+    // Load the first group for the hash value into cache ahead of get().
+    void prefetch(uint64_t hv) const {
+      this->curr_.prefetch(LRUTable::mix(hv));
+    }
+
+    // progress tick
+    void prog(size_t tick=1) {
+      Expire fn(this);
+      this->wheel_.advance(tick, fn);
+
+      this->rehash(REHASH_STEP);
+      const size_t cap = this->curr_.capacity();
+      if (!this->rehashing() && cap > this->min_capacity_ &&
+          this->size() * 8 < cap) {
+        this->resize(cap / 2);
+      }
+    }
+
+    // Pop expired node.
+    NodeT *pop() {
+      return static_cast<NodeT*>(this->wheel_.pop());
+    }
+
+    // Expire all node, need to pop() after the function.
+    void purge() {
+      Expire fn(this);
+      this->wheel_.expire_all(fn);
+    }
+
+    size_t size() const { return this->curr_.size() + this->prev_.size(); }
+    size_t capacity() const { return this->curr_.capacity(); }
+    bool rehashing() const { return this->prev_.capacity() > 0; }
+    // Lookups by get() and groups probed by them, probes / lookups is the
+    // average length of probe sequences.
+    uint64_t lookups() const { return this->lookups_; }
+    uint64_t probes() const { return this->probes_; }
+  };
+
+  template <typename NodeT, typename KeyT>
+  const size_t LRUTable<NodeT, KeyT>::GROUP_SIZE;
+  template <typename NodeT, typename KeyT>
+  const size_t LRUTable<NodeT, KeyT>::DEFAULT_CAPACITY;
+  template <typename NodeT, typename KeyT>
+  const size_t LRUTable<NodeT, KeyT>::REHASH_STEP;
+  template <typename NodeT, typename KeyT>
+  const uint8_t LRUTable<NodeT, KeyT>::CTRL_EMPTY;
+  template <typename NodeT, typename KeyT>
+  const uint8_t LRUTable<NodeT, KeyT>::CTRL_DELETED;
+  template <typename NodeT, typename KeyT>
+  const uint8_t LRUTable<NodeT, KeyT>::CTRL_LIVE;
+}  // namespace devourer
+
+#endif  // SRC_LRU_TABLE_H__
@@ -28,23 +28,63 @@
 #ifndef SRC_MODULE_H__
 #define SRC_MODULE_H__
 
-#include <fluent.hpp>
 #include <swarm.hpp>
+#include <stdint.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include "./emitter.hpp"
+#include "./stats.hpp"
 
 namespace devourer {
+  // Timeouts of modules are in milliseconds, and time of a packet is
+  // truncated to millisecond to advance their tables.
+  inline uint64_t msec_of(const struct timeval &tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+  }
+  inline uint64_t msec_of(const swarm::Property &p) {
+    struct timeval tv;
+    p.tv(&tv);
+    return msec_of(tv);
+  }
+  // Timeout must be shorter than max msec of the table, and not 0.
+  inline void check_timeout(const char *name, uint64_t timeout, uint64_t max)
+    throw(Exception) {
+    if (timeout == 0 || timeout >= max) {
+      throw Exception(std::string(name) + " timeout must be 1 to " +
+                      std::to_string(max - 1) + " msec");
+    }
+  }
+
   class Module : public swarm::Handler, public swarm::Task {
   private:
   protected:
-    fluent::Logger *fluent_;
+    // Records are written through emitter, and begin() returns NULL when
+    // the tag is shed.
+    Emitter *emitter_;
+    // Passive module only updates its state by packets owned by other
+    // shard, and must not emit messages for them.
+    bool passive_;
+    // Updated by StatScope in recv().
+    ModuleStats stats_;
     
   public:
-    Module() : fluent_(NULL) {};
+    Module() : emitter_(NULL), passive_(false) {};
     virtual ~Module() {};
+    virtual const char *name() const = 0;
     virtual const std::vector<std::string>& recv_event() const = 0;
     virtual int task_interval() const = 0;
     virtual void bind_event_id(const std::string &ev_name, swarm::ev_id eid) {
     }
-    void set_fluent(fluent::Logger *fluent) { this->fluent_ = fluent; }
+    void set_emitter(Emitter *emitter) { this->emitter_ = emitter; }
+    void set_passive(bool passive) { this->passive_ = passive; }
+    // Advance time of the module to expire its state before packets of
+    // msec. Time in the same millisecond costs only a comparison.
+    virtual void update_time(uint64_t msec) {}
+    const ModuleStats& stats() const { return this->stats_; }
+    // Append stats of own tables, called by the thread running the module.
+    virtual void table_stats(std::vector<TableStats> *tables) const {}
   };
 
 }
@@ -27,12 +27,38 @@
 #include "./dns.hpp"
 #include <iostream>
 #include <string.h>
-#include <fluent.hpp>
+#include <arpa/inet.h>
+#include <algorithm>
 
 #include "../devourer.hpp"
+#include "../record.hpp"
 #include "../debug.hpp"
+#include "../trace.hpp"
 
 namespace devourer {
+  // Keys of records must be sorted.
+  static const RecordSchema dns_tx_schema("dns.tx", {
+      "client", "latency", "q_name", "server", "status",
+    });
+  enum {
+    TX_CLIENT, TX_LATENCY, TX_Q_NAME, TX_SERVER, TX_STATUS,
+  };
+
+  static const RecordSchema dns_log_schema("dns.log", {
+      "client", "data", "name", "server", "type",
+    });
+  enum {
+    LOG_CLIENT, LOG_DATA, LOG_NAME, LOG_SERVER, LOG_TYPE,
+  };
+
+  static const char *addr_text(const void *addr, size_t len, char *buf) {
+    const int af = (len == 4) ? AF_INET : AF_INET6;
+    if ((len != 4 && len != 16) ||
+        inet_ntop(af, addr, buf, INET6_ADDRSTRLEN) == NULL) {
+      buf[0] = '\0';
+    }
+    return buf;
+  }
 
   std::string v4addr(const void *addr) {
     std::string str;
@@ -43,16 +69,69 @@ namespace devourer {
   }
   
 
+  // ------------------------------------------------------------
+  // class ModDns::QueryKey
+  //
+  ModDns::QueryKey::QueryKey(const swarm::Property &p, uint32_t tx_id,
+                             bool response) {
+    size_t src_len, dst_len;
+    const void *src = p.src_addr(&src_len);
+    const void *dst = p.dst_addr(&dst_len);
+    this->init(src, dst, std::min(src_len, dst_len),
+               static_cast<uint16_t>(p.src_port()),
+               static_cast<uint16_t>(p.dst_port()),
+               static_cast<uint16_t>(tx_id), response);
+  }
+
+  void ModDns::QueryKey::init(const void *src, const void *dst,
+                              size_t addr_len, uint16_t src_port,
+                              uint16_t dst_port, uint16_t tx_id,
+                              bool response) {
+    const void *client = response ? dst : src;
+    const void *server = response ? src : dst;
+    const size_t len = std::min(addr_len, sizeof(this->key_.client));
+
+    // Padding and unused bytes of addresses are compared by match().
+    memset(&this->key_, 0, sizeof(this->key_));
+    if (client && server) {
+      memcpy(this->key_.client, client, len);
+      memcpy(this->key_.server, server, len);
+      this->key_.addr_len = static_cast<uint16_t>(len);
+    }
+    this->key_.c_port = response ? dst_port : src_port;
+    this->key_.s_port = response ? src_port : dst_port;
+    this->key_.tx_id = tx_id;
+
+    // Multiply and rotate each word, and finalize like MurmurHash3, so
+    // that clients behind one resolver do not share buckets.
+    uint64_t w[sizeof(Fields) / sizeof(uint64_t)];
+    memcpy(w, &this->key_, sizeof(w));
+    uint64_t hv = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < sizeof(w) / sizeof(w[0]); i++) {
+      uint64_t k = w[i] * 0x87c37b91114253d5ULL;
+      k = (k << 31) | (k >> 33);
+      hv ^= k * 0x4cf5ad432745937fULL;
+      hv = ((hv << 27) | (hv >> 37)) * 5 + 0x52dce729;
+    }
+    hv ^= hv >> 33;
+    hv *= 0xff51afd7ed558ccdULL;
+    hv ^= hv >> 33;
+    hv *= 0xc4ceb9fe1a85ec53ULL;
+    hv ^= hv >> 33;
+    this->hv_ = hv;
+  }
+
   // ------------------------------------------------------------
   // class ModDns::Query
   //
-  ModDns::Query::Query(uint64_t hv, uint32_t tx_id) : key_(hv, tx_id) {}
+  ModDns::Query::Query(const QueryKey &key) :
+    key_(key), has_reply_(false) {}
   ModDns::Query::~Query() {}
-  uint64_t ModDns::Query::hash() {
+  uint64_t ModDns::Query::hash() const {
     return this->key_.hash();
   }
-  bool ModDns::Query::match(const void *key, size_t len) {
-    return this->key_.match(key, len);
+  bool ModDns::Query::match(const QueryKey &key) const {
+    return this->key_.match(key);
   }
   void ModDns::Query::set_ts(double ts) {
     this->last_ts_ = ts;
@@ -73,17 +152,19 @@ namespace devourer {
   bool ModDns::Query::has_reply() const {
     return this->has_reply_;
   }
-  void ModDns::Query::set_flow(const std::string &client, 
-                              const std::string &server) {
-    this->client_ = client;
-    this->server_ = server;
-  }
   void ModDns::Query::add_question(const std::string &name,
                                   const std::string &type) {
     this->name_.push_back(name);
     this->type_.push_back(type);
   }
 
+  // ------------------------------------------------------------
+  // class ModDns::AddrKey
+  //
+  ModDns::AddrKey::AddrKey(const void *addr, size_t len) :
+    addr_(addr), len_(len), hv_(ARecord::calc_hash(addr, len)) {
+  }
+
   // ------------------------------------------------------------
   // class ModDns::ARecord
   //
@@ -93,7 +174,6 @@ namespace devourer {
     init_ts_(init_ts), last_ts_(init_ts)
   {
     this->hv_ = ARecord::calc_hash(key, keylen);
-    this->key_ = ::malloc(keylen);
     ::memcpy(this->key_, key, keylen);
     /*
     const uint8_t *kp = reinterpret_cast<const uint8_t*>(key);
@@ -102,7 +182,6 @@ namespace devourer {
     */
   }
   ModDns::ARecord::~ARecord() {
-    ::free(this->key_);
   }
   void ModDns::ARecord::update(time_t ts) {
     if (this->last_ts_ < ts) {
@@ -124,10 +203,12 @@ namespace devourer {
     }
     return hv;
   }
-  uint64_t ModDns::ARecord::hash() {
+  uint64_t ModDns::ARecord::hash() const {
     return this->hv_;
   }
-  bool ModDns::ARecord::match(const void *key, size_t len) {
+  bool ModDns::ARecord::match(const AddrKey &key) const {
+    const void *addr = key.addr();
+    const size_t len = key.len();
     /*
     const uint32_t *k1 = reinterpret_cast<const uint32_t*>(key);
     const uint32_t *k2 = reinterpret_cast<const uint32_t*>(this->key_);
@@ -135,16 +216,30 @@ namespace devourer {
     std::string a2 = v4addr(this->key_);
     debug(true, "%s:%08X, %s:%08X", a1.c_str(), *k1, a2.c_str(), *k2);
     */
-    return (this->keylen_ == len && 0 == ::memcmp(key, this->key_, len));
+    return (this->keylen_ == len && 0 == ::memcmp(addr, this->key_, len));
   }
 
   // ------------------------------------------------------------
   // class ModDns::CNameRecord
   //
+  static inline size_t name_len(const void *name, size_t len) {
+    // Trailing dot of FQDN is not a part of the name.
+    const char *p = static_cast<const char*>(name);
+    return (len > 0 && p[len - 1] == '.') ? len - 1 : len;
+  }
+  static inline uint8_t name_lower(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+  }
+
+  ModDns::NameKey::NameKey(const std::string &name) :
+    name_(name), hv_(CNameRecord::calc_hash(name)) {
+  }
+
   ModDns::CNameRecord::CNameRecord(const std::string &qname,
                                    const std::string &cname, time_t init_ts) :
     qname_(qname), cname_(cname), last_ts_(init_ts)
   {
+    this->hv_ = CNameRecord::calc_hash(cname);
     debug(false, "reg: %s -> %s", qname.c_str(), cname.c_str());
   }
   ModDns::CNameRecord::~CNameRecord() {
@@ -153,15 +248,44 @@ namespace devourer {
     this->last_ts_ = ts;
   }
   uint64_t ModDns::CNameRecord::calc_hash(const std::string &name) {
-    return 0;
+    return CNameRecord::calc_hash(name.data(), name.length());
   }
-  uint64_t ModDns::CNameRecord::hash() {
-    // ToDo:
-    return 0;
+  uint64_t ModDns::CNameRecord::calc_hash(const void *name, size_t len) {
+    // FNV-1a over case folded name, then finalize to spread the low bits
+    // that are used for bucket selection.
+    const uint8_t *p = static_cast<const uint8_t*>(name);
+    const size_t n = name_len(name, len);
+    uint64_t hv = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) {
+      hv ^= name_lower(p[i]);
+      hv *= 0x100000001b3ULL;
+    }
+    hv ^= hv >> 33;
+    hv *= 0xff51afd7ed558ccdULL;
+    hv ^= hv >> 33;
+    return hv;
   }
-  bool ModDns::CNameRecord::match(const void *key, size_t len) {
-    return (this->cname_.length() == len &&
-            0 == ::memcmp(key, this->cname_.data(), len));
+  bool ModDns::CNameRecord::name_eq(const void *a, size_t a_len,
+                                    const void *b, size_t b_len) {
+    const size_t n = name_len(a, a_len);
+    if (n != name_len(b, b_len)) {
+      return false;
+    }
+    const uint8_t *ap = static_cast<const uint8_t*>(a);
+    const uint8_t *bp = static_cast<const uint8_t*>(b);
+    for (size_t i = 0; i < n; i++) {
+      if (name_lower(ap[i]) != name_lower(bp[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  uint64_t ModDns::CNameRecord::hash() const {
+    return this->hv_;
+  }
+  bool ModDns::CNameRecord::match(const NameKey &key) const {
+    return CNameRecord::name_eq(key.name().data(), key.name().length(),
+                                this->cname_.data(), this->cname_.length());
   }
 
 
@@ -171,72 +295,122 @@ namespace devourer {
 
   const std::vector<std::string> ModDns::recv_event_{"dns.packet"};
   const bool ModDns::DBG = false;
+  const uint64_t ModDns::QUERY_TTL = 120 * 1000;
+  const uint64_t ModDns::MAX_TIMEOUT = 3600 * 1000;
+  const uint64_t ModDns::CACHE_TTL = 600 * 1000;
 
-  ModDns::ModDns() : last_ts_(0), query_table_(600), addr_table_(1200),
-                     name_table_(1200)
+  ModDns::ModDns() : last_msec_(0), query_timeout_(QUERY_TTL),
+                     query_table_(MAX_TIMEOUT),
+                     addr_table_(CACHE_TTL * 2),
+                     name_table_(CACHE_TTL * 2)
   {
   }
   ModDns::~ModDns() {
     this->query_table_.purge();
     this->flush_query();
+
+    ARecord *a_rec;
+    this->addr_table_.purge();
+    while (NULL != (a_rec = this->addr_table_.pop())) {
+      this->addr_pool_.release(a_rec);
+    }
+    CNameRecord *cname_rec;
+    this->name_table_.purge();
+    while (NULL != (cname_rec = this->name_table_.pop())) {
+      this->name_pool_.release(cname_rec);
+    }
   }
   void ModDns::flush_query() {
-    LRUHash::Node *n;
-    while(NULL != (n = this->query_table_.pop())) {
-      Query *q = dynamic_cast<Query*>(n);
-
+    Query *q;
+    while(NULL != (q = this->query_table_.pop())) {
       if(!(q->has_reply())) {
-        fluent::Message *msg = this->fluent_->retain_message("dns.tx");
-        msg->set_ts(q->last_ts());
-        msg->set("client", q->client());
-        msg->set("server", q->server());
-        msg->set("q_name", q->q_name(0));
-        msg->set("status", "timeout");
-        this->fluent_->emit(msg);
+        TRACE(DNS_TIMEOUT, q->hash(), 0);
+        RecordWriter *w = this->emitter_->begin(dns_tx_schema, q->last_ts());
+        if (w) {
+          const QueryKey &key = q->key();
+          char buf[INET6_ADDRSTRLEN];
+          w->put_str(TX_CLIENT, addr_text(key.client(), key.addr_len(), buf));
+          w->put_str(TX_Q_NAME, q->q_name(0));
+          w->put_str(TX_SERVER, addr_text(key.server(), key.addr_len(), buf));
+          w->put_str(TX_STATUS, "timeout");
+          this->emitter_->commit();
+        }
+      }
+
+      this->query_pool_.release(q);
+    }
+  }
+
+  // Records refreshed by update() are put again for the rest of TTL.
+  template <typename T, typename K>
+  void ModDns::expire_record(LRUTable<T, K> *table, NodePool<T> *pool,
+                             uint64_t msec) {
+    T *rec;
+    while (NULL != (rec = table->pop())) {
+      const uint64_t expire =
+        static_cast<uint64_t>(rec->last_ts()) * 1000 + ModDns::CACHE_TTL;
+      if (expire > msec) {
+        table->put(expire - msec, rec);
+      } else {
+        pool->release(rec);
       }
+    }
+  }
 
-      delete n;
+  void ModDns::update_time(uint64_t msec) {
+    if (msec <= this->last_msec_) {
+      return;
+    }
+    if (this->last_msec_ > 0) {
+      const uint64_t diff = msec - this->last_msec_;
+      this->query_table_.prog(diff);
+      this->flush_query();
+      this->addr_table_.prog(diff);
+      this->expire_record(&this->addr_table_, &this->addr_pool_, msec);
+      this->name_table_.prog(diff);
+      this->expire_record(&this->name_table_, &this->name_pool_, msec);
     }
+    this->last_msec_ = msec;
   }
 
   // XXX: Too long function
   void ModDns::recv (swarm::ev_id eid, const swarm::Property &p) {
+    StatScope scope(&this->stats_);
     uint32_t qflag = p.value("dns.query").uint32();
     uint32_t tx_id = p.value("dns.tx_id").uint32();
-    uint64_t hv = p.hash_value();
-    ModDns::QueryKey key(hv, tx_id);
-    const size_t query_ttl = 120;
-    const size_t cache_ttl = 600;
 
-    // Progress tick of LRU hash table for queries.
+    // Progress tick of LRU hash tables and release expired nodes.
     const time_t ts = p.tv_sec();
-    if (this->last_ts_ > 0 && ts > this->last_ts_) {
-      const time_t diff = ts - this->last_ts_;
-      // ToDo: Need to prune expired nodes
-      this->query_table_.prog(diff);
-      this->addr_table_.prog(diff);
-      this->name_table_.prog(diff);
+    this->update_time(msec_of(p));
+
+    if (this->passive_) {
+      // Learn only records for name resolution of own flows.
+      if (qflag != 0) {
+        size_t an_max = p.value_size("dns.an_name");
+        for(size_t i = 0; i < an_max; i++) {
+          this->add_answer(p, i, ts);
+        }
+      }
+      return;
     }
 
-    this->last_ts_ = ts;
-    
-    Query *q = dynamic_cast<Query*>
-      (this->query_table_.get(key.hash(), key.ptr(), key.len()));
+    const ModDns::QueryKey key(p, tx_id, qflag != 0);
+    Query *q = this->query_table_.get(key);
 
     debug(DBG, "flag:%d, query %p", qflag, q);
     if (qflag == 0) {
       // DNS query.
       if (!q) {
         // Query is not found.
-        q = new Query(hv, tx_id);
-        q->set_flow(p.src_addr(), p.dst_addr());
+        TRACE(DNS_QUERY, key.hash(), tx_id);
+        q = new (this->query_pool_.alloc()) Query(key);
         q->set_ts(p.ts());
         size_t max = p.value_size("dns.qd_name");
         for(size_t i = 0; i < max; i++) {
           q->add_question(p.value("dns.qd_name", i).repr(), 
                           p.value("dns.qd_type", i).repr());
         }
-        this->query_table_.put(query_ttl, q);
+        this->query_table_.put(this->query_timeout_, q);
       } else {
         q->set_last_ts(p.ts());
       }
@@ -247,110 +421,107 @@ namespace devourer {
 
       if (q) {
         // Found matched query with the response.
+        TRACE(DNS_RESPONSE, key.hash(), tx_id);
         tv.tv_sec = q->last_ts();
-        double ts = p.ts() - q->last_ts();
-
-        fluent::Message *msg = this->fluent_->retain_message("dns.tx");
-        msg->set_ts(q->last_ts());
-        msg->set("client", q->client());
-        msg->set("server", q->server());
-        msg->set("q_name", q->q_name(0));
-        msg->set("status", "success");
-        msg->set("latency", ts);
-        this->fluent_->emit(msg);
+        double latency = p.ts() - q->last_ts();
+
+        RecordWriter *w = this->emitter_->begin(dns_tx_schema, q->last_ts());
+        if (w) {
+          char buf[INET6_ADDRSTRLEN];
+          w->put_str(TX_CLIENT, addr_text(key.client(), key.addr_len(), buf));
+          w->put_double(TX_LATENCY, latency);
+          w->put_str(TX_Q_NAME, q->q_name(0));
+          w->put_str(TX_SERVER, addr_text(key.server(), key.addr_len(), buf));
+          w->put_str(TX_STATUS, "success");
+          this->emitter_->commit();
+        }
         q->set_has_reply(true);
 
         size_t an_max = p.value_size("dns.an_name");
         for(size_t i = 0; i < an_max; i++) {
-          fluent::Message *msg = this->fluent_->retain_message("dns.log");
-          msg->set_ts(tv.tv_sec);
-          msg->set("client", p.dst_addr());
-          msg->set("server", p.src_addr());
-          msg->set("name", p.value("dns.an_name", i).repr());
-          msg->set("type", p.value("dns.an_type", i).repr());
-          msg->set("data", p.value("dns.an_data", i).repr());
-          this->fluent_->emit(msg);
-
-          // XXX: Merge A/AAAA record process and CNAME record process
-          uint32_t rec_type = p.value("dns.an_type", i).uint32();
-          if (rec_type == 1 || rec_type == 28) {
-            // A record or AAAA record
-            size_t keylen;
-            const void *key = p.value("dns.an_data", i).ptr(&keylen);
-
-            const std::string& qname = p.value("dns.an_name", i).repr();
-            uint64_t hv = ARecord::calc_hash(key, keylen);
-            ARecord *rec =
-              dynamic_cast<ARecord*>(this->addr_table_.get(hv, key, keylen));
-            if (rec) {
-              rec->update(ts);
-            } else {
-              rec = new ARecord(qname, key, keylen, ts);
-              // debug(false, "A Record: %s -> %s", qname.c_str(), p.value("dns.an_data", i).ip4().c_str());
-              this->addr_table_.put(cache_ttl, rec);
-            }
-          } else if (rec_type == 5) {
-            // CNAME record
-            const std::string& qname = p.value("dns.an_name", i).repr();
-            const std::string& cname = p.value("dns.an_data", i).repr();
-            const size_t keylen = qname.length();
-            const void *key = qname.c_str();
-            uint64_t hv = CNameRecord::calc_hash(cname);
-            CNameRecord *rec = dynamic_cast<CNameRecord*>
-              (this->name_table_.get(hv, key, keylen));
-              
-            if (rec) {
-              rec->update(ts);
-            } else {
-              rec = new CNameRecord(qname, cname, ts);
-              this->name_table_.put(cache_ttl, rec);
-            }
+          RecordWriter *w = this->emitter_->begin(dns_log_schema, tv.tv_sec);
+          if (w) {
+            w->put_str(LOG_CLIENT, p.dst_addr());
+            w->put_str(LOG_DATA, p.value("dns.an_data", i).repr());
+            w->put_str(LOG_NAME, p.value("dns.an_name", i).repr());
+            w->put_str(LOG_SERVER, p.src_addr());
+            w->put_str(LOG_TYPE, p.value("dns.an_type", i).repr());
+            this->emitter_->commit();
           }
+          this->add_answer(p, i, ts);
         }
 
       } else {
         // Matched query is not found.
-        fluent::Message *msg = this->fluent_->retain_message("dns.tx");
-        msg->set_ts(p.ts());
-        msg->set("client", p.dst_addr());
-        msg->set("server", p.src_addr());
-        msg->set("q_name", p.value("dns.qd_name").repr());
-        msg->set("status", "miss");
-        this->fluent_->emit(msg);
+        TRACE(DNS_MISS, key.hash(), tx_id);
+        RecordWriter *w = this->emitter_->begin(dns_tx_schema, p.tv_sec());
+        if (w) {
+          w->put_str(TX_CLIENT, p.dst_addr());
+          w->put_str(TX_Q_NAME, p.value("dns.qd_name").repr());
+          w->put_str(TX_SERVER, p.src_addr());
+          w->put_str(TX_STATUS, "miss");
+          this->emitter_->commit();
+        }
       }
     }
   }
 
+  void ModDns::add_answer(const swarm::Property &p, size_t i, time_t ts) {
+    // XXX: Merge A/AAAA record process and CNAME record process
+    uint32_t rec_type = p.value("dns.an_type", i).uint32();
+    if (rec_type == 1 || rec_type == 28) {
+      // A record or AAAA record
+      size_t keylen;
+      const void *key = p.value("dns.an_data", i).ptr(&keylen);
+      this->add_a_record(p.value("dns.an_name", i).repr(), key, keylen, ts);
+    } else if (rec_type == 5) {
+      // CNAME record
+      this->add_cname_record(p.value("dns.an_name", i).repr(),
+                             p.value("dns.an_data", i).repr(), ts);
+    }
+  }
+
+  void ModDns::add_a_record(const std::string &name, const void *addr,
+                            size_t len, time_t ts) {
+    ARecord *rec = this->addr_table_.get(AddrKey(addr, len));
+    if (rec) {
+      rec->update(ts);
+    } else {
+      rec = new (this->addr_pool_.alloc()) ARecord(name, addr, len, ts);
+      this->addr_table_.put(ModDns::CACHE_TTL, rec);
+    }
+  }
+
+  void ModDns::add_cname_record(const std::string &qname,
+                                const std::string &cname, time_t ts) {
+    // name_table_ is keyed by cname to walk a chain from A record backward.
+    CNameRecord *rec = this->name_table_.get(NameKey(cname));
+    if (rec) {
+      rec->update(ts);
+    } else {
+      rec = new (this->name_pool_.alloc()) CNameRecord(qname, cname, ts);
+      this->name_table_.put(ModDns::CACHE_TTL, rec);
+    }
+  }
+
   const std::string ModDns::null_str_;
   const std::string& ModDns::resolv_addr(const void *addr, size_t len,
                                          size_t recur_max) {
     assert(len == 4 || len == 16);
-    uint64_t hv = ARecord::calc_hash(addr, len);
-    ARecord *a_rec = dynamic_cast<ARecord*>
-      (this->addr_table_.get(hv, addr, len));
+    ARecord *a_rec = this->addr_table_.get(AddrKey(addr, len));
 
     if (a_rec) {
-      std::string name = a_rec->name();
-      CNameRecord *cname_rec = NULL;
+      const std::string *name = &(a_rec->name());
 
       for (size_t i = 0; i < recur_max; i++) {
-        const void *key = name.c_str();
-        const size_t keylen = name.length();
-        uint64_t hv = CNameRecord::calc_hash(name);
-        CNameRecord *r =
-          dynamic_cast<CNameRecord*>(this->name_table_.get(hv, key, keylen));
+        CNameRecord *r = this->name_table_.get(NameKey(*name));
         if (r == NULL) {
           break;
         }
-        cname_rec = r;
-        name = cname_rec->qname();
+        name = &(r->qname());
       }
 
-      if (cname_rec) {
-        return cname_rec->qname();
-      } else {
-        return a_rec->name();
-      }
+      return *name;
     } 
 
     return ModDns::null_str_;
@@ -364,4 +535,20 @@ namespace devourer {
   int ModDns::task_interval() const {
     return 1;
   }
+
+  template <typename T, typename K>
+  static void push_stats(std::vector<TableStats> *tables, const char *name,
+                         const LRUTable<T, K> &table,
+                         const NodePool<T> &pool) {
+    const TableStats st = {
+      name, table.size(), table.lookups(), table.probes(), pool.slabs(),
+    };
+    tables->push_back(st);
+  }
+
+  void ModDns::table_stats(std::vector<TableStats> *tables) const {
+    push_stats(tables, "dns.query", this->query_table_, this->query_pool_);
+    push_stats(tables, "dns.addr", this->addr_table_, this->addr_pool_);
+    push_stats(tables, "dns.name", this->name_table_, this->name_pool_);
+  }
 }
@@ -28,67 +28,113 @@
 #define SRC_MODULES_DNS_H__
 
 #include <exception>
+#include <algorithm>
 #include <vector>
 #include <msgpack.hpp>
 
 #include "../module.hpp"
 #include "../devourer.hpp"
-#include "../lru-hash.hpp"
+#include "../lru-table.hpp"
+#include "../node-pool.hpp"
 
 namespace devourer {
   class ModDns : public Module {
-  private:
+  public:
+    // Query is keyed by addresses and ports of client and server, and
+    // transaction ID. The key is kept inline in Query, and addresses are
+    // converted to text only when dns.tx is written.
     class QueryKey {
     private:
-      uint64_t key_[2];
+      struct Fields {
+        uint8_t client[16];
+        uint8_t server[16];
+        uint16_t c_port;
+        uint16_t s_port;
+        uint16_t tx_id;
+        uint16_t addr_len;
+      };
+      Fields key_;
+      uint64_t hv_;
+      void init(const void *src, const void *dst, size_t addr_len,
+                uint16_t src_port, uint16_t dst_port, uint16_t tx_id,
+                bool response);
 
     public:
-      QueryKey(uint64_t hv, uint32_t tx_id) {
-        this->key_[0] = hv;
-        this->key_[1] = static_cast<uint64_t>(tx_id);
+      QueryKey(const swarm::Property &p, uint32_t tx_id, bool response);
+      // Key of a packet from src to dst, a response is from the server.
+      QueryKey(const void *src, const void *dst, size_t addr_len,
+               uint16_t src_port, uint16_t dst_port, uint16_t tx_id,
+               bool response) {
+        this->init(src, dst, addr_len, src_port, dst_port, tx_id, response);
       }
-      const uint64_t *ptr() const { return &(this->key_[0]); }
-      size_t len() const { return sizeof(this->key_);}
-      uint64_t hash() const { return (this->key_[0] ^ this->key_[1]); }
-      bool match(const void *key, size_t len) {
-        return (len == sizeof(this->key_) && 0 == memcmp(key, this->key_, sizeof(this->key_)));
+      uint64_t hash() const { return this->hv_; }
+      bool match(const QueryKey &key) const {
+        return (0 == memcmp(&key.key_, &this->key_, sizeof(this->key_)));
       }
+      const uint8_t *client() const { return this->key_.client; }
+      const uint8_t *server() const { return this->key_.server; }
+      size_t addr_len() const { return this->key_.addr_len; }
+      uint16_t tx_id() const { return this->key_.tx_id; }
+      uint16_t client_port() const { return this->key_.c_port; }
+      uint16_t server_port() const { return this->key_.s_port; }
+    };
+
+  private:
+    class AddrKey {
+    private:
+      const void *addr_;
+      size_t len_;
+      uint64_t hv_;
+
+    public:
+      AddrKey(const void *addr, size_t len);
+      const void *addr() const { return this->addr_; }
+      size_t len() const { return this->len_; }
+      uint64_t hash() const { return this->hv_; }
+    };
+
+    class NameKey {
+    private:
+      const std::string &name_;
+      uint64_t hv_;
+
+    public:
+      explicit NameKey(const std::string &name);
+      const std::string &name() const { return this->name_; }
+      uint64_t hash() const { return this->hv_; }
     };
 
-    class Query : public LRUHash::Node {
+    class Query : public LRUTableNode {
     private:
       double last_ts_;
       double ts_;
       QueryKey key_;
       bool has_reply_;
-      std::string client_, server_;
       std::vector<std::string> name_;
       std::vector<std::string> type_;
 
     public:
-      Query(uint64_t hv, uint32_t tx_id);
+      explicit Query(const QueryKey &key);
       ~Query();
-      uint64_t hash();
-      bool match(const void *key, size_t len);
+      uint64_t hash() const;
+      bool match(const QueryKey &key) const;
       void set_ts(double ts);
       void set_last_ts(double ts);
       double ts() const;
       double last_ts() const;
       void set_has_reply(bool has);
       bool has_reply() const;
-      void set_flow(const std::string &client, const std::string &server);
       void add_question(const std::string &name, const std::string &type);
       size_t q_count() const { return this->name_.size(); }
       const std::string& q_name(size_t i) { return this->name_[i]; }
       const std::string& q_type(size_t i) { return this->type_[i]; }
-      const std::string& client() { return this->client_; }
-      const std::string& server() { return this->server_; }
+      const QueryKey& key() const { return this->key_; }
     };
 
-    class ARecord : public LRUHash::Node {
+    class ARecord : public LRUTableNode {
     private:
       const std::string name_;
-      void *key_;
+      uint8_t key_[16];
       const size_t keylen_;
       const time_t init_ts_;
       time_t last_ts_;
@@ -100,13 +146,16 @@ namespace devourer {
       ~ARecord();
       void update(time_t ts);
       const std::string &name() { return this->name_; }
+      time_t last_ts() const { return this->last_ts_; }
       static uint64_t calc_hash(const void *key, size_t keylen);
-      uint64_t hash();
-      bool match(const void *key, size_t len);
+      uint64_t hash() const;
+      bool match(const AddrKey &key) const;
     };
 
 
-    class CNameRecord : public LRUHash::Node {
+    // CNAME record is keyed by cname (alias target) and resolves to qname.
+    // Hash and match ignore letter case and a trailing dot of the name.
+    class CNameRecord : public LRUTableNode {
     private:
       const std::string qname_;
       const std::string cname_;
@@ -119,32 +168,62 @@ namespace devourer {
       ~CNameRecord();
       void update(time_t ts);
       const std::string& qname() { return this->qname_; }
+      time_t last_ts() const { return this->last_ts_; }
       static uint64_t calc_hash(const std::string &name);
-      uint64_t hash();
-      bool match(const void *key, size_t len);
+      static uint64_t calc_hash(const void *name, size_t len);
+      static bool name_eq(const void *a, size_t a_len,
+                          const void *b, size_t b_len);
+      uint64_t hash() const;
+      bool match(const NameKey &key) const;
     };
 
     
     static const bool DBG;
+    static const uint64_t QUERY_TTL;    // Default query timeout in msec
+    static const uint64_t CACHE_TTL;    // msec
     static const std::vector<std::string> recv_event_;
     static const std::string null_str_;
     
-    time_t last_ts_;
-    LRUHash query_table_;
-    LRUHash addr_table_;
-    LRUHash name_table_;
+    uint64_t last_msec_;
+    uint64_t query_timeout_;
+    NodePool<Query> query_pool_;
+    NodePool<ARecord> addr_pool_;
+    NodePool<CNameRecord> name_pool_;
+    LRUTable<Query, QueryKey> query_table_;
+    LRUTable<ARecord, AddrKey> addr_table_;
+    LRUTable<CNameRecord, NameKey> name_table_;
     void flush_query();
+    void add_answer(const swarm::Property &p, size_t i, time_t ts);
+    template <typename T, typename K>
+    void expire_record(LRUTable<T, K> *table, NodePool<T> *pool,
+                       uint64_t msec);
 
   public:
+    static const uint64_t MAX_TIMEOUT;  // msec
     ModDns();
     ~ModDns();
+    const char *name() const { return "dns"; }
     void recv (swarm::ev_id eid, const  swarm::Property &p);
     void exec (const struct timespec &ts);
     const std::vector<std::string>& recv_event() const;
     int task_interval() const;
+    void update_time(uint64_t msec);
+    // Queries without response in timeout msec are reported as timeout.
+    void set_query_timeout(uint64_t timeout) throw(Exception) {
+      check_timeout("Query", timeout, MAX_TIMEOUT);
+      this->query_timeout_ = timeout;
+    }
+    void table_stats(std::vector<TableStats> *tables) const;
     // ToDo: add const to lookup functions
     const std::string& resolv_addr(const void *addr, size_t len,
                                    size_t recur_max=32);
+    void add_a_record(const std::string &name, const void *addr, size_t len,
+                      time_t ts);
+    void add_cname_record(const std::string &qname, const std::string &cname,
+                          time_t ts);
+    size_t query_count() const { return this->query_pool_.used(); }
+    size_t a_record_count() const { return this->addr_pool_.used(); }
+    size_t cname_record_count() const { return this->name_pool_.used(); }
   };
 
 }
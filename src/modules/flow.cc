@@ -26,16 +26,16 @@
 
 #include "./flow.hpp"
 
-#include <fluent.hpp>
 #include <swarm.hpp>
 
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <iostream>
-#include <functional>
-#include <sstream>
-#include <iomanip>
 
 #include "../devourer.hpp"
 #include "../debug.hpp"
+#include "../trace.hpp"
 #include "./dns.hpp"
 
 namespace devourer {
@@ -45,21 +45,104 @@ namespace devourer {
     "ipv6.packet",
   };
   const bool ModFlow::DBG = true;
+  const uint64_t ModFlow::MAX_TIMEOUT = 3600 * 1000;
+  const size_t ModFlow::HINT_SIZE;
+  const size_t ModFlow::Flow::NOT_TOUCHED;
+
+  // Keys of records must be sorted.
+  static const RecordSchema flow_new_schema("flow.new", {
+      "dst_addr", "dst_name", "dst_port", "hash", "proto", "src_addr",
+      "src_name", "src_port",
+    });
+  enum {
+    NEW_DST_ADDR, NEW_DST_NAME, NEW_DST_PORT, NEW_HASH, NEW_PROTO,
+    NEW_SRC_ADDR, NEW_SRC_NAME, NEW_SRC_PORT,
+  };
+
+  static const std::vector<std::string> flow_log_keys = {
+    "c_addr", "c_name", "c_pkt", "c_port", "c_size", "hash", "init_ts",
+    "last_ts", "proto", "s_addr", "s_name", "s_pkt", "s_port", "s_size",
+  };
+  static const RecordSchema flow_log_schema("flow.log", flow_log_keys);
+  static const RecordSchema flow_active_schema("flow.active", flow_log_keys);
+  enum {
+    LOG_C_ADDR, LOG_C_NAME, LOG_C_PKT, LOG_C_PORT, LOG_C_SIZE, LOG_HASH,
+    LOG_INIT_TS, LOG_LAST_TS, LOG_PROTO, LOG_S_ADDR, LOG_S_NAME, LOG_S_PKT,
+    LOG_S_PORT, LOG_S_SIZE,
+  };
+
+  static const RecordSchema flow_update_schema("flow.update", {
+      "flow_pkt", "flow_size",
+    });
+  enum {
+    UPDATE_FLOW_PKT, UPDATE_FLOW_SIZE,
+  };
+
+  static const size_t HASH_TEXT_LEN = 17;
+  static const char *hash_text(uint64_t hv, char *buf) {
+    snprintf(buf, HASH_TEXT_LEN, "%016" PRIX64, hv);
+    return buf;
+  }
+
+  static const char *addr_text(const void *addr, size_t len, char *buf) {
+    const int af = (len == 4) ? AF_INET : AF_INET6;
+    if ((len != 4 && len != 16) ||
+        inet_ntop(af, addr, buf, INET6_ADDRSTRLEN) == NULL) {
+      buf[0] = '\0';
+    }
+    return buf;
+  }
   
   // ------------------------------------------------------------
   // class ModFlow
   ModFlow::ModFlow(ModDns *mod_dns) :
     mod_dns_(mod_dns),
-    flow_timeout_(600), flow_table_(3600), last_ts_(0)
+    flow_timeout_(600 * 1000), flow_table_(MAX_TIMEOUT), last_msec_(0),
+    active_timeout_(1800), act_head_(NULL), act_tail_(NULL), tuple_hv_(0)
   {
+    Hint empty = {0, 0, NULL};
+    this->hint_.resize(HINT_SIZE, empty);
   }
   ModFlow::~ModFlow() {
-    LRUHash::Node *node;
+    Flow *flow;
     this->flow_table_.purge();
-    while(NULL != (node = this->flow_table_.pop())) {
-      Flow *flow = dynamic_cast<Flow*>(node);
-        delete flow;
+    while(NULL != (flow = this->flow_table_.pop())) {
+      this->flow_pool_.release(flow);
+    }
+  }
+  void ModFlow::release_flow(Flow *flow) {
+    // Interval counts of the flow are dropped, flow.log has the totals.
+    const size_t idx = flow->touched_idx();
+    if (idx != Flow::NOT_TOUCHED) {
+      this->touched_[idx] = this->touched_.back();
+      this->touched_[idx]->set_touched_idx(idx);
+      this->touched_.pop_back();
+    }
+    this->act_remove(flow);
+    this->flow_pool_.release(flow);
+  }
+  void ModFlow::act_append(Flow *flow) {
+    flow->act_prev_ = this->act_tail_;
+    flow->act_next_ = NULL;
+    if (this->act_tail_) {
+      this->act_tail_->act_next_ = flow;
+    } else {
+      this->act_head_ = flow;
     }
+    this->act_tail_ = flow;
+  }
+  void ModFlow::act_remove(Flow *flow) {
+    if (flow->act_prev_) {
+      flow->act_prev_->act_next_ = flow->act_next_;
+    } else {
+      this->act_head_ = flow->act_next_;
+    }
+    if (flow->act_next_) {
+      flow->act_next_->act_prev_ = flow->act_prev_;
+    } else {
+      this->act_tail_ = flow->act_prev_;
+    }
+    flow->act_prev_ = flow->act_next_ = NULL;
   }
   void ModFlow::bind_event_id(const std::string &ev_name, swarm::ev_id eid) {
     if (ev_name == "ipv4.packet") {
@@ -71,45 +154,23 @@ namespace devourer {
   
   void ModFlow::recv (swarm::ev_id eid, const swarm::Property &p) {
     static const bool FLOW_DBG = false;
+    StatScope scope(&this->stats_);
+    if (this->passive_) {
+      return;
+    }
 
     // Get packet time.
     struct timeval tv;
     p.tv(&tv);
-
-    // Eliminate timeout flow, and re-put flow if it updated.
-    if (this->last_ts_ == 0) {
-      this->last_ts_ = p.tv_sec();
-    } else if (this->last_ts_ < p.tv_sec()) {
-      time_t diff = p.tv_sec() - this->last_ts_;
-      // debug(FLOW_DBG, "tick: %ld (%ld)", p.tv_sec(), diff);
-      this->last_ts_ = p.tv_sec();
-      this->flow_table_.prog(diff);
-
-      LRUHash::Node *node;
-      while(NULL != (node = this->flow_table_.pop())) {
-        Flow *flow = dynamic_cast<Flow*>(node);
-        if (flow->remain() > 0) {
-          // debug(FLOW_DBG, "updating [%016llX]", flow->hash());
-          this->flow_table_.put(flow->remain(), flow);
-          flow->refresh(p.tv_sec());
-        } else {
-          debug(FLOW_DBG, "deleting [%016llX]", flow->hash());
-
-          fluent::Message *msg = this->fluent_->retain_message("flow.log");
-          flow->build_message(msg);
-          this->fluent_->emit(msg);
-          delete flow;
-        }
-      }
-    }
-
+    const uint64_t msec = msec_of(tv);
+    this->update_time(msec);
     
     // IPv4/IPv6 packets
     if (eid == this->ev_ipv4_ || eid == this->ev_ipv6_) {
       size_t keylen;
       const void *key = p.ssn_label(&keylen); 
-      Flow *flow = dynamic_cast<Flow*>
-        (this->flow_table_.get(p.hash_value(), key, keylen));
+      Flow *flow =
+        this->flow_table_.get(FlowKey(p.hash_value(), key, keylen));
       if (flow == NULL) {
         // TODO: catch bad_alloc
         size_t src_len, dst_len;
@@ -120,55 +181,140 @@ namespace devourer {
         const std::string &dst =
           this->mod_dns_->resolv_addr(dst_addr, dst_len);
 
-        flow = new Flow(p, src, dst);
+        const std::string *proto = this->intern_proto(p.proto());
+        flow = new (this->flow_pool_.alloc()) Flow(p, msec, proto, src, dst);
 
-        fluent::Message *msg = this->fluent_->retain_message("flow.new");
-        msg->set_ts(tv.tv_sec);
-        msg->set("src_addr", p.src_addr());
-        msg->set("dst_addr", p.dst_addr());
-        msg->set("hash", flow->hash_hex());
-        
-        if (!src.empty()) {
-          msg->set("src_name", src);
-        }
-        if (!dst.empty()) {
-          msg->set("dst_name", dst);
-        }
-        
-        msg->set("proto", p.proto());
-        if (p.has_port()) {
-          msg->set("src_port", p.src_port());
-          msg->set("dst_port", p.dst_port());
-        }
-        
+        char src_text[INET6_ADDRSTRLEN], dst_text[INET6_ADDRSTRLEN];
+        char hash_buf[HASH_TEXT_LEN];
         debug(FLOW_DBG, "new flow %s(%s)->%s(%s)",
-              p.src_addr().c_str(), src.c_str(), 
-              p.dst_addr().c_str(), dst.c_str());
-        this->fluent_->emit(msg);
+              addr_text(src_addr, src_len, src_text), src.c_str(),
+              addr_text(dst_addr, dst_len, dst_text), dst.c_str());
+        TRACE(FLOW_NEW, flow->hash(), 0);
+        RecordWriter *w = this->emitter_->begin(flow_new_schema, tv.tv_sec);
+        if (w) {
+          const bool has_port = p.has_port();
+          w->put_str(NEW_DST_ADDR, addr_text(dst_addr, dst_len, dst_text));
+          if (!dst.empty()) {
+            w->put_str(NEW_DST_NAME, dst);
+          }
+          if (has_port) {
+            w->put_uint(NEW_DST_PORT, p.dst_port());
+          }
+          w->put_str(NEW_HASH, hash_text(flow->hash(), hash_buf));
+          w->put_str(NEW_PROTO, *proto);
+          w->put_str(NEW_SRC_ADDR, addr_text(src_addr, src_len, src_text));
+          if (!src.empty()) {
+            w->put_str(NEW_SRC_NAME, src);
+          }
+          if (has_port) {
+            w->put_uint(NEW_SRC_PORT, p.src_port());
+          }
+          this->emitter_->commit();
+        }
         this->flow_table_.put(this->flow_timeout_, flow);
+        this->act_append(flow);
+      }
+
+      flow->update(p, msec);
+      if (flow->touched_idx() == Flow::NOT_TOUCHED) {
+        flow->set_touched_idx(this->touched_.size());
+        this->touched_.push_back(flow);
+      }
+      if (this->tuple_hv_ != 0) {
+        Hint &h = this->hint_[this->tuple_hv_ & (HINT_SIZE - 1)];
+        h.tuple_hv = this->tuple_hv_;
+        h.hv = p.hash_value();
+        h.flow = flow;
+      }
+
+    }
+  }
+  void ModFlow::update_time(uint64_t msec) {
+    static const bool FLOW_DBG = false;
+
+    // Eliminate timeout flow, and re-put flow if it updated.
+    if (msec <= this->last_msec_) {
+      return;
+    }
+    const uint64_t prev = this->last_msec_;
+    this->last_msec_ = msec;
+    if (prev > 0) {
+      const uint64_t diff = msec - prev;
+      // debug(FLOW_DBG, "tick: %" PRIu64 " (%" PRIu64 ")", msec, diff);
+      this->flow_table_.prog(diff);
+
+      Flow *flow;
+      while(NULL != (flow = this->flow_table_.pop())) {
+        if (flow->remain() > 0) {
+          // debug(FLOW_DBG, "updating [%016llX]", flow->hash());
+          this->flow_table_.put(flow->remain(), flow);
+          flow->refresh(msec);
+        } else {
+          debug(FLOW_DBG, "deleting [%016" PRIX64 "]", flow->hash());
+          TRACE(FLOW_EXPIRE, flow->hash(), 0);
+
+          RecordWriter *w =
+            this->emitter_->begin(flow_log_schema, flow->created_at());
+          if (w) {
+            flow->write_record(w);
+            this->emitter_->commit();
+          }
+          this->release_flow(flow);
+        }
       }
+    }
+  }
 
-      flow->update(p);
+  // Exported flow moves to the tail with the current time, then the list is
+  // kept in order of exported_at_ and only expired heads are checked.
+  void ModFlow::export_active(time_t now) {
+    if (this->active_timeout_ == 0) {
+      return;
+    }
 
-      auto it = this->update_map_.find(flow->hash_hex());
-      if (it == this->update_map_.end()) {
-        this->update_map_.insert(std::make_pair(flow->hash_hex(), p.len()));
-      } else {
-        it->second += p.len();
+    Flow *flow;
+    while (NULL != (flow = this->act_head_) &&
+           flow->exported_at_ + this->active_timeout_ <= now) {
+      RecordWriter *w = this->emitter_->begin(flow_active_schema, now);
+      if (w) {
+        flow->write_record(w);
+        this->emitter_->commit();
       }
+
+      flow->exported_at_ = now;
+      this->act_remove(flow);
+      this->act_append(flow);
     }
   }
+
+  // Called by Shard every second of packet time, ts is time of the packet.
   void ModFlow::exec (const struct timespec &ts) {
-    /*
-    fluent::Message *msg = this->fluent_->retain_message("flow.update");
-    msg->set_ts(ts.tv_sec);
-    fluent::Message::Map *map = msg->retain_map("flow_size");
-    for (auto f : this->update_map_) {
-      map->set(f.first, static_cast<unsigned int>(f.second));               
+    this->export_active(ts.tv_sec);
+    if (this->touched_.empty()) {
+      return;
+    }
+
+    RecordWriter *w = this->emitter_->begin(flow_update_schema, ts.tv_sec);
+    if (w) {
+      char hash_buf[HASH_TEXT_LEN];
+      w->put_map(UPDATE_FLOW_PKT, this->touched_.size());
+      for (size_t i = 0; i < this->touched_.size(); i++) {
+        const Flow *flow = this->touched_[i];
+        w->map_key(hash_text(flow->hash(), hash_buf));
+        w->map_uint(flow->int_pkt());
+      }
+      w->put_map(UPDATE_FLOW_SIZE, this->touched_.size());
+      for (size_t i = 0; i < this->touched_.size(); i++) {
+        const Flow *flow = this->touched_[i];
+        w->map_key(hash_text(flow->hash(), hash_buf));
+        w->map_uint(flow->int_size());
+      }
+      this->emitter_->commit();
+    }
+    for (size_t i = 0; i < this->touched_.size(); i++) {
+      this->touched_[i]->reset_interval();
     }
-    this->update_map_.clear();
-    this->fluent_->emit(msg);
-    */
+    this->touched_.clear();
   }
   const std::vector<std::string>& ModFlow::recv_event() const {
     return ModFlow::recv_events_;
@@ -177,65 +323,83 @@ namespace devourer {
     return 1;
   }
 
+  void ModFlow::table_stats(std::vector<TableStats> *tables) const {
+    const TableStats st = {
+      "flow", this->flow_table_.size(), this->flow_table_.lookups(),
+      this->flow_table_.probes(), this->flow_pool_.slabs(),
+    };
+    tables->push_back(st);
+  }
+
+  // Protocol names are a few kinds, and flows share one copy of them.
+  const std::string *ModFlow::intern_proto(const std::string &proto) {
+    for (size_t i = 0; i < this->protos_.size(); i++) {
+      if (this->protos_[i] == proto) {
+        return &this->protos_[i];
+      }
+    }
+    this->protos_.push_back(proto);
+    return &this->protos_.back();
+  }
+
   // ------------------------------------------------------------
   // class ModFlow::Flow
-  ModFlow::Flow::Flow(const swarm::Property &p, const std::string& src,
+  ModFlow::Flow::Flow(const swarm::Property &p, uint64_t msec,
+                      const std::string *proto, const std::string& src,
                       const std::string& dst) :
-    l_port_(0), r_port_(0),
+    addr_len_(0), l_port_(0), r_port_(0), proto_(proto),
     l_pkt_(0),  r_pkt_(0),
-    l_size_(0), r_size_(0)
+    l_size_(0), r_size_(0),
+    int_pkt_(0), int_size_(0), touched_idx_(NOT_TOUCHED),
+    act_prev_(NULL), act_next_(NULL)
   {
     this->hv_ = p.hash_value();
 
-    // L4 mode
-    this->hv_hex_ = p.hash_hex();
-
-    // L3 mode
-    /*
-    {
-      const std::string &sp = (src.empty()) ? p.src_addr() : src;
-      const std::string &dp = (dst.empty()) ? p.dst_addr() : dst;
-      const std::string label = sp + "=" + dp + "=" + p.proto();
-      std::hash<std::string> hash_fn;
-      this->flow_hv_ = 0;
-      this->flow_hv_ = hash_fn(label);
-      std::stringstream ss;
-      ss << std::setw(16) << std::setfill('0') <<
-        std::hex << std::uppercase << this->flow_hv_ ;
-      this->hv_hex_ = ss.str();
-    }    
-    */
-    
     const void *key = p.ssn_label(&this->keylen_);
-    this->key_ = malloc(this->keylen_);
+    this->key_ = (this->keylen_ <= KEY_INLINE) ?
+      this->key_buf_ : static_cast<uint8_t*>(malloc(this->keylen_));
     memcpy(this->key_, key, this->keylen_);
 
     this->created_at_ = p.tv_sec();
     this->updated_at_ = p.tv_sec();
-    this->refreshed_at_ = p.tv_sec();
+    this->refreshed_msec_ = msec;
+    this->updated_msec_ = msec;
+    this->exported_at_ = p.tv_sec();
+
+    size_t src_len, dst_len;
+    const void *src_addr = p.src_addr(&src_len);
+    const void *dst_addr = p.dst_addr(&dst_len);
+    if (src_len == dst_len && src_len <= sizeof(this->l_addr_)) {
+      this->addr_len_ = src_len;
+    }
     
     this->init_dir_ = p.dir();
     if (this->init_dir_ == swarm::FlowDir::DIR_L2R) {
       // Left to Right
-      this->l_addr_ = p.src_addr(); this->r_addr_ = p.dst_addr();
+      memcpy(this->l_addr_, src_addr, this->addr_len_);
+      memcpy(this->r_addr_, dst_addr, this->addr_len_);
       this->l_port_ = p.src_port(); this->r_port_ = p.dst_port();
       this->l_name_ = src;          this->r_name_ = dst;
     } else if (this->init_dir_ == swarm::FlowDir::DIR_R2L) {
       // Right to Left
-      this->r_addr_ = p.src_addr(); this->l_addr_ = p.dst_addr();
+      memcpy(this->r_addr_, src_addr, this->addr_len_);
+      memcpy(this->l_addr_, dst_addr, this->addr_len_);
       this->r_port_ = p.src_port(); this->l_port_ = p.dst_port();
       this->r_name_ = src;          this->l_name_ = dst;
     }
-    this->proto_ = p.proto();
-
   }
 
   ModFlow::Flow::~Flow() {
-    free(this->key_);
+    if (this->key_ != this->key_buf_) {
+      free(this->key_);
+    }
   }
   
-  void ModFlow::Flow::update(const swarm::Property &p) {
-    this->updated_at_ = p.tv_sec();
+  void ModFlow::Flow::update(const swarm::Property &p, uint64_t msec) {
+    this->updated_at_ = msec / 1000;
+    this->updated_msec_ = msec;
+    this->int_pkt_  += 1;
+    this->int_size_ += p.len();
     if (p.dir() == swarm::FlowDir::DIR_L2R) {
       this->l_pkt_  += 1;
       this->l_size_ += p.len();
@@ -245,50 +409,34 @@ namespace devourer {
     }
   }
 
-  void ModFlow::Flow::build_message(fluent::Message *msg) {
-    msg->set("proto",  this->proto_);
-    msg->set("init_ts", static_cast<unsigned int>(this->created_at_));
-    msg->set("last_ts", static_cast<unsigned int>(this->updated_at_));
-    msg->set("hash",   this->hv_hex_);
-    msg->set_ts(static_cast<unsigned int>(this->created_at_));
-      
-    switch (this->init_dir_) {
-    case swarm::FlowDir::DIR_L2R:
-      msg->set("c_addr", this->l_addr_);
-      msg->set("s_addr", this->r_addr_);
-      msg->set("c_port", this->l_port_);
-      msg->set("s_port", this->r_port_);
-      msg->set("c_size", this->l_size_);
-      msg->set("s_size", this->r_size_);
-      msg->set("c_pkt",  this->l_pkt_);
-      msg->set("s_pkt",  this->r_pkt_);
-      if (!this->l_name_.empty()) {
-        msg->set("c_name", this->l_name_);
-      }
-      if (!this->r_name_.empty()) {
-        msg->set("s_name", this->r_name_);
-      }
-      break;
-      
-    case swarm::FlowDir::DIR_R2L:
-      msg->set("s_addr", this->l_addr_);
-      msg->set("c_addr", this->r_addr_);
-      msg->set("s_port", this->l_port_);
-      msg->set("c_port", this->r_port_);
-      msg->set("s_size", this->l_size_);
-      msg->set("c_size", this->r_size_);
-      msg->set("s_pkt",  this->l_pkt_);
-      msg->set("c_pkt",  this->r_pkt_);
-      if (!this->l_name_.empty()) {
-        msg->set("s_name", this->l_name_);
-      }
-      if (!this->r_name_.empty()) {
-        msg->set("c_name", this->r_name_);
-      }
-      break;
-      
-    case swarm::FlowDir::DIR_NIL: assert(0); break; // nothing to do
+  void ModFlow::Flow::write_record(RecordWriter *w) const {
+    // Client is the side sending the first packet.
+    const bool l2r = (this->init_dir_ == swarm::FlowDir::DIR_L2R);
+    const uint8_t *c_addr = l2r ? this->l_addr_ : this->r_addr_;
+    const uint8_t *s_addr = l2r ? this->r_addr_ : this->l_addr_;
+    const std::string &c_name = l2r ? this->l_name_ : this->r_name_;
+    const std::string &s_name = l2r ? this->r_name_ : this->l_name_;
+    char addr_buf[INET6_ADDRSTRLEN];
+    char hash_buf[HASH_TEXT_LEN];
+
+    w->put_str(LOG_C_ADDR, addr_text(c_addr, this->addr_len_, addr_buf));
+    if (!c_name.empty()) {
+      w->put_str(LOG_C_NAME, c_name);
+    }
+    w->put_uint(LOG_C_PKT,  l2r ? this->l_pkt_ : this->r_pkt_);
+    w->put_uint(LOG_C_PORT, l2r ? this->l_port_ : this->r_port_);
+    w->put_uint(LOG_C_SIZE, l2r ? this->l_size_ : this->r_size_);
+    w->put_str(LOG_HASH, hash_text(this->hv_, hash_buf));
+    w->put_uint(LOG_INIT_TS, this->created_at_);
+    w->put_uint(LOG_LAST_TS, this->updated_at_);
+    w->put_str(LOG_PROTO, *this->proto_);
+    w->put_str(LOG_S_ADDR, addr_text(s_addr, this->addr_len_, addr_buf));
+    if (!s_name.empty()) {
+      w->put_str(LOG_S_NAME, s_name);
     }
+    w->put_uint(LOG_S_PKT,  l2r ? this->r_pkt_ : this->l_pkt_);
+    w->put_uint(LOG_S_PORT, l2r ? this->r_port_ : this->l_port_);
+    w->put_uint(LOG_S_SIZE, l2r ? this->r_size_ : this->l_size_);
   }
 
   
@@ -28,52 +28,96 @@
 #define SRC_MODULES_FLOW_H__
 
 #include <exception>
+#include <algorithm>
 #include <vector>
+#include <deque>
 #include <assert.h>
+#include <stdint.h>
 
 #include "../module.hpp"
 #include "../devourer.hpp"
-#include "../lru-hash.hpp"
+#include "../lru-table.hpp"
+#include "../node-pool.hpp"
+#include "../record.hpp"
 
 namespace devourer {
   class ModDns;
   class ModFlow : public Module {
   private:
-    class Flow : public LRUHash::Node {
+    class FlowKey {
     private:
       uint64_t hv_;
-      void *key_;
+      const void *label_;
+      size_t len_;
+
+    public:
+      FlowKey(uint64_t hv, const void *label, size_t len) :
+        hv_(hv), label_(label), len_(len) {}
+      uint64_t hash() const { return this->hv_; }
+      const void *label() const { return this->label_; }
+      size_t len() const { return this->len_; }
+    };
+
+    class Flow : public LRUTableNode {
+    private:
+      // Session label of swarm is short enough to be kept in the node
+      // except for unusual protocols.
+      static const size_t KEY_INLINE = 48;
+      uint64_t hv_;
+      uint8_t *key_;
       size_t keylen_;
+      uint8_t key_buf_[KEY_INLINE];
       time_t created_at_;
-      time_t refreshed_at_;
       time_t updated_at_;
+      // Idle timeout is counted from the last packet in msec.
+      uint64_t refreshed_msec_;
+      uint64_t updated_msec_;
       swarm::FlowDir init_dir_;
 
-      std::string l_addr_, r_addr_;
+      // Addresses are kept in binary and formatted only for messages.
+      uint8_t l_addr_[16], r_addr_[16];
+      uint8_t addr_len_;
+      uint16_t l_port_, r_port_;
+      const std::string *proto_;  // Interned by ModFlow
+      uint64_t l_pkt_, r_pkt_;
+      uint64_t l_size_, r_size_;
+      // Counts since the last flow.update, and index in ModFlow::touched_
+      // while they are not zero.
+      uint32_t int_pkt_;
+      uint64_t int_size_;
+      size_t touched_idx_;
+      // List of flows in order of the last active export.
+      Flow *act_prev_, *act_next_;
+      time_t exported_at_;
       std::string l_name_, r_name_;
-      int l_port_, r_port_;
-      int l_pkt_, r_pkt_;
-      int l_size_, r_size_;
-      std::string proto_;
-      std::string hv_hex_;
-      std::string flow_hv_hex_;
+
+      friend class ModFlow;
     public:
-      Flow(const swarm::Property &p, const std::string& src_name = "",
-           const std::string& dst = "");
+      Flow(const swarm::Property &p, uint64_t msec, const std::string *proto,
+           const std::string& src_name = "", const std::string& dst = "");
       ~Flow();
-      uint64_t hash() { return this->hv_; }
-      const std::string& flow_hv_hex() const { return this->flow_hv_hex_; }
-      const std::string& hash_hex() { return this->hv_hex_; }
-      bool match(const void *key, size_t len) {
-        return (len == this->keylen_ && 0 == memcmp(key, this->key_, len));
+      uint64_t hash() const { return this->hv_; }
+      bool match(const FlowKey &key) const {
+        return (key.len() == this->keylen_ &&
+                0 == memcmp(key.label(), this->key_, this->keylen_));
+      }
+      static const size_t NOT_TOUCHED = SIZE_MAX;
+      void update(const swarm::Property &p, uint64_t msec);
+      uint32_t int_pkt() const { return this->int_pkt_; }
+      uint64_t int_size() const { return this->int_size_; }
+      size_t touched_idx() const { return this->touched_idx_; }
+      void set_touched_idx(size_t idx) { this->touched_idx_ = idx; }
+      void reset_interval() {
+        this->int_pkt_ = 0;
+        this->int_size_ = 0;
+        this->touched_idx_ = NOT_TOUCHED;
       }
-      void update(const swarm::Property &p);
-      void refresh(time_t tv_sec) {
-        this->refreshed_at_ = tv_sec;
+      void refresh(uint64_t msec) {
+        this->refreshed_msec_ = msec;
       }
-      time_t remain() const {
-        if (this->refreshed_at_ <= this->updated_at_) {
-          return (this->updated_at_ - this->refreshed_at_);
+      uint64_t remain() const {
+        if (this->refreshed_msec_ <= this->updated_msec_) {
+          return (this->updated_msec_ - this->refreshed_msec_);
         } else {
           return 0;
         }
@@ -81,31 +125,72 @@ namespace devourer {
       void set_l_name(const std::string& name) { this->l_name_ = name; }
       void set_r_name(const std::string& name) { this->r_name_ = name; }
       
-      void build_message(fluent::Message *msg);
-      void created_at(struct timeval *tv) const {
-        tv->tv_sec = this->created_at_;
-        tv->tv_usec = 0;
-      }
+      void write_record(RecordWriter *w) const;
+      time_t created_at() const { return this->created_at_; }
     };
 
     static const bool DBG;
     static const std::vector<std::string> recv_events_;
     ModDns *mod_dns_;
-    time_t flow_timeout_;
-    LRUHash flow_table_;
+    uint64_t flow_timeout_;  // msec
+    NodePool<Flow> flow_pool_;
+    LRUTable<Flow, FlowKey> flow_table_;
     swarm::ev_id ev_ipv4_;
     swarm::ev_id ev_ipv6_;
-    time_t last_ts_;
-    std::map<std::string, size_t> update_map_;
+    uint64_t last_msec_;
+    std::vector<Flow*> touched_;  // Flows updated since the last exec()
+    time_t active_timeout_;
+    Flow *act_head_, *act_tail_;  // Oldest export first
+    std::deque<std::string> protos_;
+    const std::string *intern_proto(const std::string &proto);
+    void release_flow(Flow *flow);
+    void act_append(Flow *flow);
+    void act_remove(Flow *flow);
+    void export_active(time_t now);
+
+    // Hint to prefetch flows of next packets in a batch. It maps tuple hash
+    // of raw packet to hash value and node of the flow seen last time.
+    struct Hint {
+      uint64_t tuple_hv;
+      uint64_t hv;
+      const Flow *flow;
+    };
+    static const size_t HINT_SIZE = 4096;
+    std::vector<Hint> hint_;
+    uint64_t tuple_hv_;  // Tuple hash of current packet, 0 if unknown
     
   public:
+    static const uint64_t MAX_TIMEOUT;  // msec
     ModFlow(ModDns *mod_dns);
     ~ModFlow();
+    const char *name() const { return "flow"; }
     void recv (swarm::ev_id eid, const  swarm::Property &p);
     void exec (const struct timespec &ts);
     const std::vector<std::string>& recv_event() const;
     int task_interval() const;
     void bind_event_id(const std::string &ev_name, swarm::ev_id eid);
+    void update_time(uint64_t msec);
+    void table_stats(std::vector<TableStats> *tables) const;
+    // Flows living longer than timeout seconds are reported by flow.active
+    // every timeout seconds before flow.log at the end. 0 disables it.
+    void set_active_timeout(time_t timeout) {
+      this->active_timeout_ = timeout;
+    }
+    // Flows without packets in timeout msec are closed by flow.log.
+    void set_flow_timeout(uint64_t timeout) throw(Exception) {
+      check_timeout("Flow", timeout, MAX_TIMEOUT);
+      this->flow_timeout_ = timeout;
+    }
+    void set_tuple_hash(uint64_t tuple_hv) { this->tuple_hv_ = tuple_hv; }
+    void prefetch(uint64_t tuple_hv) const {
+      const Hint &h = this->hint_[tuple_hv & (HINT_SIZE - 1)];
+      if (tuple_hv != 0 && h.tuple_hv == tuple_hv) {
+        this->flow_table_.prefetch(h.hv);
+        __builtin_prefetch(h.flow);
+      }
+    }
+    size_t flow_count() const { return this->flow_pool_.used(); }
+    size_t flow_pool_capacity() const { return this->flow_pool_.capacity(); }
 
   };
 
@@ -27,6 +27,13 @@
 #include "./local.hpp"
 
 namespace devourer {
+  static const RecordSchema arp_request_schema("arp.request", {
+      "dst_hw", "dst_pr", "src_hw", "src_pr",
+    });
+  enum {
+    ARP_DST_HW, ARP_DST_PR, ARP_SRC_HW, ARP_SRC_PR,
+  };
+
   const std::vector<std::string> ModLocal::recv_events_{
     "arp.request",
     "mdns.packet",
@@ -44,20 +51,26 @@ namespace devourer {
   }
   
   void ModLocal::recv(swarm::ev_id eid, const swarm::Property &p) {
+    StatScope scope(&this->stats_);
+    if (this->passive_) {
+      return;
+    }
     if (eid == this->recv_events_id_[ARP_REQUEST]) {
-      fluent::Message *msg = this->fluent_->retain_message("arp.request");
-      msg->set_ts(p.tv_sec());
-      msg->set("src_hw", p.value("arp.src_hw").repr());
-      msg->set("dst_hw", p.value("arp.dst_hw").repr());
-      msg->set("src_pr", p.value("arp.src_pr").repr());
-      msg->set("dst_pr", p.value("arp.dst_pr").repr());
-      this->fluent_->emit(msg);
+      RecordWriter *w = this->emitter_->begin(arp_request_schema, p.tv_sec());
+      if (w == NULL) {
+        return;
+      }
+      w->put_str(ARP_DST_HW, p.value("arp.dst_hw").repr());
+      w->put_str(ARP_DST_PR, p.value("arp.dst_pr").repr());
+      w->put_str(ARP_SRC_HW, p.value("arp.src_hw").repr());
+      w->put_str(ARP_SRC_PR, p.value("arp.src_pr").repr());
+      this->emitter_->commit();
     }
 
     // ToDo: change to flat object scheme, do not use nest
       /*
     if (eid == this->recv_events_id_[MDNS_PACKET]) {
-      fluent::Message *msg = this->fluent_->retain_message("mdns");
+      fluent::Message *msg = this->emitter_->retain_message("mdns");
       msg->set_ts(p.tv_sec());
 
       static const std::vector<std::string> type_name = {
@@ -85,7 +98,7 @@ namespace devourer {
         }
       }
       
-      this->fluent_->emit(msg);
+      this->emitter_->emit(msg);
     }
       */
   }
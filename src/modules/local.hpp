@@ -40,6 +40,7 @@ namespace devourer {
   public:
     ModLocal();
     ~ModLocal();
+    const char *name() const { return "local"; }
     void recv (swarm::ev_id eid, const  swarm::Property &p);
     void exec (const struct timespec &ts);
     const std::vector<std::string>& recv_event() const;
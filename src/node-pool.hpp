@@ -0,0 +1,106 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_NODE_POOL_H__
+#define SRC_NODE_POOL_H__
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace devourer {
+  // NodePool allocates objects of T from fixed size slabs, and released
+  // objects are kept in a free list to be reused. Slabs are not returned
+  // until the pool is destroyed, then allocation in steady state does not
+  // call allocator at all.
+  //
+  //   T *obj = new (pool.alloc()) T(...);
+  //   pool.release(obj);
+  template <typename T>
+  class NodePool {
+  private:
+    static const size_t SLAB_SIZE = 256;  // Objects per slab
+
+    union Slot {
+      Slot *next;
+      typename std::aligned_storage<sizeof(T),
+                                    std::alignment_of<T>::value>::type data;
+    };
+
+    std::vector<Slot*> slabs_;
+    Slot *free_;
+    size_t used_;
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    void grow() {
+      Slot *slab = new Slot[SLAB_SIZE];
+      this->slabs_.push_back(slab);
+      for (size_t i = SLAB_SIZE; i > 0; i--) {
+        slab[i - 1].next = this->free_;
+        this->free_ = &slab[i - 1];
+      }
+    }
+
+  public:
+    NodePool() : free_(NULL), used_(0) {}
+    ~NodePool() {
+      // All objects must be released before.
+      for (size_t i = 0; i < this->slabs_.size(); i++) {
+        delete[] this->slabs_[i];
+      }
+    }
+
+    // Return memory for one T, construct it by placement new.
+    void *alloc() {
+      if (this->free_ == NULL) {
+        this->grow();
+      }
+      Slot *slot = this->free_;
+      this->free_ = slot->next;
+      this->used_++;
+      return &(slot->data);
+    }
+
+    // Destruct the object and return its memory to the pool.
+    void release(T *obj) {
+      obj->~T();
+      Slot *slot = reinterpret_cast<Slot*>(obj);
+      slot->next = this->free_;
+      this->free_ = slot;
+      this->used_--;
+    }
+
+    size_t used() const { return this->used_; }
+    size_t capacity() const { return this->slabs_.size() * SLAB_SIZE; }
+    size_t slabs() const { return this->slabs_.size(); }
+  };
+
+  template <typename T> const size_t NodePool<T>::SLAB_SIZE;
+}  // namespace devourer
+
+#endif  // SRC_NODE_POOL_H__
@@ -0,0 +1,277 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <climits>
+#include <fluent.hpp>
+
+#include "./output.hpp"
+#include "./record.hpp"
+
+namespace devourer {
+  bool write_all(int fd, const uint8_t *data, size_t len, bool socket) {
+    while (len > 0) {
+      const ssize_t rc = socket ?
+        ::send(fd, data, len, MSG_NOSIGNAL) : ::write(fd, data, len);
+      if (rc < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += rc;
+      len -= rc;
+    }
+    return true;
+  }
+
+  // ------------------------------------------------------------
+  // class MultiOutput
+  //
+  MultiOutput::~MultiOutput() {
+    for (size_t i = 0; i < this->outputs_.size(); i++) {
+      delete this->outputs_[i];
+    }
+  }
+
+  void MultiOutput::write(const uint8_t *data, size_t len, size_t count) {
+    for (size_t i = 0; i < this->outputs_.size(); i++) {
+      this->outputs_[i]->write(data, len, count);
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class FileOutput
+  //
+  FileOutput::FileOutput(int fd) : fd_(fd), own_fd_(false) {
+  }
+
+  FileOutput::FileOutput(const std::string &path) throw(Exception) :
+    fd_(-1), own_fd_(true) {
+    this->fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (this->fd_ < 0) {
+      throw Exception(path + ": " + strerror(errno));
+    }
+  }
+
+  FileOutput::~FileOutput() {
+    if (this->own_fd_) {
+      ::close(this->fd_);
+    }
+  }
+
+  void FileOutput::write(const uint8_t *data, size_t len, size_t count) {
+    write_all(this->fd_, data, len, false);
+  }
+
+  // ------------------------------------------------------------
+  // class ForwardOutput
+  //
+  const time_t ForwardOutput::RETRY_SEC;
+  const size_t ForwardOutput::BACKLOG_SIZE;
+
+  ForwardOutput::ForwardOutput(const std::string &host, int port) :
+    host_(host), port_(port), sock_(-1), retry_at_(0), dropped_(0),
+    backlog_count_(0) {
+  }
+
+  ForwardOutput::~ForwardOutput() {
+    if (this->sock_ >= 0) {
+      ::close(this->sock_);
+    }
+  }
+
+  bool ForwardOutput::connect() {
+    const time_t now = ::time(NULL);
+    if (now < this->retry_at_) {
+      return false;
+    }
+    this->retry_at_ = now + RETRY_SEC;
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char port[16];
+    snprintf(port, sizeof(port), "%d", this->port_);
+    if (::getaddrinfo(this->host_.c_str(), port, &hints, &res) != 0) {
+      return false;
+    }
+
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+      int sock = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (sock < 0) {
+        continue;
+      }
+      if (::connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+        this->sock_ = sock;
+        break;
+      }
+      ::close(sock);
+    }
+    ::freeaddrinfo(res);
+    return (this->sock_ >= 0);
+  }
+
+  bool ForwardOutput::send(const uint8_t *data, size_t len) {
+    if (!write_all(this->sock_, data, len, true)) {
+      // Records may be sent partially, and fluentd drops the broken one.
+      ::close(this->sock_);
+      this->sock_ = -1;
+      return false;
+    }
+    return true;
+  }
+
+  void ForwardOutput::keep(const uint8_t *data, size_t len, size_t count) {
+    if (this->backlog_.size() + len > BACKLOG_SIZE) {
+      this->dropped_ += count;
+      return;
+    }
+    this->backlog_.insert(this->backlog_.end(), data, data + len);
+    this->backlog_count_ += count;
+  }
+
+  void ForwardOutput::write(const uint8_t *data, size_t len, size_t count) {
+    if (this->sock_ < 0 && !this->connect()) {
+      this->keep(data, len, count);
+      return;
+    }
+    if (!this->backlog_.empty()) {
+      if (!this->send(this->backlog_.data(), this->backlog_.size())) {
+        this->keep(data, len, count);
+        return;
+      }
+      this->backlog_.clear();
+      this->backlog_count_ = 0;
+    }
+    if (!this->send(data, len)) {
+      this->keep(data, len, count);
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class LoggerOutput
+  //
+  static bool set_map(msgpack::Reader *rd, fluent::Message::Map *map) {
+    size_t n;
+    if (!rd->read_map(&n)) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      const char *k, *s;
+      size_t klen, slen;
+      uint64_t u;
+      if (!rd->read_str(&k, &klen)) {
+        return false;
+      }
+      const std::string key(k, klen);
+      if (rd->read_uint(&u)) {
+        map->set(key, static_cast<unsigned int>(u));
+      } else if (rd->read_str(&s, &slen)) {
+        map->set(key, std::string(s, slen));
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool set_value(msgpack::Reader *rd, fluent::Message *msg,
+                        const std::string &key) {
+    const char *s;
+    size_t len;
+    uint64_t u;
+    int64_t i;
+    double d;
+
+    switch (rd->next_type()) {
+    case msgpack::Reader::STR:
+      rd->read_str(&s, &len);
+      msg->set(key, std::string(s, len));
+      return true;
+    case msgpack::Reader::UINT:
+      rd->read_uint(&u);
+      // libfluent has no 64-bit integer overload, then larger values are
+      // given as double like other numbers of fluent::Message.
+      if (u <= UINT_MAX) {
+        msg->set(key, static_cast<unsigned int>(u));
+      } else {
+        msg->set(key, static_cast<double>(u));
+      }
+      return true;
+    case msgpack::Reader::INT:
+      rd->read_int(&i);
+      msg->set(key, static_cast<int>(i));
+      return true;
+    case msgpack::Reader::DOUBLE:
+      rd->read_double(&d);
+      msg->set(key, d);
+      return true;
+    case msgpack::Reader::MAP:
+      return set_map(rd, msg->retain_map(key));
+    case msgpack::Reader::NIL:
+      return rd->read_nil();
+    default:
+      return false;
+    }
+  }
+
+  void LoggerOutput::write(const uint8_t *data, size_t len, size_t count) {
+    msgpack::Reader rd(data, len);
+    while (!rd.empty()) {
+      size_t n;
+      const char *tag;
+      size_t tag_len;
+      uint64_t ts;
+      if (!rd.read_array(&n) || n != 3 || !rd.read_str(&tag, &tag_len) ||
+          !rd.read_uint(&ts) || !rd.read_map(&n)) {
+        return;
+      }
+
+      fluent::Message *msg =
+        this->logger_->retain_message(std::string(tag, tag_len));
+      msg->set_ts(static_cast<time_t>(ts));
+      for (size_t i = 0; i < n; i++) {
+        const char *key;
+        size_t key_len;
+        if (!rd.read_str(&key, &key_len) ||
+            !set_value(&rd, msg, std::string(key, key_len))) {
+          this->logger_->emit(msg);
+          return;
+        }
+      }
+      this->logger_->emit(msg);
+    }
+  }
+}
@@ -0,0 +1,121 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_OUTPUT_H__
+#define SRC_OUTPUT_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "./devourer.hpp"
+
+namespace fluent {
+  class Logger;
+}
+
+namespace devourer {
+  // Write all data to fd, by send(2) if socket. Return false on error.
+  bool write_all(int fd, const uint8_t *data, size_t len, bool socket);
+
+  // Output receives records encoded by RecordWriter. write() is called by
+  // one thread at a time.
+  class Output {
+  public:
+    virtual ~Output() {}
+    // data has count records.
+    virtual void write(const uint8_t *data, size_t len, size_t count) = 0;
+  };
+
+  // Records are written to all outputs.
+  class MultiOutput : public Output {
+  private:
+    std::vector<Output*> outputs_;
+
+  public:
+    ~MultiOutput();
+    void add(Output *output) { this->outputs_.push_back(output); }
+    bool empty() const { return this->outputs_.empty(); }
+    void write(const uint8_t *data, size_t len, size_t count);
+  };
+
+  // Stream of msgpack records to a file descriptor.
+  class FileOutput : public Output {
+  private:
+    int fd_;
+    bool own_fd_;
+
+  public:
+    explicit FileOutput(int fd);
+    explicit FileOutput(const std::string &path) throw(Exception);
+    ~FileOutput();
+    void write(const uint8_t *data, size_t len, size_t count);
+  };
+
+  // Records to fluentd by forward protocol in message mode over TCP.
+  // While the connection is down, records are kept in a backlog up to
+  // BACKLOG_SIZE bytes and sent first after reconnect, which is tried on
+  // write() every RETRY_SEC. Records over the backlog are dropped and
+  // counted. Records of a failed send are sent again, then fluentd may
+  // receive some of them twice.
+  class ForwardOutput : public Output {
+  private:
+    std::string host_;
+    int port_;
+    int sock_;
+    time_t retry_at_;
+    uint64_t dropped_;
+    std::vector<uint8_t> backlog_;
+    size_t backlog_count_;
+
+    bool connect();
+    bool send(const uint8_t *data, size_t len);
+    void keep(const uint8_t *data, size_t len, size_t count);
+
+  public:
+    static const time_t RETRY_SEC = 1;
+    static const size_t BACKLOG_SIZE = 16 * 1024 * 1024;
+    ForwardOutput(const std::string &host, int port);
+    ~ForwardOutput();
+    void write(const uint8_t *data, size_t len, size_t count);
+    uint64_t dropped() const { return this->dropped_; }
+    size_t backlog() const { return this->backlog_count_; }
+  };
+
+  // Records are converted to fluent::Message and emitted to the logger, e.g.
+  // for the message queue of Devourer::setdst_msgqueue().
+  class LoggerOutput : public Output {
+  private:
+    fluent::Logger *logger_;
+
+  public:
+    explicit LoggerOutput(fluent::Logger *logger) : logger_(logger) {}
+    void write(const uint8_t *data, size_t len, size_t count);
+  };
+}
+
+#endif  // SRC_OUTPUT_H__
@@ -0,0 +1,153 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./packet-ring.hpp"
+
+namespace devourer {
+  const size_t PacketRing::DEFAULT_DESC_COUNT;
+  const size_t PacketRing::DEFAULT_BUF_SIZE;
+
+  static const uint64_t DATA_ALIGN = 8;
+
+  PacketRing::PacketRing(size_t desc_count, size_t buf_size) :
+    desc_(desc_count), buf_(NULL), buf_size_(buf_size), write_pos_(0),
+    release_pos_(0), closed_(false), pushed_(0), dropped_(0), stalled_(0)
+  {
+    this->buf_ = static_cast<uint8_t*>(::malloc(buf_size));
+  }
+
+  PacketRing::~PacketRing() {
+    ::free(this->buf_);
+  }
+
+  bool PacketRing::push(const uint8_t *data, size_t len,
+                        const struct timeval &tv, size_t cap_len,
+                        bool passive, bool block) {
+    if (len > this->buf_size_) {
+      this->dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    // Packet data must be contiguous, skip the tail of buffer if it does
+    // not have enough space.
+    uint64_t pos = this->write_pos_;
+    const uint64_t off = pos % this->buf_size_;
+    if (off + len > this->buf_size_) {
+      pos += this->buf_size_ - off;
+    }
+
+    bool stalled = false;
+    while (pos + len - this->release_pos_.load(std::memory_order_acquire) >
+           this->buf_size_) {
+      if (!block) {
+        this->dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      stalled = true;
+      usleep(50);
+    }
+
+    ::memcpy(this->buf_ + (pos % this->buf_size_), data, len);
+    Desc desc;
+    desc.ref = NULL;
+    desc.offset = pos;
+    desc.len = static_cast<uint32_t>(len);
+    desc.cap_len = static_cast<uint32_t>(cap_len);
+    desc.tv = tv;
+    desc.passive = passive;
+    while (!this->desc_.push(desc)) {
+      if (!block) {
+        this->dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      stalled = true;
+      usleep(50);
+    }
+
+    if (stalled) {
+      this->stalled_.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->pushed_.fetch_add(1, std::memory_order_relaxed);
+    this->write_pos_ = (pos + len + DATA_ALIGN - 1) & ~(DATA_ALIGN - 1);
+    return true;
+  }
+
+  bool PacketRing::push_ref(const uint8_t *data, size_t len,
+                            const struct timeval &tv, size_t cap_len,
+                            bool passive, bool block) {
+    Desc desc;
+    desc.ref = data;
+    desc.offset = this->write_pos_;
+    desc.len = static_cast<uint32_t>(len);
+    desc.cap_len = static_cast<uint32_t>(cap_len);
+    desc.tv = tv;
+    desc.passive = passive;
+
+    bool stalled = false;
+    while (!this->desc_.push(desc)) {
+      if (!block) {
+        this->dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      stalled = true;
+      usleep(50);
+    }
+
+    if (stalled) {
+      this->stalled_.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->pushed_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void PacketRing::close() {
+    this->closed_.store(true, std::memory_order_release);
+  }
+
+  const uint8_t *PacketRing::pop(Desc *desc) {
+    if (!this->desc_.pop(desc)) {
+      return NULL;
+    }
+    if (desc->ref) {
+      return desc->ref;
+    }
+    return this->buf_ + (desc->offset % this->buf_size_);
+  }
+
+  void PacketRing::release(const Desc &desc) {
+    // Buffer before offset of referenced data is already consumed.
+    const uint64_t pos = desc.ref ? desc.offset : desc.offset + desc.len;
+    this->release_pos_.store(pos, std::memory_order_release);
+  }
+
+  bool PacketRing::closed() const {
+    return this->closed_.load(std::memory_order_acquire);
+  }
+}
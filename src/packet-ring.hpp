@@ -0,0 +1,98 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_PACKET_RING_H__
+#define SRC_PACKET_RING_H__
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "./spsc-ring.hpp"
+
+namespace devourer {
+  // PacketRing passes packets from a capture thread to a worker thread.
+  // Packet data is copied into a byte ring buffer that is recycled in order
+  // of consumption, and descriptors pointing to the data are passed through
+  // SpscRing. One producer and one consumer only.
+  class PacketRing {
+  public:
+    struct Desc {
+      const uint8_t *ref;  // Packet data not copied, or NULL
+      uint64_t offset;     // Position in the buffer
+      uint32_t len;        // Captured length
+      uint32_t cap_len;    // Original length
+      struct timeval tv;
+      bool passive;
+    };
+
+  private:
+    SpscRing<Desc> desc_;
+    uint8_t *buf_;
+    const size_t buf_size_;
+    uint64_t write_pos_;                 // Producer only
+    std::atomic<uint64_t> release_pos_;  // Written by consumer
+    std::atomic<bool> closed_;
+
+    // Written by producer only, readable from any thread.
+    std::atomic<uint64_t> pushed_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> stalled_;
+
+    PacketRing(const PacketRing&);
+    PacketRing& operator=(const PacketRing&);
+
+  public:
+    static const size_t DEFAULT_DESC_COUNT = 16384;
+    static const size_t DEFAULT_BUF_SIZE = 16 * 1024 * 1024;
+
+    PacketRing(size_t desc_count = DEFAULT_DESC_COUNT,
+               size_t buf_size = DEFAULT_BUF_SIZE);
+    ~PacketRing();
+
+    // Producer side. If block is true, wait until the consumer releases
+    // space (back-pressure), otherwise drop the packet and return false.
+    bool push(const uint8_t *data, size_t len, const struct timeval &tv,
+              size_t cap_len, bool passive, bool block);
+    // Pass data by reference. It must be valid until the consumer finishes.
+    bool push_ref(const uint8_t *data, size_t len, const struct timeval &tv,
+                  size_t cap_len, bool passive, bool block);
+    void close();
+
+    // Consumer side. Return packet data or NULL if the ring is empty. The
+    // data is valid until release() of the descriptor.
+    const uint8_t *pop(Desc *desc);
+    void release(const Desc &desc);
+    bool closed() const;
+
+    uint64_t pushed() const { return this->pushed_.load(); }
+    uint64_t dropped() const { return this->dropped_.load(); }
+    uint64_t stalled() const { return this->stalled_.load(); }
+    size_t queued() const { return this->desc_.size(); }
+  };
+}
+
+#endif  // SRC_PACKET_RING_H__
@@ -0,0 +1,368 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <assert.h>
+#include <algorithm>
+
+#include "./record.hpp"
+
+namespace devourer {
+  namespace msgpack {
+    // Extend buf by len bytes and return the head of them.
+    static inline uint8_t *grow(std::vector<uint8_t> *buf, size_t len) {
+      const size_t pos = buf->size();
+      buf->resize(pos + len);
+      return &(*buf)[pos];
+    }
+
+    static inline void put_code(std::vector<uint8_t> *buf, uint8_t code,
+                                uint64_t v, size_t len) {
+      uint8_t *p = grow(buf, 1 + len);
+      p[0] = code;
+      for (size_t i = len; i > 0; i--) {
+        p[i] = static_cast<uint8_t>(v);
+        v >>= 8;
+      }
+    }
+
+    static inline void put_size(std::vector<uint8_t> *buf, size_t n,
+                                uint8_t fix_type, size_t fix_max,
+                                uint8_t code8, uint8_t code16,
+                                uint8_t code32) {
+      if (n <= fix_max) {
+        buf->push_back(fix_type | static_cast<uint8_t>(n));
+      } else if (code8 != 0 && n <= 0xff) {
+        put_code(buf, code8, n, 1);
+      } else if (n <= 0xffff) {
+        put_code(buf, code16, n, 2);
+      } else {
+        put_code(buf, code32, n, 4);
+      }
+    }
+
+    void pack_str(std::vector<uint8_t> *buf, const void *ptr, size_t len) {
+      // No str8, strings of 32 bytes or more are raw16 of msgpack-c 0.5.
+      put_size(buf, len, 0xa0, 31, 0, 0xda, 0xdb);
+      memcpy(grow(buf, len), ptr, len);
+    }
+
+    void pack_uint(std::vector<uint8_t> *buf, uint64_t v) {
+      if (v < 0x80) {
+        buf->push_back(static_cast<uint8_t>(v));
+      } else if (v <= 0xff) {
+        put_code(buf, 0xcc, v, 1);
+      } else if (v <= 0xffff) {
+        put_code(buf, 0xcd, v, 2);
+      } else if (v <= 0xffffffffULL) {
+        put_code(buf, 0xce, v, 4);
+      } else {
+        put_code(buf, 0xcf, v, 8);
+      }
+    }
+
+    void pack_int(std::vector<uint8_t> *buf, int64_t v) {
+      if (v >= 0) {
+        pack_uint(buf, static_cast<uint64_t>(v));
+      } else if (v >= -32) {
+        buf->push_back(static_cast<uint8_t>(v));
+      } else if (v >= INT8_MIN) {
+        put_code(buf, 0xd0, static_cast<uint64_t>(v), 1);
+      } else if (v >= INT16_MIN) {
+        put_code(buf, 0xd1, static_cast<uint64_t>(v), 2);
+      } else if (v >= INT32_MIN) {
+        put_code(buf, 0xd2, static_cast<uint64_t>(v), 4);
+      } else {
+        put_code(buf, 0xd3, static_cast<uint64_t>(v), 8);
+      }
+    }
+
+    void pack_double(std::vector<uint8_t> *buf, double v) {
+      uint64_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      put_code(buf, 0xcb, bits, 8);
+    }
+
+    void pack_map(std::vector<uint8_t> *buf, size_t n) {
+      put_size(buf, n, 0x80, 15, 0, 0xde, 0xdf);
+    }
+
+    void pack_array(std::vector<uint8_t> *buf, size_t n) {
+      put_size(buf, n, 0x90, 15, 0, 0xdc, 0xdd);
+    }
+
+    void pack_nil(std::vector<uint8_t> *buf) {
+      buf->push_back(0xc0);
+    }
+
+    // ------------------------------------------------------------
+    // class Reader
+    //
+    static inline uint64_t get_be(const uint8_t *p, size_t len) {
+      uint64_t v = 0;
+      for (size_t i = 0; i < len; i++) {
+        v = (v << 8) | p[i];
+      }
+      return v;
+    }
+
+    Reader::Type Reader::next_type() const {
+      if (this->empty()) {
+        return NONE;
+      }
+      const uint8_t c = *this->ptr_;
+      if (c < 0x80 || (c >= 0xcc && c <= 0xcf)) {
+        return UINT;
+      } else if (c >= 0xe0 || (c >= 0xd0 && c <= 0xd3)) {
+        return INT;
+      } else if ((c & 0xe0) == 0xa0 || (c >= 0xd9 && c <= 0xdb)) {
+        return STR;
+      } else if ((c & 0xf0) == 0x80 || c == 0xde || c == 0xdf) {
+        return MAP;
+      } else if ((c & 0xf0) == 0x90 || c == 0xdc || c == 0xdd) {
+        return ARRAY;
+      } else if (c == 0xcb) {
+        return DOUBLE;
+      } else if (c == 0xc0) {
+        return NIL;
+      }
+      return NONE;
+    }
+
+    bool Reader::read_size(uint8_t fix_mask, uint8_t fix_type,
+                           uint8_t fix_max, uint8_t code8, uint8_t code16,
+                           uint8_t code32, size_t *n) {
+      if (this->empty()) {
+        return false;
+      }
+      const uint8_t c = *this->ptr_;
+      size_t len;
+      if ((c & fix_mask) == fix_type) {
+        *n = c & fix_max;
+        len = 0;
+      } else if (code8 != 0 && c == code8) {
+        len = 1;
+      } else if (c == code16) {
+        len = 2;
+      } else if (c == code32) {
+        len = 4;
+      } else {
+        return false;
+      }
+      if (this->end_ - this->ptr_ < static_cast<ptrdiff_t>(1 + len)) {
+        return false;
+      }
+      if (len > 0) {
+        *n = get_be(this->ptr_ + 1, len);
+      }
+      this->ptr_ += 1 + len;
+      return true;
+    }
+
+    bool Reader::read_str(const char **str, size_t *len) {
+      const uint8_t *saved = this->ptr_;
+      if (!this->read_size(0xe0, 0xa0, 0x1f, 0xd9, 0xda, 0xdb, len)) {
+        return false;
+      }
+      if (this->end_ - this->ptr_ < static_cast<ptrdiff_t>(*len)) {
+        this->ptr_ = saved;
+        return false;
+      }
+      *str = reinterpret_cast<const char*>(this->ptr_);
+      this->ptr_ += *len;
+      return true;
+    }
+
+    bool Reader::read_uint(uint64_t *v) {
+      if (this->empty()) {
+        return false;
+      }
+      const uint8_t c = *this->ptr_;
+      if (c < 0x80) {
+        *v = c;
+        this->ptr_++;
+        return true;
+      }
+      if (c < 0xcc || c > 0xcf) {
+        return false;
+      }
+      const size_t len = static_cast<size_t>(1) << (c - 0xcc);
+      if (this->end_ - this->ptr_ < static_cast<ptrdiff_t>(1 + len)) {
+        return false;
+      }
+      *v = get_be(this->ptr_ + 1, len);
+      this->ptr_ += 1 + len;
+      return true;
+    }
+
+    bool Reader::read_int(int64_t *v) {
+      if (this->empty()) {
+        return false;
+      }
+      const uint8_t c = *this->ptr_;
+      if (c >= 0xe0) {
+        *v = static_cast<int8_t>(c);
+        this->ptr_++;
+        return true;
+      }
+      if (c < 0xd0 || c > 0xd3) {
+        return false;
+      }
+      const size_t len = static_cast<size_t>(1) << (c - 0xd0);
+      if (this->end_ - this->ptr_ < static_cast<ptrdiff_t>(1 + len)) {
+        return false;
+      }
+      const uint64_t raw = get_be(this->ptr_ + 1, len);
+      switch (len) {
+      case 1: *v = static_cast<int8_t>(raw);  break;
+      case 2: *v = static_cast<int16_t>(raw); break;
+      case 4: *v = static_cast<int32_t>(raw); break;
+      default: *v = static_cast<int64_t>(raw); break;
+      }
+      this->ptr_ += 1 + len;
+      return true;
+    }
+
+    bool Reader::read_double(double *v) {
+      if (this->end_ - this->ptr_ < 9 || *this->ptr_ != 0xcb) {
+        return false;
+      }
+      const uint64_t bits = get_be(this->ptr_ + 1, 8);
+      memcpy(v, &bits, sizeof(bits));
+      this->ptr_ += 9;
+      return true;
+    }
+
+    bool Reader::read_map(size_t *n) {
+      return this->read_size(0xf0, 0x80, 0x0f, 0, 0xde, 0xdf, n);
+    }
+
+    bool Reader::read_array(size_t *n) {
+      return this->read_size(0xf0, 0x90, 0x0f, 0, 0xdc, 0xdd, n);
+    }
+
+    bool Reader::read_nil() {
+      if (this->empty() || *this->ptr_ != 0xc0) {
+        return false;
+      }
+      this->ptr_++;
+      return true;
+    }
+
+    bool Reader::skip() {
+      const char *s;
+      size_t n;
+      uint64_t u;
+      int64_t i;
+      double d;
+
+      switch (this->next_type()) {
+      case STR:    return this->read_str(&s, &n);
+      case UINT:   return this->read_uint(&u);
+      case INT:    return this->read_int(&i);
+      case DOUBLE: return this->read_double(&d);
+      case NIL:    return this->read_nil();
+      case MAP:
+        if (!this->read_map(&n)) {
+          return false;
+        }
+        n *= 2;
+        break;
+      case ARRAY:
+        if (!this->read_array(&n)) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+      }
+      for (size_t k = 0; k < n; k++) {
+        if (!this->skip()) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+
+  // ------------------------------------------------------------
+  // class RecordSchema
+  //
+  const char RecordSchema::TAG_PREFIX[] = "devourer.";
+  const size_t RecordSchema::MAX_KEYS;
+
+  RecordSchema::RecordSchema(const std::string &tag,
+                             const std::vector<std::string> &keys)
+    throw(Exception) : tag_(tag) {
+    if (keys.size() > MAX_KEYS) {
+      throw Exception("Too many keys for " + tag);
+    }
+    if (!std::is_sorted(keys.begin(), keys.end())) {
+      throw Exception("Keys must be sorted for " + tag);
+    }
+
+    const std::string full_tag = std::string(TAG_PREFIX) + tag;
+    msgpack::pack_str(&this->tag_bytes_, full_tag.data(), full_tag.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      this->key_pos_.push_back(this->key_bytes_.size());
+      msgpack::pack_str(&this->key_bytes_, keys[i].data(), keys[i].size());
+    }
+    this->key_pos_.push_back(this->key_bytes_.size());
+  }
+
+  // ------------------------------------------------------------
+  // class RecordWriter
+  //
+  void RecordWriter::begin(std::vector<uint8_t> *buf,
+                           const RecordSchema &schema, time_t ts) {
+    this->buf_ = buf;
+    this->schema_ = &schema;
+    this->start_ = buf->size();
+    this->count_ = 0;
+    this->next_ = 0;
+
+    msgpack::pack_array(buf, 3);
+    const std::vector<uint8_t> &tag = schema.tag_bytes();
+    memcpy(msgpack::grow(buf, tag.size()), tag.data(), tag.size());
+    msgpack::pack_uint(buf, static_cast<uint64_t>(ts));
+    // Number of fields is set by end(), and always fits in fixmap.
+    this->map_pos_ = buf->size();
+    buf->push_back(0x80);
+  }
+
+  void RecordWriter::put_key(size_t idx) {
+    assert(idx >= this->next_ && idx < this->schema_->size());
+    size_t len;
+    const uint8_t *key = this->schema_->key(idx, &len);
+    memcpy(msgpack::grow(this->buf_, len), key, len);
+    this->count_++;
+    this->next_ = idx + 1;
+  }
+
+  size_t RecordWriter::end() {
+    (*this->buf_)[this->map_pos_] = 0x80 | static_cast<uint8_t>(this->count_);
+    return this->buf_->size() - this->start_;
+  }
+}
@@ -0,0 +1,157 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_RECORD_H__
+#define SRC_RECORD_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "./devourer.hpp"
+
+namespace devourer {
+  // Encoders of msgpack with the smallest format for each value, same as
+  // msgpack-c 0.5 packer that libfluent uses. Strings have no str8 of the
+  // current spec, the reader accepts it.
+  namespace msgpack {
+    void pack_str(std::vector<uint8_t> *buf, const void *ptr, size_t len);
+    void pack_uint(std::vector<uint8_t> *buf, uint64_t v);
+    void pack_int(std::vector<uint8_t> *buf, int64_t v);
+    void pack_double(std::vector<uint8_t> *buf, double v);
+    void pack_map(std::vector<uint8_t> *buf, size_t n);
+    void pack_array(std::vector<uint8_t> *buf, size_t n);
+    void pack_nil(std::vector<uint8_t> *buf);
+
+    // Decoder of the formats above. All methods return false if the next
+    // value is not the type or is truncated.
+    class Reader {
+    private:
+      const uint8_t *ptr_;
+      const uint8_t *end_;
+      bool read_size(uint8_t fix_mask, uint8_t fix_type, uint8_t fix_max,
+                     uint8_t code8, uint8_t code16, uint8_t code32,
+                     size_t *n);
+
+    public:
+      enum Type { NONE, STR, UINT, INT, DOUBLE, MAP, ARRAY, NIL };
+      Reader(const uint8_t *ptr, size_t len) : ptr_(ptr), end_(ptr + len) {}
+      const uint8_t *ptr() const { return this->ptr_; }
+      bool empty() const { return this->ptr_ >= this->end_; }
+      Type next_type() const;
+      bool read_str(const char **str, size_t *len);
+      bool read_uint(uint64_t *v);
+      bool read_int(int64_t *v);
+      bool read_double(double *v);
+      bool read_map(size_t *n);
+      bool read_array(size_t *n);
+      bool read_nil();
+      // Skip the next value including nested ones.
+      bool skip();
+    };
+  }
+
+  // RecordSchema is a fixed set of keys for a tag. The tag and keys are
+  // encoded once, and records are written without string keys. Keys must
+  // be sorted, that is the order of fluent::Message.
+  class RecordSchema {
+  private:
+    std::string tag_;
+    std::vector<uint8_t> tag_bytes_;
+    std::vector<uint8_t> key_bytes_;
+    std::vector<size_t> key_pos_;  // Offsets in key_bytes_, and the end
+
+  public:
+    static const char TAG_PREFIX[];
+    static const size_t MAX_KEYS = 15;  // Fits in fixmap
+    RecordSchema(const std::string &tag, const std::vector<std::string> &keys)
+      throw(Exception);
+    const std::string& tag() const { return this->tag_; }
+    size_t size() const { return this->key_pos_.size() - 1; }
+    const std::vector<uint8_t>& tag_bytes() const { return this->tag_bytes_; }
+    const uint8_t *key(size_t idx, size_t *len) const {
+      *len = this->key_pos_[idx + 1] - this->key_pos_[idx];
+      return &this->key_bytes_[this->key_pos_[idx]];
+    }
+  };
+
+  // RecordWriter appends a record of fluentd forward format, [tag, time,
+  // {key: value, ...}], to a buffer. Fields are given by index of keys in
+  // increasing order, and may be skipped.
+  class RecordWriter {
+  private:
+    std::vector<uint8_t> *buf_;
+    const RecordSchema *schema_;
+    size_t start_;
+    size_t map_pos_;
+    size_t count_;
+    size_t next_;  // Smallest index of the next field
+
+    void put_key(size_t idx);
+
+  public:
+    RecordWriter() : buf_(NULL), schema_(NULL), start_(0), map_pos_(0),
+                     count_(0), next_(0) {}
+    void begin(std::vector<uint8_t> *buf, const RecordSchema &schema,
+               time_t ts);
+    void put_str(size_t idx, const std::string &v) {
+      this->put_key(idx);
+      msgpack::pack_str(this->buf_, v.data(), v.size());
+    }
+    void put_str(size_t idx, const char *v) {
+      this->put_key(idx);
+      msgpack::pack_str(this->buf_, v, strlen(v));
+    }
+    void put_uint(size_t idx, uint64_t v) {
+      this->put_key(idx);
+      msgpack::pack_uint(this->buf_, v);
+    }
+    void put_int(size_t idx, int64_t v) {
+      this->put_key(idx);
+      msgpack::pack_int(this->buf_, v);
+    }
+    void put_double(size_t idx, double v) {
+      this->put_key(idx);
+      msgpack::pack_double(this->buf_, v);
+    }
+    // Nested map of n entries, followed by n pairs of map_key() and a
+    // value of map_*().
+    void put_map(size_t idx, size_t n) {
+      this->put_key(idx);
+      msgpack::pack_map(this->buf_, n);
+    }
+    void map_key(const char *key) {
+      msgpack::pack_str(this->buf_, key, strlen(key));
+    }
+    void map_uint(uint64_t v) { msgpack::pack_uint(this->buf_, v); }
+    // Return size of the record in bytes.
+    size_t end();
+  };
+}
+
+#endif  // SRC_RECORD_H__
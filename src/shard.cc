@@ -0,0 +1,414 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include "../external/swarm/src/swarm.hpp"
+
+#include "./shard.hpp"
+#include "./capture.hpp"
+#include "./module.hpp"
+#include "./modules/dns.hpp"
+#include "./modules/flow.hpp"
+#include "./modules/local.hpp"
+#include "./tuple-hash.hpp"
+
+namespace devourer {
+  static const RecordSchema capture_stats_schema("capture.stats", {
+      "drops", "packets",
+    });
+  enum {
+    STATS_DROPS, STATS_PACKETS,
+  };
+
+  // Counters are totals since start, and rates are given by differences of
+  // records.
+  static const RecordSchema stats_schema("stats", {
+      "cycles", "emitted", "events", "packets", "shard", "table_lookups",
+      "table_probes", "table_size", "table_slabs",
+    });
+  enum {
+    STATS_CYCLES, STATS_EMITTED, STATS_EVENTS, STATS_SHARD_PACKETS,
+    STATS_SHARD, STATS_TABLE_LOOKUPS, STATS_TABLE_PROBES, STATS_TABLE_SIZE,
+    STATS_TABLE_SLABS,
+  };
+
+  // ------------------------------------------------------------
+  // class Shard
+  //
+  const time_t Shard::STATS_INTERVAL;
+
+  Shard::Shard(Output *output, size_t id) :
+    netdec_(new swarm::NetDec()), id_(id), kernel_drops_(0), next_stats_(0)
+  {
+    if (output == NULL) {
+      this->emitter_ = new Emitter(Emitter::DEFAULT_BATCH_SIZE,
+                                   Emitter::DEFAULT_QUEUE_SIZE);
+    } else {
+      this->emitter_ = new Emitter(output);
+    }
+
+    ModDns *mod_dns = new ModDns();
+    ModFlow *mod_flow = new ModFlow(mod_dns);
+    ModLocal *mod_local = new ModLocal();
+    this->install_module(mod_dns);
+    this->install_module(mod_flow);
+    this->install_module(mod_local);
+    this->mod_dns_ = mod_dns;
+    this->mod_flow_ = mod_flow;
+  }
+
+  Shard::~Shard() {
+    this->close();
+    this->join();
+    for (size_t i = 0; i < this->modules_.size(); i++) {
+      delete this->modules_[i];
+    }
+    delete this->netdec_;
+    delete this->emitter_;
+  }
+
+  void Shard::install_module(Module *module) throw(Exception) {
+    const std::vector<std::string> &ev_set = module->recv_event();
+    for(size_t i = 0; i < ev_set.size(); i++) {
+      swarm::ev_id eid = this->netdec_->lookup_event_id(ev_set[i]);
+      swarm::hdlr_id hid = this->netdec_->set_handler(eid, module);
+      if (hid == swarm::HDLR_NULL) {
+        throw Exception(this->netdec_->errmsg());
+      }
+      module->bind_event_id(ev_set[i], eid);
+    }
+
+    module->set_emitter(this->emitter_);
+    this->modules_.push_back(module);
+    this->next_task_.push_back(0);
+  }
+
+  bool Shard::input(const uint8_t *data, const size_t len,
+                    const struct timeval &tv, const size_t cap_len,
+                    bool passive) {
+    this->packets_.add();
+    this->run_tasks(msec_of(tv));
+    if (!passive) {
+      return this->netdec_->input(data, len, tv, cap_len);
+    }
+
+    for (size_t i = 0; i < this->modules_.size(); i++) {
+      this->modules_[i]->set_passive(true);
+    }
+    bool rc = this->netdec_->input(data, len, tv, cap_len);
+    for (size_t i = 0; i < this->modules_.size(); i++) {
+      this->modules_[i]->set_passive(false);
+    }
+    return rc;
+  }
+
+  size_t Shard::input_batch(const Packet *pkts, size_t count) {
+    static const size_t PREFETCH_DIST = 4;
+    if (count == 0) {
+      return 0;
+    }
+    this->packets_.add(count);
+
+    // Expire state once for the batch, then modules only compare time for
+    // each packet until the next millisecond.
+    const uint64_t msec = msec_of(pkts[0].tv);
+    for (size_t i = 0; i < this->modules_.size(); i++) {
+      this->modules_[i]->update_time(msec);
+    }
+    this->run_tasks(msec);
+
+    // Tuple hash is computed PREFETCH_DIST packets ahead of decoding to
+    // prefetch the flow entry and the packet header.
+    uint64_t tuple_hv[PREFETCH_DIST];
+    bool dns_answer;
+    for (size_t i = 0; i < count && i < PREFETCH_DIST; i++) {
+      tuple_hv[i] = tuple_hash(pkts[i].data, pkts[i].len, &dns_answer);
+      this->mod_flow_->prefetch(tuple_hv[i]);
+    }
+
+    size_t decoded = 0;
+    for (size_t i = 0; i < count; i++) {
+      const uint64_t curr_hv = tuple_hv[i % PREFETCH_DIST];
+      const size_t ahead = i + PREFETCH_DIST;
+      if (ahead < count) {
+        const uint64_t hv = tuple_hash(pkts[ahead].data, pkts[ahead].len,
+                                       &dns_answer);
+        tuple_hv[ahead % PREFETCH_DIST] = hv;
+        this->mod_flow_->prefetch(hv);
+      }
+
+      this->mod_flow_->set_tuple_hash(curr_hv);
+      if (this->netdec_->input(pkts[i].data, pkts[i].len, pkts[i].tv,
+                               pkts[i].cap_len)) {
+        decoded++;
+      }
+    }
+    this->mod_flow_->set_tuple_hash(0);
+
+    return decoded;
+  }
+
+  // Periodic tasks of modules run by packet time before packets of msec,
+  // same as expiry of their tables, then replay of a file has the same
+  // intervals as live capture. Intervals without packets are run once.
+  void Shard::run_tasks(uint64_t msec) {
+    for (size_t i = 0; i < this->modules_.size(); i++) {
+      const int interval = this->modules_[i]->task_interval();
+      if (interval <= 0 || msec < this->next_task_[i]) {
+        continue;
+      }
+      if (this->next_task_[i] > 0) {
+        struct timespec ts;
+        ts.tv_sec = msec / 1000;
+        ts.tv_nsec = (msec % 1000) * 1000000;
+        this->modules_[i]->exec(ts);
+      }
+      const uint64_t step = static_cast<uint64_t>(interval) * 1000;
+      this->next_task_[i] = (msec / step + 1) * step;
+    }
+  }
+
+  // Stats and flush of batches are by wall clock, also while no packet
+  // comes.
+  void Shard::exec_tasks() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (ts.tv_sec >= this->next_stats_) {
+      if (this->next_stats_ > 0) {
+        this->emit_stats(ts);
+      }
+      this->next_stats_ = ts.tv_sec + STATS_INTERVAL;
+    }
+    this->emitter_->tick(ts);
+  }
+
+  void Shard::emit_stats(const struct timespec &ts) {
+    RecordWriter *w = this->emitter_->begin(stats_schema, ts.tv_sec);
+    if (w == NULL) {
+      return;
+    }
+    const size_t n = this->modules_.size();
+    w->put_map(STATS_CYCLES, n);
+    for (size_t i = 0; i < n; i++) {
+      w->map_key(this->modules_[i]->name());
+      w->map_uint(this->modules_[i]->stats().cycles.get());
+    }
+    // Including this record.
+    const size_t tags = this->emitter_->tags();
+    w->put_map(STATS_EMITTED, tags);
+    for (size_t i = 0; i < tags; i++) {
+      w->map_key(this->emitter_->tag(i).c_str());
+      w->map_uint(this->emitter_->tag_emitted(i));
+    }
+    w->put_map(STATS_EVENTS, n);
+    for (size_t i = 0; i < n; i++) {
+      w->map_key(this->modules_[i]->name());
+      w->map_uint(this->modules_[i]->stats().events.get());
+    }
+    w->put_uint(STATS_SHARD_PACKETS, this->packets_.get());
+    w->put_uint(STATS_SHARD, this->id_);
+
+    std::vector<TableStats> &tables = this->table_stats_;
+    tables.clear();
+    for (size_t i = 0; i < n; i++) {
+      this->modules_[i]->table_stats(&tables);
+    }
+    w->put_map(STATS_TABLE_LOOKUPS, tables.size());
+    for (size_t i = 0; i < tables.size(); i++) {
+      w->map_key(tables[i].name);
+      w->map_uint(tables[i].lookups);
+    }
+    w->put_map(STATS_TABLE_PROBES, tables.size());
+    for (size_t i = 0; i < tables.size(); i++) {
+      w->map_key(tables[i].name);
+      w->map_uint(tables[i].probes);
+    }
+    w->put_map(STATS_TABLE_SIZE, tables.size());
+    for (size_t i = 0; i < tables.size(); i++) {
+      w->map_key(tables[i].name);
+      w->map_uint(tables[i].size);
+    }
+    w->put_map(STATS_TABLE_SLABS, tables.size());
+    for (size_t i = 0; i < tables.size(); i++) {
+      w->map_key(tables[i].name);
+      w->map_uint(tables[i].slabs);
+    }
+    this->emitter_->commit();
+  }
+
+  void Shard::run() {
+    static const size_t BATCH_SIZE = 32;
+    static const size_t TASK_CHECK = 1024;  // Packets between task checks
+    Packet batch[BATCH_SIZE];
+    PacketRing::Desc desc;
+    size_t since_task = 0;
+
+    for (;;) {
+      // Packets pushed before close() must be processed.
+      const bool closed = this->ring_.closed();
+      size_t popped = 0, n = 0;
+      const uint8_t *data;
+
+      // Passive packets are rare (DNS answers), and decoded one by one.
+      while (popped < BATCH_SIZE &&
+             NULL != (data = this->ring_.pop(&desc))) {
+        popped++;
+        if (desc.passive) {
+          this->input_batch(batch, n);
+          n = 0;
+          this->input(data, desc.len, desc.tv, desc.cap_len, true);
+        } else {
+          batch[n].data = data;
+          batch[n].len = desc.len;
+          batch[n].cap_len = desc.cap_len;
+          batch[n].tv = desc.tv;
+          n++;
+        }
+      }
+
+      if (popped == 0) {
+        if (closed) {
+          break;
+        }
+        this->exec_tasks();
+        usleep(100);
+        continue;
+      }
+
+      this->input_batch(batch, n);
+      // Data of all packets in the batch is kept until here.
+      this->ring_.release(desc);
+
+      since_task += popped;
+      if (since_task >= TASK_CHECK) {
+        this->exec_tasks();
+        since_task = 0;
+      }
+    }
+    this->emitter_->flush();
+  }
+
+  void Shard::drain_passive() {
+    PacketRing::Desc desc;
+    const uint8_t *data;
+    while (NULL != (data = this->ring_.pop(&desc))) {
+      this->input(data, desc.len, desc.tv, desc.cap_len, true);
+      this->ring_.release(desc);
+    }
+  }
+
+  void Shard::emit_capture_stats(Capture *cap, const struct timespec &ts) {
+    uint64_t packets, drops;
+    if (!cap->stats(&packets, &drops)) {
+      return;
+    }
+    this->kernel_drops_ += drops;
+
+    // Counts since the last report.
+    RecordWriter *w = this->emitter_->begin(capture_stats_schema, ts.tv_sec);
+    if (w) {
+      w->put_uint(STATS_DROPS, drops);
+      w->put_uint(STATS_PACKETS, packets);
+      this->emitter_->commit();
+    }
+  }
+
+  void Shard::run_capture(Capture *cap, const std::vector<Shard*> *peers) {
+    static const size_t TASK_CHECK = 1024;
+    Packet pkt;
+    size_t since_task = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    time_t next_stats = ts.tv_sec + STATS_INTERVAL;
+
+    while (!this->ring_.closed()) {
+      this->drain_passive();
+
+      const Capture::Status st = cap->next(&pkt);
+      if (st == Capture::READ) {
+        bool dns_answer = false;
+        const uint64_t hv = tuple_hash(pkt.data, pkt.len, &dns_answer);
+        if (dns_answer) {
+          for (size_t i = 0; i < peers->size(); i++) {
+            if ((*peers)[i] != this) {
+              (*peers)[i]->push_shared(pkt.data, pkt.len, pkt.tv,
+                                       pkt.cap_len);
+            }
+          }
+        }
+        this->mod_flow_->set_tuple_hash(hv);
+        this->packets_.add();
+        this->run_tasks(msec_of(pkt.tv));
+        this->netdec_->input(pkt.data, pkt.len, pkt.tv, pkt.cap_len);
+        this->mod_flow_->set_tuple_hash(0);
+        if (++since_task < TASK_CHECK) {
+          continue;
+        }
+      } else if (st == Capture::END) {
+        break;
+      }
+
+      since_task = 0;
+      this->exec_tasks();
+      clock_gettime(CLOCK_REALTIME, &ts);
+      if (ts.tv_sec >= next_stats) {
+        this->emit_capture_stats(cap, ts);
+        next_stats = ts.tv_sec + STATS_INTERVAL;
+      }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    this->emit_capture_stats(cap, ts);
+    this->emitter_->flush();
+  }
+
+  void Shard::start() {
+    this->thread_ = std::thread(&Shard::run, this);
+  }
+
+  void Shard::start(Capture *cap, const std::vector<Shard*> *peers) {
+    this->thread_ = std::thread(&Shard::run_capture, this, cap, peers);
+  }
+
+  bool Shard::push_shared(const uint8_t *data, const size_t len,
+                          const struct timeval &tv, const size_t cap_len) {
+    // Peers push concurrently, and never wait for this shard because it may
+    // wait for them as well.
+    std::lock_guard<std::mutex> lock(this->push_lock_);
+    return this->ring_.push(data, len, tv, cap_len, true, false);
+  }
+
+  void Shard::close() {
+    this->ring_.close();
+  }
+
+  void Shard::join() {
+    if (this->thread_.joinable()) {
+      this->thread_.join();
+    }
+  }
+}
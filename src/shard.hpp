@@ -0,0 +1,135 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_SHARD_H__
+#define SRC_SHARD_H__
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "./devourer.hpp"
+#include "./packet-ring.hpp"
+#include "./emitter.hpp"
+#include "./stats.hpp"
+
+namespace swarm {
+  class NetDec;
+}
+
+namespace devourer {
+  class Module;
+  class ModDns;
+  class ModFlow;
+  class Capture;
+  class Output;
+
+  // Shard has a decoder and own instances of modules, so that flow and DNS
+  // state are not shared with other shards. A shard is used synchronously by
+  // Devourer::input(), or runs in own worker thread in sharded mode.
+  class Shard {
+  private:
+    swarm::NetDec *netdec_;
+    size_t id_;
+    Emitter *emitter_;
+    std::vector<Module*> modules_;
+    ModDns *mod_dns_;
+    ModFlow *mod_flow_;
+    std::vector<uint64_t> next_task_;  // msec of packet time
+
+    std::thread thread_;
+    PacketRing ring_;
+    std::mutex push_lock_;
+    std::atomic<uint64_t> kernel_drops_;
+    Counter packets_;
+    time_t next_stats_;
+    std::vector<TableStats> table_stats_;
+
+    void install_module(Module *module) throw(Exception);
+    void run();
+    void run_capture(Capture *cap, const std::vector<Shard*> *peers);
+    void drain_passive();
+    void emit_capture_stats(Capture *cap, const struct timespec &ts);
+    void emit_stats(const struct timespec &ts);
+    void exec_tasks();
+    void run_tasks(uint64_t msec);
+
+  public:
+    // Seconds between capture.stats and stats records.
+    static const time_t STATS_INTERVAL = 10;
+
+    // Records are written to output. If output is NULL, records are queued
+    // in emitter() to be drained by the output thread. id is reported in
+    // stats records.
+    explicit Shard(Output *output, size_t id = 0);
+    ~Shard();
+    swarm::NetDec *netdec() const { return this->netdec_; }
+    const std::vector<Module*>& modules() const { return this->modules_; }
+    ModDns *mod_dns() const { return this->mod_dns_; }
+    ModFlow *mod_flow() const { return this->mod_flow_; }
+    Emitter *emitter() const { return this->emitter_; }
+
+    // Decode a packet in the calling thread.
+    bool input(const uint8_t *data, const size_t len,
+               const struct timeval &tv, const size_t cap_len = 0,
+               bool passive = false);
+    size_t input_batch(const Packet *pkts, size_t count);
+
+    // Worker thread. push() and close() are called by one capture thread.
+    // push() waits for the worker if block is true, otherwise the packet is
+    // dropped when the ring is full.
+    void start();
+    bool push(const uint8_t *data, const size_t len,
+              const struct timeval &tv, const size_t cap_len,
+              bool passive, bool block) {
+      return this->ring_.push(data, len, tv, cap_len, passive, block);
+    }
+    bool push_ref(const uint8_t *data, const size_t len,
+                  const struct timeval &tv, const size_t cap_len,
+                  bool passive, bool block) {
+      return this->ring_.push_ref(data, len, tv, cap_len, passive, block);
+    }
+    void close();
+    void join();
+    const PacketRing& ring() const { return this->ring_; }
+
+    // Worker thread reading own capture, e.g. an AF_PACKET socket in fanout
+    // group. DNS answers are copied to rings of peers by push_shared(), and
+    // the ring has only them. The shard runs until close().
+    void start(Capture *cap, const std::vector<Shard*> *peers);
+    bool push_shared(const uint8_t *data, const size_t len,
+                     const struct timeval &tv, const size_t cap_len);
+    // Packets dropped by kernel for the capture.
+    uint64_t kernel_drops() const { return this->kernel_drops_.load(); }
+    // Packets given to the decoder, can be read by any thread.
+    uint64_t packets() const { return this->packets_.get(); }
+  };
+}
+
+#endif  // SRC_SHARD_H__
@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_SPSC_RING_H__
+#define SRC_SPSC_RING_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+namespace devourer {
+  // Bounded lock-free ring for exactly one producer thread and one consumer
+  // thread. Capacity is rounded up to power of 2.
+  template <typename T>
+  class SpscRing {
+  private:
+    static const size_t CACHE_LINE = 64;
+
+    std::vector<T> slot_;
+    const size_t mask_;
+    char pad0_[CACHE_LINE];
+    std::atomic<size_t> head_;  // Written by producer
+    size_t tail_cache_;
+    char pad1_[CACHE_LINE];
+    std::atomic<size_t> tail_;  // Written by consumer
+    size_t head_cache_;
+    char pad2_[CACHE_LINE];
+
+    static size_t round_up(size_t n) {
+      size_t cap = 2;
+      while (cap < n) {
+        cap <<= 1;
+      }
+      return cap;
+    }
+
+  public:
+    explicit SpscRing(size_t capacity) :
+      slot_(round_up(capacity)), mask_(round_up(capacity) - 1), head_(0),
+      tail_cache_(0), tail_(0), head_cache_(0) {}
+
+    // Producer side. Return false if the ring is full.
+    bool push(const T &v) {
+      const size_t h = this->head_.load(std::memory_order_relaxed);
+      if (h - this->tail_cache_ > this->mask_) {
+        this->tail_cache_ = this->tail_.load(std::memory_order_acquire);
+        if (h - this->tail_cache_ > this->mask_) {
+          return false;
+        }
+      }
+      this->slot_[h & this->mask_] = v;
+      this->head_.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer side. Return false if the ring is empty.
+    bool pop(T *v) {
+      const size_t t = this->tail_.load(std::memory_order_relaxed);
+      if (t == this->head_cache_) {
+        this->head_cache_ = this->head_.load(std::memory_order_acquire);
+        if (t == this->head_cache_) {
+          return false;
+        }
+      }
+      *v = this->slot_[t & this->mask_];
+      this->tail_.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Approximate number of entries, can be called from any thread.
+    size_t size() const {
+      return this->head_.load(std::memory_order_relaxed) -
+        this->tail_.load(std::memory_order_relaxed);
+    }
+    size_t capacity() const { return this->mask_ + 1; }
+  };
+
+  template <typename T> const size_t SpscRing<T>::CACHE_LINE;
+}
+
+#endif  // SRC_SPSC_RING_H__
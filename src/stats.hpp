@@ -0,0 +1,99 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_STATS_H__
+#define SRC_STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace devourer {
+  // Counter is updated by only one thread and can be read by any thread.
+  // Relaxed load and store do not need a locked instruction, and cost same
+  // as a plain integer.
+  class Counter {
+  private:
+    std::atomic<uint64_t> v_;
+    Counter(const Counter&);
+    Counter& operator=(const Counter&);
+
+  public:
+    Counter() : v_(0) {}
+    void add(uint64_t n = 1) {
+      this->v_.store(this->v_.load(std::memory_order_relaxed) + n,
+                     std::memory_order_relaxed);
+    }
+    uint64_t get() const { return this->v_.load(std::memory_order_relaxed); }
+  };
+
+  // Time stamp counter, or nanoseconds where it is not available.
+  inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+  }
+
+  struct ModuleStats {
+    Counter events;
+    Counter cycles;
+  };
+
+  // Count an event and cycles until the end of scope.
+  class StatScope {
+  private:
+    ModuleStats *stats_;
+    uint64_t start_;
+
+  public:
+    explicit StatScope(ModuleStats *stats) :
+      stats_(stats), start_(cycles()) {}
+    ~StatScope() {
+      this->stats_->events.add();
+      this->stats_->cycles.add(cycles() - this->start_);
+    }
+  };
+
+  // Snapshot of a table of a module, taken by the thread owning it.
+  struct TableStats {
+    const char *name;
+    size_t size;
+    uint64_t lookups;
+    uint64_t probes;  // Groups probed by lookups
+    size_t slabs;     // Allocations by the node pool
+  };
+}
+
+#endif  // SRC_STATS_H__
@@ -0,0 +1,209 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_TIMING_WHEEL_H__
+#define SRC_TIMING_WHEEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace devourer {
+  // Base class of a node scheduled in TimingWheel.
+  class TimerNode {
+    friend class TimingWheel;
+  private:
+    TimerNode *timer_next_;
+    uint64_t timer_expire_;
+  public:
+    TimerNode() : timer_next_(NULL), timer_expire_(0) {}
+  };
+
+  // TimingWheel is a hierarchical timing wheel with LEVELS levels of SLOTS
+  // slots. A node is placed at the level of the highest digit (SLOT_BITS
+  // bits) where its expire tick differs from current tick, then moved to
+  // lower level when the wheel reaches its slot. Memory does not depend on
+  // timeout length, and advance() checks at most LEVELS * SLOTS slots by
+  // bitmap however many ticks it skips. Then a tick can be any unit, e.g.
+  // millisecond.
+  class TimingWheel {
+  private:
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned LEVELS = 6;
+    static const size_t SLOTS = (1 << SLOT_BITS);
+    static const uint64_t SLOT_MASK = SLOTS - 1;
+    static const unsigned WHEEL_BITS = SLOT_BITS * LEVELS;
+
+    TimerNode *slot_[LEVELS][SLOTS];
+    uint64_t occupied_[LEVELS];  // Bitmap of non-empty slots
+    TimerNode *overflow_;        // Beyond range of top level
+    TimerNode *expired_;
+    uint64_t now_;
+
+    static void push_list(TimerNode **head, TimerNode *node) {
+      node->timer_next_ = *head;
+      *head = node;
+    }
+    static TimerNode *pop_list(TimerNode **head) {
+      TimerNode *node = *head;
+      if (node) {
+        *head = node->timer_next_;
+        node->timer_next_ = NULL;
+      }
+      return node;
+    }
+
+    void place(TimerNode *node) {
+      const uint64_t diff = node->timer_expire_ ^ this->now_;
+      if (diff >> WHEEL_BITS) {
+        TimingWheel::push_list(&this->overflow_, node);
+        return;
+      }
+
+      const unsigned level = (63 - __builtin_clzll(diff)) / SLOT_BITS;
+      const size_t s = (node->timer_expire_ >> (level * SLOT_BITS)) &
+        SLOT_MASK;
+      TimingWheel::push_list(&this->slot_[level][s], node);
+      this->occupied_[level] |= (1ULL << s);
+    }
+
+    // Move all nodes in the slot to a list.
+    void take_slot(unsigned level, size_t s, TimerNode **list) {
+      TimerNode *node;
+      while (NULL != (node = TimingWheel::pop_list(&this->slot_[level][s]))) {
+        TimingWheel::push_list(list, node);
+      }
+      this->occupied_[level] &= ~(1ULL << s);
+    }
+
+    template <typename F>
+    void expire_list(TimerNode **list, F &fn) {
+      TimerNode *node;
+      while (NULL != (node = TimingWheel::pop_list(list))) {
+        fn(node);
+        TimingWheel::push_list(&this->expired_, node);
+      }
+    }
+
+  public:
+    TimingWheel() : overflow_(NULL), expired_(NULL), now_(0) {
+      ::memset(this->slot_, 0, sizeof(this->slot_));
+      ::memset(this->occupied_, 0, sizeof(this->occupied_));
+    }
+
+    uint64_t now() const { return this->now_; }
+
+    // Node expires when the wheel is advanced more than tick.
+    void push(TimerNode *node, uint64_t tick) {
+      node->timer_expire_ = this->now_ + tick + 1;
+      this->place(node);
+    }
+
+    // Advance the wheel. fn(TimerNode*) is called for each expired node
+    // before it is moved to expired list.
+    template <typename F>
+    void advance(uint64_t tick, F &fn) {
+      if (tick == 0) {
+        return;
+      }
+
+      const uint64_t prev = this->now_;
+      const uint64_t next = this->now_ + tick;
+      TimerNode *expired = NULL;
+      TimerNode *cascade = NULL;
+
+      // A node at a level has same upper digits with prev. If upper digits
+      // of next differ, all nodes at the level expire. Otherwise, nodes in
+      // slots before the digit of next expire, and nodes in the slot of the
+      // digit need to be placed again.
+      for (unsigned level = 0; level < LEVELS; level++) {
+        uint64_t occ = this->occupied_[level];
+        if (occ == 0) {
+          continue;
+        }
+
+        const unsigned shift = level * SLOT_BITS;
+        const unsigned upper = shift + SLOT_BITS;
+        if ((prev >> upper) != (next >> upper)) {
+          for (; occ; occ &= occ - 1) {
+            this->take_slot(level, __builtin_ctzll(occ), &expired);
+          }
+          continue;
+        }
+
+        const size_t d = (next >> shift) & SLOT_MASK;
+        for (occ &= ((1ULL << d) - 1); occ; occ &= occ - 1) {
+          this->take_slot(level, __builtin_ctzll(occ), &expired);
+        }
+        if (this->occupied_[level] & (1ULL << d)) {
+          this->take_slot(level, d, &cascade);
+        }
+      }
+
+      if ((prev >> WHEEL_BITS) != (next >> WHEEL_BITS)) {
+        TimerNode *node;
+        while (NULL != (node = TimingWheel::pop_list(&this->overflow_))) {
+          TimingWheel::push_list(&cascade, node);
+        }
+      }
+
+      this->now_ = next;
+      TimerNode *node;
+      while (NULL != (node = TimingWheel::pop_list(&cascade))) {
+        if (node->timer_expire_ <= this->now_) {
+          TimingWheel::push_list(&expired, node);
+        } else {
+          this->place(node);
+        }
+      }
+
+      this->expire_list(&expired, fn);
+    }
+
+    // Expire all nodes.
+    template <typename F>
+    void expire_all(F &fn) {
+      TimerNode *expired = NULL;
+      for (unsigned level = 0; level < LEVELS; level++) {
+        for (uint64_t occ = this->occupied_[level]; occ; occ &= occ - 1) {
+          this->take_slot(level, __builtin_ctzll(occ), &expired);
+        }
+      }
+      TimerNode *node;
+      while (NULL != (node = TimingWheel::pop_list(&this->overflow_))) {
+        TimingWheel::push_list(&expired, node);
+      }
+      this->expire_list(&expired, fn);
+    }
+
+    // Pop expired node.
+    TimerNode *pop() {
+      return TimingWheel::pop_list(&this->expired_);
+    }
+  };
+}  // namespace devourer
+
+#endif  // SRC_TIMING_WHEEL_H__
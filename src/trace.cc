@@ -0,0 +1,159 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "./trace.hpp"
+
+namespace devourer {
+  namespace trace {
+    static const char MAGIC[4] = {'D', 'V', 'T', 'R'};
+    static const uint32_t VERSION = 1;
+    static const size_t CHUNK = 64;  // Events copied at once by dump()
+
+    struct Header {
+      char magic[4];
+      uint32_t version;
+      uint32_t event_size;
+      uint32_t reserved;
+    };
+
+    std::atomic<bool> enabled_(false);
+    __thread Ring *local_ = NULL;
+    static std::atomic<Ring*> rings_(NULL);
+    static std::atomic<uint32_t> threads_(0);
+
+    Ring::Ring(uint32_t thread, Ring *next) :
+      head_(0), thread_(thread), next_(next) {
+    }
+
+    void enable(bool on) {
+      enabled_.store(on, std::memory_order_relaxed);
+    }
+
+    Ring *local() {
+      if (local_ == NULL) {
+        Ring *r = new Ring(threads_.fetch_add(1), NULL);
+        Ring *head = rings_.load();
+        do {
+          r->next_ = head;
+        } while (!rings_.compare_exchange_weak(head, r));
+        local_ = r;
+      }
+      return local_;
+    }
+
+    static bool write_all(int fd, const void *data, size_t len) {
+      const uint8_t *p = static_cast<const uint8_t*>(data);
+      while (len > 0) {
+        const ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return false;
+        }
+        p += n;
+        len -= n;
+      }
+      return true;
+    }
+
+    bool dump(int fd) {
+      const Header head = {{MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]},
+                           VERSION, sizeof(Event), 0};
+      if (!write_all(fd, &head, sizeof(head))) {
+        return false;
+      }
+
+      Event buf[CHUNK];
+      for (Ring *r = rings_.load(); r != NULL; r = r->next_) {
+        const uint64_t end = r->head_.load(std::memory_order_acquire);
+        // The oldest slot may be being written by the next event.
+        uint64_t pos = (end >= Ring::SIZE) ? end - Ring::SIZE + 1 : 0;
+        while (pos < end) {
+          const size_t n = std::min<uint64_t>(CHUNK, end - pos);
+          for (size_t i = 0; i < n; i++) {
+            buf[i] = r->events_[(pos + i) & (Ring::SIZE - 1)];
+          }
+          // Slot of pos + i is being overwritten once the head reaches
+          // pos + i + SIZE.
+          std::atomic_thread_fence(std::memory_order_acquire);
+          const uint64_t now = r->head_.load(std::memory_order_relaxed);
+          size_t skip = 0;
+          if (now >= pos + Ring::SIZE) {
+            skip = std::min<uint64_t>(n, now - (pos + Ring::SIZE) + 1);
+          }
+          if (!write_all(fd, buf + skip, (n - skip) * sizeof(Event))) {
+            return false;
+          }
+          pos += n;
+        }
+      }
+      return true;
+    }
+
+    void read(const std::string &path, std::vector<Event> *events)
+      throw(Exception) {
+      FILE *fp = fopen(path.c_str(), "rb");
+      if (fp == NULL) {
+        throw Exception("can not open " + path + ": " + strerror(errno));
+      }
+      Header head;
+      if (fread(&head, sizeof(head), 1, fp) != 1 ||
+          memcmp(head.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+          head.version != VERSION || head.event_size != sizeof(Event)) {
+        fclose(fp);
+        throw Exception("not a trace dump: " + path);
+      }
+
+      Event e;
+      while (fread(&e, sizeof(e), 1, fp) == 1) {
+        events->push_back(e);
+      }
+      fclose(fp);
+    }
+
+    const char *point_name(uint16_t point) {
+      static const char *names[] = {
+        "unknown",
+        "flow.new",
+        "flow.expire",
+        "dns.query",
+        "dns.response",
+        "dns.miss",
+        "dns.timeout",
+        "record.shed",
+        "record.drop",
+      };
+      return (point < POINT_MAX) ? names[point] : names[0];
+    }
+  }
+}
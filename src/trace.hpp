@@ -0,0 +1,144 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_TRACE_H__
+#define SRC_TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "./devourer.hpp"
+#include "./stats.hpp"
+
+// TRACE() records a binary event to the ring of the calling thread while
+// tracing is enabled at runtime. Trace points are compiled only if
+// DEVOURER_TRACE is defined (cmake -DWITH_TRACE=ON), otherwise arguments
+// are not evaluated and no code is generated.
+#ifdef DEVOURER_TRACE
+#define TRACE(P, A, B)                                                  \
+  do {                                                                  \
+    if (devourer::trace::enabled()) {                                   \
+      devourer::trace::record(devourer::trace::P,                       \
+                              static_cast<uint64_t>(A),                 \
+                              static_cast<uint64_t>(B));                \
+    }                                                                   \
+  } while (0)
+#else
+#define TRACE(P, A, B) do {} while (0)
+#endif
+
+namespace devourer {
+  namespace trace {
+#ifdef DEVOURER_TRACE
+    static const bool COMPILED = true;
+#else
+    static const bool COMPILED = false;
+#endif
+
+    enum Point {
+      FLOW_NEW = 1,      // Flow hash
+      FLOW_EXPIRE,       // Flow hash
+      DNS_QUERY,         // Query hash, transaction ID
+      DNS_RESPONSE,      // Query hash, transaction ID
+      DNS_MISS,          // Query hash, transaction ID
+      DNS_TIMEOUT,       // Query hash
+      RECORD_SHED,       // Priority
+      RECORD_DROP,       // Records in the batch
+      POINT_MAX,
+    };
+
+    struct Event {
+      uint64_t cycles;
+      uint64_t arg[2];
+      uint32_t thread;
+      uint16_t point;
+      uint16_t reserved;
+    };
+
+    // Ring keeps the latest SIZE - 1 events of a thread. Only the owner thread
+    // writes, and dump() copies events without lock and drops ones
+    // overwritten during the copy.
+    class Ring {
+    private:
+      static const size_t SIZE = 8192;
+      Event events_[SIZE];
+      std::atomic<uint64_t> head_;
+      uint32_t thread_;
+      Ring *next_;
+      Ring(const Ring&);
+      Ring& operator=(const Ring&);
+      friend Ring *local();
+      friend bool dump(int fd);
+
+    public:
+      Ring(uint32_t thread, Ring *next);
+      void put(uint16_t point, uint64_t a, uint64_t b) {
+        const uint64_t h = this->head_.load(std::memory_order_relaxed);
+        Event &e = this->events_[h & (SIZE - 1)];
+        e.cycles = devourer::cycles();
+        e.arg[0] = a;
+        e.arg[1] = b;
+        e.thread = this->thread_;
+        e.point = point;
+        e.reserved = 0;
+        this->head_.store(h + 1, std::memory_order_release);
+      }
+      uint32_t thread() const { return this->thread_; }
+      static size_t size() { return SIZE; }
+    };
+
+    extern std::atomic<bool> enabled_;
+    extern __thread Ring *local_;
+
+    inline bool enabled() {
+      return enabled_.load(std::memory_order_relaxed);
+    }
+    void enable(bool on);
+
+    // Ring of the calling thread, it is kept after the thread exits so
+    // that events of stopped workers can be dumped.
+    Ring *local();
+    inline void record(uint16_t point, uint64_t a, uint64_t b) {
+      Ring *r = local_;
+      if (r == NULL) {
+        r = local();
+      }
+      r->put(point, a, b);
+    }
+
+    // Write events of all rings to fd. It calls only write(2), and can be
+    // used in a signal handler.
+    bool dump(int fd);
+    void read(const std::string &path, std::vector<Event> *events)
+      throw(Exception);
+    const char *point_name(uint16_t point);
+  }
+}
+
+#endif  // SRC_TRACE_H__
@@ -0,0 +1,509 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <algorithm>
+
+#include "./traffic-gen.hpp"
+
+namespace devourer {
+  enum {
+    TCP_FIN = 0x01,
+    TCP_SYN = 0x02,
+    TCP_ACK = 0x10,
+  };
+  static const uint16_t DNS_PORT = 53;
+  static const uint16_t SERVER_PORT = 443;
+  static const uint32_t DNS_TTL = 300;
+
+  static void put16(std::vector<uint8_t> *buf, uint16_t v) {
+    buf->push_back(static_cast<uint8_t>(v >> 8));
+    buf->push_back(static_cast<uint8_t>(v));
+  }
+
+  static void put32(std::vector<uint8_t> *buf, uint32_t v) {
+    put16(buf, static_cast<uint16_t>(v >> 16));
+    put16(buf, static_cast<uint16_t>(v));
+  }
+
+  static void put_name(std::vector<uint8_t> *buf, const std::string &name) {
+    size_t pos = 0;
+    while (pos < name.size()) {
+      size_t end = name.find('.', pos);
+      if (end == std::string::npos) {
+        end = name.size();
+      }
+      buf->push_back(static_cast<uint8_t>(end - pos));
+      buf->insert(buf->end(), name.begin() + pos, name.begin() + end);
+      pos = end + 1;
+    }
+    buf->push_back(0);
+  }
+
+  // One's complement sum of 16 bit words.
+  static uint32_t sum16(const uint8_t *p, size_t len, uint32_t sum) {
+    for (size_t i = 0; i + 1 < len; i += 2) {
+      sum += (p[i] << 8) | p[i + 1];
+    }
+    if (len % 2 == 1) {
+      sum += p[len - 1] << 8;
+    }
+    return sum;
+  }
+
+  static uint16_t fold(uint32_t sum) {
+    while (sum > 0xffff) {
+      sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+  }
+
+  static void client_addr(bool v6, uint32_t idx, uint8_t *addr) {
+    if (v6) {
+      static const uint8_t prefix[] = {0xfd, 0, 0, 0, 0, 0, 0, 0};
+      memcpy(addr, prefix, sizeof(prefix));
+      memset(addr + 8, 0, 4);
+      idx += 0x100;  // Skip ::53 of the resolver
+    } else {
+      addr[0] = 10;
+      idx += 1;
+    }
+    uint8_t *p = addr + (v6 ? 12 : 1);
+    const size_t len = v6 ? 4 : 3;
+    for (size_t i = 0; i < len; i++) {
+      p[i] = static_cast<uint8_t>(idx >> ((len - 1 - i) * 8));
+    }
+  }
+
+  static void resolver_addr(bool v6, uint8_t *addr) {
+    if (v6) {
+      static const uint8_t a[] = {0xfd, 0, 0, 0, 0, 0, 0, 0,
+                                  0, 0, 0, 0, 0, 0, 0, 0x53};
+      memcpy(addr, a, sizeof(a));
+    } else {
+      static const uint8_t a[] = {10, 255, 0, 53};
+      memcpy(addr, a, sizeof(a));
+    }
+  }
+
+  TrafficGen::Config::Config() :
+    seed(1), clients(1000), servers(1000), names(1000), concurrent(1000),
+    dns_ratio(0.5), dns_loss(0.0), cname_depth(0), ipv6_ratio(0.0),
+    udp_ratio(0.0), syn_only_ratio(0.0), flow_packets(10), payload(1000),
+    interval_nsec(10000), gap_ratio(0.0), gap_nsec(0), snap_len(65535),
+    start(1420070400) {
+  }
+
+  // ------------------------------------------------------------
+  // class TrafficGen
+  //
+  TrafficGen::TrafficGen(const Config &config) :
+    config_(config), rand_(config.seed),
+    nsec_(static_cast<uint64_t>(config.start) * 1000000000), ip_id_(1),
+    session_seq_(0) {
+    if (this->config_.clients == 0) {
+      this->config_.clients = 1;
+    }
+    if (this->config_.servers == 0) {
+      this->config_.servers = 1;
+    }
+    if (this->config_.names == 0) {
+      this->config_.names = 1;
+    }
+    if (this->config_.concurrent == 0) {
+      this->config_.concurrent = 1;
+    }
+    memset(&this->stats_, 0, sizeof(this->stats_));
+  }
+
+  // splitmix64, every seed gives a full period sequence.
+  uint64_t TrafficGen::rand() {
+    uint64_t z = (this->rand_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  bool TrafficGen::chance(double ratio) {
+    if (ratio <= 0) {
+      return false;
+    }
+    return (this->rand() >> 11) * (1.0 / 9007199254740992.0) < ratio;
+  }
+
+  std::string TrafficGen::name_of(size_t name, size_t depth) const {
+    char buf[64];
+    if (depth == 0) {
+      snprintf(buf, sizeof(buf), "h%zu.example.com", name);
+    } else {
+      snprintf(buf, sizeof(buf), "c%zu-%zu.cdn.example.net", depth, name);
+    }
+    return buf;
+  }
+
+  void TrafficGen::server_addr(bool v6, uint32_t idx, uint8_t *addr) const {
+    if (v6) {
+      static const uint8_t prefix[] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+                                       0, 0, 0, 0};
+      memcpy(addr, prefix, sizeof(prefix));
+      idx += 1;
+      for (size_t i = 0; i < 4; i++) {
+        addr[12 + i] = static_cast<uint8_t>(idx >> ((3 - i) * 8));
+      }
+    } else {
+      const uint32_t a = 0xc6120000 + (idx & 0x1ffff);  // 198.18.0.0/15
+      for (size_t i = 0; i < 4; i++) {
+        addr[i] = static_cast<uint8_t>(a >> ((3 - i) * 8));
+      }
+    }
+  }
+
+  void TrafficGen::new_session(Session *s) {
+    const Config &c = this->config_;
+    this->session_seq_++;
+    this->stats_.sessions++;
+
+    s->v6 = this->chance(c.ipv6_ratio);
+    s->udp = this->chance(c.udp_ratio);
+    s->syn_only = !s->udp && this->chance(c.syn_only_ratio);
+    s->client = static_cast<uint32_t>(this->rand_range(c.clients));
+    s->name = this->rand_range(c.names);
+    s->server = static_cast<uint32_t>(s->name % c.servers);
+    s->cnames = this->rand_range(c.cname_depth + 1);
+    s->c_port = static_cast<uint16_t>(1024 + this->session_seq_ % 64512);
+    s->s_port = SERVER_PORT;
+    s->tx_id = static_cast<uint16_t>(this->rand());
+    s->data_left = (c.flow_packets > 0) ?
+      1 + this->rand_range(c.flow_packets * 2 - 1) : 0;
+    s->sent = 0;
+
+    if (s->syn_only) {
+      s->server = static_cast<uint32_t>(this->rand_range(c.servers));
+      s->s_port = static_cast<uint16_t>(1 + this->rand_range(1024));
+      s->step = SYN;
+    } else if (this->chance(c.dns_ratio)) {
+      s->step = DNS_QUERY;
+    } else {
+      s->step = s->udp ? DATA : SYN;
+    }
+    if (s->step == DATA && s->data_left == 0) {
+      s->data_left = 1;
+    }
+  }
+
+  void TrafficGen::build_dns(const Session &s, bool response) {
+    std::vector<uint8_t> &msg = this->dns_;
+    msg.clear();
+    put16(&msg, s.tx_id);
+    put16(&msg, response ? 0x8180 : 0x0100);
+    put16(&msg, 1);
+    put16(&msg, response ? s.cnames + 1 : 0);
+    put32(&msg, 0);
+
+    const uint16_t type = s.v6 ? 28 : 1;  // AAAA or A
+    put_name(&msg, this->name_of(s.name, 0));
+    put16(&msg, type);
+    put16(&msg, 1);
+
+    if (response) {
+      for (size_t d = 0; d <= s.cnames; d++) {
+        if (d == 0) {
+          put16(&msg, 0xc00c);  // Pointer to the question
+        } else {
+          put_name(&msg, this->name_of(s.name, d));
+        }
+        if (d < s.cnames) {
+          const std::string cname = this->name_of(s.name, d + 1);
+          put16(&msg, 5);  // CNAME
+          put16(&msg, 1);
+          put32(&msg, DNS_TTL);
+          put16(&msg, static_cast<uint16_t>(cname.size() + 2));
+          put_name(&msg, cname);
+        } else {
+          uint8_t addr[16];
+          this->server_addr(s.v6, s.server, addr);
+          put16(&msg, type);
+          put16(&msg, 1);
+          put32(&msg, DNS_TTL);
+          put16(&msg, s.v6 ? 16 : 4);
+          msg.insert(msg.end(), addr, addr + (s.v6 ? 16 : 4));
+        }
+      }
+    }
+  }
+
+  // Frame goes to buf_, return length on the wire.
+  size_t TrafficGen::build(const Session &s, bool from_client,
+                           uint8_t tcp_flags, const uint8_t *data,
+                           size_t data_len, size_t payload) {
+    static const uint8_t client_mac[] = {0x02, 0, 0, 0, 0, 0x01};
+    static const uint8_t router_mac[] = {0x02, 0, 0, 0, 0, 0x02};
+    const bool dns = (data != NULL);
+    const bool udp = s.udp || dns;
+    const size_t addr_len = s.v6 ? 16 : 4;
+    const size_t l4_hdr = udp ? 8 : 20;
+    const size_t wire_payload = dns ? data_len : payload;
+    const size_t l4_len = l4_hdr + wire_payload;
+
+    uint8_t c_addr[16], s_addr[16];
+    client_addr(s.v6, s.client, c_addr);
+    if (dns) {
+      resolver_addr(s.v6, s_addr);
+    } else {
+      this->server_addr(s.v6, s.server, s_addr);
+    }
+    const uint8_t *src = from_client ? c_addr : s_addr;
+    const uint8_t *dst = from_client ? s_addr : c_addr;
+    const uint16_t s_port = dns ? DNS_PORT : s.s_port;
+    const uint16_t sport = from_client ? s.c_port : s_port;
+    const uint16_t dport = from_client ? s_port : s.c_port;
+
+    std::vector<uint8_t> &buf = this->buf_;
+    buf.clear();
+    buf.insert(buf.end(), from_client ? router_mac : client_mac,
+               (from_client ? router_mac : client_mac) + 6);
+    buf.insert(buf.end(), from_client ? client_mac : router_mac,
+               (from_client ? client_mac : router_mac) + 6);
+    put16(&buf, s.v6 ? 0x86dd : 0x0800);
+
+    const uint8_t proto = udp ? IPPROTO_UDP : IPPROTO_TCP;
+    const size_t ip = buf.size();
+    if (s.v6) {
+      put32(&buf, 0x60000000);
+      put16(&buf, static_cast<uint16_t>(l4_len));
+      buf.push_back(proto);
+      buf.push_back(64);
+      buf.insert(buf.end(), src, src + 16);
+      buf.insert(buf.end(), dst, dst + 16);
+    } else {
+      put16(&buf, 0x4500);
+      put16(&buf, static_cast<uint16_t>(20 + l4_len));
+      put16(&buf, this->ip_id_++);
+      put16(&buf, 0x4000);  // Don't fragment
+      buf.push_back(64);
+      buf.push_back(proto);
+      put16(&buf, 0);
+      buf.insert(buf.end(), src, src + 4);
+      buf.insert(buf.end(), dst, dst + 4);
+      const uint16_t csum = fold(sum16(&buf[ip], 20, 0));
+      buf[ip + 10] = static_cast<uint8_t>(csum >> 8);
+      buf[ip + 11] = static_cast<uint8_t>(csum);
+    }
+
+    const size_t l4 = buf.size();
+    put16(&buf, sport);
+    put16(&buf, dport);
+    if (udp) {
+      put16(&buf, static_cast<uint16_t>(l4_len));
+      put16(&buf, 0);
+    } else {
+      put32(&buf, from_client ? 1 : 0x10000);
+      put32(&buf, (tcp_flags & TCP_ACK) ? (from_client ? 0x10000 : 1) : 0);
+      put16(&buf, 0x5000 | tcp_flags);
+      put16(&buf, 65535);
+      put32(&buf, 0);  // Checksum and urgent pointer
+    }
+    if (dns) {
+      buf.insert(buf.end(), data, data + data_len);
+    }
+
+    // Pseudo header and segment, zero payload adds nothing to the sum.
+    uint32_t sum = sum16(src, addr_len, 0);
+    sum = sum16(dst, addr_len, sum);
+    sum += proto + static_cast<uint32_t>(l4_len);
+    sum = sum16(&buf[l4], buf.size() - l4, sum);
+    uint16_t csum = fold(sum);
+    if (udp && csum == 0) {
+      csum = 0xffff;
+    }
+    const size_t csum_pos = l4 + (udp ? 6 : 16);
+    buf[csum_pos] = static_cast<uint8_t>(csum >> 8);
+    buf[csum_pos + 1] = static_cast<uint8_t>(csum);
+
+    const size_t wire_len = l4 + l4_len;
+    if (!dns) {
+      const size_t room = (this->config_.snap_len > buf.size()) ?
+        this->config_.snap_len - buf.size() : 0;
+      buf.insert(buf.end(), std::min(payload, room), 0);
+    }
+    if (buf.size() > this->config_.snap_len) {
+      buf.resize(this->config_.snap_len);
+    }
+    return wire_len;
+  }
+
+  void TrafficGen::next(Packet *pkt) {
+    const Config &c = this->config_;
+    if (this->sessions_.empty()) {
+      this->sessions_.resize(c.concurrent);
+      for (size_t i = 0; i < this->sessions_.size(); i++) {
+        this->new_session(&this->sessions_[i]);
+      }
+    }
+
+    Session &s = this->sessions_[this->rand_range(this->sessions_.size())];
+    size_t wire_len = 0;
+    switch (s.step) {
+    case DNS_QUERY:
+      this->build_dns(s, false);
+      wire_len = this->build(s, true, 0, &this->dns_[0], this->dns_.size(), 0);
+      this->stats_.dns_queries++;
+      s.step = this->chance(c.dns_loss) ? DONE : DNS_RESPONSE;
+      break;
+
+    case DNS_RESPONSE:
+      this->build_dns(s, true);
+      wire_len = this->build(s, false, 0, &this->dns_[0], this->dns_.size(),
+                             0);
+      this->stats_.dns_responses++;
+      if (s.udp) {
+        s.step = (s.data_left > 0) ? DATA : DONE;
+      } else {
+        s.step = SYN;
+      }
+      break;
+
+    case SYN:
+      wire_len = this->build(s, true, TCP_SYN, NULL, 0, 0);
+      this->stats_.tcp_flows++;
+      s.step = s.syn_only ? DONE : SYN_ACK;
+      break;
+
+    case SYN_ACK:
+      wire_len = this->build(s, false, TCP_SYN | TCP_ACK, NULL, 0, 0);
+      s.step = ACK;
+      break;
+
+    case ACK:
+      wire_len = this->build(s, true, TCP_ACK, NULL, 0, 0);
+      s.step = (s.data_left > 0) ? DATA : FIN;
+      break;
+
+    case DATA: {
+      // UDP goes both ways, TCP has a request and then responses.
+      const bool from_client = s.udp ? (s.sent % 2 == 0) : (s.sent == 0);
+      if (s.udp && s.sent == 0) {
+        this->stats_.udp_flows++;
+      }
+      wire_len = this->build(s, from_client, TCP_ACK, NULL, 0, c.payload);
+      s.sent++;
+      s.data_left--;
+      if (s.data_left == 0) {
+        s.step = s.udp ? DONE : FIN;
+      }
+      break;
+    }
+
+    case FIN:
+      wire_len = this->build(s, true, TCP_FIN | TCP_ACK, NULL, 0, 0);
+      s.step = FIN_ACK;
+      break;
+
+    case FIN_ACK:
+    case DONE:
+      wire_len = this->build(s, false, TCP_FIN | TCP_ACK, NULL, 0, 0);
+      s.step = DONE;
+      break;
+    }
+
+    if (s.step == DONE) {
+      this->new_session(&s);
+    }
+
+    this->nsec_ += this->rand_range(c.interval_nsec * 2 + 1);
+    if (this->chance(c.gap_ratio)) {
+      this->nsec_ += c.gap_nsec;
+    }
+    this->stats_.packets++;
+
+    pkt->data = &this->buf_[0];
+    pkt->len = this->buf_.size();
+    pkt->cap_len = wire_len;
+    pkt->tv.tv_sec = this->nsec_ / 1000000000;
+    pkt->tv.tv_usec = (this->nsec_ % 1000000000) / 1000;
+  }
+
+  void TrafficGen::generate(size_t count, std::vector<uint8_t> *data,
+                            std::vector<Packet> *pkts) {
+    data->clear();
+    pkts->clear();
+    pkts->reserve(count);
+    std::vector<size_t> offsets;
+    offsets.reserve(count);
+
+    Packet pkt;
+    for (size_t i = 0; i < count; i++) {
+      this->next(&pkt);
+      offsets.push_back(data->size());
+      data->insert(data->end(), pkt.data, pkt.data + pkt.len);
+      pkts->push_back(pkt);
+    }
+    // Set data after all frames are added, the buffer may be moved.
+    for (size_t i = 0; i < count; i++) {
+      (*pkts)[i].data = &(*data)[offsets[i]];
+    }
+  }
+
+  void TrafficGen::write_pcap(const std::string &path, size_t count)
+    throw(Exception) {
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp == NULL) {
+      throw Exception("can not open " + path + ": " + strerror(errno));
+    }
+
+    struct {
+      uint32_t magic;
+      uint16_t version_major;
+      uint16_t version_minor;
+      int32_t thiszone;
+      uint32_t sigfigs;
+      uint32_t snaplen;
+      uint32_t linktype;
+    } head = {0xa1b2c3d4, 2, 4, 0, 0,
+              static_cast<uint32_t>(this->config_.snap_len), 1};
+    bool ok = (fwrite(&head, sizeof(head), 1, fp) == 1);
+
+    Packet pkt;
+    for (size_t i = 0; ok && i < count; i++) {
+      this->next(&pkt);
+      const uint32_t rec[] = {
+        static_cast<uint32_t>(pkt.tv.tv_sec),
+        static_cast<uint32_t>(pkt.tv.tv_usec),
+        static_cast<uint32_t>(pkt.len),
+        static_cast<uint32_t>(pkt.cap_len),
+      };
+      ok = (fwrite(rec, sizeof(rec), 1, fp) == 1 &&
+            fwrite(pkt.data, 1, pkt.len, fp) == pkt.len);
+    }
+
+    if (fclose(fp) != 0 || !ok) {
+      throw Exception("can not write " + path + ": " + strerror(errno));
+    }
+  }
+}
@@ -0,0 +1,134 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_TRAFFIC_GEN_H__
+#define SRC_TRAFFIC_GEN_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "./devourer.hpp"
+
+namespace devourer {
+  // TrafficGen makes Ethernet frames of IPv4/IPv6 and TCP/UDP sessions for
+  // load and timeout tests. A session optionally starts with a DNS lookup
+  // of the server name, whose answer may have a CNAME chain, and packets of
+  // concurrent sessions are interleaved. Same seed gives the same frames.
+  //
+  // Clients are 10.0.0.0/8 and fd00::/64, servers are 198.18.0.0/15 and
+  // 2001:db8::/64, and the resolver is 10.255.0.53 and fd00::53. Name N
+  // (hN.example.com) always resolves to server N % servers.
+  class TrafficGen {
+  public:
+    struct Config {
+      uint64_t seed;
+      size_t clients;
+      size_t servers;
+      size_t names;
+      size_t concurrent;      // Sessions sending packets at the same time
+      double dns_ratio;       // Sessions starting with DNS lookup
+      double dns_loss;        // Lookups without response, session ends
+      size_t cname_depth;     // Max CNAME records before address record
+      double ipv6_ratio;
+      double udp_ratio;
+      double syn_only_ratio;  // TCP sessions of only SYN to a random port
+      size_t flow_packets;    // Mean data packets, UDP may have none
+      size_t payload;         // Bytes of a data packet on the wire
+      uint64_t interval_nsec; // Mean time between packets
+      double gap_ratio;       // Packets following a time gap
+      uint64_t gap_nsec;
+      size_t snap_len;        // Captured bytes of a packet
+      time_t start;
+
+      Config();
+    };
+
+    struct Stats {
+      uint64_t packets;
+      uint64_t sessions;
+      uint64_t tcp_flows;
+      uint64_t udp_flows;
+      uint64_t dns_queries;
+      uint64_t dns_responses;
+    };
+
+  private:
+    enum Step {
+      DNS_QUERY, DNS_RESPONSE, SYN, SYN_ACK, ACK, DATA, FIN, FIN_ACK, DONE,
+    };
+
+    struct Session {
+      bool v6;
+      bool udp;
+      bool syn_only;
+      uint32_t client;
+      uint32_t server;
+      size_t name;
+      size_t cnames;
+      uint16_t c_port;
+      uint16_t s_port;
+      uint16_t tx_id;
+      Step step;
+      size_t data_left;
+      size_t sent;  // Data packets sent
+    };
+
+    Config config_;
+    uint64_t rand_;
+    uint64_t nsec_;
+    uint16_t ip_id_;
+    uint64_t session_seq_;
+    std::vector<Session> sessions_;
+    std::vector<uint8_t> buf_;
+    std::vector<uint8_t> dns_;
+    Stats stats_;
+
+    uint64_t rand();
+    size_t rand_range(size_t n) { return n > 0 ? this->rand() % n : 0; }
+    bool chance(double ratio);
+    void new_session(Session *s);
+    std::string name_of(size_t name, size_t depth) const;
+    void server_addr(bool v6, uint32_t idx, uint8_t *addr) const;
+    void build_dns(const Session &s, bool response);
+    size_t build(const Session &s, bool from_client, uint8_t tcp_flags,
+                 const uint8_t *data, size_t data_len, size_t payload);
+
+  public:
+    explicit TrafficGen(const Config &config);
+    // Make the next frame. Data of pkt is valid until the next call.
+    void next(Packet *pkt);
+    // Replace data with count frames, and pkts with packets of them.
+    void generate(size_t count, std::vector<uint8_t> *data,
+                  std::vector<Packet> *pkts);
+    // Write count frames to a pcap file.
+    void write_pcap(const std::string &path, size_t count) throw(Exception);
+    const Stats& stats() const { return this->stats_; }
+  };
+}
+
+#endif  // SRC_TRAFFIC_GEN_H__
@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "./tuple-hash.hpp"
+
+namespace devourer {
+  static const uint16_t ETH_IPV4 = 0x0800;
+  static const uint16_t ETH_IPV6 = 0x86DD;
+  static const uint16_t ETH_VLAN = 0x8100;
+  static const uint16_t ETH_QINQ = 0x88A8;
+  static const uint16_t DNS_PORT = 53;
+
+  static inline uint16_t read16(const uint8_t *p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+  }
+
+  static inline uint64_t mix(uint64_t hv, const uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      hv = (hv ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hv;
+  }
+
+  // Hash the endpoints in canonical order to be symmetric.
+  static uint64_t endpoint_hash(const uint8_t *src, const uint8_t *dst,
+                                size_t addr_len, uint16_t sport,
+                                uint16_t dport, uint8_t proto) {
+    int cmp = memcmp(src, dst, addr_len);
+    if (cmp > 0 || (cmp == 0 && sport > dport)) {
+      const uint8_t *a = src; src = dst; dst = a;
+      uint16_t p = sport; sport = dport; dport = p;
+    }
+
+    const uint8_t tail[5] = {
+      static_cast<uint8_t>(sport >> 8), static_cast<uint8_t>(sport),
+      static_cast<uint8_t>(dport >> 8), static_cast<uint8_t>(dport),
+      proto,
+    };
+    uint64_t hv = 0xcbf29ce484222325ULL;
+    hv = mix(hv, src, addr_len);
+    hv = mix(hv, dst, addr_len);
+    hv = mix(hv, tail, sizeof(tail));
+    hv ^= hv >> 33;
+    hv *= 0xff51afd7ed558ccdULL;
+    hv ^= hv >> 33;
+    return hv;
+  }
+
+  uint64_t tuple_hash(const uint8_t *pkt, size_t len, bool *dns_answer) {
+    *dns_answer = false;
+    if (len < 14) {
+      return 0;
+    }
+
+    size_t off = 12;
+    uint16_t type = read16(pkt + off);
+    off += 2;
+    while ((type == ETH_VLAN || type == ETH_QINQ) && off + 4 <= len) {
+      type = read16(pkt + off + 2);
+      off += 4;
+    }
+
+    const uint8_t *src, *dst;
+    size_t addr_len;
+    uint8_t proto;
+    bool has_port = true;
+
+    if (type == ETH_IPV4) {
+      if (off + 20 > len) {
+        return 0;
+      }
+      const uint8_t *ip = pkt + off;
+      const size_t hdr_len = (ip[0] & 0x0F) * 4;
+      // Only the first fragment has the L4 header. All fragments including
+      // the first (MF set or offset not 0) are hashed by addresses and
+      // protocol, then every fragment of a datagram goes to the same shard.
+      if ((read16(ip + 6) & 0x3FFF) != 0) {
+        has_port = false;
+      }
+      proto = ip[9];
+      src = ip + 12;
+      dst = ip + 16;
+      addr_len = 4;
+      off += hdr_len;
+    } else if (type == ETH_IPV6) {
+      if (off + 40 > len) {
+        return 0;
+      }
+      const uint8_t *ip = pkt + off;
+      proto = ip[6];
+      src = ip + 8;
+      dst = ip + 24;
+      addr_len = 16;
+      off += 40;
+
+      // Skip Hop-by-Hop, Routing and Destination Options headers.
+      while ((proto == 0 || proto == 43 || proto == 60) && off + 8 <= len) {
+        proto = pkt[off];
+        off += (pkt[off + 1] + 1) * 8;
+      }
+      if (proto == 44) {
+        has_port = false;
+      }
+    } else {
+      return 0;
+    }
+
+    uint16_t sport = 0, dport = 0;
+    if (has_port && (proto == 6 || proto == 17 || proto == 132) &&
+        off + 4 <= len) {
+      sport = read16(pkt + off);
+      dport = read16(pkt + off + 2);
+      *dns_answer = (sport == DNS_PORT && proto != 132);
+    }
+
+    return endpoint_hash(src, dst, addr_len, sport, dport, proto);
+  }
+}
@@ -0,0 +1,108 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <memory>
+#include <string>
+#include "./gtest.h"
+#include "../src/capture.hpp"
+
+// Capture on loopback needs CAP_NET_RAW and Linux, then the test is
+// disabled by default. Run it by --gtest_also_run_disabled_tests as root.
+TEST(AfPacketCapture, DISABLED_loopback) {
+  std::unique_ptr<devourer::AfPacketCapture> cap;
+  try {
+    cap.reset(new devourer::AfPacketCapture("lo", 0x7e57, 4 * 1024 * 1024,
+                                            64 * 1024));
+  } catch (const devourer::Exception &e) {
+    FAIL() << "AF_PACKET is not available: " << e.what();
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_LE(0, sock);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(54321);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const char payload[] = "devourer-afpacket-test";
+  for (int i = 0; i < 10; i++) {
+    sendto(sock, payload, sizeof(payload), 0,
+           reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+  }
+  close(sock);
+
+  size_t found = 0;
+  devourer::Packet pkt;
+  for (int i = 0; i < 1000 && found < 10; i++) {
+    devourer::Capture::Status st = cap->next(&pkt);
+    ASSERT_NE(devourer::Capture::END, st);
+    if (st != devourer::Capture::READ) {
+      continue;
+    }
+    // Ethernet (14) + IPv4 (20) + UDP (8)
+    if (pkt.len == 42 + sizeof(payload) &&
+        memcmp(pkt.data + 42, payload, sizeof(payload)) == 0) {
+      EXPECT_EQ(pkt.len, pkt.cap_len);
+      EXPECT_LT(0, pkt.tv.tv_sec);
+      found++;
+    }
+  }
+  EXPECT_EQ(10U, found);
+
+  uint64_t packets, drops;
+  EXPECT_TRUE(cap->stats(&packets, &drops));
+  EXPECT_LE(10U, packets);
+}
+
+namespace {
+  std::string size_error(size_t ring_size, size_t block_size) {
+    try {
+      devourer::AfPacketCapture cap("lo", 1, ring_size, block_size);
+    } catch (const devourer::Exception &e) {
+      return e.what();
+    }
+    return "";
+  }
+}
+
+TEST(AfPacketCapture, invalid_size) {
+  // Sizes are checked before the socket, the test needs no privilege.
+  // Block size not aligned to page size.
+  EXPECT_EQ("Block size must be a multiple of page size",
+            size_error(1024 * 1024, 1000));
+  EXPECT_EQ("Block size must be a multiple of page size",
+            size_error(1024 * 1024, 0));
+  // Ring size not multiple of block size.
+  EXPECT_EQ("Ring size must be a multiple of block size",
+            size_error(1000 * 1000, 64 * 1024));
+  EXPECT_EQ("Ring size must be a multiple of block size",
+            size_error(32 * 1024, 64 * 1024));
+}
@@ -0,0 +1,201 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/column.hpp"
+#include "../src/record.hpp"
+
+namespace {
+  class TmpPath {
+  private:
+    std::string path_;
+
+  public:
+    TmpPath() {
+      char path[] = "/tmp/devourer-column-XXXXXX";
+      close(mkstemp(path));
+      this->path_ = path;
+    }
+    ~TmpPath() { unlink(this->path_.c_str()); }
+    const std::string& path() const { return this->path_; }
+  };
+
+  const devourer::RecordSchema dns_tx("dns.tx", {
+      "client", "latency", "q_name", "server", "status",
+    });
+  const devourer::RecordSchema arp("arp.request", {
+      "dst_hw", "src_hw",
+    });
+  const devourer::RecordSchema flow_log("flow.log", {
+      "c_addr", "c_name", "c_pkt", "c_port", "c_size", "hash", "init_ts",
+      "last_ts", "proto", "s_addr", "s_name", "s_pkt", "s_port", "s_size",
+    });
+
+  void write_dns_tx(std::vector<uint8_t> *buf, time_t ts,
+                    const char *client, const char *q_name, double latency,
+                    const char *status) {
+    devourer::RecordWriter w;
+    w.begin(buf, dns_tx, ts);
+    w.put_str(0, client);
+    if (latency >= 0) {
+      w.put_double(1, latency);
+    }
+    w.put_str(2, q_name);
+    w.put_str(3, "10.0.0.53");
+    w.put_str(4, status);
+    w.end();
+  }
+}
+
+TEST(ColumnOutput, dns_tx) {
+  TmpPath tmp;
+  std::vector<uint8_t> buf;
+  write_dns_tx(&buf, 100, "10.0.0.1", "example.com", 0.25, "success");
+  write_dns_tx(&buf, 101, "2001:db8::1", "example.org", -1, "timeout");
+  write_dns_tx(&buf, 102, "10.0.0.1", "example.com", 0.5, "success");
+
+  // Not a column table, skipped.
+  devourer::RecordWriter w;
+  w.begin(&buf, arp, 103);
+  w.put_str(0, "00:00:00:00:00:01");
+  w.put_str(1, "00:00:00:00:00:02");
+  w.end();
+
+  {
+    devourer::ColumnOutput out(tmp.path());
+    out.write(&buf[0], buf.size(), 4);
+  }
+
+  devourer::ColumnReader rd(tmp.path());
+  ASSERT_TRUE(rd.next());
+  EXPECT_EQ("dns.tx", rd.table());
+  ASSERT_EQ(3U, rd.rows());
+  ASSERT_EQ(6U, rd.columns().size());
+  EXPECT_EQ("ts", rd.columns()[0].name);
+
+  std::vector<uint8_t> raw;
+  ASSERT_TRUE(rd.read("ts", &raw));
+  EXPECT_EQ(101U, devourer::ColumnReader::get_uint(
+      raw, devourer::column::UINT64, 1));
+
+  ASSERT_TRUE(rd.read("client", &raw));
+  ASSERT_EQ(3U * 16, raw.size());
+  const uint8_t v4[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff,
+                          10, 0, 0, 1};
+  const uint8_t v6[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0,
+                          0, 0, 0, 1};
+  EXPECT_EQ(0, memcmp(v4, devourer::ColumnReader::get_addr(raw, 0), 16));
+  EXPECT_EQ(0, memcmp(v6, devourer::ColumnReader::get_addr(raw, 1), 16));
+
+  ASSERT_TRUE(rd.read("latency", &raw));
+  EXPECT_EQ(0.25, devourer::ColumnReader::get_double(raw, 0));
+  EXPECT_EQ(0.0, devourer::ColumnReader::get_double(raw, 1));
+  EXPECT_EQ(0.5, devourer::ColumnReader::get_double(raw, 2));
+
+  std::vector<std::string> names;
+  ASSERT_TRUE(rd.read("q_name", &raw));
+  ASSERT_TRUE(devourer::ColumnReader::get_dict(raw, rd.rows(), &names));
+  ASSERT_EQ(3U, names.size());
+  EXPECT_EQ("example.com", names[0]);
+  EXPECT_EQ("example.org", names[1]);
+  EXPECT_EQ("example.com", names[2]);
+
+  EXPECT_FALSE(rd.read("no_such_column", &raw));
+  EXPECT_FALSE(rd.next());
+}
+
+TEST(ColumnOutput, flow_log_blocks) {
+  TmpPath tmp;
+  const size_t N = 1000;
+  std::vector<uint8_t> buf;
+  for (size_t i = 0; i < N; i++) {
+    devourer::RecordWriter w;
+    w.begin(&buf, flow_log, 1000 + i);
+    w.put_str(0, "192.168.0.1");
+    if (i % 2 == 0) {
+      w.put_str(1, "client.example.com");
+    }
+    w.put_uint(2, i);
+    w.put_uint(3, 40000 + i);
+    w.put_uint(4, i * 100);
+    w.put_str(5, "00000000DEADBEEF");
+    w.put_uint(6, 1000);
+    w.put_uint(7, 1000 + i);
+    w.put_str(8, "tcp");
+    w.put_str(9, "192.168.0.2");
+    w.put_uint(11, 1);
+    w.put_uint(12, 443);
+    w.put_uint(13, 0x100000000ULL);
+    w.end();
+  }
+
+  {
+    devourer::ColumnOutput out(tmp.path(), 400);
+    out.write(&buf[0], buf.size(), N);
+  }
+
+  devourer::ColumnReader rd(tmp.path());
+  std::vector<uint8_t> raw;
+  std::vector<std::string> values;
+  size_t rows = 0;
+  while (rd.next()) {
+    EXPECT_EQ("flow.log", rd.table());
+    EXPECT_EQ(15U, rd.columns().size());
+    ASSERT_TRUE(rd.read("c_port", &raw));
+    ASSERT_EQ(rd.rows() * 2, raw.size());
+    for (size_t i = 0; i < rd.rows(); i++) {
+      EXPECT_EQ(40000 + rows + i, devourer::ColumnReader::get_uint(
+          raw, devourer::column::UINT16, i));
+    }
+    ASSERT_TRUE(rd.read("hash", &raw));
+    EXPECT_EQ(0xDEADBEEFULL, devourer::ColumnReader::get_uint(
+        raw, devourer::column::UINT64, 0));
+    ASSERT_TRUE(rd.read("s_size", &raw));
+    EXPECT_EQ(0x100000000ULL, devourer::ColumnReader::get_uint(
+        raw, devourer::column::UINT64, 0));
+    ASSERT_TRUE(rd.read("c_name", &raw));
+    ASSERT_TRUE(devourer::ColumnReader::get_dict(raw, rd.rows(), &values));
+    EXPECT_EQ("client.example.com", values[0]);
+    EXPECT_EQ("", values[1]);
+    ASSERT_TRUE(rd.read("s_name", &raw));
+    ASSERT_TRUE(devourer::ColumnReader::get_dict(raw, rd.rows(), &values));
+    EXPECT_EQ("", values[0]);
+    rows += rd.rows();
+
+    for (size_t i = 0; i < rd.columns().size(); i++) {
+      if (rd.columns()[i].name == "proto") {
+        // Repeated values are deflated.
+        EXPECT_EQ(devourer::column::DEFLATE, rd.columns()[i].codec);
+        EXPECT_LT(rd.columns()[i].len, rd.columns()[i].raw_len);
+      }
+    }
+  }
+  EXPECT_EQ(N, rows);
+}
@@ -24,7 +24,485 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <map>
+#include <string>
+#include <vector>
 #include "./gtest.h"
+#include "../src/devourer.hpp"
+#include "../src/record.hpp"
+#include "../src/shard.hpp"
+#include "../src/modules/dns.hpp"
+#include "../src/modules/flow.hpp"
+
+namespace {
+  // Base time of packets in msec.
+  const uint64_t T0 = 1420070400ULL * 1000;
+
+  class TmpFile {
+  private:
+    std::string path_;
+
+  public:
+    TmpFile() {
+      char path[] = "/tmp/devourer-test-XXXXXX";
+      int fd = mkstemp(path);
+      close(fd);
+      this->path_ = path;
+    }
+    ~TmpFile() { unlink(this->path_.c_str()); }
+    const std::string& path() const { return this->path_; }
+  };
+
+  // Record written by setdst_filestream(). Nested maps are flow.update.
+  struct Record {
+    uint64_t ts;
+    std::map<std::string, std::string> str;
+    std::map<std::string, uint64_t> num;
+    std::map<std::string, std::map<std::string, uint64_t> > maps;
+  };
+
+  std::vector<Record> read_records(const std::string &path,
+                                   const std::string &tag) {
+    std::vector<uint8_t> buf;
+    FILE *fp = fopen(path.c_str(), "rb");
+    uint8_t tmp[4096];
+    size_t len;
+    while (fp && (len = fread(tmp, 1, sizeof(tmp), fp)) > 0) {
+      buf.insert(buf.end(), tmp, tmp + len);
+    }
+    if (fp) {
+      fclose(fp);
+    }
+
+    std::vector<Record> records;
+    devourer::msgpack::Reader rd(buf.data(), buf.size());
+    while (!rd.empty()) {
+      size_t n, klen, slen;
+      const char *k, *s;
+      Record rec;
+      EXPECT_TRUE(rd.read_array(&n) && n == 3);
+      EXPECT_TRUE(rd.read_str(&s, &slen));
+      const std::string rec_tag(s, slen);
+      EXPECT_TRUE(rd.read_uint(&rec.ts));
+      EXPECT_TRUE(rd.read_map(&n));
+      for (size_t i = 0; i < n; i++) {
+        EXPECT_TRUE(rd.read_str(&k, &klen));
+        const std::string key(k, klen);
+        uint64_t u;
+        size_t m;
+        if (rd.read_str(&s, &slen)) {
+          rec.str[key] = std::string(s, slen);
+        } else if (rd.read_uint(&u)) {
+          rec.num[key] = u;
+        } else if (rd.read_map(&m)) {
+          for (size_t j = 0; j < m; j++) {
+            EXPECT_TRUE(rd.read_str(&s, &slen));
+            EXPECT_TRUE(rd.read_uint(&u));
+            rec.maps[key][std::string(s, slen)] = u;
+          }
+        } else {
+          EXPECT_TRUE(rd.skip());
+        }
+      }
+      if (::testing::Test::HasFailure()) {
+        break;
+      }
+      if (rec_tag == "devourer." + tag) {
+        records.push_back(rec);
+      }
+    }
+    return records;
+  }
+
+  void put16(std::string *buf, uint16_t v) {
+    buf->push_back(static_cast<char>(v >> 8));
+    buf->push_back(static_cast<char>(v));
+  }
+
+  void put32(std::string *buf, uint32_t v) {
+    put16(buf, static_cast<uint16_t>(v >> 16));
+    put16(buf, static_cast<uint16_t>(v));
+  }
+
+  std::string addr_bytes(const std::string &addr) {
+    uint8_t buf[16];
+    const bool v6 = (addr.find(':') != std::string::npos);
+    EXPECT_EQ(1, inet_pton(v6 ? AF_INET6 : AF_INET, addr.c_str(), buf));
+    return std::string(reinterpret_cast<char*>(buf), v6 ? 16 : 4);
+  }
+
+  uint16_t checksum(const std::string &data, uint32_t sum) {
+    for (size_t i = 0; i < data.size(); i += 2) {
+      uint32_t w = static_cast<uint8_t>(data[i]) << 8;
+      if (i + 1 < data.size()) {
+        w |= static_cast<uint8_t>(data[i + 1]);
+      }
+      sum += w;
+    }
+    while (sum >> 16) {
+      sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+  }
+
+  // Ethernet frame of an IPv4 or IPv6 UDP packet, by type of addresses.
+  std::string udp_frame(const std::string &src, uint16_t sport,
+                        const std::string &dst, uint16_t dport,
+                        const std::string &payload) {
+    const std::string s = addr_bytes(src), d = addr_bytes(dst);
+    const bool v6 = (s.size() == 16);
+    std::string udp;
+    put16(&udp, sport);
+    put16(&udp, dport);
+    put16(&udp, static_cast<uint16_t>(8 + payload.size()));
+    put16(&udp, 0);
+    udp += payload;
+
+    std::string pseudo = s + d;
+    put32(&pseudo, static_cast<uint32_t>(udp.size()));
+    put32(&pseudo, 17);
+    const uint16_t sum = checksum(pseudo + udp, 0);
+    udp[6] = static_cast<char>(sum >> 8);
+    udp[7] = static_cast<char>(sum);
+
+    std::string frame("\x00\x00\x5e\x00\x53\x01\x00\x00\x5e\x00\x53\x02", 12);
+    std::string ip;
+    if (v6) {
+      put16(&frame, 0x86dd);
+      put32(&ip, 0x60000000);
+      put16(&ip, static_cast<uint16_t>(udp.size()));
+      ip.push_back(17);
+      ip.push_back(64);
+      ip += s + d;
+    } else {
+      put16(&frame, 0x0800);
+      put16(&ip, 0x4500);
+      put16(&ip, static_cast<uint16_t>(20 + udp.size()));
+      put32(&ip, 0x00004000);
+      put16(&ip, 0x4011);
+      put16(&ip, 0);
+      ip += s + d;
+      const uint16_t sum = checksum(ip, 0);
+      ip[10] = static_cast<char>(sum >> 8);
+      ip[11] = static_cast<char>(sum);
+    }
+    return frame + ip + udp;
+  }
+
+  std::string dns_name(const std::string &name) {
+    std::string buf;
+    size_t pos = 0;
+    while (pos < name.size()) {
+      size_t end = name.find('.', pos);
+      if (end == std::string::npos) {
+        end = name.size();
+      }
+      buf.push_back(static_cast<char>(end - pos));
+      buf += name.substr(pos, end - pos);
+      pos = end + 1;
+    }
+    buf.push_back(0);
+    return buf;
+  }
+
+  // Answer of A, AAAA or CNAME. data is address text or name.
+  struct Answer {
+    uint16_t type;
+    std::string name;
+    std::string data;
+  };
+
+  std::string dns_msg(uint16_t tx_id, bool response, const std::string &q_name,
+                      const std::vector<Answer> &an = std::vector<Answer>()) {
+    std::string buf;
+    put16(&buf, tx_id);
+    put16(&buf, response ? 0x8180 : 0x0100);
+    put16(&buf, 1);
+    put16(&buf, static_cast<uint16_t>(an.size()));
+    put32(&buf, 0);
+    buf += dns_name(q_name);
+    put16(&buf, 1);
+    put16(&buf, 1);
+    for (size_t i = 0; i < an.size(); i++) {
+      const std::string data = (an[i].type == 5) ?
+        dns_name(an[i].data) : addr_bytes(an[i].data);
+      buf += dns_name(an[i].name);
+      put16(&buf, an[i].type);
+      put16(&buf, 1);
+      put32(&buf, 300);
+      put16(&buf, static_cast<uint16_t>(data.size()));
+      buf += data;
+    }
+    return buf;
+  }
+
+  // Packets are given one by one as batches, then every module advances
+  // its time by each packet.
+  void feed(Devourer *d, const std::string &frame, uint64_t msec) {
+    devourer::Packet pkt;
+    pkt.data = reinterpret_cast<const uint8_t*>(frame.data());
+    pkt.len = frame.size();
+    pkt.cap_len = frame.size();
+    pkt.tv.tv_sec = msec / 1000;
+    pkt.tv.tv_usec = (msec % 1000) * 1000;
+    EXPECT_EQ(1U, d->input_batch(&pkt, 1));
+  }
+
+  // Packet of an unrelated flow only to advance time.
+  void tick(Devourer *d, uint64_t msec) {
+    feed(d, udp_frame("192.0.2.1", 7000, "192.0.2.2", 7001, "tick"), msec);
+  }
+}
 
 TEST(Devourer, basic) {
 }
+
+TEST(Devourer, invalid_timeout) {
+  Devourer d("", devourer::PCAP_FILE);
+  EXPECT_THROW(d.set_query_timeout(0), devourer::Exception);
+  EXPECT_THROW(d.set_query_timeout(devourer::ModDns::MAX_TIMEOUT),
+               devourer::Exception);
+  EXPECT_THROW(d.set_flow_timeout(0), devourer::Exception);
+  EXPECT_THROW(d.set_flow_timeout(devourer::ModFlow::MAX_TIMEOUT),
+               devourer::Exception);
+  EXPECT_NO_THROW(d.set_query_timeout(1));
+  EXPECT_NO_THROW(d.set_flow_timeout(devourer::ModFlow::MAX_TIMEOUT - 1));
+}
+
+TEST(Devourer, query_timeout_msec) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+  d.set_query_timeout(500);
+
+  feed(&d, udp_frame("10.0.0.1", 40000, "10.0.0.53", 53,
+                     dns_msg(0x1234, false, "lost.example.com")), T0);
+  tick(&d, T0 + 400);
+  EXPECT_EQ(0U, read_records(out.path(), "dns.tx").size());
+
+  tick(&d, T0 + 600);
+  const std::vector<Record> tx = read_records(out.path(), "dns.tx");
+  ASSERT_EQ(1U, tx.size());
+  EXPECT_EQ("timeout", tx[0].str.at("status"));
+  EXPECT_EQ("10.0.0.1", tx[0].str.at("client"));
+  EXPECT_EQ("10.0.0.53", tx[0].str.at("server"));
+}
+
+TEST(Devourer, flow_timeout_msec) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+  d.set_flow_timeout(300);
+
+  feed(&d, udp_frame("10.0.1.1", 1000, "10.0.1.2", 2000, "data"), T0);
+  tick(&d, T0 + 200);
+  EXPECT_EQ(0U, read_records(out.path(), "flow.log").size());
+
+  // Idle for 400 msec, the tick flow is idle for 200 msec.
+  tick(&d, T0 + 400);
+  const std::vector<Record> logs = read_records(out.path(), "flow.log");
+  ASSERT_EQ(1U, logs.size());
+  EXPECT_EQ("10.0.1.1", logs[0].str.at("c_addr"));
+  EXPECT_EQ(1000U, logs[0].num.at("c_port"));
+  EXPECT_EQ(1U, logs[0].num.at("c_pkt"));
+  EXPECT_EQ(T0 / 1000, logs[0].ts);
+}
+
+TEST(Devourer, dns_tx_response) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+
+  std::vector<Answer> an;
+  an.push_back(Answer{1, "www.example.com", "93.184.216.34"});
+  feed(&d, udp_frame("10.0.0.1", 40000, "10.0.0.53", 53,
+                     dns_msg(0x1234, false, "www.example.com")), T0);
+  // Response from the server with another tx_id does not match.
+  feed(&d, udp_frame("10.0.0.53", 53, "10.0.0.1", 40000,
+                     dns_msg(0x1235, true, "www.example.com", an)), T0 + 5);
+  feed(&d, udp_frame("10.0.0.53", 53, "10.0.0.1", 40000,
+                     dns_msg(0x1234, true, "www.example.com", an)), T0 + 10);
+
+  const std::vector<Record> tx = read_records(out.path(), "dns.tx");
+  ASSERT_EQ(2U, tx.size());
+  EXPECT_EQ("miss", tx[0].str.at("status"));
+  EXPECT_EQ("success", tx[1].str.at("status"));
+  EXPECT_EQ("10.0.0.1", tx[1].str.at("client"));
+  EXPECT_EQ("10.0.0.53", tx[1].str.at("server"));
+}
+
+TEST(Devourer, dns_tx_same_tx_id) {
+  // Two clients behind one resolver with the same port and tx_id.
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+  d.set_query_timeout(500);
+
+  feed(&d, udp_frame("10.0.0.1", 5353, "10.0.0.53", 53,
+                     dns_msg(7, false, "a.example.com")), T0);
+  feed(&d, udp_frame("10.0.0.2", 5353, "10.0.0.53", 53,
+                     dns_msg(7, false, "b.example.com")), T0 + 1);
+  feed(&d, udp_frame("10.0.0.53", 53, "10.0.0.2", 5353,
+                     dns_msg(7, true, "b.example.com")), T0 + 2);
+  tick(&d, T0 + 600);
+
+  const std::vector<Record> tx = read_records(out.path(), "dns.tx");
+  ASSERT_EQ(2U, tx.size());
+  EXPECT_EQ("success", tx[0].str.at("status"));
+  EXPECT_EQ("10.0.0.2", tx[0].str.at("client"));
+  EXPECT_EQ("timeout", tx[1].str.at("status"));
+  EXPECT_EQ("10.0.0.1", tx[1].str.at("client"));
+}
+
+TEST(Devourer, dns_tx_ipv6) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+
+  std::vector<Answer> an;
+  an.push_back(Answer{28, "www.example.com", "2001:db8::80"});
+  feed(&d, udp_frame("2001:db8::1", 40000, "fd00::53", 53,
+                     dns_msg(0xbeef, false, "www.example.com")), T0);
+  feed(&d, udp_frame("fd00::53", 53, "2001:db8::1", 40000,
+                     dns_msg(0xbeef, true, "www.example.com", an)), T0 + 3);
+
+  const std::vector<Record> tx = read_records(out.path(), "dns.tx");
+  ASSERT_EQ(1U, tx.size());
+  EXPECT_EQ("success", tx[0].str.at("status"));
+  EXPECT_EQ("2001:db8::1", tx[0].str.at("client"));
+  EXPECT_EQ("fd00::53", tx[0].str.at("server"));
+}
+
+TEST(Devourer, flow_name_by_cname) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+
+  // A record name differs in case from CNAME data.
+  std::vector<Answer> an;
+  an.push_back(Answer{5, "www.example.com", "EDGE.cdn.example.net"});
+  an.push_back(Answer{1, "edge.CDN.example.net", "93.184.216.34"});
+  feed(&d, udp_frame("10.0.0.1", 40000, "10.0.0.53", 53,
+                     dns_msg(1, false, "www.example.com")), T0);
+  feed(&d, udp_frame("10.0.0.53", 53, "10.0.0.1", 40000,
+                     dns_msg(1, true, "www.example.com", an)), T0 + 5);
+  feed(&d, udp_frame("10.0.0.1", 40001, "93.184.216.34", 443, "data"),
+       T0 + 10);
+
+  const std::vector<Record> flows = read_records(out.path(), "flow.new");
+  ASSERT_EQ(2U, flows.size());
+  EXPECT_EQ("93.184.216.34", flows[1].str.at("dst_addr"));
+  // Trailing dot depends on the decoder.
+  EXPECT_EQ(0U, flows[1].str.at("dst_name").find("www.example.com"));
+}
+
+TEST(Devourer, flow_update) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+  const std::string a = udp_frame("10.0.2.1", 1000, "10.0.2.2", 2000, "a");
+  const std::string b = udp_frame("10.0.2.3", 1000, "10.0.2.4", 2000, "b");
+
+  // Tasks run every second of packet time before the packet.
+  feed(&d, a, T0);
+  feed(&d, a, T0 + 10);
+  feed(&d, b, T0 + 20);
+  EXPECT_EQ(0U, read_records(out.path(), "flow.update").size());
+  tick(&d, T0 + 1000);
+  const std::vector<Record> flows = read_records(out.path(), "flow.new");
+  ASSERT_EQ(3U, flows.size());
+  const std::string hash_a = flows[0].str.at("hash");
+  const std::string hash_b = flows[1].str.at("hash");
+  const std::string hash_tick = flows[2].str.at("hash");
+
+  std::vector<Record> updates = read_records(out.path(), "flow.update");
+  ASSERT_EQ(1U, updates.size());
+  EXPECT_EQ(T0 / 1000 + 1, updates[0].ts);
+  std::map<std::string, uint64_t> pkt = updates[0].maps.at("flow_pkt");
+  EXPECT_EQ(2U, pkt.size());
+  EXPECT_EQ(2U, pkt[hash_a]);
+  EXPECT_EQ(1U, pkt[hash_b]);
+  EXPECT_EQ(2U, updates[0].maps.at("flow_size").size());
+
+  // Only touched flows in the interval.
+  tick(&d, T0 + 1500);
+  feed(&d, b, T0 + 1600);
+  EXPECT_EQ(1U, read_records(out.path(), "flow.update").size());
+  tick(&d, T0 + 2000);
+  updates = read_records(out.path(), "flow.update");
+  ASSERT_EQ(2U, updates.size());
+  pkt = updates[1].maps.at("flow_pkt");
+  EXPECT_EQ(2U, pkt.size());
+  EXPECT_EQ(2U, pkt[hash_tick]);
+  EXPECT_EQ(1U, pkt[hash_b]);
+  EXPECT_EQ(0U, pkt.count(hash_a));
+
+  // Seconds without packets are not caught up one by one.
+  feed(&d, a, T0 + 5500);
+  updates = read_records(out.path(), "flow.update");
+  ASSERT_EQ(3U, updates.size());
+  EXPECT_EQ(T0 / 1000 + 5, updates[2].ts);
+  EXPECT_EQ(1U, updates[2].maps.at("flow_pkt").size());
+}
+
+TEST(Devourer, flow_active) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+  d.set_active_timeout(2);
+  const std::string a = udp_frame("10.0.3.1", 1000, "10.0.3.2", 2000, "a");
+
+  feed(&d, a, T0);
+  feed(&d, a, T0 + 1000);
+  EXPECT_EQ(0U, read_records(out.path(), "flow.active").size());
+
+  // Exported by the task before the packet of T0 + 2500.
+  feed(&d, a, T0 + 2500);
+  std::vector<Record> active = read_records(out.path(), "flow.active");
+  ASSERT_EQ(1U, active.size());
+  EXPECT_EQ(T0 / 1000 + 2, active[0].ts);
+  EXPECT_EQ(T0 / 1000, active[0].num.at("init_ts"));
+  EXPECT_EQ(2U, active[0].num.at("c_pkt"));
+  EXPECT_EQ("10.0.3.1", active[0].str.at("c_addr"));
+
+  // Next export is active timeout after the last one.
+  feed(&d, a, T0 + 3500);
+  EXPECT_EQ(1U, read_records(out.path(), "flow.active").size());
+  feed(&d, a, T0 + 4200);
+  active = read_records(out.path(), "flow.active");
+  ASSERT_EQ(2U, active.size());
+  EXPECT_EQ(T0 / 1000 + 4, active[1].ts);
+  EXPECT_EQ(4U, active[1].num.at("c_pkt"));
+
+  // 0 disables export.
+  d.set_active_timeout(0);
+  feed(&d, a, T0 + 9000);
+  EXPECT_EQ(2U, read_records(out.path(), "flow.active").size());
+  EXPECT_EQ(0U, read_records(out.path(), "flow.log").size());
+}
+
+// input() has no update_time() before decoding, then the export must not
+// depend on time of the previous packet.
+TEST(Devourer, flow_active_input) {
+  TmpFile out;
+  Devourer d("", devourer::PCAP_FILE);
+  d.setdst_filestream(out.path());
+  d.set_active_timeout(2);
+  const std::string a = udp_frame("10.0.4.1", 1000, "10.0.4.2", 2000, "a");
+  const uint8_t *data = reinterpret_cast<const uint8_t*>(a.data());
+  const uint64_t msec[] = {T0, T0 + 1000, T0 + 2500};
+
+  for (size_t i = 0; i < 3; i++) {
+    const struct timeval tv = {static_cast<time_t>(msec[i] / 1000),
+                               static_cast<suseconds_t>(msec[i] % 1000 * 1000)};
+    d.input(data, a.size(), tv, a.size());
+  }
+  const std::vector<Record> active = read_records(out.path(), "flow.active");
+  ASSERT_EQ(1U, active.size());
+  EXPECT_EQ(T0 / 1000 + 2, active[0].ts);
+  EXPECT_EQ(2U, active[0].num.at("c_pkt"));
+}
@@ -0,0 +1,158 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <time.h>
+#include <vector>
+#include "./gtest.h"
+#include "../src/emitter.hpp"
+#include "../src/output.hpp"
+
+namespace {
+  class CountOutput : public devourer::Output {
+  public:
+    size_t records_;
+    size_t writes_;
+    std::vector<uint8_t> data_;
+    CountOutput() : records_(0), writes_(0) {}
+    void write(const uint8_t *data, size_t len, size_t count) {
+      this->data_.insert(this->data_.end(), data, data + len);
+      this->records_ += count;
+      this->writes_++;
+    }
+  };
+
+  const devourer::RecordSchema dns_log("dns.log", {"name"});
+  const devourer::RecordSchema flow_log("flow.log", {"hash"});
+
+  bool write(devourer::Emitter *emitter, const devourer::RecordSchema &s) {
+    devourer::RecordWriter *w = emitter->begin(s, 1);
+    if (w == NULL) {
+      return false;
+    }
+    w->put_str(0, "x");
+    emitter->commit();
+    return true;
+  }
+}
+
+TEST(Emitter, direct) {
+  CountOutput out;
+  devourer::Emitter emitter(&out);
+
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(write(&emitter, dns_log));
+  }
+  EXPECT_EQ(3U, out.records_);
+  EXPECT_EQ(3U, out.writes_);
+  EXPECT_EQ(3U, emitter.emitted());
+}
+
+TEST(Emitter, batch) {
+  CountOutput out;
+  devourer::Emitter emitter(4, 16);
+  struct timespec ts = {100, 0};
+  emitter.tick(ts);
+
+  for (int i = 0; i < 10; i++) {
+    write(&emitter, flow_log);
+  }
+  // Two full batches are queued, and the rest waits for flush.
+  EXPECT_EQ(2U, emitter.queue_depth());
+  EXPECT_EQ(8U, emitter.drain(&out));
+  EXPECT_EQ(2U, out.writes_);
+
+  // Pending batch is flushed when it gets old.
+  ts.tv_nsec = 50 * 1000 * 1000;
+  emitter.tick(ts);
+  EXPECT_EQ(0U, emitter.drain(&out));
+  ts.tv_sec += 1;
+  emitter.tick(ts);
+  EXPECT_EQ(2U, emitter.drain(&out));
+  EXPECT_EQ(10U, out.records_);
+  EXPECT_EQ(10U, emitter.emitted());
+  EXPECT_EQ(3U, emitter.batches());
+
+  // Batches are reused, and records are same as direct mode.
+  CountOutput direct_out;
+  devourer::Emitter direct(&direct_out);
+  for (int i = 0; i < 10; i++) {
+    write(&direct, flow_log);
+  }
+  EXPECT_EQ(direct_out.data_, out.data_);
+}
+
+TEST(Emitter, shed_low_priority) {
+  CountOutput out;
+  devourer::Emitter emitter(1, 8);
+
+  // Output is stalled, and low priority records are shed at half.
+  size_t low = 0, high = 0;
+  for (int i = 0; i < 8; i++) {
+    if (write(&emitter, dns_log)) {
+      low++;
+    }
+  }
+  EXPECT_EQ(4U, low);
+  EXPECT_EQ(4U, emitter.shed(devourer::Emitter::LOW));
+
+  for (int i = 0; i < 4; i++) {
+    if (write(&emitter, flow_log)) {
+      high++;
+    }
+  }
+  EXPECT_EQ(4U, high);
+  EXPECT_EQ(0U, emitter.shed(devourer::Emitter::HIGH));
+  EXPECT_EQ(8U, emitter.queue_depth());
+
+  EXPECT_EQ(8U, emitter.drain(&out));
+  EXPECT_TRUE(write(&emitter, dns_log));
+
+  // Shed records are not counted for the tag.
+  ASSERT_EQ(2U, emitter.tags());
+  EXPECT_EQ("dns.log", emitter.tag(0));
+  EXPECT_EQ(5U, emitter.tag_emitted(0));
+  EXPECT_EQ("flow.log", emitter.tag(1));
+  EXPECT_EQ(4U, emitter.tag_emitted(1));
+}
+
+TEST(Emitter, drop_on_stalled_output) {
+  CountOutput out;
+  devourer::Emitter emitter(1, 2, 10);
+
+  // High priority records wait for a while, then are dropped without
+  // blocking the producer.
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(write(&emitter, flow_log));
+  }
+  EXPECT_EQ(2U, emitter.queue_depth());
+  EXPECT_EQ(2U, emitter.dropped());
+  EXPECT_EQ(2U, emitter.emitted());
+
+  EXPECT_EQ(2U, emitter.drain(&out));
+  EXPECT_TRUE(write(&emitter, flow_log));
+  EXPECT_EQ(1U, emitter.drain(&out));
+  EXPECT_EQ(2U, emitter.dropped());
+}
@@ -0,0 +1,100 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/output.hpp"
+
+namespace {
+  int listen_at(uint16_t port, uint16_t *bound) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    const int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(sock, reinterpret_cast<struct sockaddr*>(&addr), len) < 0 ||
+        listen(sock, 1) < 0 ||
+        getsockname(sock, reinterpret_cast<struct sockaddr*>(&addr),
+                    &len) < 0) {
+      close(sock);
+      return -1;
+    }
+    *bound = ntohs(addr.sin_port);
+    return sock;
+  }
+}
+
+TEST(ForwardOutput, backlog) {
+  // Take a free port, and close it to refuse connections.
+  uint16_t port;
+  int lsock = listen_at(0, &port);
+  ASSERT_LE(0, lsock);
+  close(lsock);
+
+  devourer::ForwardOutput out("127.0.0.1", port);
+  out.write(reinterpret_cast<const uint8_t*>("abc"), 3, 1);
+  out.write(reinterpret_cast<const uint8_t*>("de"), 2, 2);
+  EXPECT_EQ(3U, out.backlog());
+  EXPECT_EQ(0U, out.dropped());
+
+  // Records over the backlog are dropped.
+  std::vector<uint8_t> big(devourer::ForwardOutput::BACKLOG_SIZE);
+  out.write(big.data(), big.size(), 5);
+  EXPECT_EQ(3U, out.backlog());
+  EXPECT_EQ(5U, out.dropped());
+
+  // Backlog is sent first after reconnect.
+  uint16_t bound;
+  lsock = listen_at(port, &bound);
+  ASSERT_LE(0, lsock);
+  sleep(devourer::ForwardOutput::RETRY_SEC);
+  out.write(reinterpret_cast<const uint8_t*>("f"), 1, 1);
+  EXPECT_EQ(0U, out.backlog());
+
+  int sock = accept(lsock, NULL, NULL);
+  ASSERT_LE(0, sock);
+  std::string recv_data;
+  char buf[16];
+  while (recv_data.size() < 6) {
+    ssize_t rc = recv(sock, buf, sizeof(buf), 0);
+    ASSERT_LT(0, rc);
+    recv_data.append(buf, rc);
+  }
+  EXPECT_EQ("abcdef", recv_data);
+  EXPECT_EQ(5U, out.dropped());
+  close(sock);
+  close(lsock);
+}
@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/ipfix.hpp"
+#include "../src/record.hpp"
+
+namespace {
+  const devourer::RecordSchema flow_log("flow.log", {
+      "c_addr", "c_name", "c_pkt", "c_port", "c_size", "hash", "init_ts",
+      "last_ts", "proto", "s_addr", "s_name", "s_pkt", "s_port", "s_size",
+    });
+  const devourer::RecordSchema dns_tx("dns.tx", {"client"});
+
+  void write_flow(std::vector<uint8_t> *buf, const char *c_addr,
+                  const char *s_addr, const char *s_name) {
+    devourer::RecordWriter w;
+    w.begin(buf, flow_log, 2000);
+    w.put_str(0, c_addr);
+    w.put_uint(2, 3);
+    w.put_uint(3, 50000);
+    w.put_uint(4, 300);
+    w.put_str(5, "0123456789ABCDEF");
+    w.put_uint(6, 1000);
+    w.put_uint(7, 2000);
+    w.put_str(8, "TCP");
+    w.put_str(9, s_addr);
+    if (s_name) {
+      w.put_str(10, s_name);
+    }
+    w.put_uint(11, 2);
+    w.put_uint(12, 443);
+    w.put_uint(13, 0x123456789ULL);
+    w.end();
+  }
+
+  uint64_t be(const uint8_t *p, size_t len) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+      v = (v << 8) | p[i];
+    }
+    return v;
+  }
+
+  std::vector<uint8_t> read_file(int fd) {
+    std::vector<uint8_t> data(65536);
+    const ssize_t len = pread(fd, &data[0], data.size(), 0);
+    data.resize(len > 0 ? len : 0);
+    return data;
+  }
+}
+
+TEST(IpfixOutput, message) {
+  char path[] = "/tmp/devourer-ipfix-XXXXXX";
+  int fd = mkstemp(path);
+  unlink(path);
+
+  std::vector<uint8_t> buf;
+  write_flow(&buf, "10.0.0.1", "192.0.2.1", "www.example.com");
+  devourer::RecordWriter w;
+  w.begin(&buf, dns_tx, 2000);
+  w.put_str(0, "10.0.0.1");
+  w.end();
+  write_flow(&buf, "2001:db8::1", "2001:db8::2", NULL);
+  write_flow(&buf, "10.0.0.1", "2001:db8::2", NULL);  // Not exported
+
+  devourer::IpfixOutput out(fd, 99, 7);
+  out.write(&buf[0], buf.size(), 4);
+  EXPECT_EQ(2U, out.exported());
+
+  const std::vector<uint8_t> msg = read_file(fd);
+  close(fd);
+  ASSERT_GE(msg.size(), 16U);
+  EXPECT_EQ(10U, be(&msg[0], 2));
+  EXPECT_EQ(msg.size(), be(&msg[2], 2));
+  EXPECT_EQ(0U, be(&msg[8], 4));  // Sequence number
+  EXPECT_EQ(7U, be(&msg[12], 4));
+
+  // Template set, 5 fields of 14 have enterprise number.
+  size_t pos = 16;
+  EXPECT_EQ(2U, be(&msg[pos], 2));
+  const size_t tmpl_len = 4 + 2 * (4 + 14 * 4 + 5 * 4);
+  ASSERT_EQ(tmpl_len, be(&msg[pos + 2], 2));
+  EXPECT_EQ(256U, be(&msg[pos + 4], 2));
+  EXPECT_EQ(14U, be(&msg[pos + 6], 2));
+  EXPECT_EQ(8U, be(&msg[pos + 8], 2));  // sourceIPv4Address
+  pos += tmpl_len;
+
+  // IPv4 data set
+  ASSERT_LT(pos + 4, msg.size());
+  EXPECT_EQ(256U, be(&msg[pos], 2));
+  const size_t v4_len = be(&msg[pos + 2], 2);
+  const uint8_t *r = &msg[pos + 4];
+  EXPECT_EQ(0x0a000001U, be(r, 4));
+  EXPECT_EQ(0xc0000201U, be(r + 4, 4));
+  EXPECT_EQ(50000U, be(r + 8, 2));
+  EXPECT_EQ(443U, be(r + 10, 2));
+  EXPECT_EQ(6U, r[12]);
+  EXPECT_EQ(1000U, be(r + 13, 4));
+  EXPECT_EQ(2000U, be(r + 17, 4));
+  EXPECT_EQ(3U, be(r + 21, 8));
+  EXPECT_EQ(300U, be(r + 29, 8));
+  EXPECT_EQ(2U, be(r + 37, 8));
+  EXPECT_EQ(0x123456789ULL, be(r + 45, 8));
+  EXPECT_EQ(0x0123456789ABCDEFULL, be(r + 53, 8));
+  EXPECT_EQ(0U, r[61]);  // No client name
+  ASSERT_EQ(15U, r[62]);
+  EXPECT_EQ("www.example.com",
+            std::string(reinterpret_cast<const char*>(r + 63), 15));
+  EXPECT_EQ(4U + 78, v4_len);
+  pos += v4_len;
+
+  // IPv6 data set
+  ASSERT_LT(pos + 4, msg.size());
+  EXPECT_EQ(257U, be(&msg[pos], 2));
+  EXPECT_EQ(4U + 87, be(&msg[pos + 2], 2));
+  EXPECT_EQ(0x20U, msg[pos + 4]);
+  EXPECT_EQ(msg.size(), pos + 4 + 87);
+}
+
+TEST(IpfixOutput, split_messages) {
+  char path[] = "/tmp/devourer-ipfix-XXXXXX";
+  int fd = mkstemp(path);
+  unlink(path);
+
+  std::vector<uint8_t> buf;
+  const size_t N = 100;
+  for (size_t i = 0; i < N; i++) {
+    write_flow(&buf, "10.0.0.1", "192.0.2.1", "www.example.com");
+  }
+  devourer::IpfixOutput out(fd);
+  out.write(&buf[0], buf.size(), N);
+  EXPECT_EQ(N, out.exported());
+
+  const std::vector<uint8_t> data = read_file(fd);
+  close(fd);
+  size_t pos = 0, records = 0, messages = 0;
+  while (pos + 16 <= data.size()) {
+    const size_t len = be(&data[pos + 2], 2);
+    ASSERT_LE(len, devourer::IpfixOutput::MAX_MESSAGE);
+    EXPECT_EQ(records, be(&data[pos + 8], 4));
+    // Records of 78 bytes in a data set following templates only in the
+    // first message.
+    size_t set = pos + 16;
+    if (messages == 0) {
+      set += be(&data[set + 2], 2);
+    }
+    EXPECT_EQ(256U, be(&data[set], 2));
+    records += (be(&data[set + 2], 2) - 4) / 78;
+    pos += len;
+    messages++;
+  }
+  EXPECT_EQ(data.size(), pos);
+  EXPECT_EQ(N, records);
+  EXPECT_LT(1U, messages);
+}
+
+TEST(IpfixOutput, udp) {
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_LE(0, sock);
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, bind(sock, reinterpret_cast<struct sockaddr*>(&sin),
+                    sizeof(sin)));
+  socklen_t sin_len = sizeof(sin);
+  getsockname(sock, reinterpret_cast<struct sockaddr*>(&sin), &sin_len);
+
+  std::vector<uint8_t> buf;
+  write_flow(&buf, "10.0.0.1", "192.0.2.1", NULL);
+  devourer::IpfixOutput out("127.0.0.1", ntohs(sin.sin_port));
+  out.write(&buf[0], buf.size(), 1);
+
+  uint8_t msg[2048];
+  const ssize_t len = recv(sock, msg, sizeof(msg), 0);
+  close(sock);
+  ASSERT_LT(16, len);
+  EXPECT_EQ(10U, be(msg, 2));
+  EXPECT_EQ(static_cast<uint64_t>(len), be(msg + 2, 2));
+}
@@ -0,0 +1,238 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <vector>
+#include "./gtest.h"
+#include "../src/lru-hash.hpp"
+#include "../src/lru-table.hpp"
+
+namespace {
+  class TestNode : public devourer::LRUHash::Node {
+  private:
+    uint64_t key_;
+    uint64_t hv_;
+  public:
+    TestNode(uint64_t key, uint64_t hv) : key_(key), hv_(hv) {}
+    uint64_t hash() { return this->hv_; }
+    bool match(const void *key, size_t len) {
+      return (len == sizeof(this->key_) &&
+              0 == memcmp(key, &this->key_, sizeof(this->key_)));
+    }
+    uint64_t key() const { return this->key_; }
+  };
+
+  template <typename T>
+  TestNode* get_node(T *table, uint64_t key, uint64_t hv) {
+    return dynamic_cast<TestNode*>(table->get(hv, &key, sizeof(key)));
+  }
+}
+
+TEST(LRUHash, put_get_expire) {
+  devourer::LRUHash table(10);
+  TestNode *n1 = new TestNode(1, 100);
+  TestNode *n2 = new TestNode(2, 100);  // same hash value as n1
+  EXPECT_TRUE(table.put(3, n1));
+  EXPECT_TRUE(table.put(5, n2));
+  TestNode n3(3, 1);
+  EXPECT_FALSE(table.put(10, &n3));
+
+  EXPECT_EQ(n1, get_node(&table, 1, 100));
+  EXPECT_EQ(n2, get_node(&table, 2, 100));
+  EXPECT_EQ(NULL, get_node(&table, 3, 100));
+
+  table.prog(4);
+  EXPECT_EQ(n1, table.pop());
+  EXPECT_EQ(NULL, table.pop());
+  EXPECT_EQ(NULL, get_node(&table, 1, 100));
+  EXPECT_EQ(n2, get_node(&table, 2, 100));
+
+  table.purge();
+  EXPECT_EQ(n2, table.pop());
+  EXPECT_EQ(NULL, get_node(&table, 2, 100));
+  delete n1;
+  delete n2;
+}
+
+TEST(LRUHash, grow_and_reuse_slots) {
+  const size_t count = 100000;
+  devourer::LRUHash table(4, 16);
+  std::vector<TestNode*> nodes;
+
+  // Put nodes in 2 time slots. Hash values are sequential and collide in
+  // low bits to test mixing.
+  for (size_t i = 0; i < count; i++) {
+    nodes.push_back(new TestNode(i, i << 20));
+    ASSERT_TRUE(table.put(1 + i % 2, nodes[i]));
+  }
+  EXPECT_EQ(count, table.size());
+  EXPECT_LE(count, table.capacity());
+  for (size_t i = 0; i < count; i++) {
+    ASSERT_EQ(nodes[i], get_node(&table, i, i << 20));
+  }
+
+  // Expire a half, and remains must be still found.
+  table.prog(2);
+  size_t expired = 0;
+  while (NULL != table.pop()) {
+    expired++;
+  }
+  EXPECT_EQ(count / 2, expired);
+  for (size_t i = 0; i < count; i++) {
+    TestNode *n = get_node(&table, i, i << 20);
+    ASSERT_EQ((i % 2 == 0) ? NULL : nodes[i], n);
+  }
+
+  // Re-put expired nodes into deleted slots.
+  for (size_t i = 0; i < count; i += 2) {
+    ASSERT_TRUE(table.put(3, nodes[i]));
+  }
+  for (size_t i = 0; i < count; i++) {
+    ASSERT_EQ(nodes[i], get_node(&table, i, i << 20));
+  }
+
+  table.purge();
+  while (NULL != table.pop()) {}
+  EXPECT_EQ(0U, table.size());
+  for (size_t i = 0; i < count; i++) {
+    delete nodes[i];
+  }
+}
+
+template <typename T>
+void test_resize(T *table) {
+  const size_t count = 50000;
+  const size_t init_buckets = table->capacity();
+  std::vector<TestNode*> nodes;
+
+  // Nodes must be found at any time while rehashing.
+  bool rehashed = false;
+  for (size_t i = 0; i < count; i++) {
+    nodes.push_back(new TestNode(i, i * 7919));
+    ASSERT_TRUE(table->put(1 + i % 2, nodes[i]));
+    rehashed |= table->rehashing();
+    if (i % 97 == 0) {
+      for (size_t j = 0; j <= i; j += 13) {
+        ASSERT_EQ(nodes[j], get_node(table, j, j * 7919));
+      }
+    }
+  }
+  EXPECT_TRUE(rehashed);
+  EXPECT_EQ(count, table->size());
+  EXPECT_LT(init_buckets, table->capacity());
+
+  // Expire a half, then other half must be found while shrinking.
+  table->prog(2);
+  while (NULL != table->pop()) {}
+  EXPECT_EQ(count / 2, table->size());
+  for (size_t i = 1; i < count; i += 2) {
+    ASSERT_EQ(nodes[i], get_node(table, i, i * 7919));
+  }
+
+  // Expire all, then table shrinks back to initial size step by step.
+  table->prog(1);
+  while (NULL != table->pop()) {}
+  EXPECT_EQ(0U, table->size());
+  for (size_t i = 0; i < 100000 && table->capacity() > init_buckets; i++) {
+    table->prog(1);
+  }
+  EXPECT_EQ(init_buckets, table->capacity());
+
+  for (size_t i = 0; i < count; i++) {
+    delete nodes[i];
+  }
+}
+
+TEST(LRUHash, resize) {
+  devourer::LRUHash table(4);
+  test_resize(&table);
+}
+
+namespace {
+  class TypedKey {
+  private:
+    uint32_t id_;
+  public:
+    explicit TypedKey(uint32_t id) : id_(id) {}
+    uint32_t id() const { return this->id_; }
+    uint64_t hash() const { return this->id_ * 0x9E3779B97F4A7C15ULL; }
+  };
+
+  class TypedNode : public devourer::LRUTableNode {
+  private:
+    uint32_t id_;
+  public:
+    explicit TypedNode(uint32_t id) : id_(id) {}
+    uint32_t id() const { return this->id_; }
+    uint64_t hash() const { return TypedKey(this->id_).hash(); }
+    bool match(const TypedKey &key) const { return key.id() == this->id_; }
+  };
+}
+
+TEST(LRUTable, typed_node) {
+  devourer::LRUTable<TypedNode, TypedKey> table(10);
+  TypedNode n1(1), n2(2);
+  EXPECT_TRUE(table.put(3, &n1));
+  EXPECT_TRUE(table.put(5, &n2));
+
+  TypedNode *n = table.get(TypedKey(2));
+  ASSERT_TRUE(n != NULL);
+  EXPECT_EQ(2U, n->id());
+  EXPECT_EQ(NULL, table.get(TypedKey(3)));
+
+  table.prog(4);
+  EXPECT_EQ(&n1, table.pop());
+  EXPECT_EQ(NULL, table.pop());
+  EXPECT_EQ(NULL, table.get(TypedKey(1)));
+
+  table.purge();
+  EXPECT_EQ(&n2, table.pop());
+  EXPECT_EQ(0U, table.size());
+}
+
+TEST(LRUTable, probe_stats) {
+  devourer::LRUTable<TypedNode, TypedKey> table(10);
+  std::vector<TypedNode*> nodes;
+  for (uint64_t i = 0; i < 500; i++) {
+    nodes.push_back(new TypedNode(i));
+    EXPECT_TRUE(table.put(1, nodes.back()));
+  }
+  EXPECT_EQ(0U, table.lookups());
+  for (uint64_t i = 0; i < 1000; i++) {
+    table.get(TypedKey(i));
+  }
+  EXPECT_EQ(1000U, table.lookups());
+  // Each lookup probes a group at least, and a few on average.
+  EXPECT_LE(1000U, table.probes());
+  EXPECT_GT(2000U, table.probes());
+
+  table.purge();
+  while (table.pop() != NULL) {
+  }
+  for (size_t i = 0; i < nodes.size(); i++) {
+    delete nodes[i];
+  }
+}
@@ -0,0 +1,144 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <fluent.hpp>
+#include "./gtest.h"
+#include "../src/output.hpp"
+#include "../src/record.hpp"
+
+// Records of RecordWriter must be the same bytes as fluent::Message of
+// libfluent, which was used before to write them. Records are converted to
+// fluent::Message by LoggerOutput, and packed again by libfluent.
+namespace {
+  class TmpFile {
+  private:
+    std::string path_;
+
+  public:
+    TmpFile() {
+      char path[] = "/tmp/devourer-test-XXXXXX";
+      int fd = mkstemp(path);
+      close(fd);
+      this->path_ = path;
+    }
+    ~TmpFile() { unlink(this->path_.c_str()); }
+    const std::string& path() const { return this->path_; }
+    std::string read() const {
+      std::string data;
+      FILE *fp = fopen(this->path_.c_str(), "rb");
+      char buf[4096];
+      size_t len;
+      while (fp && (len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, len);
+      }
+      if (fp) {
+        fclose(fp);
+      }
+      return data;
+    }
+  };
+
+  // Records of every value type and string size class.
+  std::vector<uint8_t> records() {
+    static const devourer::RecordSchema tx("dns.tx", {
+        "client", "latency", "q_name", "server", "status"
+      });
+    static const devourer::RecordSchema log("flow.log", {
+        "c_port", "c_size", "hash", "init_ts"
+      });
+    static const devourer::RecordSchema update("flow.update", {"flow_pkt"});
+    std::vector<uint8_t> buf;
+    devourer::RecordWriter w;
+
+    w.begin(&buf, tx, 1420070400);
+    w.put_str(0, "10.0.0.1");
+    w.put_double(1, 0.5);
+    w.put_str(2, std::string(40, 'a') + ".example.com");
+    w.put_str(3, "10.0.0.53");
+    w.put_str(4, std::string(300, 'b'));
+    w.end();
+
+    w.begin(&buf, log, 1420070401);
+    w.put_uint(0, 443);
+    w.put_uint(1, 70000);
+    w.put_str(2, "0123456789ABCDEF");
+    w.put_uint(3, 1420070400);
+    w.end();
+
+    w.begin(&buf, update, 1420070402);
+    w.put_map(0, 2);
+    w.map_key("0000000000000001");
+    w.map_uint(1);
+    w.map_key("0000000000000002");
+    w.map_uint(300);
+    w.end();
+    return buf;
+  }
+}
+
+TEST(LoggerOutput, same_bytes_as_libfluent) {
+  const std::vector<uint8_t> buf = records();
+  fluent::Logger logger;
+  fluent::MsgQueue *q = logger.new_msgqueue();
+  devourer::LoggerOutput out(&logger);
+  out.write(buf.data(), buf.size(), 3);
+
+  msgpack::sbuffer sbuf;
+  msgpack::packer<msgpack::sbuffer> pk(&sbuf);
+  fluent::Message *msg;
+  size_t count = 0;
+  while (NULL != (msg = q->pop())) {
+    msg->to_msgpack(&pk);
+    delete msg;
+    count++;
+  }
+  EXPECT_EQ(3U, count);
+  EXPECT_EQ(std::string(buf.begin(), buf.end()),
+            std::string(sbuf.data(), sbuf.size()));
+}
+
+TEST(LoggerOutput, file_output_same_as_dumpfile) {
+  // -o wrote libfluent dumpfile before FileOutput replaced it.
+  const std::vector<uint8_t> buf = records();
+  TmpFile dump, file;
+  {
+    fluent::Logger logger;
+    logger.new_dumpfile(dump.path());
+    devourer::LoggerOutput out(&logger);
+    out.write(buf.data(), buf.size(), 3);
+  }
+  {
+    devourer::FileOutput out(file.path());
+    out.write(buf.data(), buf.size(), 3);
+  }
+  EXPECT_EQ(dump.read(), file.read());
+  EXPECT_EQ(std::string(buf.begin(), buf.end()), file.read());
+}
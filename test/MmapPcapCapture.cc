@@ -0,0 +1,363 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/capture.hpp"
+
+namespace {
+  class TmpFile {
+  private:
+    std::string path_;
+    std::vector<uint8_t> buf_;
+
+  public:
+    TmpFile() {
+      char path[] = "/tmp/devourer-test-XXXXXX";
+      int fd = mkstemp(path);
+      close(fd);
+      this->path_ = path;
+    }
+    ~TmpFile() { unlink(this->path_.c_str()); }
+    const std::string& path() const { return this->path_; }
+
+    void u16(uint16_t v) { this->raw(&v, sizeof(v)); }
+    void u32(uint32_t v) { this->raw(&v, sizeof(v)); }
+    void raw(const void *p, size_t len) {
+      const uint8_t *b = static_cast<const uint8_t*>(p);
+      this->buf_.insert(this->buf_.end(), b, b + len);
+    }
+    void pad() {
+      while (this->buf_.size() % 4 != 0) {
+        this->buf_.push_back(0);
+      }
+    }
+    void save(size_t truncate = 0) {
+      FILE *fp = fopen(this->path_.c_str(), "wb");
+      fwrite(&this->buf_[0], 1, this->buf_.size() - truncate, fp);
+      fclose(fp);
+    }
+  };
+}
+
+TEST(MmapPcapCapture, pcap) {
+  TmpFile f;
+  f.u32(0xa1b2c3d4); f.u16(2); f.u16(4); f.u32(0); f.u32(0);
+  f.u32(65535); f.u32(1);
+  for (uint32_t i = 0; i < 3; i++) {
+    uint8_t data[64];
+    memset(data, i, sizeof(data));
+    f.u32(1000 + i); f.u32(500 + i); f.u32(60); f.u32(1514);
+    f.raw(data, 60);
+  }
+  f.save(10);  // The last record is being written.
+
+  devourer::MmapPcapCapture cap(f.path());
+  devourer::Packet pkt;
+  for (uint32_t i = 0; i < 2; i++) {
+    ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+    EXPECT_EQ(60U, pkt.len);
+    EXPECT_EQ(1514U, pkt.cap_len);
+    EXPECT_EQ(1000 + i, pkt.tv.tv_sec);
+    EXPECT_EQ(500 + i, pkt.tv.tv_usec);
+    EXPECT_EQ(i, pkt.data[59]);
+  }
+  EXPECT_EQ(devourer::Capture::END, cap.next(&pkt));
+}
+
+TEST(MmapPcapCapture, pcapng) {
+  TmpFile f;
+  // Section Header Block
+  f.u32(0x0A0D0D0A); f.u32(28); f.u32(0x1A2B3C4D); f.u16(1); f.u16(0);
+  f.u32(0xffffffff); f.u32(0xffffffff); f.u32(28);
+  // Interface Description Block, if_tsresol = 9 (nanosecond)
+  f.u32(1); f.u32(32); f.u16(1); f.u16(0); f.u32(65535);
+  f.u16(9); f.u16(1); f.u32(9); f.u16(0); f.u16(0); f.u32(32);
+  // Enhanced Packet Block
+  const uint64_t ts = 1400000000ULL * 1000000000ULL + 123456789ULL;
+  uint8_t data[62];
+  memset(data, 0xAB, sizeof(data));
+  f.u32(6); f.u32(32 + 64); f.u32(0);
+  f.u32(static_cast<uint32_t>(ts >> 32)); f.u32(static_cast<uint32_t>(ts));
+  f.u32(62); f.u32(62); f.raw(data, 62); f.pad(); f.u32(32 + 64);
+  // Unknown block is skipped.
+  f.u32(0x0BADBEEF); f.u32(16); f.u32(0); f.u32(16);
+  // Simple Packet Block
+  f.u32(3); f.u32(16 + 64); f.u32(62); f.raw(data, 62); f.pad();
+  f.u32(16 + 64);
+  f.save();
+
+  devourer::MmapPcapCapture cap(f.path());
+  devourer::Packet pkt;
+  ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+  EXPECT_EQ(62U, pkt.len);
+  EXPECT_EQ(1400000000, pkt.tv.tv_sec);
+  EXPECT_EQ(123456, pkt.tv.tv_usec);
+  EXPECT_EQ(0xAB, pkt.data[61]);
+
+  ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+  EXPECT_EQ(62U, pkt.len);
+  EXPECT_EQ(62U, pkt.cap_len);
+  EXPECT_EQ(devourer::Capture::END, cap.next(&pkt));
+}
+
+namespace {
+  // Section Header Block and Interface Description Block of Ethernet.
+  void pcapng_header(TmpFile *f) {
+    f->u32(0x0A0D0D0A); f->u32(28); f->u32(0x1A2B3C4D); f->u16(1);
+    f->u16(0); f->u32(0xffffffff); f->u32(0xffffffff); f->u32(28);
+    f->u32(1); f->u32(20); f->u16(1); f->u16(0); f->u32(65535); f->u32(20);
+  }
+}
+
+TEST(MmapPcapCapture, pcapng_truncated_epb) {
+  uint8_t data[64];
+  memset(data, 0xAB, sizeof(data));
+
+  // Enhanced Packet Block shorter than its fixed fields at the end of file.
+  TmpFile f1;
+  pcapng_header(&f1);
+  f1.u32(6); f1.u32(32 + 64); f1.u32(0); f1.u32(0); f1.u32(1);
+  f1.u32(64); f1.u32(64); f1.raw(data, 64); f1.u32(32 + 64);
+  f1.u32(6); f1.u32(16); f1.u32(0); f1.u32(16);
+  f1.save();
+  {
+    devourer::MmapPcapCapture cap(f1.path());
+    devourer::Packet pkt;
+    ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+    EXPECT_EQ(64U, pkt.len);
+    EXPECT_THROW(cap.next(&pkt), devourer::Exception);
+  }
+
+  // Packet data overlapping the trailing block length.
+  TmpFile f2;
+  pcapng_header(&f2);
+  f2.u32(6); f2.u32(32 + 64); f2.u32(0); f2.u32(0); f2.u32(1);
+  f2.u32(66); f2.u32(66); f2.raw(data, 64); f2.u32(32 + 64);
+  f2.save();
+  {
+    devourer::MmapPcapCapture cap(f2.path());
+    devourer::Packet pkt;
+    EXPECT_THROW(cap.next(&pkt), devourer::Exception);
+  }
+
+  // Block being written is ignored.
+  TmpFile f3;
+  pcapng_header(&f3);
+  f3.u32(6); f3.u32(32 + 64); f3.u32(0); f3.u32(0); f3.u32(1);
+  f3.u32(64); f3.u32(64); f3.raw(data, 64); f3.u32(32 + 64);
+  f3.save(40);
+  {
+    devourer::MmapPcapCapture cap(f3.path());
+    devourer::Packet pkt;
+    EXPECT_EQ(devourer::Capture::END, cap.next(&pkt));
+  }
+}
+
+TEST(MmapPcapCapture, invalid) {
+  TmpFile f;
+  for (int i = 0; i < 8; i++) {
+    f.u32(0x12345678);
+  }
+  f.save();
+  EXPECT_THROW(devourer::MmapPcapCapture cap(f.path()), devourer::Exception);
+  EXPECT_THROW(devourer::MmapPcapCapture cap("/nonexistent/file.pcap"),
+               devourer::Exception);
+}
+
+namespace {
+  // pcap file that has packets of given seconds, first byte of data is tag.
+  void write_pcap(TmpFile *f, const uint32_t *secs, size_t count,
+                  uint8_t tag) {
+    f->u32(0xa1b2c3d4); f->u16(2); f->u16(4); f->u32(0); f->u32(0);
+    f->u32(65535); f->u32(1);
+    uint8_t data[60];
+    memset(data, tag, sizeof(data));
+    for (size_t i = 0; i < count; i++) {
+      f->u32(secs[i]); f->u32(0); f->u32(60); f->u32(60);
+      f->raw(data, 60);
+    }
+    f->save();
+  }
+}
+
+TEST(MergeCapture, time_order) {
+  TmpFile f1, f2, f3;
+  const uint32_t s1[] = {10, 20, 30, 40};
+  const uint32_t s2[] = {15, 20, 35};
+  write_pcap(&f1, s1, 4, 1);
+  write_pcap(&f2, s2, 3, 2);
+  write_pcap(&f3, NULL, 0, 3);
+
+  std::vector<std::string> paths;
+  paths.push_back(f1.path());
+  paths.push_back(f2.path());
+  paths.push_back(f3.path());
+  devourer::MergeCapture cap(paths);
+
+  const time_t expect_ts[] = {10, 15, 20, 20, 30, 35, 40};
+  const uint8_t expect_tag[] = {1, 2, 1, 2, 1, 2, 1};
+  devourer::Packet pkt;
+  for (size_t i = 0; i < 7; i++) {
+    ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+    EXPECT_EQ(expect_ts[i], pkt.tv.tv_sec);
+    EXPECT_EQ(expect_tag[i], pkt.data[0]);
+  }
+  EXPECT_EQ(devourer::Capture::END, cap.next(&pkt));
+}
+
+namespace {
+  // Files of 3 packets, tag is the index of file. Timestamps interleave the
+  // files, and the last packets come in the reverse order of files.
+  void write_files(size_t n, std::vector<TmpFile*> *files,
+                   std::vector<std::string> *paths) {
+    for (size_t i = 0; i < n; i++) {
+      const uint32_t s[] = {static_cast<uint32_t>(i),
+                            static_cast<uint32_t>(1000 + i),
+                            static_cast<uint32_t>(2000 + n - i)};
+      TmpFile *f = new TmpFile();
+      write_pcap(f, s, 3, static_cast<uint8_t>(i));
+      files->push_back(f);
+      paths->push_back(f->path());
+    }
+  }
+
+  void expected(size_t n, size_t i, size_t *idx, time_t *ts) {
+    *idx = i;
+    *ts = i;
+    if (i >= n * 2) {
+      *idx = n - 1 - (i - n * 2);
+      *ts = 2000 + n - *idx;
+    } else if (i >= n) {
+      *idx = i - n;
+      *ts = 1000 + *idx;
+    }
+  }
+}
+
+TEST(MergeCapture, many_files) {
+  // More files than mapped at once, each file is unmapped and mapped again.
+  // Packets are copied before the next call as Devourer::start() does.
+  const size_t n = 11;
+  std::vector<TmpFile*> files;
+  std::vector<std::string> paths;
+  write_files(n, &files, &paths);
+
+  devourer::MergeCapture cap(paths, 3);
+  EXPECT_FALSE(cap.zero_copy());
+  std::vector<std::vector<uint8_t> > copies;
+  devourer::Packet pkt;
+  for (size_t i = 0; i < n * 3; i++) {
+    ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+    size_t idx;
+    time_t ts;
+    expected(n, i, &idx, &ts);
+    EXPECT_EQ(ts, pkt.tv.tv_sec);
+    ASSERT_EQ(60U, pkt.len);
+    copies.push_back(std::vector<uint8_t>(pkt.data, pkt.data + pkt.len));
+  }
+  EXPECT_EQ(devourer::Capture::END, cap.next(&pkt));
+
+  for (size_t i = 0; i < copies.size(); i++) {
+    size_t idx;
+    time_t ts;
+    expected(n, i, &idx, &ts);
+    EXPECT_EQ(std::vector<uint8_t>(60, static_cast<uint8_t>(idx)),
+              copies[i]);
+  }
+  for (size_t i = 0; i < n; i++) {
+    delete files[i];
+  }
+}
+
+TEST(MergeCapture, zero_copy) {
+  // All files stay mapped, data of all packets is valid until the end.
+  const size_t n = 5;
+  std::vector<TmpFile*> files;
+  std::vector<std::string> paths;
+  write_files(n, &files, &paths);
+
+  devourer::MergeCapture cap(paths, n);
+  EXPECT_TRUE(cap.zero_copy());
+  std::vector<const uint8_t*> refs;
+  devourer::Packet pkt;
+  while (cap.next(&pkt) == devourer::Capture::READ) {
+    refs.push_back(pkt.data);
+  }
+  ASSERT_EQ(n * 3, refs.size());
+  for (size_t i = 0; i < refs.size(); i++) {
+    size_t idx;
+    time_t ts;
+    expected(n, i, &idx, &ts);
+    EXPECT_EQ(std::vector<uint8_t>(60, static_cast<uint8_t>(idx)),
+              std::vector<uint8_t>(refs[i], refs[i] + 60));
+  }
+  for (size_t i = 0; i < n; i++) {
+    delete files[i];
+  }
+}
+
+TEST(MmapPcapCapture, release) {
+  TmpFile f;
+  const uint32_t s[] = {1, 2};
+  write_pcap(&f, s, 2, 7);
+
+  devourer::MmapPcapCapture cap(f.path());
+  devourer::Packet pkt;
+  ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+  const size_t off = cap.offset_of(pkt.data);
+  cap.release();
+  EXPECT_FALSE(cap.mapped());
+  EXPECT_EQ(7, cap.data_at(off)[0]);
+  EXPECT_TRUE(cap.mapped());
+
+  cap.release();
+  ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+  EXPECT_EQ(2, pkt.tv.tv_sec);
+  EXPECT_EQ(devourer::Capture::END, cap.next(&pkt));
+}
+
+TEST(MergeCapture, expand_files) {
+  TmpFile f1, f2;
+  const uint32_t s[] = {1};
+  write_pcap(&f1, s, 1, 1);
+  write_pcap(&f2, s, 1, 2);
+
+  std::vector<std::string> files =
+    devourer::expand_files(f1.path() + "," + f2.path());
+  ASSERT_EQ(2U, files.size());
+  EXPECT_EQ(f1.path(), files[0]);
+
+  files = devourer::expand_files("/tmp/devourer-test-*");
+  EXPECT_LE(2U, files.size());
+  EXPECT_THROW(devourer::expand_files("/nonexistent/*.pcap"),
+               devourer::Exception);
+}
@@ -0,0 +1,160 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <string>
+#include "./gtest.h"
+#include "../src/modules/dns.hpp"
+
+TEST(ModDns, query_timeout_range) {
+  devourer::ModDns dns;
+  EXPECT_THROW(dns.set_query_timeout(0), devourer::Exception);
+  EXPECT_THROW(dns.set_query_timeout(devourer::ModDns::MAX_TIMEOUT),
+               devourer::Exception);
+  EXPECT_NO_THROW(dns.set_query_timeout(1));
+  EXPECT_NO_THROW(dns.set_query_timeout(devourer::ModDns::MAX_TIMEOUT - 1));
+
+  try {
+    dns.set_query_timeout(0);
+  } catch (const devourer::Exception &e) {
+    EXPECT_EQ(std::string("Query timeout must be 1 to 3599999 msec"),
+              e.what());
+  }
+}
+
+namespace {
+  typedef devourer::ModDns::QueryKey QueryKey;
+
+  std::string addr(const char *text) {
+    uint8_t buf[16];
+    const bool v6 = (strchr(text, ':') != NULL);
+    inet_pton(v6 ? AF_INET6 : AF_INET, text, buf);
+    return std::string(reinterpret_cast<char*>(buf), v6 ? 16 : 4);
+  }
+
+  QueryKey key(const std::string &src, uint16_t sport, const std::string &dst,
+               uint16_t dport, uint16_t tx_id, bool response) {
+    return QueryKey(src.data(), dst.data(), src.size(), sport, dport, tx_id,
+                    response);
+  }
+}
+
+TEST(ModDns, query_key_response) {
+  const std::string client = addr("10.0.0.1"), server = addr("10.0.0.53");
+  const QueryKey q = key(client, 40000, server, 53, 0x1234, false);
+  const QueryKey r = key(server, 53, client, 40000, 0x1234, true);
+  EXPECT_TRUE(q.match(r));
+  EXPECT_EQ(q.hash(), r.hash());
+  EXPECT_EQ(0, memcmp(client.data(), r.client(), 4));
+  EXPECT_EQ(0, memcmp(server.data(), r.server(), 4));
+  EXPECT_EQ(40000, r.client_port());
+  EXPECT_EQ(53, r.server_port());
+  EXPECT_EQ(4U, r.addr_len());
+
+  // Response in the same direction as the query is another transaction.
+  const QueryKey same_dir = key(client, 40000, server, 53, 0x1234, true);
+  EXPECT_FALSE(q.match(same_dir));
+  EXPECT_FALSE(q.match(key(server, 53, client, 40000, 0x1235, true)));
+  EXPECT_FALSE(q.match(key(server, 53, client, 40001, 0x1234, true)));
+}
+
+TEST(ModDns, query_key_same_tx_id) {
+  // Two clients behind one resolver use the same port and transaction ID.
+  const std::string server = addr("10.0.0.53");
+  const QueryKey a = key(addr("10.0.0.1"), 5353, server, 53, 7, false);
+  const QueryKey b = key(addr("10.0.0.2"), 5353, server, 53, 7, false);
+  EXPECT_FALSE(a.match(b));
+  EXPECT_NE(a.hash(), b.hash());
+  EXPECT_TRUE(b.match(key(server, 53, addr("10.0.0.2"), 5353, 7, true)));
+  EXPECT_FALSE(a.match(key(server, 53, addr("10.0.0.2"), 5353, 7, true)));
+}
+
+TEST(ModDns, query_key_ipv6) {
+  const std::string client = addr("2001:db8::1"), server = addr("fd00::53");
+  const QueryKey q = key(client, 40000, server, 53, 0xbeef, false);
+  const QueryKey r = key(server, 53, client, 40000, 0xbeef, true);
+  EXPECT_TRUE(q.match(r));
+  EXPECT_EQ(q.hash(), r.hash());
+  EXPECT_EQ(16U, q.addr_len());
+  EXPECT_EQ(0, memcmp(client.data(), q.client(), 16));
+
+  // Addresses differ only in the last byte.
+  const QueryKey other = key(addr("2001:db8::2"), 40000, server, 53, 0xbeef,
+                             false);
+  EXPECT_FALSE(q.match(other));
+  EXPECT_NE(q.hash(), other.hash());
+
+  // IPv4 address equal to the head of IPv6 one is another key.
+  const std::string v4 = client.substr(0, 4), s4 = server.substr(0, 4);
+  EXPECT_FALSE(q.match(key(v4, 40000, s4, 53, 0xbeef, false)));
+}
+
+TEST(ModDns, cname_chain) {
+  devourer::ModDns dns;
+  const std::string a = addr("93.184.216.34");
+  dns.add_cname_record("www.example.com", "web.example.net", 0);
+  dns.add_cname_record("web.example.net", "edge.cdn.example.org", 0);
+  dns.add_a_record("edge.cdn.example.org", a.data(), a.size(), 0);
+  EXPECT_EQ("www.example.com", dns.resolv_addr(a.data(), a.size()));
+  EXPECT_EQ("web.example.net", dns.resolv_addr(a.data(), a.size(), 1));
+  EXPECT_EQ("edge.cdn.example.org", dns.resolv_addr(a.data(), a.size(), 0));
+
+  const std::string unknown = addr("192.0.2.1");
+  EXPECT_EQ("", dns.resolv_addr(unknown.data(), unknown.size()));
+}
+
+TEST(ModDns, cname_normalized) {
+  // Names in records differ in case and trailing dot of FQDN.
+  devourer::ModDns dns;
+  const std::string a = addr("2001:db8::80");
+  dns.add_cname_record("www.example.com.", "EDGE.CDN.example.net.", 0);
+  dns.add_a_record("edge.cdn.EXAMPLE.NET", a.data(), a.size(), 0);
+  EXPECT_EQ("www.example.com.", dns.resolv_addr(a.data(), a.size()));
+
+  // Same CNAME in another form updates the record.
+  dns.add_cname_record("www.example.com", "edge.cdn.example.net", 1);
+  EXPECT_EQ(1U, dns.cname_record_count());
+
+  // Only one trailing dot is ignored, and other names do not match.
+  const std::string b = addr("2001:db8::81");
+  dns.add_a_record("edge.cdn.example.net..", b.data(), b.size(), 0);
+  EXPECT_EQ("edge.cdn.example.net..", dns.resolv_addr(b.data(), b.size()));
+  const std::string c = addr("2001:db8::82");
+  dns.add_a_record("edge.cdn.example", c.data(), c.size(), 0);
+  EXPECT_EQ("edge.cdn.example", dns.resolv_addr(c.data(), c.size()));
+}
+
+TEST(ModDns, cname_loop) {
+  // Looped CNAMEs end at recur_max.
+  devourer::ModDns dns;
+  const std::string a = addr("10.0.0.80");
+  dns.add_cname_record("a.example.com", "b.example.com", 0);
+  dns.add_cname_record("b.example.com", "a.example.com", 0);
+  dns.add_a_record("a.example.com", a.data(), a.size(), 0);
+  EXPECT_EQ("b.example.com", dns.resolv_addr(a.data(), a.size(), 1));
+  EXPECT_EQ("a.example.com", dns.resolv_addr(a.data(), a.size(), 32));
+}
@@ -0,0 +1,76 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <set>
+#include <vector>
+#include "./gtest.h"
+#include "../src/node-pool.hpp"
+
+namespace {
+  class PoolObj {
+  public:
+    static int live_;
+    uint64_t value_;
+    explicit PoolObj(uint64_t v) : value_(v) { live_++; }
+    ~PoolObj() { live_--; }
+  };
+  int PoolObj::live_ = 0;
+}
+
+TEST(NodePool, reuse_released_slots) {
+  devourer::NodePool<PoolObj> pool;
+  std::vector<PoolObj*> objs;
+  std::set<PoolObj*> addrs;
+
+  for (uint64_t i = 0; i < 1000; i++) {
+    PoolObj *obj = new (pool.alloc()) PoolObj(i);
+    objs.push_back(obj);
+    addrs.insert(obj);
+  }
+  EXPECT_EQ(1000U, addrs.size());
+  EXPECT_EQ(1000U, pool.used());
+  EXPECT_EQ(1000, PoolObj::live_);
+  const size_t cap = pool.capacity();
+  EXPECT_LE(1000U, cap);
+
+  for (size_t i = 0; i < objs.size(); i++) {
+    EXPECT_EQ(i, objs[i]->value_);
+    pool.release(objs[i]);
+  }
+  EXPECT_EQ(0U, pool.used());
+  EXPECT_EQ(0, PoolObj::live_);
+
+  // Released slots are reused without new slab.
+  for (uint64_t i = 0; i < 1000; i++) {
+    PoolObj *obj = new (pool.alloc()) PoolObj(i);
+    EXPECT_EQ(1U, addrs.count(obj));
+    objs[i] = obj;
+  }
+  EXPECT_EQ(cap, pool.capacity());
+  for (size_t i = 0; i < objs.size(); i++) {
+    pool.release(objs[i]);
+  }
+}
@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "./gtest.h"
+#include "../src/packet-ring.hpp"
+
+namespace {
+  void fill(uint8_t *buf, size_t len, uint32_t seq) {
+    for (size_t i = 0; i < len; i++) {
+      buf[i] = static_cast<uint8_t>(seq + i);
+    }
+  }
+}
+
+TEST(SpscRing, push_pop) {
+  devourer::SpscRing<int> ring(3);
+  EXPECT_EQ(4U, ring.capacity());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(ring.push(i));
+  }
+  EXPECT_FALSE(ring.push(4));
+  int v;
+  EXPECT_TRUE(ring.pop(&v));
+  EXPECT_EQ(0, v);
+  EXPECT_TRUE(ring.push(4));
+  for (int i = 1; i < 5; i++) {
+    EXPECT_TRUE(ring.pop(&v));
+    EXPECT_EQ(i, v);
+  }
+  EXPECT_FALSE(ring.pop(&v));
+}
+
+TEST(PacketRing, threaded_in_order) {
+  static const uint32_t count = 200000;
+  devourer::PacketRing ring(256, 64 * 1024);
+
+  std::thread producer([&ring]() {
+      uint8_t buf[1600];
+      struct timeval tv = {0, 0};
+      for (uint32_t seq = 0; seq < count; seq++) {
+        size_t len = 60 + (seq * 7919) % 1500;
+        fill(buf, len, seq);
+        tv.tv_usec = seq;
+        ring.push(buf, len, tv, len, false, true);
+      }
+      ring.close();
+    });
+
+  uint32_t seq = 0;
+  size_t broken = 0;
+  devourer::PacketRing::Desc desc;
+  uint8_t expect[1600];
+  for (;;) {
+    const uint8_t *data = ring.pop(&desc);
+    if (data == NULL) {
+      if (ring.closed() && NULL == (data = ring.pop(&desc))) {
+        break;
+      }
+      if (data == NULL) {
+        continue;
+      }
+    }
+    size_t len = 60 + (seq * 7919) % 1500;
+    fill(expect, len, seq);
+    if (desc.len != len || desc.tv.tv_usec != static_cast<long>(seq) ||
+        0 != memcmp(data, expect, len)) {
+      broken++;
+    }
+    ring.release(desc);
+    seq++;
+  }
+  producer.join();
+
+  EXPECT_EQ(count, seq);
+  EXPECT_EQ(0U, broken);
+  EXPECT_EQ(count, ring.pushed());
+  EXPECT_EQ(0U, ring.dropped());
+}
+
+TEST(PacketRing, drop_when_full) {
+  devourer::PacketRing ring(4, 4096);
+  uint8_t buf[1000];
+  struct timeval tv = {0, 0};
+  memset(buf, 0, sizeof(buf));
+
+  size_t pushed = 0;
+  for (int i = 0; i < 8; i++) {
+    if (ring.push(buf, sizeof(buf), tv, sizeof(buf), false, false)) {
+      pushed++;
+    }
+  }
+  EXPECT_EQ(4U, pushed);
+  EXPECT_EQ(4U, ring.dropped());
+
+  // Released space is reused.
+  devourer::PacketRing::Desc desc;
+  ASSERT_TRUE(NULL != ring.pop(&desc));
+  ring.release(desc);
+  EXPECT_TRUE(ring.push(buf, sizeof(buf), tv, sizeof(buf), false, false));
+}
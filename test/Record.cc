@@ -0,0 +1,207 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/record.hpp"
+
+namespace {
+  std::string bytes(const std::vector<uint8_t> &buf) {
+    return std::string(buf.begin(), buf.end());
+  }
+
+  std::string packed_uint(uint64_t v) {
+    std::vector<uint8_t> buf;
+    devourer::msgpack::pack_uint(&buf, v);
+    return bytes(buf);
+  }
+
+  std::string packed_int(int64_t v) {
+    std::vector<uint8_t> buf;
+    devourer::msgpack::pack_int(&buf, v);
+    return bytes(buf);
+  }
+}
+
+// Golden record is same as the one packed by msgpack-c 0.5 of libfluent for
+// fluentd forward protocol: [tag, time, {key: value}] with keys in sorted
+// order. Strings of 32 bytes or more are raw16, there is no str8.
+TEST(Record, golden_dns_tx) {
+  const devourer::RecordSchema schema("dns.tx", {
+      "client", "latency", "q_name", "server", "status"
+    });
+  std::vector<uint8_t> buf;
+  devourer::RecordWriter w;
+  w.begin(&buf, schema, 1420070400);
+  w.put_str(0, "10.0.0.1");
+  w.put_double(1, 0.5);
+  // q_name is skipped
+  w.put_str(3, std::string("10.0.0.53"));
+  w.put_str(4, "success");
+  EXPECT_EQ(buf.size(), w.end());
+
+  static const char raw[] =
+    "\x93"
+    "\xaf" "devourer.dns.tx"
+    "\xce\x54\xa4\x8e\x00"
+    "\x84"
+    "\xa6" "client" "\xa8" "10.0.0.1"
+    "\xa7" "latency" "\xcb\x3f\xe0\x00\x00\x00\x00\x00\x00"
+    "\xa6" "server" "\xa9" "10.0.0.53"
+    "\xa6" "status" "\xa7" "success";
+  const std::string golden(raw, sizeof(raw) - 1);
+  EXPECT_EQ(golden, bytes(buf));
+}
+
+TEST(Record, golden_long_str) {
+  const devourer::RecordSchema schema("dns.log", {"q_name"});
+  const std::string name = "0123456789.abcdefghijklmnopqrstuvwxyz.example.com";
+  std::vector<uint8_t> buf;
+  devourer::RecordWriter w;
+  w.begin(&buf, schema, 1);
+  w.put_str(0, name);
+  w.end();
+
+  const std::string golden =
+    std::string("\x93" "\xb0" "devourer.dns.log" "\x01" "\x81"
+                "\xa6" "q_name" "\xda\x00\x31", 30) + name;
+  EXPECT_EQ(golden, bytes(buf));
+}
+
+TEST(Record, golden_nested_map) {
+  const devourer::RecordSchema schema("flow.update", {"flow_pkt"});
+  std::vector<uint8_t> buf;
+  devourer::RecordWriter w;
+  w.begin(&buf, schema, 5);
+  w.put_map(0, 2);
+  w.map_key("A");
+  w.map_uint(1);
+  w.map_key("B");
+  w.map_uint(300);
+  w.end();
+
+  const std::string golden =
+    "\x93"
+    "\xb4" "devourer.flow.update"
+    "\x05"
+    "\x81"
+    "\xa8" "flow_pkt" "\x82" "\xa1" "A" "\x01" "\xa1" "B" "\xcd\x01\x2c";
+  EXPECT_EQ(golden, bytes(buf));
+}
+
+TEST(Record, smallest_format) {
+  EXPECT_EQ(std::string("\x7f"), packed_uint(127));
+  EXPECT_EQ(std::string("\xcc\x80"), packed_uint(128));
+  EXPECT_EQ(std::string("\xcd\x01\x00", 3), packed_uint(256));
+  EXPECT_EQ(std::string("\xce\x00\x01\x00\x00", 5), packed_uint(65536));
+  EXPECT_EQ(std::string("\xcf\x00\x00\x00\x01\x00\x00\x00\x00", 9),
+            packed_uint(1ULL << 32));
+  EXPECT_EQ(std::string("\x00", 1), packed_int(0));
+  EXPECT_EQ(std::string("\xff"), packed_int(-1));
+  EXPECT_EQ(std::string("\xe0"), packed_int(-32));
+  EXPECT_EQ(std::string("\xd0\xdf"), packed_int(-33));
+  EXPECT_EQ(std::string("\xd1\xff\x7f"), packed_int(-129));
+
+  std::vector<uint8_t> buf;
+  devourer::msgpack::pack_str(&buf, std::string(32, 'a').data(), 32);
+  EXPECT_EQ(std::string("\xda\x00\x20", 3) + std::string(32, 'a'),
+            bytes(buf));
+  buf.clear();
+  devourer::msgpack::pack_str(&buf, std::string(256, 'a').data(), 256);
+  EXPECT_EQ(std::string("\xda\x01\x00", 3) + std::string(256, 'a'),
+            bytes(buf));
+  buf.clear();
+  devourer::msgpack::pack_str(&buf, std::string(65536, 'a').data(), 65536);
+  EXPECT_EQ(std::string("\xdb\x00\x01\x00\x00", 5) +
+            std::string(65536, 'a'), bytes(buf));
+  buf.clear();
+  devourer::msgpack::pack_map(&buf, 16);
+  EXPECT_EQ(std::string("\xde\x00\x10", 3), bytes(buf));
+}
+
+TEST(Record, reader) {
+  std::vector<uint8_t> buf;
+  devourer::msgpack::pack_array(&buf, 20);
+  devourer::msgpack::pack_str(&buf, "key", 3);
+  devourer::msgpack::pack_uint(&buf, 70000);
+  devourer::msgpack::pack_int(&buf, -200);
+  devourer::msgpack::pack_double(&buf, 1.25);
+  devourer::msgpack::pack_nil(&buf);
+
+  devourer::msgpack::Reader rd(buf.data(), buf.size());
+  size_t n;
+  const char *str;
+  uint64_t u;
+  int64_t i;
+  double d;
+  EXPECT_TRUE(rd.read_array(&n));
+  EXPECT_EQ(20U, n);
+  EXPECT_FALSE(rd.read_uint(&u));
+  EXPECT_EQ(devourer::msgpack::Reader::STR, rd.next_type());
+  EXPECT_TRUE(rd.read_str(&str, &n));
+  EXPECT_EQ("key", std::string(str, n));
+  EXPECT_TRUE(rd.read_uint(&u));
+  EXPECT_EQ(70000U, u);
+  EXPECT_TRUE(rd.read_int(&i));
+  EXPECT_EQ(-200, i);
+  EXPECT_TRUE(rd.read_double(&d));
+  EXPECT_EQ(1.25, d);
+  EXPECT_TRUE(rd.read_nil());
+  EXPECT_TRUE(rd.empty());
+
+  // Truncated string
+  devourer::msgpack::Reader rd2(buf.data() + 3, 2);
+  EXPECT_FALSE(rd2.read_str(&str, &n));
+}
+
+TEST(Record, reader_skip) {
+  const devourer::RecordSchema schema("flow.update", {"flow_pkt", "x"});
+  std::vector<uint8_t> buf;
+  devourer::RecordWriter w;
+  w.begin(&buf, schema, 1);
+  w.put_map(0, 2);
+  w.map_key("a");
+  w.map_uint(1);
+  w.map_key("b");
+  w.map_uint(300);
+  w.put_double(1, 0.5);
+  w.end();
+  devourer::msgpack::pack_uint(&buf, 7);
+
+  devourer::msgpack::Reader rd(buf.data(), buf.size());
+  uint64_t u;
+  EXPECT_TRUE(rd.skip());
+  EXPECT_TRUE(rd.read_uint(&u));
+  EXPECT_EQ(7U, u);
+  EXPECT_TRUE(rd.empty());
+  EXPECT_FALSE(rd.skip());
+}
+
+TEST(Record, unsorted_keys) {
+  EXPECT_THROW(devourer::RecordSchema("x", {"b", "a"}),
+               devourer::Exception);
+}
@@ -0,0 +1,123 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+#include "./gtest.h"
+#include "../src/timing-wheel.hpp"
+
+namespace {
+  class TestTimer : public devourer::TimerNode {
+  public:
+    uint64_t expire_at_;   // expected expire tick
+    uint64_t expired_at_;  // actual expire tick
+    TestTimer() : expire_at_(0), expired_at_(0) {}
+  };
+
+  class Record {
+  private:
+    const uint64_t *now_;
+  public:
+    explicit Record(const uint64_t *now) : now_(now) {}
+    void operator()(devourer::TimerNode *node) {
+      static_cast<TestTimer*>(node)->expired_at_ = *this->now_;
+    }
+  };
+}
+
+TEST(TimingWheel, expire_in_order) {
+  devourer::TimingWheel wheel;
+  TestTimer t1, t2;
+  uint64_t now = 0;
+  Record fn(&now);
+
+  wheel.push(&t1, 0);
+  wheel.push(&t2, 100);
+  now = 1;
+  wheel.advance(1, fn);
+  EXPECT_EQ(&t1, wheel.pop());
+  EXPECT_EQ(NULL, wheel.pop());
+
+  now = 100;
+  wheel.advance(99, fn);
+  EXPECT_EQ(NULL, wheel.pop());
+  now = 101;
+  wheel.advance(1, fn);
+  EXPECT_EQ(&t2, wheel.pop());
+  EXPECT_EQ(101U, wheel.now());
+}
+
+TEST(TimingWheel, random_ticks_and_jumps) {
+  const size_t count = 20000;
+  std::vector<TestTimer> timers(count);
+  devourer::TimingWheel wheel;
+  uint64_t now = 0;
+  Record fn(&now);
+  uint64_t seed = 7;
+  size_t pushed = 0, expired = 0;
+
+  while (expired < count) {
+    // Push some timers with short to very long (over range of wheel) ticks.
+    for (size_t i = 0; i < 50 && pushed < count; i++, pushed++) {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      const unsigned bits = (seed >> 60) * 3;  // up to 45 bits
+      const uint64_t tick = (seed >> 8) & ((1ULL << bits) - 1);
+      timers[pushed].expire_at_ = now + tick + 1;
+      wheel.push(&timers[pushed], tick);
+    }
+
+    // Advance by small step or large jump.
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const unsigned bits = (seed >> 61) * 6 + 1;
+    const uint64_t tick = ((seed >> 8) & ((1ULL << bits) - 1)) + 1;
+    now += tick;
+    wheel.advance(tick, fn);
+    ASSERT_EQ(now, wheel.now());
+
+    for (devourer::TimerNode *n; NULL != (n = wheel.pop()); expired++) {
+      TestTimer *t = static_cast<TestTimer*>(n);
+      // Expired at the first advance() that reaches expire tick.
+      ASSERT_LE(t->expire_at_, t->expired_at_);
+      ASSERT_GT(t->expire_at_, t->expired_at_ - tick);
+    }
+  }
+  EXPECT_EQ(count, expired);
+}
+
+TEST(TimingWheel, expire_all) {
+  devourer::TimingWheel wheel;
+  std::vector<TestTimer> timers(100);
+  uint64_t now = 0;
+  Record fn(&now);
+  for (size_t i = 0; i < timers.size(); i++) {
+    wheel.push(&timers[i], i * i * i * i * i);
+  }
+  wheel.expire_all(fn);
+  size_t expired = 0;
+  while (wheel.pop()) {
+    expired++;
+  }
+  EXPECT_EQ(timers.size(), expired);
+}
@@ -0,0 +1,125 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./gtest.h"
+#include "../src/trace.hpp"
+
+namespace {
+  // Dump rings to a file and return events of the thread.
+  std::vector<devourer::trace::Event> dump_thread(uint32_t thread) {
+    char path[] = "/tmp/devourer-trace-XXXXXX";
+    int fd = mkstemp(path);
+    EXPECT_TRUE(devourer::trace::dump(fd));
+    close(fd);
+    std::vector<devourer::trace::Event> all, events;
+    devourer::trace::read(path, &all);
+    unlink(path);
+    for (size_t i = 0; i < all.size(); i++) {
+      if (all[i].thread == thread) {
+        events.push_back(all[i]);
+      }
+    }
+    return events;
+  }
+}
+
+TEST(Trace, dump) {
+  uint32_t thread = 0;
+  std::thread th([&thread]() {
+      thread = devourer::trace::local()->thread();
+      devourer::trace::record(devourer::trace::FLOW_NEW, 1, 2);
+      devourer::trace::record(devourer::trace::DNS_QUERY, 3, 4);
+    });
+  th.join();
+
+  // The ring is kept after the thread exits.
+  std::vector<devourer::trace::Event> events = dump_thread(thread);
+  ASSERT_EQ(2U, events.size());
+  EXPECT_EQ(devourer::trace::FLOW_NEW, events[0].point);
+  EXPECT_EQ(1U, events[0].arg[0]);
+  EXPECT_EQ(2U, events[0].arg[1]);
+  EXPECT_EQ(devourer::trace::DNS_QUERY, events[1].point);
+  EXPECT_LE(events[0].cycles, events[1].cycles);
+  EXPECT_STREQ("dns.query", devourer::trace::point_name(events[1].point));
+}
+
+TEST(Trace, wrap) {
+  const size_t size = devourer::trace::Ring::size() - 1;
+  uint32_t thread = 0;
+  std::thread th([&thread, size]() {
+      thread = devourer::trace::local()->thread();
+      for (size_t i = 0; i < size + 10; i++) {
+        devourer::trace::record(devourer::trace::FLOW_EXPIRE, i, 0);
+      }
+    });
+  th.join();
+
+  std::vector<devourer::trace::Event> events = dump_thread(thread);
+  ASSERT_EQ(size, events.size());
+  for (size_t i = 0; i < size; i++) {
+    EXPECT_EQ(i + 10, events[i].arg[0]);
+  }
+}
+
+TEST(Trace, concurrent_dump) {
+  // Events are dumped while being written, and none is torn.
+  std::atomic<bool> done(false);
+  uint32_t thread = 0;
+  std::atomic<bool> ready(false);
+  std::thread th([&]() {
+      thread = devourer::trace::local()->thread();
+      ready = true;
+      for (uint64_t i = 0; !done; i++) {
+        devourer::trace::record(devourer::trace::DNS_RESPONSE, i, ~i);
+      }
+    });
+  while (!ready) {
+  }
+  for (size_t n = 0; n < 20; n++) {
+    std::vector<devourer::trace::Event> events = dump_thread(thread);
+    for (size_t i = 0; i < events.size(); i++) {
+      ASSERT_EQ(~events[i].arg[0], events[i].arg[1]);
+      if (i > 0) {
+        ASSERT_LT(events[i - 1].arg[0], events[i].arg[0]);
+      }
+    }
+  }
+  done = true;
+  th.join();
+}
+
+TEST(Trace, macro) {
+  devourer::trace::enable(false);
+  int evaluated = 0;
+  TRACE(FLOW_NEW, ++evaluated, 0);
+  EXPECT_EQ(0, evaluated);
+}
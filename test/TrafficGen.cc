@@ -0,0 +1,168 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/capture.hpp"
+#include "../src/traffic-gen.hpp"
+#include "../src/tuple-hash.hpp"
+
+TEST(TrafficGen, deterministic) {
+  devourer::TrafficGen::Config c;
+  c.dns_ratio = 0.5;
+  c.cname_depth = 2;
+  c.ipv6_ratio = 0.3;
+  c.udp_ratio = 0.2;
+  std::vector<uint8_t> d1, d2, d3;
+  std::vector<devourer::Packet> p1, p2, p3;
+  devourer::TrafficGen(c).generate(1000, &d1, &p1);
+  devourer::TrafficGen(c).generate(1000, &d2, &p2);
+  c.seed = 2;
+  devourer::TrafficGen(c).generate(1000, &d3, &p3);
+
+  ASSERT_EQ(1000U, p1.size());
+  EXPECT_TRUE(d1 == d2);
+  EXPECT_FALSE(d1 == d3);
+  for (size_t i = 0; i < p1.size(); i++) {
+    EXPECT_EQ(p1[i].tv.tv_usec, p2[i].tv.tv_usec);
+    EXPECT_LE(p1[i].len, p1[i].cap_len);
+  }
+}
+
+TEST(TrafficGen, ipv4_checksum) {
+  devourer::TrafficGen::Config c;
+  devourer::TrafficGen gen(c);
+  devourer::Packet pkt;
+  for (size_t i = 0; i < 100; i++) {
+    gen.next(&pkt);
+    ASSERT_EQ(0x08, pkt.data[12]);
+    uint32_t sum = 0;
+    for (size_t j = 14; j < 34; j += 2) {
+      sum += (pkt.data[j] << 8) | pkt.data[j + 1];
+    }
+    while (sum > 0xffff) {
+      sum = (sum & 0xffff) + (sum >> 16);
+    }
+    EXPECT_EQ(0xffffU, sum);
+  }
+}
+
+TEST(TrafficGen, session) {
+  // Only one session at a time: query, response, handshake, 1 data
+  // packet and FIN of both sides.
+  devourer::TrafficGen::Config c;
+  c.concurrent = 1;
+  c.dns_ratio = 1.0;
+  c.flow_packets = 1;
+  c.ipv6_ratio = 0.5;
+  devourer::TrafficGen gen(c);
+  devourer::Packet pkt;
+  for (size_t n = 0; n < 10; n++) {
+    bool answer;
+    gen.next(&pkt);
+    const uint64_t query = devourer::tuple_hash(pkt.data, pkt.len, &answer);
+    EXPECT_FALSE(answer);
+    gen.next(&pkt);
+    EXPECT_EQ(query, devourer::tuple_hash(pkt.data, pkt.len, &answer));
+    EXPECT_TRUE(answer);
+
+    gen.next(&pkt);
+    const uint64_t flow = devourer::tuple_hash(pkt.data, pkt.len, &answer);
+    EXPECT_NE(0U, flow);
+    for (size_t i = 0; i < 5; i++) {
+      gen.next(&pkt);
+      EXPECT_EQ(flow, devourer::tuple_hash(pkt.data, pkt.len, &answer));
+    }
+  }
+  EXPECT_EQ(11U, gen.stats().sessions);  // The next one is started
+  EXPECT_EQ(10U, gen.stats().dns_responses);
+  EXPECT_EQ(10U, gen.stats().tcp_flows);
+}
+
+TEST(TrafficGen, dns_loss) {
+  devourer::TrafficGen::Config c;
+  c.dns_ratio = 1.0;
+  c.dns_loss = 1.0;
+  devourer::TrafficGen gen(c);
+  devourer::Packet pkt;
+  for (size_t i = 0; i < 1000; i++) {
+    bool answer;
+    gen.next(&pkt);
+    devourer::tuple_hash(pkt.data, pkt.len, &answer);
+    EXPECT_FALSE(answer);
+  }
+  EXPECT_LT(0U, gen.stats().dns_queries);
+  EXPECT_EQ(0U, gen.stats().dns_responses);
+}
+
+TEST(TrafficGen, dns_only) {
+  devourer::TrafficGen::Config c;
+  c.dns_ratio = 1.0;
+  c.udp_ratio = 1.0;
+  c.flow_packets = 0;
+  devourer::TrafficGen gen(c);
+  devourer::Packet pkt;
+  for (size_t i = 0; i < 1000; i++) {
+    gen.next(&pkt);
+  }
+  EXPECT_EQ(1000U, gen.stats().dns_queries + gen.stats().dns_responses);
+  EXPECT_EQ(0U, gen.stats().udp_flows);
+  EXPECT_EQ(0U, gen.stats().tcp_flows);
+}
+
+TEST(TrafficGen, write_pcap) {
+  char path[] = "/tmp/devourer-gen-XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+
+  devourer::TrafficGen::Config c;
+  c.snap_len = 96;
+  c.payload = 1460;
+  devourer::TrafficGen(c).write_pcap(path, 500);
+  std::vector<uint8_t> data;
+  std::vector<devourer::Packet> pkts;
+  devourer::TrafficGen(c).generate(500, &data, &pkts);
+
+  {
+    devourer::MmapPcapCapture cap(path);
+    devourer::Packet pkt;
+    for (size_t i = 0; i < pkts.size(); i++) {
+      ASSERT_EQ(devourer::Capture::READ, cap.next(&pkt));
+      ASSERT_EQ(pkts[i].len, pkt.len);
+      EXPECT_GE(96U, pkt.len);
+      EXPECT_EQ(pkts[i].cap_len, pkt.cap_len);
+      EXPECT_EQ(pkts[i].tv.tv_sec, pkt.tv.tv_sec);
+      EXPECT_EQ(pkts[i].tv.tv_usec, pkt.tv.tv_usec);
+      EXPECT_EQ(0, memcmp(pkts[i].data, pkt.data, pkt.len));
+    }
+    EXPECT_EQ(devourer::Capture::END, cap.next(&pkt));
+  }
+  unlink(path);
+}
@@ -0,0 +1,100 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <vector>
+#include "./gtest.h"
+#include "../src/tuple-hash.hpp"
+
+namespace {
+  // Ethernet + IPv4 + UDP header.
+  std::vector<uint8_t> udp4(const uint8_t src[4], const uint8_t dst[4],
+                            uint16_t sport, uint16_t dport) {
+    std::vector<uint8_t> pkt(14 + 20 + 8, 0);
+    pkt[12] = 0x08;
+    pkt[13] = 0x00;
+    uint8_t *ip = &pkt[14];
+    ip[0] = 0x45;
+    ip[9] = 17;
+    memcpy(ip + 12, src, 4);
+    memcpy(ip + 16, dst, 4);
+    uint8_t *udp = ip + 20;
+    udp[0] = sport >> 8; udp[1] = sport & 0xff;
+    udp[2] = dport >> 8; udp[3] = dport & 0xff;
+    return pkt;
+  }
+}
+
+TEST(TupleHash, symmetric) {
+  const uint8_t a[4] = {10, 0, 0, 1}, b[4] = {10, 0, 0, 2};
+  bool dns;
+  std::vector<uint8_t> p1 = udp4(a, b, 40000, 53);
+  std::vector<uint8_t> p2 = udp4(b, a, 53, 40000);
+  std::vector<uint8_t> p3 = udp4(a, b, 40001, 53);
+
+  uint64_t h1 = devourer::tuple_hash(&p1[0], p1.size(), &dns);
+  EXPECT_FALSE(dns);
+  uint64_t h2 = devourer::tuple_hash(&p2[0], p2.size(), &dns);
+  EXPECT_TRUE(dns);
+  uint64_t h3 = devourer::tuple_hash(&p3[0], p3.size(), &dns);
+  EXPECT_EQ(h1, h2);
+  EXPECT_NE(h1, h3);
+}
+
+TEST(TupleHash, vlan_and_fragment) {
+  const uint8_t a[4] = {192, 168, 0, 1}, b[4] = {192, 168, 0, 2};
+  bool dns;
+  std::vector<uint8_t> p1 = udp4(a, b, 1000, 2000);
+  std::vector<uint8_t> p2 = p1;
+  // Insert 802.1Q tag.
+  const uint8_t tag[4] = {0x81, 0x00, 0x00, 0x64};
+  p2.insert(p2.begin() + 12, tag, tag + 4);
+  EXPECT_EQ(devourer::tuple_hash(&p1[0], p1.size(), &dns),
+            devourer::tuple_hash(&p2[0], p2.size(), &dns));
+
+  // Non-first fragment is hashed by addresses only.
+  std::vector<uint8_t> f1 = udp4(a, b, 1, 2), f2 = udp4(b, a, 3, 4);
+  f1[14 + 6] = 0x00; f1[14 + 7] = 0x10;
+  f2[14 + 6] = 0x00; f2[14 + 7] = 0x20;
+  EXPECT_EQ(devourer::tuple_hash(&f1[0], f1.size(), &dns),
+            devourer::tuple_hash(&f2[0], f2.size(), &dns));
+
+  // First fragment has ports but goes to the same shard as later ones.
+  std::vector<uint8_t> first = udp4(a, b, 1000, 2000);
+  std::vector<uint8_t> later = udp4(a, b, 0, 0);
+  first[14 + 6] = 0x20; first[14 + 7] = 0x00;   // MF, offset 0
+  later[14 + 6] = 0x00; later[14 + 7] = 0xb9;   // offset 1480
+  memset(&later[14 + 20], 0xAB, 8);             // Payload, not ports
+  EXPECT_EQ(devourer::tuple_hash(&first[0], first.size(), &dns),
+            devourer::tuple_hash(&later[0], later.size(), &dns));
+  EXPECT_NE(devourer::tuple_hash(&first[0], first.size(), &dns),
+            devourer::tuple_hash(&p1[0], p1.size(), &dns));
+
+  // Truncated or non-IP frame.
+  EXPECT_EQ(0U, devourer::tuple_hash(&p1[0], 20, &dns));
+  p1[12] = 0x08; p1[13] = 0x06;
+  EXPECT_EQ(0U, devourer::tuple_hash(&p1[0], p1.size(), &dns));
+}